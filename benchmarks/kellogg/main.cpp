@@ -44,6 +44,8 @@ const double ERR_STOP = 1.0;      // Stopping criterion for adaptivity (rel. err
                                   // fine mesh and coarse mesh solution in percent).
 const int NDOF_STOP = 100000;     // Adaptivity process stops when the number of degrees of freedom grows
                                   // over this limit. This is to prevent h-adaptivity to go on forever.
+const bool SAVE_PROFILE = false;  // Save the profile of all adaptivity steps to profile.json and
+                                  // profile.csv when the adaptivity is finished.
 
 // problem constants
 const double R = 161.4476387975881;      // Equation parameter.
@@ -215,24 +217,36 @@ int main(int argc, char* argv[])
   // prepare selector
   RefinementSelectors::H1NonUniformHP selector(ISO_ONLY, ADAPT_TYPE, 1.0, H2DRS_DEFAULT_ORDER, &shapeset);
 
+  // the profiler records phases and counters of every adaptivity step
+  Profiler profiler;
+  Profiler::set_current(&profiler);
+
   // adaptivity loop
   int it = 1, ndofs;
   bool done = false;
   double cpu = 0.0;
   Solution sln_coarse, sln_fine;
+
+  // the systems are kept across the adaptivity steps, so that the reference
+  // system can reuse its last matrix structure
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  RefSystem rs(&ls);
+  rs.set_reuse_previous(true);
   do
   {
+    profiler.begin_iteration(it);
     info("\n---- Adaptivity step %d ---------------------------------------------\n", it++);
 
     // time measurement
     begin_time();
 
     // solve the coarse mesh problem
-    LinSystem ls(&wf, &solver);
-    ls.set_spaces(1, &space);
-    ls.set_pss(1, &pss);
+    profiler.begin_phase("coarse");
     ls.assemble();
     ls.solve(1, &sln_coarse);
+    profiler.end_phase();
 
     // time measurement
     cpu += end_time();
@@ -249,9 +263,10 @@ int main(int argc, char* argv[])
     begin_time();
 
     // solve the fine mesh problem
-    RefSystem rs(&ls);
+    profiler.begin_phase("reference");
     rs.assemble();
     rs.solve(1, &sln_fine);
+    profiler.end_phase();
 
     // calculate error estimate wrt. fine mesh solution
     H1AdaptHP hp(1, &space);
@@ -281,10 +296,28 @@ int main(int argc, char* argv[])
 
     // time measurement
     cpu += end_time();
+
+    // show the profile of this step
+    profiler.print();
   }
   while (done == false);
   verbose("Total running time: %g sec", cpu);
 
+  // save the profile of all steps
+  if (SAVE_PROFILE)
+  {
+    profiler.save_json("profile.json");
+    profiler.save_csv("profile.csv");
+  }
+
+#if defined(HERMES2D_REPORT_VERBOSE) || defined(HERMES2D_REPORT_RUNTIME_CONTROL)
+  // the selector keeps projection matrices and shape values across adaptivity steps
+  TableCacheStats proj_stats;
+  selector.get_cache_stats(proj_stats);
+  verbose("Selector cache: %lu hits, %lu misses, %lu bytes", (unsigned long) proj_stats.hits,
+          (unsigned long) proj_stats.misses, (unsigned long) proj_stats.total_mem);
+#endif
+
   // show the fine solution - this is the final result
   sview.set_title("Final solution");
   sview.show(&sln_fine);
@@ -193,6 +193,14 @@ int main(int argc, char* argv[])
   while (done == false);
   verbose("Total running time: %g sec", cpu);
 
+#if defined(HERMES2D_REPORT_VERBOSE) || defined(HERMES2D_REPORT_RUNTIME_CONTROL)
+  // the selector keeps projection matrices and shape values across adaptivity steps
+  TableCacheStats proj_stats;
+  selector.get_cache_stats(proj_stats);
+  verbose("Selector cache: %lu hits, %lu misses, %lu bytes", (unsigned long) proj_stats.hits,
+          (unsigned long) proj_stats.misses, (unsigned long) proj_stats.total_mem);
+#endif
+
   // show the fine solution - this is the final result
   sview.set_title("Final solution");
   sview.show(&sln_fine);
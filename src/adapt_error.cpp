@@ -0,0 +1,476 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "solution.h"
+#include "linsystem.h"
+#include "quad_all.h"
+#include "traverse.h"
+#include "adapt_error.h"
+
+
+// Evaluates all forms on the current element of the union mesh. The values of the solutions,
+// their differences and the geometry are kept for the element, keyed by the integration
+// order, so each of them is obtained once even if it is used by several forms.
+class ElemErrorEvaluator
+{
+public:
+
+  ElemErrorEvaluator(int num, Solution** fns, error_form_val_t* form, error_form_ord_t* ord, int stride)
+    : num(num), fns(fns), form(form), ord(ord), stride(stride),
+      vals(2*num), val_orders(2*num, -1), diffs(num), diff_orders(num, -1),
+      geoms(num), jwts(num), geom_orders(num, -1) {}
+
+  ~ElemErrorEvaluator() { free(); }
+
+  // fns[0..num-1] are the solutions, fns[num..2*num-1] the reference solutions, all of them
+  // set to the current element. Fills num*num errors and norms, zero for unused forms.
+  void eval(double* err, double* nrm);
+
+private:
+
+  int num;
+  Solution** fns;
+  error_form_val_t* form;
+  error_form_ord_t* ord;
+  int stride;
+
+  std::vector<Func<scalar>*> vals;
+  std::vector<int> val_orders;
+  std::vector<Func<scalar>*> diffs;
+  std::vector<int> diff_orders;
+  std::vector<Geom<double>*> geoms;
+  std::vector<double*> jwts;
+  std::vector<int> geom_orders;
+
+  int get_order(int i, int j);
+  Func<scalar>* get_values(int k, int order);
+  Func<scalar>* get_diff(int i, int order);
+  double* get_jwt(int i, int order, Geom<double>*& e);
+  void free();
+};
+
+
+int ElemErrorEvaluator::get_order(int i, int j)
+{
+  Solution* rsln1 = fns[num+i];
+  Solution* rsln2 = fns[num+j];
+  int inc = (rsln1->get_num_components() == 2) ? 1 : 0;
+  Func<Ord>* ou = init_fn_ord(rsln1->get_fn_order() + inc);
+  Func<Ord>* ov = init_fn_ord(rsln2->get_fn_order() + inc);
+
+  double fake_wt = 1.0;
+  Geom<Ord>* fake_e = init_geom_ord();
+  Ord o = ord[i*stride + j](1, &fake_wt, ou, ov, fake_e, NULL);
+  int order = rsln1->get_refmap()->get_inv_ref_order();
+  order += o.get_order();
+  limit_order(order);
+
+  ou->free_ord(); delete ou;
+  ov->free_ord(); delete ov;
+  delete fake_e;
+  return order;
+}
+
+
+Func<scalar>* ElemErrorEvaluator::get_values(int k, int order)
+{
+  if (val_orders[k] != order)
+  {
+    if (vals[k] != NULL) { vals[k]->free_fn(); delete vals[k]; }
+    vals[k] = init_fn(fns[k], fns[k]->get_refmap(), order);
+    val_orders[k] = order;
+  }
+  return vals[k];
+}
+
+
+static inline void sub_values(scalar* u, const scalar* v, int np)
+{
+  if (u == NULL) return;
+  for (int i = 0; i < np; i++)
+    u[i] = u[i] - v[i];
+}
+
+
+Func<scalar>* ElemErrorEvaluator::get_diff(int i, int order)
+{
+  if (diff_orders[i] != order)
+  {
+    if (diffs[i] != NULL) { diffs[i]->free_fn(); delete diffs[i]; }
+    Func<scalar>* u = diffs[i] = init_fn(fns[i], fns[i]->get_refmap(), order);
+    Func<scalar>* v = get_values(num+i, order);
+    int np = fns[i]->get_quad_2d()->get_num_points(order);
+    sub_values(u->val, v->val, np);
+    sub_values(u->dx, v->dx, np);
+    sub_values(u->dy, v->dy, np);
+    sub_values(u->val0, v->val0, np);
+    sub_values(u->val1, v->val1, np);
+    sub_values(u->curl, v->curl, np);
+    diff_orders[i] = order;
+  }
+  return diffs[i];
+}
+
+
+double* ElemErrorEvaluator::get_jwt(int i, int order, Geom<double>*& e)
+{
+  if (geom_orders[i] != order)
+  {
+    if (geoms[i] != NULL) { geoms[i]->free(); delete geoms[i]; }
+    delete [] jwts[i];
+
+    RefMap* rrm = fns[num+i]->get_refmap();
+    Quad2D* quad = fns[num+i]->get_quad_2d();
+    double3* pt = quad->get_points(order);
+    int np = quad->get_num_points(order);
+
+    geoms[i] = init_geom_vol(rrm, order);
+    double* jac = rrm->get_jacobian(order);
+    double* jwt = jwts[i] = new double[np];
+    for (int k = 0; k < np; k++)
+      jwt[k] = pt[k][2] * jac[k];
+    geom_orders[i] = order;
+  }
+  e = geoms[i];
+  return jwts[i];
+}
+
+
+void ElemErrorEvaluator::free()
+{
+  for (int k = 0; k < 2*num; k++)
+  {
+    if (vals[k] != NULL) { vals[k]->free_fn(); delete vals[k]; vals[k] = NULL; }
+    val_orders[k] = -1;
+  }
+  for (int i = 0; i < num; i++)
+  {
+    if (diffs[i] != NULL) { diffs[i]->free_fn(); delete diffs[i]; diffs[i] = NULL; }
+    if (geoms[i] != NULL) { geoms[i]->free(); delete geoms[i]; geoms[i] = NULL; }
+    delete [] jwts[i];
+    jwts[i] = NULL;
+    diff_orders[i] = geom_orders[i] = -1;
+  }
+}
+
+
+void ElemErrorEvaluator::eval(double* err, double* nrm)
+{
+  for (int i = 0; i < num; i++)
+  {
+    for (int j = 0; j < num; j++)
+    {
+      error_form_val_t fn = form[i*stride + j];
+      if (fn == NULL)
+      {
+        err[i*num + j] = nrm[i*num + j] = 0.0;
+        continue;
+      }
+
+      int order = get_order(i, j);
+      Geom<double>* e;
+      double* jwt = get_jwt(i, order, e);
+      int np = fns[num+i]->get_quad_2d()->get_num_points(order);
+
+      #ifndef COMPLEX
+      err[i*num + j] = fabs(fn(np, jwt, get_diff(i, order), get_diff(j, order), e, NULL));
+      nrm[i*num + j] = fabs(fn(np, jwt, get_values(num+i, order), get_values(num+j, order), e, NULL));
+      #else
+      err[i*num + j] = std::abs(fn(np, jwt, get_diff(i, order), get_diff(j, order), e, NULL));
+      nrm[i*num + j] = std::abs(fn(np, jwt, get_values(num+i, order), get_values(num+j, order), e, NULL));
+      #endif
+    }
+  }
+  free();
+}
+
+
+//// parallel evaluation ///////////////////////////////////////////////////////////////////////////
+
+struct ErrorThreadData
+{
+  ElemErrorEvaluator* eval;
+  Solution** fns;
+  int nf;
+  Element** elems;
+  uint64_t* subs;
+  double* err;
+  double* nrm;
+  int first, count, nn;
+};
+
+static void* calc_elem_errors_thread(void* arg)
+{
+  ErrorThreadData* td = (ErrorThreadData*) arg;
+  for (int s = td->first; s < td->first + td->count; s++)
+  {
+    for (int k = 0; k < td->nf; k++)
+    {
+      td->fns[k]->set_active_element(td->elems[s*td->nf + k]);
+      td->fns[k]->set_transform(td->subs[s*td->nf + k]);
+    }
+    td->eval->eval(td->err + s*td->nn, td->nrm + s*td->nn);
+  }
+  return NULL;
+}
+
+
+HERMES2D_API void calc_elem_errors(int num, Solution** sln, Solution** rsln,
+                                   error_form_val_t* form, error_form_ord_t* ord, int stride,
+                                   int num_threads, double** errors, double* norms,
+                                   double& total_error, double& total_norm)
+{
+  int i, j, k, nf = 2*num, nn = num*num;
+
+  AUTOLA_OR(Mesh*, meshes, nf);
+  AUTOLA_OR(Transformable*, tr, nf);
+  AUTOLA_OR(Solution*, fns, nf);
+  for (i = 0; i < num; i++)
+  {
+    meshes[i] = sln[i]->get_mesh();
+    meshes[i+num] = rsln[i]->get_mesh();
+    tr[i] = fns[i] = sln[i];
+    tr[i+num] = fns[i+num] = rsln[i];
+  }
+
+  // exact solutions need the reference map, which cannot be used concurrently
+  bool parallel = (num_threads > 1);
+  for (i = 0; i < nf; i++)
+    if (fns[i]->get_num_dofs() < 0)
+      parallel = false;
+
+  std::vector<Element*> elems;
+  std::vector<uint64_t> subs;
+  std::vector<double> err, nrm;
+  AUTOLA_OR(double, e, nn);
+  AUTOLA_OR(double, t, nn);
+
+  // traverse the union mesh; a single thread evaluates the forms right away, otherwise
+  // the elements and transformations of the states are recorded. The traversal activates
+  // all elements, so their reference maps know the orders of their inverses afterwards.
+  ElemErrorEvaluator serial(num, fns, form, ord, stride);
+  Traverse trav;
+  Element** ee;
+  int ns = 0;
+  trav.begin(nf, meshes, tr);
+  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+  {
+    if (parallel)
+    {
+      for (k = 0; k < nf; k++)
+      {
+        elems.push_back(ee[k]);
+        subs.push_back(tr[k]->get_transform());
+      }
+    }
+    else
+    {
+      serial.eval(e, t);
+      for (i = 0; i < num; i++)
+        for (j = 0; j < num; j++)
+          if (form[i*stride + j] != NULL)
+          {
+            norms[i] += t[i*num + j];
+            total_norm  += t[i*num + j];
+            total_error += e[i*num + j];
+            errors[i][ee[i]->id] += e[i*num + j];
+          }
+    }
+    ns++;
+  }
+  trav.finish();
+  if (!parallel) return;
+
+  // evaluate the forms in threads, each with its own copies of the solutions
+  int nt = std::min(num_threads, ns);
+  err.resize(ns * nn);
+  nrm.resize(ns * nn);
+  for (i = 0; i < nf; i++)
+    fns[i]->convert_all(nt);
+
+  std::vector<Quad2DStd*> quads(nt);
+  std::vector<Solution*> copies(nt * nf);
+  std::vector<ElemErrorEvaluator*> evals(nt);
+  std::vector<pthread_t> threads(nt);
+  std::vector<ErrorThreadData> td(nt);
+  for (int th = 0; th < nt; th++)
+  {
+    quads[th] = new Quad2DStd;
+    for (k = 0; k < nf; k++)
+    {
+      Solution* copy = copies[th*nf + k] = new Solution;
+      copy->copy(fns[k]);
+      copy->set_quad_2d(quads[th]);
+      copy->use_private_refmap();
+    }
+    evals[th] = new ElemErrorEvaluator(num, &copies[th*nf], form, ord, stride);
+
+    td[th].eval = evals[th];
+    td[th].fns = &copies[th*nf];
+    td[th].nf = nf;
+    td[th].elems = &elems[0];
+    td[th].subs = &subs[0];
+    td[th].err = &err[0];
+    td[th].nrm = &nrm[0];
+    td[th].nn = nn;
+    td[th].first = (int) ((long) ns * th / nt);
+    td[th].count = (int) ((long) ns * (th+1) / nt) - td[th].first;
+  }
+  for (int th = 0; th < nt; th++)
+    if (pthread_create(&threads[th], NULL, calc_elem_errors_thread, &td[th]))
+      error("Could not create an error calculation thread.");
+  for (int th = 0; th < nt; th++)
+    pthread_join(threads[th], NULL);
+
+  for (int th = 0; th < nt; th++)
+  {
+    delete evals[th];
+    for (k = 0; k < nf; k++)
+      delete copies[th*nf + k];
+    delete quads[th];
+  }
+
+  // add the contributions in the order of the traversal
+  for (int s = 0; s < ns; s++)
+    for (i = 0; i < num; i++)
+      for (j = 0; j < num; j++)
+        if (form[i*stride + j] != NULL)
+        {
+          double ee_ij = err[s*nn + i*num + j], tt_ij = nrm[s*nn + i*num + j];
+          norms[i] += tt_ij;
+          total_norm  += tt_ij;
+          total_error += ee_ij;
+          errors[i][elems[s*nf + i]->id] += ee_ij;
+        }
+}
+
+
+//// gradient recovery estimate ////////////////////////////////////////////////////////////////////
+
+// Values of the linear (triangles) or bilinear (quads) vertex functions at a reference point.
+static inline void vertex_fns(int nvert, double x, double y, double* phi)
+{
+  if (nvert == 3)
+  {
+    phi[0] = -0.5 * (x + y);
+    phi[1] =  0.5 * (1.0 + x);
+    phi[2] =  0.5 * (1.0 + y);
+  }
+  else
+  {
+    phi[0] = 0.25 * (1.0 - x) * (1.0 - y);
+    phi[1] = 0.25 * (1.0 + x) * (1.0 - y);
+    phi[2] = 0.25 * (1.0 + x) * (1.0 + y);
+    phi[3] = 0.25 * (1.0 - x) * (1.0 + y);
+  }
+}
+
+
+HERMES2D_API void calc_elem_errors_zz(int num, Solution** sln,
+                                      error_form_val_t* form, error_form_ord_t* ord, int stride,
+                                      double** errors, double* norms,
+                                      double& total_error, double& total_norm)
+{
+  for (int i = 0; i < num; i++)
+  {
+    error_form_val_t fn = form[i*stride + i];
+    if (fn == NULL) continue;
+
+    Solution* u = sln[i];
+    if (u->get_num_dofs() < 0 || u->get_num_components() != 1)
+      error("The error estimate needs a scalar finite element solution.");
+
+    Mesh* mesh = u->get_mesh();
+    Quad2D* quad = u->get_quad_2d();
+    int nn = mesh->get_max_node_id();
+    std::vector<scalar> gx(nn, 0.0), gy(nn, 0.0);
+    std::vector<int> cnt(nn, 0);
+
+    // recovered gradient: average of the gradients of the elements at their vertices
+    Element* e;
+    for_all_active_elements(e, mesh)
+    {
+      quad->set_mode(e->get_mode());
+      for (int k = 0; k < e->nvert; k++)
+      {
+        double2* v = quad->get_ref_vertex(k);
+        int id = e->vn[k]->id;
+        gx[id] += u->get_ref_value_transformed(e, (*v)[0], (*v)[1], 0, 1);
+        gy[id] += u->get_ref_value_transformed(e, (*v)[0], (*v)[1], 0, 2);
+        cnt[id]++;
+      }
+    }
+    for (int id = 0; id < nn; id++)
+      if (cnt[id] > 1) { gx[id] /= cnt[id]; gy[id] /= cnt[id]; }
+
+    // the error is the form evaluated on the difference of the gradient of the solution
+    // and the interpolated recovered gradient, the value is not a part of it
+    for_all_active_elements(e, mesh)
+    {
+      u->set_active_element(e);
+      RefMap* rm = u->get_refmap();
+
+      double fake_wt = 1.0;
+      Func<Ord>* ou = init_fn_ord(u->get_fn_order());
+      Geom<Ord>* fake_e = init_geom_ord();
+      int order = rm->get_inv_ref_order() + ord[i*stride + i](1, &fake_wt, ou, ou, fake_e, NULL).get_order();
+      limit_order(order);
+      ou->free_ord(); delete ou;
+      delete fake_e;
+
+      double3* pt = quad->get_points(order);
+      int np = quad->get_num_points(order);
+      Func<scalar>* fu = init_fn(u, rm, order);
+      Func<scalar>* diff = init_fn(u, rm, order);
+      Geom<double>* geom = init_geom_vol(rm, order);
+      double* jac = rm->get_jacobian(order);
+      AUTOLA_OR(double, jwt, np);
+      for (int k = 0; k < np; k++)
+        jwt[k] = pt[k][2] * jac[k];
+
+      double phi[4];
+      for (int k = 0; k < np; k++)
+      {
+        vertex_fns(e->nvert, pt[k][0], pt[k][1], phi);
+        scalar rx = 0.0, ry = 0.0;
+        for (int l = 0; l < e->nvert; l++)
+        {
+          rx += phi[l] * gx[e->vn[l]->id];
+          ry += phi[l] * gy[e->vn[l]->id];
+        }
+        diff->val[k] = 0.0;
+        diff->dx[k] -= rx;
+        diff->dy[k] -= ry;
+      }
+
+      #ifndef COMPLEX
+      double err = fabs(fn(np, jwt, diff, diff, geom, NULL));
+      double nrm = fabs(fn(np, jwt, fu, fu, geom, NULL));
+      #else
+      double err = std::abs(fn(np, jwt, diff, diff, geom, NULL));
+      double nrm = std::abs(fn(np, jwt, fu, fu, geom, NULL));
+      #endif
+      errors[i][e->id] += err;
+      norms[i] += nrm;
+      total_error += err;
+      total_norm += nrm;
+
+      fu->free_fn(); delete fu;
+      diff->free_fn(); delete diff;
+      geom->free(); delete geom;
+    }
+  }
+}
@@ -0,0 +1,83 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __HERMES2D_ADAPT_ERROR_H
+#define __HERMES2D_ADAPT_ERROR_H
+
+#include "forms.h"
+
+class Solution;
+
+typedef scalar (*error_form_val_t) (int n, double *wt, Func<scalar> *u, Func<scalar> *v, Geom<double> *e, ExtData<scalar> *);
+typedef Ord (*error_form_ord_t) (int n, double *wt, Func<Ord> *u, Func<Ord> *v, Geom<Ord> *e, ExtData<Ord> *);
+
+
+/// \brief Calculates element errors and norms for the calc_error_n() of the adaptivity classes.
+///
+/// The union mesh of the solutions and the reference solutions is traversed once. On each
+/// element, the values of every solution are obtained once per integration order and used by
+/// all forms: form[i][j] is evaluated on the differences sln - rsln of the components i and j
+/// (the error) and on rsln (the norm). Absolute values of both are added to errors[i][id] of
+/// the element of sln[i], to norms[i] and to the totals.
+///
+/// If num_threads > 1, the elements are split among threads, each with its own copies of
+/// the solutions. The contributions are added in the order of the traversal afterwards, so
+/// the results do not depend on the number of threads. Exact solutions are always evaluated
+/// by a single thread.
+///
+/// \param num [in] Number of components.
+/// \param sln [in] Solutions, num items.
+/// \param rsln [in] Reference solutions, num items.
+/// \param form [in] Forms, form[i*stride + j] belongs to the components i and j. NULL if unused.
+/// \param ord [in] Integration orders of the forms, indexed as form.
+/// \param stride [in] Row length of the arrays of forms.
+/// \param num_threads [in] Number of threads.
+/// \param errors [in,out] Errors of elements of sln[i], indexed by element id.
+/// \param norms [in,out] Norms of the components.
+/// \param total_error [in,out] Sum of all errors.
+/// \param total_norm [in,out] Sum of all norms.
+extern HERMES2D_API void calc_elem_errors(int num, Solution** sln, Solution** rsln,
+                                          error_form_val_t* form, error_form_ord_t* ord, int stride,
+                                          int num_threads, double** errors, double* norms,
+                                          double& total_error, double& total_norm);
+
+
+/// \brief Estimates element errors without a reference solution by gradient recovery.
+///
+/// The gradient of each solution is averaged at the vertices of the mesh and interpolated
+/// by linear (triangles) or bilinear (quads) functions (the Zienkiewicz-Zhu estimator). The
+/// error of an element is form[i][i] evaluated on the difference of the gradient and the
+/// recovered gradient, with the value set to zero; the norm is form[i][i] of the solution.
+/// Forms coupling different components are not used. Since the recovered gradient is only
+/// (bi)linear, the estimate is most reliable for low polynomial orders. The results are added
+/// to the arrays like in calc_elem_errors(). The solutions have to be scalar finite element
+/// solutions.
+///
+/// \param num [in] Number of components.
+/// \param sln [in] Solutions, num items.
+/// \param form [in] Forms, form[i*stride + i] belongs to the component i. NULL if unused.
+/// \param ord [in] Integration orders of the forms, indexed as form.
+/// \param stride [in] Row length of the arrays of forms.
+/// \param errors [in,out] Errors of elements of sln[i], indexed by element id.
+/// \param norms [in,out] Norms of the components.
+/// \param total_error [in,out] Sum of all errors.
+/// \param total_norm [in,out] Sum of all norms.
+extern HERMES2D_API void calc_elem_errors_zz(int num, Solution** sln,
+                                             error_form_val_t* form, error_form_ord_t* ord, int stride,
+                                             double** errors, double* norms,
+                                             double& total_error, double& total_norm);
+
+
+#endif
@@ -17,15 +17,18 @@
 #include "solution.h"
 #include "linsystem.h"
 #include "refmap.h"
+#include "profiler.h"
 #include "shapeset_h1_all.h"
 #include "quad_all.h"
 #include "integrals_h1.h"
 #include "matrix.h"
 #include "adapt_h1.h"
+#include "adapt_error.h"
 #include "traverse.h"
 #include "norm.h"
 #include "element_to_refine.h"
 #include "ref_selectors/selector.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -93,22 +96,48 @@ void H1AdaptHP::init_instance(int num, Space** spaces) {
     }
 
   memset(errors, 0, sizeof(errors));
+  memset(errors_size, 0, sizeof(errors_size));
   esort = NULL;
+  esort_size = nsorted = 0;
   have_errors = false;
+  have_rsln = false;
+  num_threads = 1;
 }
 
 //// adapt /////////////////////////////////////////////////////////////////////////////////////////
 
+// Returns the number of candidates evaluated by a selector, zero if it does not evaluate candidates.
+static unsigned long get_num_evaluated_cands(RefinementSelectors::Selector* selector)
+{
+  RefinementSelectors::OptimumSelector* opt = dynamic_cast<RefinementSelectors::OptimumSelector*>(selector);
+  return (opt != NULL) ? opt->get_num_evaluated_cands() : 0;
+}
+
+// Returns statistics of the cache of a selector, zeros if it does not have any.
+static void get_selector_cache_stats(RefinementSelectors::Selector* selector, TableCacheStats& stats)
+{
+  memset(&stats, 0, sizeof(TableCacheStats));
+  RefinementSelectors::ProjBasedSelector* proj = dynamic_cast<RefinementSelectors::ProjBasedSelector*>(selector);
+  if (proj != NULL)
+    proj->get_cache_stats(stats);
+}
+
 bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refinement_selector,
                       int regularize,
                       bool same_orders, double to_be_processed)
 {
   if (!have_errors)
     error("Element errors have to be calculated first, see calc_error().");
+  ProfilerPhase phase("adapt");
+  Profiler* profiler = Profiler::get_current();
 
-  //use default refinement if none is given
+  //use default refinement if none is given; without a reference solution, only h-refinements can be selected
   if (refinement_selector == NULL)
-    refinement_selector = &default_refin_selector;
+    refinement_selector = have_rsln ? (RefinementSelectors::Selector*) &default_refin_selector : &h_only_refin_selector;
+  else if (!have_rsln && dynamic_cast<RefinementSelectors::ProjBasedSelector*>(refinement_selector) != NULL) {
+    warn("A projection-based selector needs a reference solution, only h-refinements will be selected.");
+    refinement_selector = &h_only_refin_selector;
+  }
 
   //get meshes
   int i, j, l;
@@ -140,6 +169,54 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
   int num_not_changed = 0; //a number of element that were not changed
   int num_priority_elem = 0; //a number of elements that were processed using priority queue
 
+  //parallel selection: every thread has its own selector and its own copies of the reference solutions
+  //(they share the coefficients), the refinements of regular elements are selected in batches ahead
+  vector<RefinementSelectors::Selector*> thread_selectors;
+  vector<Solution*> thread_rslns;
+  bool parallel = (num_threads > 1 && nact > 1);
+  for (j = 0; j < num; j++)
+    if (rsln[j]->get_num_dofs() < 0) // exact solutions need the reference map, which cannot be used concurrently
+      parallel = false;
+  if (parallel) {
+    for (i = 0; i < num_threads; i++) {
+      RefinementSelectors::Selector* selector = refinement_selector->clone();
+      if (selector == NULL)
+        break;
+      thread_selectors.push_back(selector);
+    }
+    if ((int)thread_selectors.size() < num_threads) {
+      for (i = 0; i < (int)thread_selectors.size(); i++)
+        delete thread_selectors[i];
+      thread_selectors.clear();
+      verbose("Refinement selector cannot be copied, refinements are selected by a single thread.");
+    }
+    else {
+      for (j = 0; j < num; j++)
+        rsln[j]->convert_all(num_threads);
+      for (i = 0; i < num_threads; i++)
+        for (j = 0; j < num; j++) {
+          Solution* copy = new Solution();
+          copy->copy(rsln[j]);
+          copy->enable_transform(false);
+          copy->use_private_refmap();
+          thread_rslns.push_back(copy);
+        }
+    }
+  }
+  vector<ElementToRefine> batch_refs;
+  AUTOLA_OR(bool, batch_refined, thread_selectors.empty() ? 1 : nact);
+  int batch_first = 0, batch_end = 0, batch_size = 4 * num_threads;
+  if (!thread_selectors.empty())
+    batch_refs.resize(nact);
+
+  unsigned long num_cands = 0;
+  TableCacheStats cache_stats0;
+  if (profiler != NULL) {
+    profiler->begin_phase("select");
+    num_cands = get_num_evaluated_cands(refinement_selector);
+    get_selector_cache_stats(refinement_selector, cache_stats0);
+  }
+
   int inx_regular_element = 0;
   while (inx_regular_element < nact || !priority_esort.empty())
   {
@@ -147,6 +224,7 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
 
     //get element identification
     if (priority_esort.empty()) {
+      sort_elements(inx_regular_element + 1);
       id = esort[inx_regular_element].id;
       comp = esort[inx_regular_element].comp;
       inx_element = inx_regular_element;
@@ -193,8 +271,30 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
 
       // get refinement suggestion
       ElementToRefine elem_ref(id, comp);
-      int current = spaces[comp]->get_element_order(id);
-      bool refined = refinement_selector->select_refinement(e, current, rsln[comp], elem_ref);
+      bool refined;
+      if (inx_element >= 0 && !thread_selectors.empty()) {
+        if (inx_element >= batch_end) {
+          //select the next batch: it ends where a strategy based on the error only would stop
+          batch_first = inx_element;
+          batch_end = std::min(nact, batch_first + batch_size);
+          sort_elements(batch_end);
+          for (i = batch_first + 1; i < batch_end; i++) {
+            double err_next = errors[esort[i].comp][esort[i].id];
+            if (((strat == 1 || strat == 3) && err_next < error_threshod) || (strat == 2 && err_next < thr)) {
+              batch_end = i;
+              break;
+            }
+          }
+          select_refinements(meshes, thread_selectors, thread_rslns, batch_first, batch_end - batch_first, &batch_refs[0], batch_refined);
+          batch_size *= 2;
+        }
+        elem_ref = batch_refs[inx_element - batch_first];
+        refined = batch_refined[inx_element - batch_first];
+      }
+      else {
+        int current = spaces[comp]->get_element_order(id);
+        refined = refinement_selector->select_refinement(e, current, rsln[comp], elem_ref);
+      }
 
       //add to a list of elements that are going to be refined
       if (refined && can_adapt_element(mesh, e, elem_ref.split, elem_ref.p, elem_ref.q) ) {
@@ -211,6 +311,26 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
     }
   }
 
+  if (profiler != NULL) {
+    num_cands = get_num_evaluated_cands(refinement_selector) - num_cands;
+    for (i = 0; i < (int)thread_selectors.size(); i++)
+      num_cands += get_num_evaluated_cands(thread_selectors[i]);
+    TableCacheStats cache_stats;
+    get_selector_cache_stats(refinement_selector, cache_stats);
+    profiler->end_phase();
+    profiler->add_count("elements examined", num_exam_elem);
+    profiler->add_count("elements refined", elem_inx_to_proc.size());
+    profiler->add_count("candidates evaluated", num_cands);
+    profiler->add_count("selector cache hits", cache_stats.hits - cache_stats0.hits);
+    profiler->add_count("selector cache misses", cache_stats.misses - cache_stats0.misses);
+    profiler->set_count("selector cache bytes", cache_stats.total_mem);
+  }
+
+  for (i = 0; i < (int)thread_selectors.size(); i++)
+    delete thread_selectors[i];
+  for (i = 0; i < (int)thread_rslns.size(); i++)
+    delete thread_rslns[i];
+
   debug_log("I examined elements: %d", num_exam_elem);
   debug_log("  elements taken from priority queue: %d", num_priority_elem);
   debug_log("  ignored elements: %d", num_ignored_elem);
@@ -226,9 +346,14 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
   }
 
   //fix refinement if multimesh is used
+  if (profiler != NULL) profiler->begin_phase("apply");
   fix_shared_mesh_refinements(meshes, num, elem_inx_to_proc, idx, refinement_selector);
 
   //apply refinements
+  for (j = 0; j < num; j++) {
+    refined_elems[j].clear();
+    changed_elems[j].clear();
+  }
   apply_refinements(meshes, elem_inx_to_proc);
 
   if (same_orders)
@@ -245,11 +370,16 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
             int o = get_h_order(spaces[j]->get_element_order(e->id));
             if (o > current) current = o;
           }
-        spaces[i]->set_element_order(e->id, current);
+        if (spaces[i]->get_element_order(e->id) != current) {
+          spaces[i]->set_element_order(e->id, current);
+          changed_elems[i].push_back(e->id);
+        }
       }
     }
   }
 
+  if (profiler != NULL) profiler->end_phase();
+
   // mesh regularization
   if (regularize >= 0)
   {
@@ -258,14 +388,13 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
       regularize = 1;
       warn("Total mesh regularization is not supported in adaptivity. 1-irregular mesh is used instead.");
     }
-    for (i = 0; i < num; i++)
-    {
-      int* parents;
-      parents = meshes[i]->regularize(regularize);
-      spaces[i]->distribute_orders(meshes[i], parents);
-      delete [] parents;
-    }
+    ProfilerPhase phase("regularize");
+    regularize_refinements(meshes, regularize);
   }
+  finish_changed_elements(meshes);
+  if (profiler != NULL)
+    for (j = 0; j < num; j++)
+      profiler->add_count("elements changed", changed_elems[j].size());
 
   for (j = 0; j < num; j++)
     rsln[j]->enable_transform(true);
@@ -278,6 +407,83 @@ bool H1AdaptHP::adapt(double thr, int strat, RefinementSelectors::Selector* refi
   return done;
 }
 
+struct SelectThreadData
+{
+  RefinementSelectors::Selector* selector;
+  Solution** rslns;
+  Mesh** meshes;
+  Space** spaces;
+  H1AdaptHP::ElementReference* elems;
+  ElementToRefine* elem_refs;
+  bool* refined;
+  int* list;
+  int n, step;
+};
+
+static void* select_refinements_thread(void* arg)
+{
+  SelectThreadData* td = (SelectThreadData*) arg;
+  for (int k = 0; k < td->n; k += td->step)
+  {
+    int i = td->list[k];
+    int id = td->elems[i].id, comp = td->elems[i].comp;
+    Element* e = td->meshes[comp]->get_element(id);
+    td->elem_refs[i] = ElementToRefine(id, comp);
+    td->refined[i] = td->selector->select_refinement(e, td->spaces[comp]->get_element_order(id), td->rslns[comp], td->elem_refs[i]);
+  }
+  return NULL;
+}
+
+void H1AdaptHP::select_refinements(Mesh** meshes, vector<RefinementSelectors::Selector*>& selectors, vector<Solution*>& slns,
+                                   int first, int count, ElementToRefine* elem_refs, bool* refined)
+{
+  // the threads must not calculate the reference maps: make sure that the orders of
+  // their inverses are known for all elements of the reference meshes which are used
+  for (int i = first; i < first + count; i++)
+  {
+    Solution* sln = rsln[esort[i].comp];
+    Element* e = sln->get_mesh()->get_element(esort[i].id);
+    for (int son = 0; son < H2D_MAX_ELEMENT_SONS; son++)
+      if (e->sons[son] != NULL && e->sons[son]->active && e->sons[son]->iro_cache == -1)
+        sln->set_active_element(e->sons[son]);
+  }
+
+  // the shapeset of the reference map has a global mode, so the triangles
+  // and the quads are processed separately and the mode is switched here
+  for (int m = 0; m <= 1; m++)
+  {
+    vector<int> list;
+    for (int i = 0; i < count; i++)
+      if (meshes[esort[first + i].comp]->get_element(esort[first + i].id)->get_mode() == m)
+        list.push_back(i);
+    if (list.empty()) continue;
+    Solution* sln = rsln[esort[first + list[0]].comp];
+    sln->set_active_element(sln->get_mesh()->get_element(esort[first + list[0]].id)->sons[0]);
+
+    // each thread takes every nt-th element
+    int nt = std::min((int) selectors.size(), (int) list.size());
+    vector<pthread_t> threads(nt);
+    vector<SelectThreadData> td(nt);
+    for (int t = 0; t < nt; t++)
+    {
+      td[t].selector = selectors[t];
+      td[t].rslns = &slns[t * num];
+      td[t].meshes = meshes;
+      td[t].spaces = spaces;
+      td[t].elems = esort + first;
+      td[t].elem_refs = elem_refs;
+      td[t].refined = refined;
+      td[t].list = &list[t];
+      td[t].n = list.size() - t;
+      td[t].step = nt;
+      if (pthread_create(&threads[t], NULL, select_refinements_thread, &td[t]))
+        error("Could not create a refinement selection thread.");
+    }
+    for (int t = 0; t < nt; t++)
+      pthread_join(threads[t], NULL);
+  }
+}
+
 void H1AdaptHP::fix_shared_mesh_refinements(Mesh** meshes, const int num_comps, std::vector<ElementToRefine>& elems_to_refine, AutoLocalArray2<int>& idx, RefinementSelectors::Selector* refinement_selector) {
   int num_elem_to_proc = elems_to_refine.size();
   for(int inx = 0; inx < num_elem_to_proc; inx++) {
@@ -348,32 +554,271 @@ void H1AdaptHP::apply_refinements(Mesh** meshes, std::vector<ElementToRefine>& e
   {
     Element* e;
     e = meshes[elem_ref->comp]->get_element(elem_ref->id);
+    vector<int>& changed = changed_elems[elem_ref->comp];
 
-    if (elem_ref->split == H2D_REFINEMENT_P)
+    if (elem_ref->split == H2D_REFINEMENT_P) {
       spaces[elem_ref->comp]->set_element_order(elem_ref->id, elem_ref->p[0]);
+      changed.push_back(elem_ref->id);
+    }
     else if (elem_ref->split == H2D_REFINEMENT_H) {
-      if (e->active)
+      if (e->active) {
         meshes[elem_ref->comp]->refine_element(elem_ref->id);
-      for (int j = 0; j < 4; j++)
+        refined_elems[elem_ref->comp].push_back(elem_ref->id);
+      }
+      for (int j = 0; j < 4; j++) {
         spaces[elem_ref->comp]->set_element_order(e->sons[j]->id, elem_ref->p[j]);
+        changed.push_back(e->sons[j]->id);
+      }
     }
     else {
-      if (e->active)
+      if (e->active) {
         meshes[elem_ref->comp]->refine_element(elem_ref->id, elem_ref->split);
-      for (int j = 0; j < 2; j++)
-        spaces[elem_ref->comp]->set_element_order(e->sons[ (elem_ref->split == 1) ? j : j+2 ]->id, elem_ref->p[j]);
+        refined_elems[elem_ref->comp].push_back(elem_ref->id);
+      }
+      for (int j = 0; j < 2; j++) {
+        int son_id = e->sons[ (elem_ref->split == 1) ? j : j+2 ]->id;
+        spaces[elem_ref->comp]->set_element_order(son_id, elem_ref->p[j]);
+        changed.push_back(son_id);
+      }
     }
   }
 }
 
+void H1AdaptHP::regularize_refinements(Mesh** meshes, int n)
+{
+  for (int i = 0; i < num; i++)
+  {
+    // a mesh shared by several components is regularized once, for the refinements of all of them
+    bool first = true;
+    for (int j = 0; j < i; j++)
+      if (meshes[j] == meshes[i]) first = false;
+    if (!first) continue;
+
+    vector<int> refined;
+    for (int j = i; j < num; j++)
+      if (meshes[j] == meshes[i])
+        refined.insert(refined.end(), refined_elems[j].begin(), refined_elems[j].end());
+    int num_refined = (int) refined.size();
+    meshes[i]->regularize_refined(n, refined);
+
+    // the sons of the elements refined by the regularization inherit their orders, parents precede sons
+    for (int j = i; j < num; j++)
+    {
+      if (meshes[j] != meshes[i]) continue;
+      for (int k = num_refined; k < (int) refined.size(); k++)
+      {
+        Element* e = meshes[j]->get_element(refined[k]);
+        int p = spaces[j]->get_element_order(e->id);
+        if (e->is_triangle() && (get_v_order(p) != 0))
+          p = std::max(get_h_order(p), get_v_order(p));
+        for (int l = 0; l < 4; l++)
+          if (e->sons[l] != NULL) {
+            spaces[j]->set_element_order(e->sons[l]->id, p);
+            changed_elems[j].push_back(e->sons[l]->id);
+          }
+        refined_elems[j].push_back(e->id);
+      }
+    }
+  }
+}
+
+void H1AdaptHP::finish_changed_elements(Mesh** meshes)
+{
+  for (int i = 0; i < num; i++)
+  {
+    vector<int>& changed = changed_elems[i];
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    // drop the elements which were refined later in the same step
+    int k = 0;
+    for (int j = 0; j < (int) changed.size(); j++)
+      if (meshes[i]->get_element(changed[j])->active)
+        changed[k++] = changed[j];
+    changed.resize(k);
+  }
+}
+
 
 ///// Unrefinements /////////////////////////////////////////////////////////////////////////////////
 
+// Errors of the projections of a solution on the sons of a coarsening candidate, an element
+// split to four active sons, to uniform orders up to 'max_order'.
+struct CoarseningErrors
+{
+  int max_order;
+  double perr[H2DRS_MAX_ORDER+1];    // to the element
+  double herr[4][H2DRS_MAX_ORDER+1]; // to each son
+};
+
+// A son whose order is lowered by coarsen().
+struct LoweredOrder
+{
+  int id, comp, order;
+};
+
+int H1AdaptHP::coarsen(double thr, RefinementSelectors::ProjBasedSelector* selector)
+{
+  if (!have_errors)
+    error("Element errors have to be calculated first, see calc_error().");
+  if (selector == NULL)
+    selector = &default_refin_selector;
+  ProfilerPhase phase("coarsen");
+
+  int i, j, son, o;
+  Mesh* meshes[H2D_MAX_NUM_EQUATIONS];
+  for (j = 0; j < num; j++) {
+    meshes[j] = spaces[j]->get_mesh();
+    if (sln[j]->get_mesh()->get_seq() != meshes[j]->get_seq())
+      error("The solution of the component %d was not calculated on the current mesh.", j);
+    sln[j]->set_quad_2d(&g_quad_2d_std);
+    sln[j]->enable_transform(false);
+    refined_elems[j].clear();
+    changed_elems[j].clear();
+  }
+
+  // find the candidates of each mesh and the projection errors of each component; the
+  // limit is relative to the largest error of a projection of a candidate to order 1
+  RefinementSelectors::SonProjectionError herr[4], perr;
+  vector<int> cands[H2D_MAX_NUM_EQUATIONS]; // candidates of each mesh, stored at its first component
+  vector<CoarseningErrors> cand_errors[H2D_MAX_NUM_EQUATIONS];
+  double max_err = 0.0;
+  for (i = 0; i < num; i++)
+  {
+    int first = 0;
+    while (meshes[first] != meshes[i]) first++;
+    Element* e;
+    if (first == i)
+      for_all_inactive_elements(e, meshes[i])
+      {
+        bool found = true;
+        for (son = 0; son < 4; son++)
+          if (e->sons[son] == NULL || !e->sons[son]->active || e->sons[son]->is_curved())
+            { found = false; break; }
+        if (found) cands[i].push_back(e->id);
+      }
+
+    cand_errors[i].resize(cands[first].size());
+    for (unsigned int k = 0; k < cands[first].size(); k++)
+    {
+      e = meshes[i]->get_element(cands[first][k]);
+      int max_order = 1;
+      for (son = 0; son < 4; son++) {
+        int so = spaces[i]->get_element_order(e->sons[son]->id);
+        max_order = std::max(max_order, std::max(get_h_order(so), get_v_order(so)));
+      }
+      CoarseningErrors& ce = cand_errors[i][k];
+      ce.max_order = selector->calc_coarsening_errors(e, max_order, sln[i], herr, perr);
+      for (o = 1; o <= ce.max_order; o++) {
+        ce.perr[o] = perr[o][o];
+        for (son = 0; son < 4; son++)
+          ce.herr[son][o] = herr[son][o][o];
+      }
+      max_err = std::max(max_err, ce.perr[1]);
+    }
+  }
+  double tol = thr * max_err;
+
+  int num_merged = 0, num_lowered = 0;
+  for (i = 0; i < num; i++)
+  {
+    // the components sharing a mesh are coarsened together: an element is merged
+    // only if all of them allow it, and the merges are applied to the mesh once
+    vector<int> comps;
+    for (j = 0; j < num; j++)
+      if (meshes[j] == meshes[i]) comps.push_back(j);
+    if (comps[0] != i) continue;
+    Mesh* mesh = meshes[i];
+
+    // decide first, the mesh is changed afterwards
+    vector<int> merged, merged_orders; // IDs of merged elements, orders of each component sharing the mesh
+    vector<LoweredOrder> lowered; // sons with lower orders
+    for (unsigned int k = 0; k < cands[i].size(); k++)
+    {
+      Element* e = mesh->get_element(cands[i][k]);
+      bool merge = true;
+      int orders[H2D_MAX_NUM_EQUATIONS];
+      int son_orders[H2D_MAX_NUM_EQUATIONS][4];
+      for (unsigned int c = 0; c < comps.size(); c++)
+      {
+        j = comps[c];
+        const CoarseningErrors& ce = cand_errors[j][k];
+
+        // the lowest order of the merged element
+        orders[j] = -1;
+        for (o = 1; o <= ce.max_order && orders[j] < 0; o++)
+          if (ce.perr[o] <= tol)
+            orders[j] = o;
+        if (orders[j] < 0)
+          merge = false;
+
+        // the lowest orders of the sons, only uniform orders are lowered
+        for (son = 0; son < 4; son++) {
+          int so = spaces[j]->get_element_order(e->sons[son]->id);
+          son_orders[j][son] = -1;
+          if (!e->is_triangle() && get_h_order(so) != get_v_order(so)) continue;
+          for (o = 1; o < get_h_order(so) && o <= ce.max_order && son_orders[j][son] < 0; o++)
+            if (ce.herr[son][o] <= tol)
+              son_orders[j][son] = o;
+        }
+      }
+
+      if (merge) {
+        merged.push_back(e->id);
+        for (unsigned int c = 0; c < comps.size(); c++)
+          merged_orders.push_back(orders[comps[c]]);
+      }
+      else {
+        for (unsigned int c = 0; c < comps.size(); c++)
+          for (son = 0; son < 4; son++)
+            if (son_orders[comps[c]][son] >= 0) {
+              LoweredOrder lo = { e->sons[son]->id, comps[c], son_orders[comps[c]][son] };
+              lowered.push_back(lo);
+            }
+      }
+    }
+
+    // apply the changes
+    for (unsigned int m = 0, k = 0; m < merged.size(); m++)
+    {
+      int id = merged[m];
+      mesh->unrefine_element(id);
+      bool tri = mesh->get_element(id)->is_triangle();
+      for (unsigned int c = 0; c < comps.size(); c++) {
+        o = merged_orders[k++];
+        spaces[comps[c]]->set_element_order(id, tri ? o : make_quad_order(o, o));
+        changed_elems[comps[c]].push_back(id);
+      }
+    }
+    num_merged += (int) merged.size();
+    for (unsigned int l = 0; l < lowered.size(); l++)
+    {
+      const LoweredOrder& lo = lowered[l];
+      bool tri = mesh->get_element(lo.id)->is_triangle();
+      spaces[lo.comp]->set_element_order(lo.id, tri ? lo.order : make_quad_order(lo.order, lo.order));
+      changed_elems[lo.comp].push_back(lo.id);
+    }
+    num_lowered += (int) lowered.size();
+  }
+
+  for (j = 0; j < num; j++)
+    sln[j]->enable_transform(true);
+  finish_changed_elements(meshes);
+
+  profiler_count("elements merged", num_merged);
+  profiler_count("elements lowered", num_lowered);
+  verbose("Merged %d elements, lowered orders of %d elements.", num_merged, num_lowered);
+  have_errors = false;
+  return num_merged + num_lowered;
+}
+
+
 void H1AdaptHP::unrefine(double thr)
 {
 
   if (!have_errors)
     error("Element errors have to be calculated first, see calc_error().");
+  sort_elements(1);
 
   Mesh* mesh[2];
   mesh[0] = spaces[0]->get_mesh();
@@ -479,12 +924,17 @@ void H1AdaptHP::unrefine(double thr)
 
 //// error calculation /////////////////////////////////////////////////////////////////////////////
 
-double** H1AdaptHP::cmp_err;
-int H1AdaptHP::compare(const void* p1, const void* p2) {
-  const ElementReference& e1 = *((const ElementReference*)p1);
-  const ElementReference& e2 = *((const ElementReference*)p2);
-  return cmp_err[e1.comp][e1.id] < cmp_err[e2.comp][e2.id] ? 1 : -1;
-}
+/// Orders references to elements by error descending, then by component and ID.
+struct ElementErrorGreater {
+  double** errors;
+  ElementErrorGreater(double** errors) : errors(errors) {};
+  bool operator()(const H1AdaptHP::ElementReference& e1, const H1AdaptHP::ElementReference& e2) const {
+    double err1 = errors[e1.comp][e1.id], err2 = errors[e2.comp][e2.id];
+    if (err1 != err2) return err1 > err2;
+    if (e1.comp != e2.comp) return e1.comp < e2.comp;
+    return e1.id < e2.id;
+  }
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -498,113 +948,6 @@ void H1AdaptHP::set_biform(int i, int j, biform_val_t bi_form, biform_ord_t bi_o
 }
 
 
-scalar H1AdaptHP::eval_error(biform_val_t bi_fn, biform_ord_t bi_ord,
-                             MeshFunction *sln1, MeshFunction *sln2, MeshFunction *rsln1, MeshFunction *rsln2,
-                             RefMap *rv1,        RefMap *rv2,        RefMap *rrv1,        RefMap *rrv2)
-{
-  // determine the integration order
-  int inc = (rsln1->get_num_components() == 2) ? 1 : 0;
-  Func<Ord>* ou = init_fn_ord(rsln1->get_fn_order() + inc);
-  Func<Ord>* ov = init_fn_ord(rsln2->get_fn_order() + inc);
-
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  Ord o = bi_ord(1, &fake_wt, ou, ov, fake_e, NULL);
-  int order = rrv1->get_inv_ref_order();
-  order += o.get_order();
-  limit_order(order);
-
-  ou->free_ord(); delete ou;
-  ov->free_ord(); delete ov;
-  delete fake_e;
-
-  // eval the form
-  Quad2D* quad = sln1->get_quad_2d();
-  double3* pt = quad->get_points(order);
-  int np = quad->get_num_points(order);
-
-  // init geometry and jacobian*weights
-  Geom<double>* e = init_geom_vol(rrv1, order);
-  double* jac = rrv1->get_jacobian(order);
-  double* jwt = new double[np];
-  for(int i = 0; i < np; i++)
-    jwt[i] = pt[i][2] * jac[i];
-
-  // function values and values of external functions
-  Func<scalar>* err1 = init_fn(sln1, rv1, order);
-  Func<scalar>* err2 = init_fn(sln2, rv2, order);
-  Func<scalar>* v1 = init_fn(rsln1, rrv1, order);
-  Func<scalar>* v2 = init_fn(rsln2, rrv2, order);
-
-  for (int i = 0; i < np; i++)
-  {
-    err1->val[i] = err1->val[i] - v1->val[i];
-    err1->dx[i] = err1->dx[i] - v1->dx[i];
-    err1->dy[i] = err1->dy[i] - v1->dy[i];
-    err2->val[i] = err2->val[i] - v2->val[i];
-    err2->dx[i] = err2->dx[i] - v2->dx[i];
-    err2->dy[i] = err2->dy[i] - v2->dy[i];
-  }
-
-  scalar res = bi_fn(np, jwt, err1, err2, e, NULL);
-
-  e->free(); delete e;
-  delete [] jwt;
-  err1->free_fn(); delete err1;
-  err2->free_fn(); delete err2;
-  v1->free_fn(); delete v1;
-  v2->free_fn(); delete v2;
-
-  return res;
-}
-
-
-scalar H1AdaptHP::eval_norm(biform_val_t bi_fn, biform_ord_t bi_ord,
-                            MeshFunction *rsln1, MeshFunction *rsln2, RefMap *rrv1, RefMap *rrv2)
-{
-  // determine the integration order
-  int inc = (rsln1->get_num_components() == 2) ? 1 : 0;
-  Func<Ord>* ou = init_fn_ord(rsln1->get_fn_order() + inc);
-  Func<Ord>* ov = init_fn_ord(rsln2->get_fn_order() + inc);
-
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  Ord o = bi_ord(1, &fake_wt, ou, ov, fake_e, NULL);
-  int order = rrv1->get_inv_ref_order();
-  order += o.get_order();
-  limit_order(order);
-
-  ou->free_ord(); delete ou;
-  ov->free_ord(); delete ov;
-  delete fake_e;
-
-  // eval the form
-  Quad2D* quad = rsln1->get_quad_2d();
-  double3* pt = quad->get_points(order);
-  int np = quad->get_num_points(order);
-
-  // init geometry and jacobian*weights
-  Geom<double>* e = init_geom_vol(rrv1, order);
-  double* jac = rrv1->get_jacobian(order);
-  double* jwt = new double[np];
-  for(int i = 0; i < np; i++)
-    jwt[i] = pt[i][2] * jac[i];
-
-  // function values
-  Func<scalar>* v1 = init_fn(rsln1, rrv1, order);
-  Func<scalar>* v2 = init_fn(rsln2, rrv2, order);
-
-  scalar res = bi_fn(np, jwt, v1, v2, e, NULL);
-
-  e->free(); delete e;
-  delete [] jwt;
-  v1->free_fn(); delete v1;
-  v2->free_fn(); delete v2;
-
-  return res;
-}
-
-
 double H1AdaptHP::calc_error(MeshFunction* sln, MeshFunction* rsln)
 {
   if (num != 1) error("Wrong number of solutions.");
@@ -623,7 +966,8 @@ double H1AdaptHP::calc_error_2(MeshFunction* sln1, MeshFunction* sln2, MeshFunct
 
 double H1AdaptHP::calc_error_n(int n, ...)
 {
-  int i, j;
+  int i;
+  ProfilerPhase phase("calc_error");
 
   if (n != num) error("Wrong number of solutions.");
 
@@ -642,22 +986,15 @@ double H1AdaptHP::calc_error_n(int n, ...)
 
   // prepare multi-mesh traversal and error arrays
   AUTOLA_OR(Mesh*, meshes, 2*num);
-  AUTOLA_OR(Transformable*, tr, 2*num);
-  Traverse trav;
   nact = 0;
   for (i = 0; i < num; i++)
   {
     meshes[i] = sln[i]->get_mesh();
     meshes[i+num] = rsln[i]->get_mesh();
-    tr[i] = sln[i];
-    tr[i+num] = rsln[i];
 
     nact += sln[i]->get_mesh()->get_num_active_elements();
 
-    int max = meshes[i]->get_max_element_id();
-    if (errors[i] != NULL) delete [] errors[i];
-    errors[i] = new double[max];
-    memset(errors[i], 0, sizeof(double) * max);
+    init_errors(i, meshes[i]->get_max_element_id());
   }
 
   double total_norm = 0.0;
@@ -665,52 +1002,87 @@ double H1AdaptHP::calc_error_n(int n, ...)
   memset(norms, 0, norms.size);
   double total_error = 0.0;
 
-  Element** ee;
-  trav.begin(2*num, meshes, tr);
-  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+  calc_elem_errors(num, sln, rsln, &form[0][0], &ord[0][0], H2D_MAX_NUM_EQUATIONS, num_threads,
+                   errors, norms, total_error, total_norm);
+
+  //prepare an ordered list of elements according to an error
+  sort_elements_by_error(meshes);
+
+  have_errors = true;
+  have_rsln = true;
+  total_err = total_error/* / total_norm*/;
+  return sqrt(total_error / total_norm);
+}
+
+
+double H1AdaptHP::estimate_error(MeshFunction* sln)
+{
+  if (num != 1) error("Wrong number of solutions.");
+
+  return estimate_error_n(1, sln);
+}
+
+
+double H1AdaptHP::estimate_error_2(MeshFunction* sln1, MeshFunction* sln2)
+{
+  if (num != 2) error("Wrong number of solutions.");
+
+  return estimate_error_n(2, sln1, sln2);
+}
+
+
+double H1AdaptHP::estimate_error_n(int n, ...)
+{
+  int i;
+  ProfilerPhase phase("estimate_error");
+
+  if (n != num) error("Wrong number of solutions.");
+
+  // obtain solutions; adapt() passes them to the selectors in place of reference solutions
+  va_list ap;
+  va_start(ap, n);
+  for (i = 0; i < n; i++) {
+    sln[i] = va_arg(ap, Solution*);
+    sln[i]->set_quad_2d(&g_quad_2d_std);
+    rsln[i] = sln[i];
+  }
+  va_end(ap);
+
+  // prepare error arrays
+  AUTOLA_OR(Mesh*, meshes, 2*num);
+  nact = 0;
+  for (i = 0; i < num; i++)
   {
-    for (i = 0; i < num; i++)
-    {
-      RefMap* rmi = sln[i]->get_refmap();
-      RefMap* rrmi = rsln[i]->get_refmap();
-      for (j = 0; j < num; j++)
-      {
-        RefMap* rmj = sln[j]->get_refmap();
-        RefMap* rrmj = rsln[j]->get_refmap();
-        double e, t;
-        if (form[i][j] != NULL)
-        {
-          #ifndef COMPLEX
-          e = fabs(eval_error(form[i][j], ord[i][j], sln[i], sln[j], rsln[i], rsln[j], rmi, rmj, rrmi, rrmj));
-          t = fabs(eval_norm(form[i][j], ord[i][j], rsln[i], rsln[j], rrmi, rrmj));
-          #else
-          e = std::abs(eval_error(form[i][j], ord[i][j], sln[i], sln[j], rsln[i], rsln[j], rmi, rmj, rrmi, rrmj));
-          t = std::abs(eval_norm(form[i][j], ord[i][j], rsln[i], rsln[j], rrmi, rrmj));
-          #endif
-
-          norms[i] += t;
-          total_norm  += t;
-          total_error += e;
-          errors[i][ee[i]->id] += e;
-        }
-      }
-    }
+    meshes[i] = meshes[i+num] = sln[i]->get_mesh();
+    nact += meshes[i]->get_num_active_elements();
+
+    init_errors(i, meshes[i]->get_max_element_id());
   }
-  trav.finish();
+
+  double total_norm = 0.0;
+  AUTOLA_OR(double, norms, num);
+  memset(norms, 0, norms.size);
+  double total_error = 0.0;
+
+  calc_elem_errors_zz(num, sln, &form[0][0], &ord[0][0], H2D_MAX_NUM_EQUATIONS,
+                      errors, norms, total_error, total_norm);
 
   //prepare an ordered list of elements according to an error
   sort_elements_by_error(meshes);
 
   have_errors = true;
-  total_err = total_error/* / total_norm*/;
+  have_rsln = false;
+  total_err = total_error;
   return sqrt(total_error / total_norm);
 }
 
 void H1AdaptHP::sort_elements_by_error(Mesh** meshes) {
   //allocate
-  if (esort != NULL)
+  if (esort_size < nact) {
     delete[] esort;
-  esort = new ElementReference[nact];
+    esort = new ElementReference[nact];
+    esort_size = nact;
+  }
 
   //prepare indices
   Element* e;
@@ -725,9 +1097,30 @@ void H1AdaptHP::sort_elements_by_error(Mesh** meshes) {
 // when norms of 2 components are very different it can help (microwave heating)
 // navier-stokes on different meshes work only without
     }
-
-  //sort
   assert(inx == nact);
-  cmp_err = errors;
-  qsort(esort, nact, sizeof(ElementReference), compare);
+
+  //the elements are sorted on demand
+  nsorted = 0;
+}
+
+void H1AdaptHP::sort_elements(int count) {
+  if (count <= nsorted)
+    return;
+
+  //sort at least twice as many elements as the last time, so that the total work is linear in nact
+  int end = std::min(nact, std::max(count, std::max(2 * nsorted, 64)));
+  ElementErrorGreater greater(errors);
+  if (end < nact)
+    std::nth_element(esort + nsorted, esort + end, esort + nact, greater);
+  std::sort(esort + nsorted, esort + end, greater);
+  nsorted = end;
+}
+
+void H1AdaptHP::init_errors(int comp, int max_id) {
+  if (errors_size[comp] < max_id) {
+    delete [] errors[comp];
+    errors[comp] = new double[max_id];
+    errors_size[comp] = max_id;
+  }
+  memset(errors[comp], 0, sizeof(double) * max_id);
 }
@@ -65,7 +65,24 @@ public:
   /// pointers are passed, followed by n fine solution pointers.
   virtual double calc_error_n(int n, ...);
 
-  /// Refines elements based on results from calc_error() or calc_energy_error().
+  /// Type-safe version of estimate_error_n() for one solution.
+  double estimate_error(MeshFunction* sln);
+
+  /// Type-safe version of estimate_error_n() for two solutions.
+  double estimate_error_2(MeshFunction* sln1, MeshFunction* sln2);
+
+  /// Estimates the error of the solution without a reference solution, using gradient
+  /// recovery (see calc_elem_errors_zz()) and the diagonal forms. 'n' must be the same as
+  /// 'num' in the constructor. After that, n coarse solution pointers are passed. The element
+  /// errors can be used by adapt() like the ones from calc_error_n(), but the projection-based
+  /// selectors need a reference solution: if no selector is given, adapt() refines in h only.
+  /// Use H1OnlyH or H1OnlyP, and a reference solution for steps which need hp-decisions.
+  double estimate_error_n(int n, ...);
+
+  /// Refines elements based on results from calc_error() or estimate_error().
+  /// If 'regularize' >= 0, the mesh is made 'regularize'-irregular (1-irregular for 0) by refining
+  /// only the neighbourhood of the refined elements, see Mesh::regularize_refined(). The mesh
+  /// is therefore expected to be regular in this sense before the first call.
   bool adapt(double thr, int strat = 0, RefinementSelectors::Selector* refinement_selector = NULL,
              int regularize = -1,
              bool same_orders = false, double to_be_processed = 0.0);
@@ -73,6 +90,28 @@ public:
   /// Unrefines the elements with the smallest error
   void unrefine(double thr);
 
+  /// Coarsens the meshes and lowers orders where the solutions of the last calc_error() or
+  /// estimate_error() can be represented with a small error. Sons of an element which was split
+  /// to four active sons are merged if the solution can be projected to the element with an
+  /// error below a limit; the element gets the lowest order satisfying this. Otherwise, the
+  /// uniform order of each son is lowered as long as the error of the projection to the son
+  /// stays below the limit. The limit is 'thr' times the largest error of a projection of such
+  /// an element to order 1, so it is measured like the projection errors. Components which share
+  /// a mesh merge an element only if all of them allow it. The projection errors are calculated
+  /// by 'selector' on the reference domain (the default selector if NULL). The mesh regularity
+  /// is not enforced. Returns the number of merged elements and elements with lowered orders,
+  /// see also get_changed_elements(). The spaces have to be assigned DOFs afterwards.
+  int coarsen(double thr, RefinementSelectors::ProjBasedSelector* selector = NULL);
+
+  /// Sets the number of threads used by calc_error_n() and adapt(). In calc_error_n(), the
+  /// elements are split among the threads and their errors are summed in the order of the
+  /// traversal afterwards. In adapt(), the threads select refinements. The candidates of
+  /// the elements are evaluated in parallel by copies of the selector (see
+  /// RefinementSelectors::Selector::clone()), while the elements are still accepted in
+  /// the order of their errors, so the result does not depend on the number of threads.
+  /// If the selector cannot be copied, the selection is serial. The default is 1.
+  void set_num_threads(int num_threads) { this->num_threads = (num_threads > 1) ? num_threads : 1; }
+
   /// Internal. Functions to obtain errors of individual elements.
   struct ElementReference { ///< A reference to a element.
     int id, comp;
@@ -80,7 +119,11 @@ public:
     ElementReference(int id, int comp) : id(id), comp(comp) {};
   };
   double get_element_error(int component, int id) const { return errors[component][id]; }
-  ElementReference*  get_sorted_elements() const { return esort; }
+
+  /// Returns IDs of active elements of a component which were created or whose order changed in the last adapt(), in ascending order.
+  /// The rest of the mesh and of the orders is unchanged, so only these elements and their neighbours need new DOFs and assembly.
+  const std::vector<int>& get_changed_elements(int component) const { return changed_elems[component]; }
+  ElementReference*  get_sorted_elements() { sort_elements(nact); return esort; } ///< Returns all elements sorted by error descending.
   int    get_total_active_elements() const { return nact; }
 
 private: //internal constructions
@@ -88,6 +131,7 @@ private: //internal constructions
 
 protected: //adaptivity
   RefinementSelectors::H1NonUniformHP default_refin_selector; ///< A default refinement selected which is used when no refinement selector is provided.
+  RefinementSelectors::H1OnlyH h_only_refin_selector; ///< A default refinement selector used when errors were estimated without a reference solution.
 
   std::queue<ElementReference> priority_esort; ///< A list of priority elements that are processed before the next element in esort is processed.
 
@@ -95,7 +139,15 @@ protected: //adaptivity
   virtual bool can_adapt_element(Mesh* mesh, Element* e, const int split, const int4& p, const int4& q) { return true; }; ///< Returns true, if an element can be adapted using a selected candidate.
   void fix_shared_mesh_refinements(Mesh** meshes, const int num_comps, std::vector<ElementToRefine>& elems_to_refine, AutoLocalArray2<int>& idx, RefinementSelectors::Selector* refinement_selector); ///< Fixes refinements of a mesh which is shared among multiple components of a multimesh.
 
-  virtual void apply_refinements(Mesh** meshes, std::vector<ElementToRefine>& elems_to_refine); ///< Apply refinements.
+  virtual void apply_refinements(Mesh** meshes, std::vector<ElementToRefine>& elems_to_refine); ///< Apply refinements. Records refined elements in refined_elems and new or changed elements in changed_elems.
+  void regularize_refinements(Mesh** meshes, int n); ///< Makes meshes n-irregular around the refined elements and assigns orders to the new elements.
+  void finish_changed_elements(Mesh** meshes); ///< Sorts changed_elems and keeps only the active elements.
+
+  std::vector<int> refined_elems[H2D_MAX_NUM_EQUATIONS]; ///< IDs of elements refined by the last adapt(), parents precede sons.
+  std::vector<int> changed_elems[H2D_MAX_NUM_EQUATIONS]; ///< IDs of active elements created or changed by the last adapt(), see get_changed_elements().
+
+  int num_threads; ///< A number of threads used to calculate errors and to select refinements, see set_num_threads().
+  void select_refinements(Mesh** meshes, std::vector<RefinementSelectors::Selector*>& selectors, std::vector<Solution*>& slns, int first, int count, ElementToRefine* elem_refs, bool* refined); ///< Selects refinements of the elements esort[first, first+count) in parallel using one selector and one copy of each reference solution per thread.
 
 protected:
   // spaces & solutions
@@ -108,29 +160,29 @@ protected:
   double* errors[H2D_MAX_NUM_EQUATIONS];
   double  norms[H2D_MAX_NUM_EQUATIONS];
   bool    have_errors;
+  bool    have_rsln; ///< True if errors were calculated using reference solutions, false if they were estimated.
   double  total_err;
   ElementReference* esort;
   int   nact;
+  int   nsorted; ///< A number of elements at the beginning of esort which are already sorted, see sort_elements().
+  int   esort_size; ///< A number of items allocated in esort.
+  int   errors_size[H2D_MAX_NUM_EQUATIONS]; ///< A number of items allocated in errors.
 
   // bilinear forms to calculate error
   biform_val_t form[H2D_MAX_NUM_EQUATIONS][H2D_MAX_NUM_EQUATIONS];
   biform_ord_t ord[H2D_MAX_NUM_EQUATIONS][H2D_MAX_NUM_EQUATIONS];
 
-  // evaluation of error and norm forms
-  scalar eval_error(biform_val_t bi_fn, biform_ord_t bi_ord,
-                    MeshFunction *sln1, MeshFunction *sln2, MeshFunction *rsln1, MeshFunction *rsln2,
-                    RefMap *rv1,        RefMap *rv2,        RefMap *rrv1,        RefMap *rrv2);
-
-  scalar eval_norm(biform_val_t bi_fn, biform_ord_t bi_ord,
-                   MeshFunction *rsln1, MeshFunction *rsln2, RefMap *rrv1, RefMap *rrv2);
-
-  /// Builds a list of elements sorted by error descending. Assumes that H1OrthoHP::errors is initialized. Initializes H1OrthoHP::esort.
-  /// \param meshes: Meshes. Indices [0,.., H1OrthoHP::num-1] contains meshes of coarse solutions, indices [H1OrthoHP::num,..,2*H1OrthoHP::num - 1] contains meshes of reference solution.
+  /// Builds a list of elements to be sorted by error descending. Assumes that H1AdaptHP::errors is initialized. Initializes H1AdaptHP::esort.
+  /// The list is sorted lazily: only the elements requested by sort_elements() are ordered.
+  /// \param meshes: Meshes. Indices [0,.., H1AdaptHP::num-1] contains meshes of coarse solutions, indices [H1AdaptHP::num,..,2*H1AdaptHP::num - 1] contains meshes of reference solution.
   void sort_elements_by_error(Mesh** meshes);
 
-private:
-  static double** cmp_err; ///< An helper array used to sort reference to elements.
-  static int compare(const void* p1, const void* p2); ///< Compares to reference to an element according to H1OrthoHP::cmp_err.
+  /// Ensures that the first 'count' items of esort are the elements with the largest errors in descending order.
+  /// Elements of equal errors are ordered by their component and ID.
+  void sort_elements(int count);
+
+  /// Prepares a zeroed array of errors of a component for elements with IDs below 'max_id'. The array is reused if it is large enough.
+  void init_errors(int comp, int max_id);
 };
 
 
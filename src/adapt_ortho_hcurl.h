@@ -47,6 +47,10 @@ public:
   /// pointers are passed, followed by n fine solution pointers.
   double calc_error_n(int n, ...);
 
+  /// Sets the number of threads used by calc_error_n() to evaluate the errors of elements.
+  /// The result does not depend on the number of threads. The default is 1.
+  void set_num_threads(int num_threads) { this->num_threads = (num_threads > 1) ? num_threads : 1; }
+
 
   /// Selects elements to refine (based on results from calc_error() or calc_energy_error())
   /// and performs their optimal hp-refinement.
@@ -69,6 +73,8 @@ protected:
   Solution* sln[10];
   Solution* rsln[10];
 
+  int num_threads; ///< A number of threads used by calc_error_n().
+
   // element error arrays
   double* errors[10];
   double  norms[10]; // ?
@@ -82,14 +88,6 @@ protected:
   biform_val_t form[10][10];
   biform_ord_t ord[10][10];
 
-  // evaluation of error and norm forms
-  scalar eval_error(biform_val_t bi_fn, biform_ord_t bi_ord,
-                    MeshFunction *sln1, MeshFunction *sln2, MeshFunction *rsln1, MeshFunction *rsln2,
-                    RefMap *rv1,        RefMap *rv2,        RefMap *rrv1,        RefMap *rrv2);
-
-  scalar eval_norm(biform_val_t bi_fn, biform_ord_t bi_ord,
-                   MeshFunction *rsln1, MeshFunction *rsln2, RefMap *rrv1, RefMap *rrv2);
-
   // orthonormal basis tables
   static double** obase_0[2][9];  // first component
   static double** obase_1[2][9];  // second component
@@ -22,12 +22,14 @@
 #include "integrals_h1.h"
 #include "matrix.h"
 #include "adapt_ortho_l2.h"
+#include "adapt_error.h"
 #include "traverse.h"
 
 
 L2OrthoHP::L2OrthoHP(int num, ...)
 {
   this->num = num;
+  num_threads = 1;
 
   va_list ap;
   va_start(ap, num);
@@ -615,113 +617,6 @@ void L2OrthoHP::set_biform(int i, int j, biform_val_t bi_form, biform_ord_t bi_o
 }
 
 
-scalar L2OrthoHP::eval_error(biform_val_t bi_fn, biform_ord_t bi_ord,
-                             MeshFunction *sln1, MeshFunction *sln2, MeshFunction *rsln1, MeshFunction *rsln2,
-                             RefMap *rv1,        RefMap *rv2,        RefMap *rrv1,        RefMap *rrv2)
-{
-  // determine the integration order
-  int inc = (rsln1->get_num_components() == 2) ? 1 : 0;
-  Func<Ord>* ou = init_fn_ord(rsln1->get_fn_order() + inc);
-  Func<Ord>* ov = init_fn_ord(rsln2->get_fn_order() + inc);
-
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  Ord o = bi_ord(1, &fake_wt, ou, ov, fake_e, NULL);
-  int order = rrv1->get_inv_ref_order();
-  order += o.get_order();
-  limit_order(order);
-
-  ou->free_ord(); delete ou;
-  ov->free_ord(); delete ov;
-  delete fake_e;
-
-  // eval the form
-  Quad2D* quad = sln1->get_quad_2d();
-  double3* pt = quad->get_points(order);
-  int np = quad->get_num_points(order);
-
-  // init geometry and jacobian*weights
-  Geom<double>* e = init_geom_vol(rrv1, order);
-  double* jac = rrv1->get_jacobian(order);
-  double* jwt = new double[np];
-  for(int i = 0; i < np; i++)
-    jwt[i] = pt[i][2] * jac[i];
-
-  // function values and values of external functions
-  Func<scalar>* err1 = init_fn(sln1, rv1, order);
-  Func<scalar>* err2 = init_fn(sln2, rv2, order);
-  Func<scalar>* v1 = init_fn(rsln1, rrv1, order);
-  Func<scalar>* v2 = init_fn(rsln2, rrv2, order);
-
-  for (int i = 0; i < np; i++)
-  {
-    err1->val[i] = err1->val[i] - v1->val[i];
-    err1->dx[i] = err1->dx[i] - v1->dx[i];
-    err1->dy[i] = err1->dy[i] - v1->dy[i];
-    err2->val[i] = err2->val[i] - v2->val[i];
-    err2->dx[i] = err2->dx[i] - v2->dx[i];
-    err2->dy[i] = err2->dy[i] - v2->dy[i];
-  }
-
-  scalar res = bi_fn(np, jwt, err1, err2, e, NULL);
-
-  e->free(); delete e;
-  delete [] jwt;
-  err1->free_fn(); delete err1;
-  err2->free_fn(); delete err2;
-  v1->free_fn(); delete v1;
-  v2->free_fn(); delete v2;
-
-  return res;
-}
-
-
-scalar L2OrthoHP::eval_norm(biform_val_t bi_fn, biform_ord_t bi_ord,
-                            MeshFunction *rsln1, MeshFunction *rsln2, RefMap *rrv1, RefMap *rrv2)
-{
-  // determine the integration order
-  int inc = (rsln1->get_num_components() == 2) ? 1 : 0;
-  Func<Ord>* ou = init_fn_ord(rsln1->get_fn_order() + inc);
-  Func<Ord>* ov = init_fn_ord(rsln2->get_fn_order() + inc);
-
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  Ord o = bi_ord(1, &fake_wt, ou, ov, fake_e, NULL);
-  int order = rrv1->get_inv_ref_order();
-  order += o.get_order();
-  limit_order(order);
-
-  ou->free_ord(); delete ou;
-  ov->free_ord(); delete ov;
-  delete fake_e;
-
-  // eval the form
-  Quad2D* quad = rsln1->get_quad_2d();
-  double3* pt = quad->get_points(order);
-  int np = quad->get_num_points(order);
-
-  // init geometry and jacobian*weights
-  Geom<double>* e = init_geom_vol(rrv1, order);
-  double* jac = rrv1->get_jacobian(order);
-  double* jwt = new double[np];
-  for(int i = 0; i < np; i++)
-    jwt[i] = pt[i][2] * jac[i];
-
-  // function values
-  Func<scalar>* v1 = init_fn(rsln1, rrv1, order);
-  Func<scalar>* v2 = init_fn(rsln2, rrv2, order);
-
-  scalar res = bi_fn(np, jwt, v1, v2, e, NULL);
-
-  e->free(); delete e;
-  delete [] jwt;
-  v1->free_fn(); delete v1;
-  v2->free_fn(); delete v2;
-
-  return res;
-}
-
-
 double L2OrthoHP::calc_error(MeshFunction* sln, MeshFunction* rsln)
 {
   if (num != 1) error("Wrong number of solutions.");
@@ -740,7 +635,7 @@ double L2OrthoHP::calc_error_2(MeshFunction* sln1, MeshFunction* sln2, MeshFunct
 
 double L2OrthoHP::calc_error_n(int n, ...)
 {
-  int i, j, k;
+  int i, k;
 
   if (n != num) error("Wrong number of solutions.");
 
@@ -759,15 +654,11 @@ double L2OrthoHP::calc_error_n(int n, ...)
 
   // prepare multi-mesh traversal and error arrays
   AUTOLA_OR(Mesh*, meshes, 2*num);
-  AUTOLA_OR(Transformable*, tr, 2*num);
-  Traverse trav;
   nact = 0;
   for (i = 0; i < num; i++)
   {
     meshes[i] = sln[i]->get_mesh();
     meshes[i+num] = rsln[i]->get_mesh();
-    tr[i] = sln[i];
-    tr[i+num] = rsln[i];
 
     nact += sln[i]->get_mesh()->get_num_active_elements();
 
@@ -784,38 +675,8 @@ double L2OrthoHP::calc_error_n(int n, ...)
   if (esort != NULL) delete [] esort;
   esort = new int2[nact];
 
-  Element** ee;
-  trav.begin(2*num, meshes, tr);
-  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
-  {
-    for (i = 0; i < num; i++)
-    {
-      RefMap* rmi = sln[i]->get_refmap();
-      RefMap* rrmi = rsln[i]->get_refmap();
-      for (j = 0; j < num; j++)
-      {
-        RefMap* rmj = sln[j]->get_refmap();
-        RefMap* rrmj = rsln[j]->get_refmap();
-        double e, t;
-        if (form[i][j] != NULL)
-        {
-          #ifndef COMPLEX
-          e = fabs(eval_error(form[i][j], ord[i][j], sln[i], sln[j], rsln[i], rsln[j], rmi, rmj, rrmi, rrmj));
-          t = fabs(eval_norm(form[i][j], ord[i][j], rsln[i], rsln[j], rrmi, rrmj));
-          #else
-          e = std::abs(eval_error(form[i][j], ord[i][j], sln[i], sln[j], rsln[i], rsln[j], rmi, rmj, rrmi, rrmj));
-          t = std::abs(eval_norm(form[i][j], ord[i][j], rsln[i], rsln[j], rrmi, rrmj));
-          #endif
-        }
-
-        norms[i] += t;
-        total_norm  += t;
-        total_error += e;
-        errors[i][ee[i]->id] += e;
-      }
-    }
-  }
-  trav.finish();
+  calc_elem_errors(num, sln, rsln, &form[0][0], &ord[0][0], 10, num_threads,
+                   errors, norms, total_error, total_norm);
 
   Element* e;
   k = 0;
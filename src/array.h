@@ -39,6 +39,7 @@ protected:
   std::vector<int> unused;
   int  size, nitems;
   bool append_only;
+  bool shared; ///< the pages belong to another array
 
   static const int PAGE_BITS = 10;
   static const int PAGE_SIZE = 1 << PAGE_BITS;
@@ -50,9 +51,10 @@ public:
   {
     size = nitems = 0;
     append_only = false;
+    shared = false;
   }
 
-  Array(Array& array) { copy(array); }
+  Array(Array& array) { shared = false; copy(array); }
 
   ~Array() { free(); }
 
@@ -75,11 +77,30 @@ public:
     }
   }
 
+  /// Makes this array use the pages of another one. Nothing is copied and the
+  /// pages are not freed by this array. Neither array may be changed while the
+  /// pages are shared.
+  void share(const Array& array)
+  {
+    free();
+    pages = array.pages;
+    unused = array.unused;
+    size = array.size;
+    nitems = array.nitems;
+    append_only = array.append_only;
+    shared = true;
+  }
+
+  /// Sets whether the pages belong to another array (and thus will not be freed).
+  void set_shared(bool shared) { this->shared = shared; }
+
   /// Removes all elements from the array.
   void free()
   {
-    for (unsigned i = 0; i < pages.size(); i++)
-      delete [] pages[i];
+    if (!shared)
+      for (unsigned i = 0; i < pages.size(); i++)
+        delete [] pages[i];
+    shared = false;
     pages.clear();
     unused.clear();
     size = nitems = 0;
@@ -144,24 +165,24 @@ public:
   void force_size(int size)
   {
     free();
-    while (size > 0)
+    for (int n = size; n > 0; n -= PAGE_SIZE)
     {
       T* new_page = new T[PAGE_SIZE];
       memset(new_page, 0, sizeof(T) * PAGE_SIZE);
       pages.push_back(new_page);
-      size -= PAGE_SIZE;
     }
-    this->size = pages.size() * PAGE_SIZE;
+    this->size = size;
   }
 
   /// Counts the items in the array and registers unused items.
   /// This is a special-purpose function, used after loading the array
   /// from file.
+  /// Unused items below 'start' are counted as skipped slots (see skip_slot()).
   void post_load_scan(int start = 0)
   {
     nitems = 0;
-    for (int i = start; i < size; i++)
-      if (get_item(i).used)
+    for (int i = 0; i < size; i++)
+      if (get_item(i).used || i < start)
         nitems++;
       else
         unused.push_back(i);
@@ -59,6 +59,16 @@ public:
     coef[cnt++] = c;
   }
 
+  /// Appends 'n' triplets stored in separate arrays.
+  inline void add_triplets(const int* i, const int* d, const scalar* c, int n)
+  {
+    while (cnt + n > cap) enlarge();
+    memcpy(idx + cnt, i, sizeof(int) * n);
+    memcpy(dof + cnt, d, sizeof(int) * n);
+    memcpy(coef + cnt, c, sizeof(scalar) * n);
+    cnt += n;
+  }
+
 protected:
 
   // this is the only non-inline method; defined in space.cpp
@@ -15,6 +15,13 @@
 FILE *fmemopen (void *buf, size_t size, const char *opentype);
 #endif
 
+#ifdef WITH_ZLIB
+/// Opens a gzip file as a standard stream ("rb" or "wb"). The data are (de)compressed
+/// in-process as they are read or written. 'level' is the compression level 0-9, -1 means
+/// the zlib default. The stream is closed by fclose(). Returns NULL on failure.
+FILE* hermes2d_gzopen(const char* filename, const char* mode, int level = -1);
+#endif
+
 //Windows DLL export/import definitions
 #if defined(WIN32) || defined(_WINDOWS)
 # if defined(_HERMESDLL)
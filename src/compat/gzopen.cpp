@@ -0,0 +1,84 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "../common.h"
+
+#ifdef WITH_ZLIB
+
+/* Wraps a zlib gzFile in a standard C stream, so that the existing FILE* based
+ * binary writers (e.g. Mesh::save_raw) can produce compressed data directly,
+ * without piping through an external gzip process.
+ */
+
+#include <zlib.h>
+
+static int gz_read(void* cookie, char* buf, int size)
+{
+  return gzread((gzFile) cookie, buf, size);
+}
+
+static int gz_write(void* cookie, const char* buf, int size)
+{
+  if (size <= 0) return 0;
+  int n = gzwrite((gzFile) cookie, buf, size);
+  return n > 0 ? n : -1;
+}
+
+static int gz_close(void* cookie)
+{
+  return gzclose((gzFile) cookie) == Z_OK ? 0 : EOF;
+}
+
+#if defined(__GLIBC__)
+
+static ssize_t gz_cookie_read(void* cookie, char* buf, size_t size)
+  { return gz_read(cookie, buf, (int) size); }
+static ssize_t gz_cookie_write(void* cookie, const char* buf, size_t size)
+  { int n = gz_write(cookie, buf, (int) size); return n < 0 ? 0 : n; }
+
+#endif
+
+
+FILE* hermes2d_gzopen(const char* filename, const char* mode, int level)
+{
+  bool writing = (strchr(mode, 'w') != NULL);
+  char gzmode[8];
+  if (writing && level >= 0 && level <= 9)
+    sprintf(gzmode, "wb%d", level);
+  else
+    strcpy(gzmode, writing ? "wb" : "rb");
+
+  gzFile gz = gzopen(filename, gzmode);
+  if (gz == NULL) return NULL;
+  gzbuffer(gz, 1 << 17);
+
+  FILE* f;
+#if defined(__GLIBC__)
+  cookie_io_functions_t io = { NULL, NULL, NULL, gz_close };
+  if (writing) io.write = gz_cookie_write; else io.read = gz_cookie_read;
+  f = fopencookie(gz, writing ? "w" : "r", io);
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+  f = funopen(gz, writing ? NULL : gz_read, writing ? gz_write : NULL, NULL, gz_close);
+#else
+  f = NULL;
+  warn("In-process compressed streams are not supported on this platform.");
+#endif
+
+  if (f == NULL) { gzclose(gz); return NULL; }
+  setvbuf(f, NULL, _IOFBF, 1 << 16);
+  return f;
+}
+
+#endif
@@ -21,6 +21,8 @@
 #include "mesh.h"
 #include "quad_all.h"
 #include "matrix.h"
+#include <map>
+#include <list>
 
 
 // defined in refmap.cpp
@@ -38,34 +40,152 @@ static double* bubble_quad_p = NULL; // diagonal vector in cholesky factorizatio
 static Quad1DStd quad1d;
 static Quad2DStd quad2d; // fixme: g_quad_2d_std
 
-static Trf ctm;
+// State of one reference map projection; concurrent projections need their own.
+struct ProjContext
+{
+  PrecalcShapeset* pss;
+  Trf ctm;
+};
 
 
-//// NURBS //////////////////////////////////////////////////////////////////////////////////////////
+// Identifies the edge and bubble part of a reference map projection. Besides the curves,
+// the projection depends only on the vertices of the top-level element, on the sub-element
+// and on the order, so it can be shared by the sons of the same element in different meshes.
+struct ProjKey
+{
+  unsigned nurbs[4]; // curve ids, zero for straight edges
+  double2 vert[4];   // vertices of the top-level element
+  uint64_t part;     // sub-element, zero for the top-level element itself
+  int mode, order;
+
+  bool operator<(const ProjKey& k) const { return memcmp(this, &k, sizeof(ProjKey)) < 0; }
+};
 
-// recursive calculation of the basis function N_i,k
-double nurbs_basis_fn(int i, int k, double t, double* knot)
+// The cache is filled from the reference map threads, hence the mutex. When it is full,
+// the least recently used projection is dropped.
+struct ProjCache
 {
-  if (k == 0)
+  typedef std::list<const ProjKey*> LruList;
+  struct Entry
   {
-    return (t >= knot[i] && t <= knot[i+1] && knot[i] < knot[i+1]) ? 1.0 : 0.0;
+    double2* coefs;
+    LruList::iterator pos; ///< position in 'lru'
+  };
+  typedef std::map<ProjKey, Entry> EntryMap;
+
+  EntryMap entries;
+  LruList lru; ///< keys of 'entries', the most recently used first
+
+  ~ProjCache() { clear(); }
+
+  int size() const { return entries.size(); }
+
+  void clear()
+  {
+    for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+      delete [] it->second.coefs;
+    entries.clear();
+    lru.clear();
   }
-  else
+
+  /// Returns the cached projection or NULL, and marks it as the most recently used.
+  double2* find(const ProjKey& key)
+  {
+    EntryMap::iterator it = entries.find(key);
+    if (it == entries.end()) return NULL;
+    lru.splice(lru.begin(), lru, it->second.pos);
+    return it->second.coefs;
+  }
+
+  /// Adds a projection, unless it is there already. Returns false if 'coefs' was not taken.
+  bool insert(const ProjKey& key, double2* coefs, int max_size)
   {
-    double N1 = nurbs_basis_fn(i, k-1, t, knot);
-    double N2 = nurbs_basis_fn(i+1, k-1, t, knot);
+    Entry entry = { coefs, lru.end() };
+    std::pair<EntryMap::iterator, bool> ins = entries.insert(std::make_pair(key, entry));
+    if (!ins.second) return false;
+    lru.push_front(&(ins.first->first));
+    ins.first->second.pos = lru.begin();
+    trim(max_size);
+    return true;
+  }
 
-    double result = 0.0;
-    if (knot[i+k] != knot[i])
+  /// Drops the least recently used projections until at most 'max_size' are left.
+  void trim(int max_size)
+  {
+    while (size() > max_size)
     {
-      result += ((t - knot[i]) / (knot[i+k] - knot[i])) * N1;
+      EntryMap::iterator it = entries.find(*lru.back());
+      delete [] it->second.coefs;
+      lru.pop_back();
+      entries.erase(it);
     }
-    if (knot[i+k+1] != knot[i+1])
+  }
+};
+
+static ProjCache proj_cache;
+static int proj_cache_size = 0x8000;
+static pthread_mutex_t proj_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void set_refmap_cache_size(int n)
+{
+  pthread_mutex_lock(&proj_cache_mutex);
+  proj_cache_size = std::max(n, 0);
+  proj_cache.trim(proj_cache_size);
+  pthread_mutex_unlock(&proj_cache_mutex);
+}
+
+
+//// NURBS //////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned Nurbs::next_id = 1;
+static pthread_mutex_t nurbs_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+Nurbs::Nurbs()
+{
+  ref = 0;
+  twin = false;
+
+  // meshes may be loaded from several threads
+  pthread_mutex_lock(&nurbs_id_mutex);
+  id = next_id++;
+  pthread_mutex_unlock(&nurbs_id_mutex);
+}
+
+
+// evaluates the curve at t using de Boor's algorithm on the homogeneous control points
+static void nurbs_point(Nurbs* nurbs, double t, double& x, double& y)
+{
+  int p = nurbs->degree;
+  double* kv = nurbs->kv;
+
+  // find the knot span kv[k] <= t < kv[k+1]; t = 1 falls into the last span
+  int k = p;
+  while (k < nurbs->np-1 && t >= kv[k+1]) k++;
+
+  // the control points of the span in homogeneous coordinates; low degrees use the stack
+  double3 buf[8] = { { 0.0 } };
+  double3* d = (p < 8) ? buf : new double3[p+1];
+  for (int j = 0; j <= p; j++)
+  {
+    double3& cp = nurbs->pt[j+k-p];
+    d[j][0] = cp[0] * cp[2];
+    d[j][1] = cp[1] * cp[2];
+    d[j][2] = cp[2];
+  }
+
+  for (int r = 1; r <= p; r++)
+    for (int j = p; j >= r; j--)
     {
-      result += ((knot[i+k+1] - t) / (knot[i+k+1] - knot[i+1])) * N2;
+      double a = kv[j+1+k-r] - kv[j+k-p];
+      a = (a != 0.0) ? (t - kv[j+k-p]) / a : 0.0;
+      for (int m = 0; m < 3; m++)
+        d[j][m] = (1.0 - a) * d[j-1][m] + a * d[j][m];
     }
-    return result;
-  }
+
+  x = d[p][0] / d[p][2];
+  y = d[p][1] / d[p][2];
+  if (d != buf) delete [] d;
 }
 
 
@@ -83,21 +203,7 @@ void nurbs_edge(Element* e, Nurbs* nurbs, int edge, double t, double& x, double&
   }
   else
   {
-    double3* cp = nurbs->pt;
-    x = y = 0.0;
-    double sum = 0.0;  // sum of basis fns and weights
-
-    for (int i = 0; i < nurbs->np; i++)
-    {
-      double basis = nurbs_basis_fn(i, nurbs->degree, t, nurbs->kv);
-      sum += cp[i][2] * basis;
-      x   += cp[i][2] * basis * cp[i][0];
-      y   += cp[i][2] * basis * cp[i][1];
-    }
-
-    sum = 1.0 / sum;
-    x *= sum;
-    y *= sum;
+    nurbs_point(nurbs, t, x, y);
   }
 }
 
@@ -314,14 +420,14 @@ static void precalculate_cholesky_projection_matrices_bubble()
 //// edge part of projection based interpolation ///////////////////////////////////////////////////
 
 // compute point (x,y) in reference element, edge vector (v1, v2)
-static void edge_coord(Element* e, int edge, double t, double2& x, double2& v)
+static void edge_coord(ProjContext& pc, Element* e, int edge, double t, double2& x, double2& v)
 {
   int mode = e->get_mode();
   double2 a, b;
-  a[0] = ctm.m[0] * ref_vert[mode][edge][0] + ctm.t[0];
-  a[1] = ctm.m[1] * ref_vert[mode][edge][1] + ctm.t[1];
-  b[0] = ctm.m[0] * ref_vert[mode][e->next_vert(edge)][0] + ctm.t[0];
-  b[1] = ctm.m[1] * ref_vert[mode][e->next_vert(edge)][1] + ctm.t[1];
+  a[0] = pc.ctm.m[0] * ref_vert[mode][edge][0] + pc.ctm.t[0];
+  a[1] = pc.ctm.m[1] * ref_vert[mode][edge][1] + pc.ctm.t[1];
+  b[0] = pc.ctm.m[0] * ref_vert[mode][e->next_vert(edge)][0] + pc.ctm.t[0];
+  b[1] = pc.ctm.m[1] * ref_vert[mode][e->next_vert(edge)][1] + pc.ctm.t[1];
 
   for (int i = 0; i < 2; i++)
   {
@@ -333,9 +439,9 @@ static void edge_coord(Element* e, int edge, double t, double2& x, double2& v)
 }
 
 
-static void calc_edge_projection(Element* e, int edge, Nurbs** nurbs, int order, double2* proj)
+static void calc_edge_projection(ProjContext& pc, Element* e, int edge, Nurbs** nurbs, int order, double2* proj)
 {
-  ref_map_pss.set_active_element(e);
+  pc.pss->set_active_element(e);
 
   int i, j, k;
   int mo1 = quad1d.get_max_order();
@@ -351,10 +457,10 @@ static void calc_edge_projection(Element* e, int edge, Nurbs** nurbs, int order,
   memset(rhside[1], 0, sizeof(double) * ne);
 
   double a_1, a_2, b_1, b_2;
-  a_1 = ctm.m[0] * ref_vert[mode][edge][0] + ctm.t[0];
-  a_2 = ctm.m[1] * ref_vert[mode][edge][1] + ctm.t[1];
-  b_1 = ctm.m[0] * ref_vert[mode][e->next_vert(edge)][0] + ctm.t[0];
-  b_2 = ctm.m[1] * ref_vert[mode][e->next_vert(edge)][1] + ctm.t[1];
+  a_1 = pc.ctm.m[0] * ref_vert[mode][edge][0] + pc.ctm.t[0];
+  a_2 = pc.ctm.m[1] * ref_vert[mode][edge][1] + pc.ctm.t[1];
+  b_1 = pc.ctm.m[0] * ref_vert[mode][e->next_vert(edge)][0] + pc.ctm.t[0];
+  b_2 = pc.ctm.m[1] * ref_vert[mode][e->next_vert(edge)][1] + pc.ctm.t[1];
 
   // values of nonpolynomial function in two vertices
   double2 fa, fb;
@@ -366,7 +472,7 @@ static void calc_edge_projection(Element* e, int edge, Nurbs** nurbs, int order,
   {
     double2 x, v;
     double t = pt[j][0];
-    edge_coord(e, edge, t, x, v);
+    edge_coord(pc, e, edge, t, x, v);
     calc_ref_map(e, nurbs, x[0], x[1], fn[j]);
 
     for (k = 0; k < 2; k++)
@@ -395,7 +501,7 @@ static void calc_edge_projection(Element* e, int edge, Nurbs** nurbs, int order,
 
 //// bubble part of projection based interpolation /////////////////////////////////////////////////
 
-static void old_projection(Element* e, int order, double2* proj, double* old[2])
+static void old_projection(ProjContext& pc, Element* e, int order, double2* proj, double* old[2])
 {
   int mo2 = quad2d.get_max_order();
   int np = quad2d.get_num_points(mo2);
@@ -405,9 +511,9 @@ static void old_projection(Element* e, int order, double2* proj, double* old[2])
     // vertex basis functions in all integration points
     double* vd;
     int index_v = ref_map_shapeset.get_vertex_index(k);
-    ref_map_pss.set_active_shape(index_v);
-    ref_map_pss.set_quad_order(mo2);
-    vd = ref_map_pss.get_fn_values();
+    pc.pss->set_active_shape(index_v);
+    pc.pss->set_quad_order(mo2);
+    vd = pc.pss->get_fn_values();
 
     for (int m = 0; m < 2; m++)   // part 0 or 1
       for (int j = 0; j < np; j++)
@@ -418,9 +524,9 @@ static void old_projection(Element* e, int order, double2* proj, double* old[2])
       // edge basis functions in all integration points
       double* ed;
       int index_e = ref_map_shapeset.get_edge_index(k,0,ii+2);
-      ref_map_pss.set_active_shape(index_e);
-      ref_map_pss.set_quad_order(mo2);
-      ed = ref_map_pss.get_fn_values();
+      pc.pss->set_active_shape(index_e);
+      pc.pss->set_quad_order(mo2);
+      ed = pc.pss->get_fn_values();
 
       for (int m = 0; m < 2; m++)  //part 0 or 1
         for (int j = 0; j < np; j++)
@@ -430,9 +536,9 @@ static void old_projection(Element* e, int order, double2* proj, double* old[2])
 }
 
 
-static void calc_bubble_projection(Element* e, Nurbs** nurbs, int order, double2* proj)
+static void calc_bubble_projection(ProjContext& pc, Element* e, Nurbs** nurbs, int order, double2* proj)
 {
-  ref_map_pss.set_active_element(e);
+  pc.pss->set_active_element(e);
 
   int i, j, k;
   int mo2 = quad2d.get_max_order();
@@ -453,15 +559,15 @@ static void calc_bubble_projection(Element* e, Nurbs** nurbs, int order, double2
   }
 
   // compute known part of projection (vertex and edge part)
-  old_projection(e, order, proj, old);
+  old_projection(pc, e, order, proj, old);
 
   // fn values of both components of nonpolynomial function
   double3* pt = quad2d.get_points(mo2);
   for (j = 0; j < np; j++)  // over all integration points
   {
     double2 a;
-    a[0] = ctm.m[0] * pt[j][0] + ctm.t[0];
-    a[1] = ctm.m[1] * pt[j][1] + ctm.t[1];
+    a[0] = pc.ctm.m[0] * pt[j][0] + pc.ctm.t[0];
+    a[1] = pc.ctm.m[1] * pt[j][1] + pc.ctm.t[1];
     calc_ref_map(e, nurbs, a[0], a[1], fn[j]);
   }
 
@@ -473,9 +579,9 @@ static void calc_bubble_projection(Element* e, Nurbs** nurbs, int order, double2
       // bubble basis functions in all integration points
       double *bfn;
       int index_i = ref_map_shapeset.get_bubble_indices(qo)[i];
-      ref_map_pss.set_active_shape(index_i);
-      ref_map_pss.set_quad_order(mo2);
-      bfn = ref_map_pss.get_fn_values();
+      pc.pss->set_active_shape(index_i);
+      pc.pss->set_quad_order(mo2);
+      bfn = pc.pss->get_fn_values();
 
       for (j = 0; j < np; j++) // over all integration points
         rhside[k][i] += pt[j][2] * (bfn[j] * (fn[j][k] - old[k][j]));
@@ -500,7 +606,7 @@ static void calc_bubble_projection(Element* e, Nurbs** nurbs, int order, double2
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void ref_map_projection(Element* e, Nurbs** nurbs, int order, double2* proj)
+static void ref_map_projection(ProjContext& pc, Element* e, Nurbs** nurbs, int order, double2* proj)
 {
   // vertex part
   for (unsigned int i = 0; i < e->nvert; i++)
@@ -514,23 +620,29 @@ static void ref_map_projection(Element* e, Nurbs** nurbs, int order, double2* pr
 
   // edge part
   for (int edge = 0; edge < (int)e->nvert; edge++)
-    calc_edge_projection(e, edge, nurbs, order, proj);
+    calc_edge_projection(pc, e, edge, nurbs, order, proj);
 
   //bubble part
-  calc_bubble_projection(e, nurbs, order, proj);
+  calc_bubble_projection(pc, e, nurbs, order, proj);
 }
 
 
 void CurvMap::update_refmap_coefs(Element* e)
 {
-  ref_map_pss.set_quad_2d(&quad2d);
-  //ref_map_pss.set_active_element(e);
+  update_refmap_coefs(e, &ref_map_pss);
+}
+
+
+void CurvMap::update_refmap_coefs(Element* e, PrecalcShapeset* pss)
+{
+  pss->set_quad_2d(&quad2d);
+  //pss->set_active_element(e);
 
   // calculation of projection matrices
   if (edge_proj_matrix == NULL) precalculate_cholesky_projection_matrix_edge();
   if (bubble_proj_matrix_tri == NULL) precalculate_cholesky_projection_matrices_bubble();
 
-  ref_map_pss.set_mode(e->get_mode());
+  pss->set_mode(e->get_mode());
   ref_map_shapeset.set_mode(e->get_mode());
 
   // allocate projection coefficients
@@ -548,20 +660,131 @@ void CurvMap::update_refmap_coefs(Element* e)
   Nurbs** nurbs;
   if (toplevel == false)
   {
-    ref_map_pss.set_active_element(e);
-    ref_map_pss.set_transform(part);
+    pss->set_active_element(e);
+    pss->set_transform(part);
     nurbs = parent->cm->nurbs;
   }
   else
   {
-    ref_map_pss.reset_transform();
+    pss->reset_transform();
     nurbs = e->cm->nurbs;
   }
-  ctm = *(ref_map_pss.get_ctm());
-  ref_map_pss.reset_transform(); // fixme - do we need this?
+  ProjContext pc;
+  pc.pss = pss;
+  pc.ctm = *(pss->get_ctm());
+  pss->reset_transform(); // fixme - do we need this?
+
+  // look for the edge and bubble part in the cache
+  ProjKey key;
+  memset(&key, 0, sizeof(ProjKey));
+  Element* top = toplevel ? e : parent;
+  for (int i = 0; i < nv; i++)
+  {
+    key.nurbs[i] = (nurbs[i] != NULL) ? nurbs[i]->id : 0;
+    key.vert[i][0] = top->vn[i]->x;
+    key.vert[i][1] = top->vn[i]->y;
+  }
+  key.part = toplevel ? 0 : part;
+  key.mode = e->get_mode();
+  key.order = order;
+
+  pthread_mutex_lock(&proj_cache_mutex);
+  double2* cached = proj_cache.find(key);
+  if (cached != NULL) memcpy(coefs + nv, cached, sizeof(double2) * (nc - nv));
+  pthread_mutex_unlock(&proj_cache_mutex);
+
+  if (cached != NULL)
+  {
+    // vertex part
+    for (int i = 0; i < nv; i++)
+    {
+      coefs[i][0] = e->vn[i]->x;
+      coefs[i][1] = e->vn[i]->y;
+    }
+    return;
+  }
 
   // calculation of new projection coefficients
-  ref_map_projection(e, nurbs, order, coefs);
+  ref_map_projection(pc, e, nurbs, order, coefs);
+
+  if (proj_cache_size > 0)
+  {
+    double2* copy = new double2[nc - nv];
+    memcpy(copy, coefs + nv, sizeof(double2) * (nc - nv));
+    pthread_mutex_lock(&proj_cache_mutex);
+    bool taken = proj_cache.insert(key, copy, proj_cache_size);
+    pthread_mutex_unlock(&proj_cache_mutex);
+    if (!taken) delete [] copy;
+  }
+}
+
+
+struct RefMapThreadData
+{
+  PrecalcShapeset* pss;
+  Element** elems;
+  int n, step;
+};
+
+static void* update_refmap_coefs_thread(void* arg)
+{
+  RefMapThreadData* td = (RefMapThreadData*) arg;
+  for (int i = 0; i < td->n; i += td->step)
+    td->elems[i]->cm->update_refmap_coefs(td->elems[i], td->pss);
+  return NULL;
+}
+
+
+void update_refmap_coefs(Element** elems, int n, int num_threads)
+{
+  if (num_threads <= 1 || n < 2)
+  {
+    for (int i = 0; i < n; i++)
+      elems[i]->cm->update_refmap_coefs(elems[i]);
+    return;
+  }
+
+  // the projection matrices are shared by all threads
+  if (edge_proj_matrix == NULL) precalculate_cholesky_projection_matrix_edge();
+  if (bubble_proj_matrix_tri == NULL) precalculate_cholesky_projection_matrices_bubble();
+
+  // the shapeset and the quadrature have a global mode, so the triangles
+  // and the quads are processed separately
+  for (int m = 0; m <= 1; m++)
+  {
+    std::vector<Element*> list;
+    for (int i = 0; i < n; i++)
+      if (elems[i]->get_mode() == m)
+        list.push_back(elems[i]);
+    if (list.empty()) continue;
+
+    // each thread has its own precalculated tables and takes every nt-th element
+    int nt = std::min(num_threads, (int) list.size());
+    std::vector<PrecalcShapeset*> pss(nt);
+    for (int t = 0; t < nt; t++)
+    {
+      pss[t] = new PrecalcShapeset(&ref_map_shapeset);
+      pss[t]->set_quad_2d(&quad2d);
+      pss[t]->set_mode(m);
+    }
+
+    std::vector<pthread_t> threads(nt);
+    std::vector<RefMapThreadData> td(nt);
+    for (int t = 0; t < nt; t++)
+    {
+      td[t].pss = pss[t];
+      td[t].elems = &list[t];
+      td[t].n = list.size() - t;
+      td[t].step = nt;
+      if (pthread_create(&threads[t], NULL, update_refmap_coefs_thread, &td[t]))
+        error("Could not create a reference map thread.");
+    }
+    for (int t = 0; t < nt; t++)
+    {
+      pthread_join(threads[t], NULL);
+      delete pss[t];
+    }
+  }
 }
 
 
@@ -570,6 +793,7 @@ void CurvMap::get_mid_edge_points(Element* e, double2* pt, int n)
   Nurbs** nurbs = this->nurbs;
   Transformable tran;
   tran.set_active_element(e);
+  Trf ctm;
 
   if (toplevel == false)
   {
@@ -19,6 +19,7 @@
 #include "common.h"
 
 struct Element;
+class PrecalcShapeset;
 
 
 /// \brief Represents one NURBS curve.
@@ -32,7 +33,7 @@ struct Element;
 ///
 struct Nurbs
 {
-  Nurbs() { ref = 0; twin = false; };
+  Nurbs();
   void unref();
 
   int degree;  ///< curve degree (2=quadratic, etc.)
@@ -44,6 +45,9 @@ struct Nurbs
   bool twin;   ///< true on internal curved edges for the second (artificial) Nurbs
   bool arc;     ///< true if this is in fact a circular arc
   double angle; ///< arc angle
+  unsigned id;  ///< unique number of the curve, identifies it in the projection cache
+
+  static unsigned next_id;
 };
 
 
@@ -88,6 +92,8 @@ struct CurvMap
   // belongs to. First, old "coefs" are removed if they are not NULL,
   // then new coefficients are projected.
   void update_refmap_coefs(Element* e);
+  /// The same, using the given precalculated shapeset instead of the shared one.
+  void update_refmap_coefs(Element* e, PrecalcShapeset* pss);
 
   void get_mid_edge_points(Element* e, double2* pt, int n);
 
@@ -96,5 +102,14 @@ struct CurvMap
 
 void nurbs_edge(Element* e, Nurbs* nurbs, int edge, double t, double& x, double& y);
 
+/// Calls CurvMap::update_refmap_coefs() for the given curved elements, in parallel
+/// if num_threads > 1. The result does not depend on the number of threads.
+void update_refmap_coefs(Element** elems, int n, int num_threads);
+
+/// Sets the maximum number of reference map projections kept by update_refmap_coefs(). The
+/// projections are shared by all meshes and are keyed by the curves, the vertices of the
+/// top-level element, the sub-element and the order. Zero disables the cache.
+void set_refmap_cache_size(int n);
+
 
 #endif
@@ -18,11 +18,18 @@
 #include <string.h>
 #include "exodusii.h"
 #include "mesh.h"
-#include <map>
+#include <vector>
+#include <algorithm>
 
 #ifdef WITH_EXODUSII
 #include <exodusII.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/time.h>
 #endif
+#endif
+
+extern unsigned g_mesh_seq;
 
 ExodusIIReader::ExodusIIReader()
 {
@@ -36,34 +43,45 @@ ExodusIIReader::~ExodusIIReader()
 {
 }
 
-struct Vertex
+#if defined(WITH_EXODUSII) && (defined(HERMES2D_REPORT_VERBOSE) || defined(HERMES2D_REPORT_RUNTIME_CONTROL))
+static double get_wall_time()
 {
-  double x, y;
-};
+#ifndef WIN32
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+#endif
 
-// needed for comparison of vertices inside std::map
+// orders node indices by their coordinates, and by index for coinciding nodes
 struct VCompare
 {
-  bool operator()(Vertex a, Vertex b) const
+  const double *x, *y;
+  VCompare(const double* x, const double* y) : x(x), y(y) {}
+
+  bool operator()(int a, int b) const
   {
-    if (a.x < b.x) return true;
-    else if (a.x > b.x) return false;
-    else
-    {
-      if (a.y < b.y) return true;
-      return false;
-    }
+    if (x[a] != x[b]) return x[a] < x[b];
+    if (y[a] != y[b]) return y[a] < y[b];
+    return a < b;
   }
 };
 
 bool ExodusIIReader::load(const char *file_name, Mesh *mesh)
 {
 #ifdef WITH_EXODUSII
+#if defined(HERMES2D_REPORT_VERBOSE) || defined(HERMES2D_REPORT_RUNTIME_CONTROL)
+  double start = get_wall_time();
+#endif
   int err;
   int cpu_ws = sizeof(double);		// use float or double
   int io_ws = 8;						// store variables as doubles
   float version;
   int exoid = ex_open(file_name, EX_READ, &cpu_ws, &io_ws, &version);
+  if (exoid < 0) error("could not open file '%s'", file_name);
 
   // read initialization parameters
   int n_dims, n_nodes, n_elems, n_eblocks, n_nodesets, n_sidesets;
@@ -76,48 +94,52 @@ bool ExodusIIReader::load(const char *file_name, Mesh *mesh)
   }
 
   // load coordinates
-  double *x = new double [n_nodes];
-  double *y = new double [n_nodes];
-  err = ex_get_coord(exoid, x, y, NULL);
-
-  // remove duplicate vertices and build renumbering map
-  std::map<Vertex, int, VCompare> vtx_list;				// map for eliminating duplicities
-  std::map<int, int> vmap;								// reindexing map
-  std::vector<Vertex> vtx_arr;							// vertex array
-  int vid = 0;
-  for (int i = 0; i < n_nodes; i++)
+  std::vector<double> x(n_nodes + 1), y(n_nodes + 1);
+  err = ex_get_coord(exoid, &x[0], &y[0], NULL);
+
+  // remove duplicate vertices: after sorting, coinciding nodes are adjacent and the first of
+  // them has the lowest index; vertex ids are then assigned in the order of first occurrence
+  std::vector<int> order(n_nodes), vmap(n_nodes);
+  for (int i = 0; i < n_nodes; i++) order[i] = i;
+  std::sort(order.begin(), order.end(), VCompare(&x[0], &y[0]));
+  for (int i = 0, first = 0; i < n_nodes; i++)
   {
-    int k;
-    Vertex v = { x[i], y[i] };
-    if (vtx_list.count(v) == 0)
-    {
-      vtx_arr.push_back(v);
-      k = vid++;
-      vtx_list[v] = k;
-    }
-    else
-      k = vtx_list[v];
-
-    vmap[i + 1] = k;
+    int k = order[i];
+    if (i == 0 || x[k] != x[order[i-1]] || y[k] != y[order[i-1]]) first = k;
+    vmap[k] = first;
   }
-  delete [] x;
-  delete [] y;
 
-  int n_vtx = vtx_arr.size();
-  double2 *vtx = new double2 [n_vtx];
-  for (int i = 0; i < n_vtx; i++)
+  mesh->free();
+
+  int n_vtx = 0;
+  for (int i = 0; i < n_nodes; i++)
+    if (vmap[i] == i) n_vtx++;
+
+  // size the hash tables for the whole mesh; by Euler's formula it has about n_vtx + n_elems edges
+  int size = 16;
+  while (size < 2*n_vtx) size *= 2;
+  mesh->init(size, HashTable::get_table_size(n_vtx + n_elems));
+
+  // create vertex nodes
+  int vid = 0;
+  for (int i = 0; i < n_nodes; i++)
   {
-    vtx[i][0] = vtx_arr[i].x;
-    vtx[i][1] = vtx_arr[i].y;
+    if (vmap[i] != i) { vmap[i] = vmap[vmap[i]]; continue; }
+    Node* node = mesh->nodes.add();
+    node->ref = TOP_LEVEL_REF;
+    node->type = TYPE_VERTEX;
+    node->bnd = 0;
+    node->p1 = node->p2 = -1;
+    node->x = x[i];
+    node->y = y[i];
+    vmap[i] = vid++;
   }
+  mesh->ntopvert = n_vtx;
 
-  int n_tri = 0;		// number of triangles
-  int n_quad = 0;		// number of quads
-
-  // get info about element blocks
-  int *eid_blocks = new int [n_eblocks];
-  err = ex_get_elem_blk_ids(exoid, eid_blocks);
-  // go over all element blocks
+  // read the element blocks one by one and create the elements straight from the connectivity,
+  // so that element ids follow the element numbering of the file
+  std::vector<int> eid_blocks(n_eblocks + 1), connect;
+  err = ex_get_elem_blk_ids(exoid, &eid_blocks[0]);
   for (int i = 0; i < n_eblocks; i++)
   {
     int id = eid_blocks[i];
@@ -126,126 +148,83 @@ bool ExodusIIReader::load(const char *file_name, Mesh *mesh)
     char elem_type[MAX_STR_LENGTH + 1];
     int n_elems_in_blk, n_elem_nodes, n_attrs;
     err = ex_get_elem_block(exoid, id, elem_type, &n_elems_in_blk, &n_elem_nodes, &n_attrs);
-
-    if (n_elem_nodes == 3) n_tri += n_elems_in_blk;
-    else if (n_elem_nodes == 4) n_quad += n_elems_in_blk;
-    else {
+    if (n_elem_nodes != 3 && n_elem_nodes != 4)
+    {
       error("Unknown type of element");
       return false;
     }
-  }
-  int4 *tri = n_tri > 0 ? new int4 [n_tri] : NULL;		// triangles
-  int5 *quad = n_quad > 0 ? new int5 [n_quad] : NULL;		// quads
-  int n_els = n_tri + n_quad;								// total number of elements
-  int **els = n_els > 0 ? new int * [n_els] : NULL;		// elements
-  int *el_nv = n_els > 0 ? new int [n_els] : NULL;		// number of vertices for each element
-
-  int it = 0, iq = 0, iel = 0;
-  for (int i = 0; i < n_eblocks; i++)
-  {
-    int id = eid_blocks[i];
-
-    // get block info
-    char elem_type[MAX_STR_LENGTH + 1];
-    int n_elems_in_blk, n_elem_nodes, n_attrs;
-    err = ex_get_elem_block(exoid, id, elem_type, &n_elems_in_blk, &n_elem_nodes, &n_attrs);
+    if (!n_elems_in_blk) continue;
 
     // read connectivity array
-    int *connect = new int [n_elem_nodes * n_elems_in_blk];
-    err = ex_get_elem_conn(exoid, id, connect);
+    connect.resize(n_elem_nodes * n_elems_in_blk);
+    err = ex_get_elem_conn(exoid, id, &connect[0]);
 
-    int ic = 0;
-    for (int j = 0; j < n_elems_in_blk; j++)
+    Node* v[4];
+    const int* c = &connect[0];
+    for (int j = 0; j < n_elems_in_blk; j++, c += n_elem_nodes)
     {
-      el_nv[iel] = n_elem_nodes;
-      if (n_elem_nodes == 3)
-      {
-        tri[it][0] = vmap[connect[ic++]];
-        tri[it][1] = vmap[connect[ic++]];
-        tri[it][2] = vmap[connect[ic++]];
-        tri[it][3] = id;
-        els[iel] = tri[it];
-        it++;
-      }
-      else if (n_elem_nodes == 4)
+      for (int k = 0; k < n_elem_nodes; k++)
       {
-        quad[iq][0] = vmap[connect[ic++]];
-        quad[iq][1] = vmap[connect[ic++]];
-        quad[iq][2] = vmap[connect[ic++]];
-        quad[iq][3] = vmap[connect[ic++]];
-        quad[iq][4] = id;
-        els[iel] = quad[iq];
-        iq++;
+        if (c[k] < 1 || c[k] > n_nodes) error("Element block %d refers to invalid node %d", id, c[k]);
+        v[k] = &mesh->nodes[vmap[c[k] - 1]];
       }
+      if (n_elem_nodes == 3)
+        mesh->create_triangle(id, v[0], v[1], v[2], NULL);
       else
-      {
-        error("Unknown type of element");
-        return false;
-      }
-      iel++;
+        mesh->create_quad(id, v[0], v[1], v[2], v[3], NULL);
     }
-    delete [] connect;
   }
-  delete [] eid_blocks;
+  int n_els = mesh->elements.get_num_items();
 
-  // query number of side sets
-  int *sid_blocks = new int [n_sidesets];
-  err = ex_get_side_set_ids(exoid, sid_blocks);
-
-  // go over the sidesets
-  int n_mark = 0;		// number of markers
+  // set boundary markers: side 's' of an element is its edge 's-1'
+  std::vector<int> sid_blocks(n_sidesets + 1), elem_list, side_list;
+  err = ex_get_side_set_ids(exoid, &sid_blocks[0]);
   for (int i = 0; i < n_sidesets; i++)
   {
     int sid = sid_blocks[i];
     int n_sides_in_set, n_df_in_set;
     err = ex_get_side_set_param(exoid, sid, &n_sides_in_set, &n_df_in_set);
-    n_mark += n_sides_in_set;
-  }
-  int3 *marks = new int3 [n_mark];
+    if (!n_sides_in_set) continue;
 
-  int im = 0;
-  for (int i = 0; i < n_sidesets; i++)
-  {
-    int sid = sid_blocks[i];
-    int n_sides_in_set, n_df_in_set;
-    err = ex_get_side_set_param(exoid, sid, &n_sides_in_set, &n_df_in_set);
-    int num_elem_in_set = n_sides_in_set;
+    elem_list.resize(n_sides_in_set);
+    side_list.resize(n_sides_in_set);
+    err = ex_get_side_set(exoid, sid, &elem_list[0], &side_list[0]);
 
-    int *elem_list = new int [num_elem_in_set];
-    int *side_list = new int [n_sides_in_set];
-    err = ex_get_side_set(exoid, sid, elem_list, side_list);
-
-    for (int j = 0; j < num_elem_in_set; j++)
+    for (int j = 0; j < n_sides_in_set; j++)
     {
-      int nv = el_nv[side_list[j] - 1];			// # of vertices of the element
-      int vt = side_list[j] - 1;
-      marks[im][0] = els[elem_list[j] - 1][vt];
-      marks[im][1] = els[elem_list[j] - 1][(vt + 1) % nv];
-      marks[im][2] = sid;
-      im++;
+      if (elem_list[j] < 1 || elem_list[j] > n_els) error("Side set %d refers to invalid element %d", sid, elem_list[j]);
+      Element* e = mesh->get_element_fast(elem_list[j] - 1);
+      int k = side_list[j] - 1;
+      if (k < 0 || k >= e->nvert) error("Side set %d refers to invalid side %d", sid, side_list[j]);
+
+      Node* en = e->en[k];
+      en->marker = sid;
+      if (sid > 0)
+      {
+        e->vn[k]->bnd = 1;
+        e->vn[e->next_vert(k)]->bnd = 1;
+        en->bnd = 1;
+      }
     }
-
-    delete [] elem_list;
-    delete [] side_list;
   }
-  delete [] sid_blocks;
 
   // we are done
   err = ex_close(exoid);
 
-  mesh->create(n_vtx, vtx, n_tri, tri, n_quad, quad, n_mark, marks);
+  mesh->nbase = mesh->nactive = mesh->ninitial = n_els;
+  mesh->seq = g_mesh_seq++;
 
-  // clean-up
-  delete [] marks;
-  delete [] tri;
-  delete [] quad;
-  delete [] vtx;
-  delete [] el_nv;
-  delete [] els;
+#if defined(HERMES2D_REPORT_VERBOSE) || defined(HERMES2D_REPORT_RUNTIME_CONTROL)
+  // report the throughput
+  double time = std::max(get_wall_time() - start, 1e-6);
+  struct stat st;
+  double mb = stat(file_name, &st) ? 0.0 : st.st_size / 1048576.0;
+  verbose("Loaded %d elements (%0.1lf MB) from '%s' in %0.3lf s: %0.0lf elements/s, %0.1lf MB/s",
+          n_els, mb, file_name, time, n_els / time, mb / time);
+#endif
 
   return true;
 #else
   return false;
 #endif
 }
-
@@ -76,6 +76,8 @@ void Filter::init()
     mesh = new Mesh;
     unidata = trav.construct_union_mesh(mesh);
     trav.finish();
+    for (int i = 0; i < num; i++)
+      sln_seq[i] = meshes[i]->get_seq();
   }
 
   // misc init
@@ -108,6 +110,72 @@ void Filter::set_quad_2d(Quad2D* quad_2d)
 }
 
 
+int Filter::get_max_hints() const
+{
+  int max = 0;
+  for (int i = 0; i < num; i++)
+    max = std::max(max, sln[i]->get_max_hints());
+  return max;
+}
+
+
+void Filter::update_unidata()
+{
+  // a source mesh which is a copy-on-write snapshot gets new elements and a new seq
+  // when the mesh it shares them with is changed (see Mesh::make_private); the union
+  // mesh stays the same, only the pointers to the source elements are looked up again
+  Mesh* meshes[4];
+  bool changed = false;
+  for (int i = 0; i < num; i++)
+  {
+    meshes[i] = sln[i]->get_mesh();
+    if (meshes[i]->get_seq() != sln_seq[i]) changed = true;
+  }
+  if (!changed) return;
+
+  Mesh tmp;
+  Traverse trav;
+  trav.begin(num, meshes);
+  UniData** ud = trav.construct_union_mesh(&tmp);
+  trav.finish();
+
+  for (int i = 0; i < num; i++)
+  {
+    delete [] unidata[i];
+    sln_seq[i] = meshes[i]->get_seq();
+  }
+  delete [] unidata;
+  unidata = ud;
+}
+
+
+void Filter::hint_elements(int n, Element** e)
+{
+  if (n <= 0) return;
+  if (!unimesh)
+  {
+    for (int i = 0; i < num; i++)
+      sln[i]->hint_elements(n, e); // nodup
+  }
+  else
+  {
+    // translate the union mesh elements to the elements of the source meshes
+    update_unidata();
+    std::vector<Element*> src;
+    for (int i = 0; i < num; i++)
+    {
+      src.clear();
+      for (int j = 0; j < n; j++)
+      {
+        Element* se = unidata[i][e[j]->id].e;
+        if (src.empty() || src.back() != se) src.push_back(se);
+      }
+      sln[i]->hint_elements(src.size(), &src[0]);
+    }
+  }
+}
+
+
 void Filter::set_active_element(Element* e)
 {
   MeshFunction::set_active_element(e);
@@ -119,6 +187,7 @@ void Filter::set_active_element(Element* e)
   }
   else
   {
+    update_unidata();
     for (int i = 0; i < num; i++) {
       sln[i]->set_active_element(unidata[i][e->id].e);
       sln[i]->set_transform(unidata[i][e->id].idx);
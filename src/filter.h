@@ -39,6 +39,8 @@ public:
 
   virtual void set_quad_2d(Quad2D* quad_2d);
   virtual void set_active_element(Element* e);
+  virtual void hint_elements(int n, Element** e);
+  virtual int get_max_hints() const;
   virtual void free();
   virtual void reinit();
 
@@ -54,8 +56,10 @@ protected:
 
   bool unimesh;
   UniData** unidata;
+  unsigned sln_seq[4]; ///< seq numbers of the source meshes unidata was built for
 
   void init();
+  void update_unidata();
   void copy_base(Filter* flt);
 
 };
@@ -63,6 +63,19 @@ const int FN_COMPONENT_1 = FN_VAL_1 | FN_DX_1 | FN_DY_1 | FN_DXX_1 | FN_DYY_1 |
 #endif
 
 
+/// \brief Statistics of a cache of precalculated tables.
+/// See Function::get_cache_stats() and RefMap::get_cache_stats().
+struct HERMES2D_API TableCacheStats
+{
+  size_t total_mem;  ///< current size of all tables in bytes
+  size_t max_mem;    ///< peak size of all tables in bytes
+  size_t mem_budget; ///< memory budget in bytes (0 = unlimited)
+  size_t hits;       ///< number of look-ups satisfied by an existing table
+  size_t misses;     ///< number of look-ups which required a (re)calculation
+  size_t evictions;  ///< number of tables freed in order to respect the budget
+};
+
+
 /// \brief Represents an arbitrary function defined on an element.
 ///
 /// The Function class is an abstraction of a function defined in integration points on an
@@ -120,7 +133,13 @@ public:
     // another reason may be a bug in Judy array usage in Hermes2D (this needs to be fixed)
     // -- as a workaround, you may for the time being use more than one pss for problems
     // where the basis and test functions can be on different meshes (i.e., multi-mesh).
-    if (cur_node == NULL || (cur_node->mask & mask) != mask) precalculate(order, mask);
+    if (cur_node == NULL || (cur_node->mask & mask) != mask)
+    {
+      table_owner->cache_misses++;
+      precalculate(order, mask);
+    }
+    else
+      table_owner->cache_hits++;
   }
 
   /// \brief Returns function values.
@@ -218,6 +237,33 @@ public:
   virtual void free() = 0;
 
 
+  /// \brief Limits the memory occupied by the precalculated tables.
+  /// \details When the tables grow over the budget, the least recently used ones
+  /// are freed at the next safe point, which is usually set_active_element().
+  /// The tables in use are never freed, so the budget may be exceeded temporarily.
+  /// \param bytes [in] The budget in bytes. Zero means no limit.
+  void set_mem_budget(size_t bytes) { table_owner->mem_budget = bytes; }
+
+  /// \brief Returns the memory budget for the precalculated tables (0 = unlimited).
+  size_t get_mem_budget() const { return table_owner->mem_budget; }
+
+  /// \brief Returns the current size of the precalculated tables in bytes.
+  size_t get_total_mem() const { return table_owner->total_mem; }
+
+  /// \brief Returns the peak size of the precalculated tables in bytes.
+  size_t get_max_mem() const { return table_owner->max_mem; }
+
+  /// \brief Returns the memory usage and hit/miss/eviction counters of the table cache.
+  void get_cache_stats(TableCacheStats& stats) const;
+
+  /// \brief Resets the hit/miss/eviction counters and the peak memory usage.
+  void reset_cache_stats();
+
+  /// \brief Sets the memory budget used by all functions created afterwards.
+  /// \param bytes [in] The budget in bytes. Zero (the default) means no limit.
+  static void set_default_mem_budget(size_t bytes) { default_mem_budget = bytes; }
+
+
 protected:
 
   /// precalculates the current function at the current integration points.
@@ -265,8 +311,21 @@ protected:
 
   Quad2D* quads[4]; ///< list of available quadratures
   int cur_quad;     ///< active quadrature (index into 'quads')
-  int total_mem;    ///< total memory in bytes used by the tables
-  int max_mem;      ///< peak memory usage
+  size_t total_mem;  ///< total memory in bytes used by the tables
+  size_t max_mem;    ///< peak memory usage
+  size_t mem_budget; ///< memory budget for the tables, 0 = unlimited
+
+  size_t cache_hits, cache_misses, cache_evictions;
+
+  /// The function whose tables (and memory accounting) this instance uses.
+  /// This is the instance itself, except for slave PrecalcShapesets.
+  Function<TYPE>* table_owner;
+
+  /// Returns true if the tables of the owner have outgrown the memory budget.
+  bool over_budget() const
+    { return table_owner->mem_budget > 0 && table_owner->total_mem > table_owner->mem_budget; }
+
+  static size_t default_mem_budget;
 
   Node* new_node(int mask, int num_points); ///< allocates a new Node structure
   void  free_nodes(void** nodes);
@@ -275,7 +334,7 @@ protected:
 
   void replace_cur_node(Node* node)
   {
-    if (cur_node != NULL) { total_mem -= cur_node->size; ::free(cur_node); }
+    if (cur_node != NULL) { table_owner->total_mem -= cur_node->size; ::free(cur_node); }
     *pp_cur_node = node;
     cur_node = node;
   }
@@ -312,6 +371,9 @@ Function<TYPE>::Function()
 {
   order = 0;
   max_mem = total_mem = 0;
+  mem_budget = default_mem_budget;
+  cache_hits = cache_misses = cache_evictions = 0;
+  table_owner = this;
 
   nodes = NULL;
   cur_node = NULL;
@@ -370,6 +432,30 @@ void Function<TYPE>::pop_transform()
 }
 
 
+template<typename TYPE>
+size_t Function<TYPE>::default_mem_budget = 0;
+
+
+template<typename TYPE>
+void Function<TYPE>::get_cache_stats(TableCacheStats& stats) const
+{
+  stats.total_mem = table_owner->total_mem;
+  stats.max_mem = table_owner->max_mem;
+  stats.mem_budget = table_owner->mem_budget;
+  stats.hits = table_owner->cache_hits;
+  stats.misses = table_owner->cache_misses;
+  stats.evictions = table_owner->cache_evictions;
+}
+
+
+template<typename TYPE>
+void Function<TYPE>::reset_cache_stats()
+{
+  table_owner->cache_hits = table_owner->cache_misses = table_owner->cache_evictions = 0;
+  table_owner->max_mem = table_owner->total_mem;
+}
+
+
 template<typename TYPE>
 int Function<TYPE>::idx2mask[6][2] =
 {
@@ -402,8 +488,9 @@ typename Function<TYPE>::Node* Function<TYPE>::new_node(int mask, int num_points
   }
   // todo: maybe put here copying of the old node
 
-  total_mem += size;
-  if (max_mem < total_mem) max_mem = total_mem;
+  Function<TYPE>* owner = table_owner;
+  owner->total_mem += size;
+  if (owner->max_mem < owner->total_mem) owner->max_mem = owner->total_mem;
   return node;
 }
 
@@ -417,7 +504,7 @@ void Function<TYPE>::free_nodes(void** nodes)
   while (pp != NULL)
   {
     // free the concrete Node structure
-    total_mem -= ((Node*) *pp)->size;
+    table_owner->total_mem -= ((Node*) *pp)->size;
     ::free(*pp);
     pp = JudyLNext(*nodes, &order, NULL);
   }
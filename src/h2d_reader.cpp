@@ -19,6 +19,10 @@
 #include <map>
 #include "hash.h"
 #include "mesh_parser.h"
+#ifndef WIN32
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 extern unsigned g_mesh_seq;
 
@@ -67,7 +71,7 @@ Nurbs* H2DReader::load_nurbs_old(Mesh *mesh, FILE* f, Node** en, int &p1, int &p
 
   // degree of curved edge
   if ((line = get_line(f)) == NULL) eof_error;
-  if (sscanf(line, "%d", &(nurbs->degree)) != 1)
+  if (sscanf(line, "%d", &(nurbs->degree)) != 1 || nurbs->degree < 0)
     error("error reading curved boundary data for edge %d-%d (degree)", p1, p2);
 
   // create a circular arc if degree == 0
@@ -202,7 +206,6 @@ void H2DReader::load_stream(FILE *f, Mesh *mesh)
     node->type = TYPE_VERTEX;
     node->bnd = 0;
     node->p1 = node->p2 = -1;
-    node->next_hash = NULL;
 
     if ((line = get_line(f)) == NULL) eof_error;
     if (sscanf(line, "%lf %lf", &node->x, &node->y) != 2) error("error reading vertex data");
@@ -481,6 +484,15 @@ bool H2DReader::load(const char *filename, Mesh *mesh)
   FILE* f = fopen(filename, "r");
   if (f == NULL) error("could not open the mesh file %s", filename);
 
+  // binary meshes are recognized by their magic number
+  char magic[4];
+  if (fread(magic, 1, 4, f) == 4 && !memcmp(magic, "H2DM", 4))
+  {
+    fclose(f);
+    return load_binary(filename, mesh);
+  }
+  rewind(f);
+
   mesh->free();
 
   // parse the file
@@ -511,7 +523,6 @@ bool H2DReader::load(const char *filename, Mesh *mesh)
     node->type = TYPE_VERTEX;
     node->bnd = 0;
     node->p1 = node->p2 = -1;
-    node->next_hash = NULL;
 
     if (!mesh_parser_get_doubles(pair, 2, &node->x, &node->y))
       error("%s: invalid vertex #%d.", filename, i);
@@ -804,3 +815,42 @@ bool H2DReader::save(const char* filename, Mesh *mesh)
 
   return true;
 }
+
+
+//// binary format /////////////////////////////////////////////////////////////////////////////
+
+bool H2DReader::save_binary(const char* filename, Mesh *mesh)
+{
+  FILE* f = fopen(filename, "wb");
+  if (f == NULL) error("Could not create mesh file %s.", filename);
+  mesh->save_raw(f);
+  if (fclose(f) != 0) error("Error writing to %s.", filename);
+  return true;
+}
+
+
+bool H2DReader::load_binary(const char* filename, Mesh *mesh)
+{
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) error("could not open the mesh file %s", filename);
+
+#ifndef WIN32
+  // decode the mesh directly from the mapped file
+  struct stat st;
+  if (!fstat(fileno(f), &st) && st.st_size > 0)
+  {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED)
+    {
+      fclose(f);
+      mesh->load_raw_data(map, st.st_size);
+      munmap(map, st.st_size);
+      return true;
+    }
+  }
+#endif
+
+  mesh->load_raw(f);
+  fclose(f);
+  return true;
+}
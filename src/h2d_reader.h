@@ -27,9 +27,17 @@ public:
   H2DReader();
   virtual ~H2DReader();
 
+  /// Loads a mesh in the text format, or in the binary format (recognized automatically).
   virtual bool load(const char *file_name, Mesh *mesh);
   virtual bool save(const char *file_name, Mesh *mesh);
 
+  /// Saves the mesh, including refinements and curved edges, in the versioned
+  /// binary format (see Mesh::save_raw()). Meshes loaded from the text format or
+  /// from ExodusII files can be converted once and then loaded quickly.
+  bool save_binary(const char *file_name, Mesh *mesh);
+  /// Loads a mesh saved by save_binary(). The file is memory-mapped where possible.
+  bool load_binary(const char *file_name, Mesh *mesh);
+
   void load_old(const char* filename, Mesh *mesh);
   void load_str(char* mesh_str, Mesh *mesh);
   void load_stream(FILE *f, Mesh *mesh);
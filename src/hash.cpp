@@ -20,39 +20,50 @@
 
 HashTable::HashTable()
 {
-  v_table = NULL; e_table = NULL;
-  nqueries = ncollisions = 0;
+  memset(&v_table, 0, sizeof(Table));
+  memset(&e_table, 0, sizeof(Table));
+  shared = false;
+  nqueries = ncollisions = nrehashes = 0;
 }
 
 
-void HashTable::init(int size)
+void HashTable::init_table(Table& t, int size)
 {
-  v_table = e_table = NULL;
-  nqueries = ncollisions = 0;
+  if (size & (size-1)) error("'size' must be a power of two.");
 
-  mask = size-1;
-  if (size & mask) error("'size' must be a power of two.");
+  t.size = size;
+  t.count = 0;
+  t.shift = 64;
+  while (size > 1) { size >>= 1; t.shift--; }
 
-  // allocate and initialize the hash tables
-  v_table = new Node*[size];
-  e_table = new Node*[size];
+  t.slots = new Slot[t.size];
+  for (int i = 0; i < t.size; i++)
+    t.slots[i].id = -1;
+}
 
-  memset(v_table, 0, size * sizeof(Node*));
-  memset(e_table, 0, size * sizeof(Node*));
 
-  nqueries = ncollisions = 0;
+void HashTable::free_table(Table& t)
+{
+  if (t.slots != NULL && !shared) delete [] t.slots;
+  memset(&t, 0, sizeof(Table));
 }
 
 
-void HashTable::copy_list(Node** ptr, Node* node)
+void HashTable::init(int size, int esize)
 {
-  while (node != NULL)
-  {
-    *ptr = &nodes[node->id];
-    ptr = &((*ptr)->next_hash);
-    node = node->next_hash;
-  }
-  *ptr = NULL;
+  free_table(v_table);
+  free_table(e_table);
+  init_table(v_table, size);
+  init_table(e_table, esize ? esize : size);
+  nqueries = ncollisions = nrehashes = 0;
+}
+
+
+int HashTable::get_table_size(int n)
+{
+  int size = 16;
+  while (size < 2*n + 2) size *= 2;
+  return size;
 }
 
 
@@ -60,40 +71,59 @@ void HashTable::copy(const HashTable* ht)
 {
   free();
   nodes.copy(ht->nodes);
-  mask = ht->mask;
 
-  v_table = new Node*[mask+1];
-  e_table = new Node*[mask+1];
-  for (int i = 0; i <= mask; i++)
+  // node ids are preserved by the copy, so the tables can be copied as they are
+  const Table* src[2] = { &ht->v_table, &ht->e_table };
+  Table* dest[2] = { &v_table, &e_table };
+  for (int i = 0; i < 2; i++)
   {
-    copy_list(v_table + i, ht->v_table[i]);
-    copy_list(e_table + i, ht->e_table[i]);
+    *dest[i] = *src[i];
+    dest[i]->slots = new Slot[src[i]->size];
+    memcpy(dest[i]->slots, src[i]->slots, src[i]->size * sizeof(Slot));
   }
 }
 
 
-void HashTable::rebuild()
+void HashTable::share(const HashTable* ht)
+{
+  free();
+  nodes.share(ht->nodes);
+  v_table = ht->v_table;
+  e_table = ht->e_table;
+  shared = true;
+}
+
+
+void HashTable::set_shared(bool shared)
 {
-  memset(v_table, 0, (mask+1) * sizeof(Node*));
-  memset(e_table, 0, (mask+1) * sizeof(Node*));
+  nodes.set_shared(shared);
+  this->shared = shared;
+}
+
 
+void HashTable::rebuild()
+{
+  // count the nodes first, so that the tables need not grow while being filled
+  int nv = 0, ne = 0;
   Node* node;
   for_all_nodes(node, this)
   {
-    int p1 = node->p1, p2 = node->p2;
-    if (p1 > p2) std::swap(p1, p2);
-    int idx = hash(p1, p2);
+    if (node->p1 < 0) continue; // top-level vertices are not hashed
+    if (node->type == TYPE_VERTEX) nv++; else ne++;
+  }
 
-    if (node->type == TYPE_VERTEX)
-    {
-      node->next_hash = v_table[idx];
-      v_table[idx] = node;
-    }
-    else
-    {
-      node->next_hash = e_table[idx];
-      e_table[idx] = node;
-    }
+  int vsize = std::max(v_table.size, 16), esize = std::max(e_table.size, 16);
+  while (vsize < 2*nv + 2) vsize *= 2;
+  while (esize < 2*ne + 2) esize *= 2;
+  free_table(v_table);
+  free_table(e_table);
+  init_table(v_table, vsize);
+  init_table(e_table, esize);
+
+  for_all_nodes(node, this)
+  {
+    if (node->p1 < 0) continue;
+    insert_node(node->type == TYPE_VERTEX ? v_table : e_table, node);
   }
 }
 
@@ -101,16 +131,9 @@ void HashTable::rebuild()
 void HashTable::free()
 {
   nodes.free();
-  if (v_table != NULL)
-  {
-    delete [] v_table;
-    v_table = NULL;
-  }
-  if (e_table != NULL)
-  {
-    delete [] e_table;
-    e_table = NULL;
-  }
+  free_table(v_table);
+  free_table(e_table);
+  shared = false;
   dump_hash_stat();
 }
 
@@ -118,20 +141,74 @@ void HashTable::free()
 void HashTable::dump_hash_stat()
 {
   if (ncollisions > 2*nqueries)
-    warn("nqueries=%d ncollisions=%d\a", nqueries, ncollisions);
+    warn("nqueries=%lu ncollisions=%lu\a", (unsigned long) nqueries, (unsigned long) ncollisions);
 }
 
 
-inline Node* HashTable::search_list(Node* node, int p1, int p2)
+inline HashTable::Slot* HashTable::find_slot(const Table& t, int p1, int p2)
 {
   nqueries++;
-  while (node != NULL)
+  int mask = t.size - 1;
+  for (int i = hash(t, p1, p2); ; i = (i + 1) & mask)
   {
-    if (node->p1 == p1 && node->p2 == p2) return node;
-    node = node->next_hash;
+    Slot* slot = t.slots + i;
+    if (slot->id < 0 || (slot->p1 == p1 && slot->p2 == p2)) return slot;
     ncollisions++;
   }
-  return NULL;
+}
+
+
+void HashTable::grow_table(Table& t)
+{
+  Table old = t;
+  init_table(t, old.size * 2);
+  for (int i = 0; i < old.size; i++)
+    if (old.slots[i].id >= 0)
+    {
+      int mask = t.size - 1, j = hash(t, old.slots[i].p1, old.slots[i].p2);
+      while (t.slots[j].id >= 0) j = (j + 1) & mask;
+      t.slots[j] = old.slots[i];
+    }
+  t.count = old.count;
+  delete [] old.slots;
+  nrehashes++;
+}
+
+
+void HashTable::insert_node(Table& t, Node* node)
+{
+  // keep the load factor at most 1/2
+  if (2*(t.count + 1) > t.size) grow_table(t);
+
+  Slot* slot = find_slot(t, node->p1, node->p2);
+  assert(slot->id < 0);
+  slot->p1 = node->p1;
+  slot->p2 = node->p2;
+  slot->id = node->id;
+  t.count++;
+}
+
+
+void HashTable::remove_node(Table& t, int id)
+{
+  Slot* slot = find_slot(t, nodes[id].p1, nodes[id].p2);
+  if (slot->id != id) return; // not hashed
+
+  // backward-shift deletion: move the following entries of the cluster
+  // to the hole if their home position allows it
+  int mask = t.size - 1;
+  int hole = slot - t.slots;
+  for (int i = (hole + 1) & mask; t.slots[i].id >= 0; i = (i + 1) & mask)
+  {
+    int home = hash(t, t.slots[i].p1, t.slots[i].p2);
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      t.slots[hole] = t.slots[i];
+      hole = i;
+    }
+  }
+  t.slots[hole].id = -1;
+  t.count--;
 }
 
 
@@ -139,9 +216,8 @@ Node* HashTable::get_vertex_node(int p1, int p2)
 {
   // search for the node in the vertex hashtable
   if (p1 > p2) std::swap(p1, p2);
-  int i = hash(p1, p2);
-  Node* node = search_list(v_table[i], p1, p2);
-  if (node != NULL) return node;
+  Slot* slot = find_slot(v_table, p1, p2);
+  if (slot->id >= 0) return &nodes[slot->id];
 
   // not found - create a new one
   Node* newnode = nodes.add();
@@ -155,8 +231,7 @@ Node* HashTable::get_vertex_node(int p1, int p2)
   newnode->y = (nodes[p1].y + nodes[p2].y) * 0.5;
 
   // insert into hashtable
-  newnode->next_hash = v_table[i];
-  v_table[i] = newnode;
+  insert_node(v_table, newnode);
 
   return newnode;
 }
@@ -166,9 +241,8 @@ Node* HashTable::get_edge_node(int p1, int p2)
 {
   // search for the node in the edge hashtable
   if (p1 > p2) std::swap(p1, p2);
-  int i = hash(p1, p2);
-  Node* node = search_list(e_table[i], p1, p2);
-  if (node != NULL) return node;
+  Slot* slot = find_slot(e_table, p1, p2);
+  if (slot->id >= 0) return &nodes[slot->id];
 
   // not found - create a new one
   Node* newnode = nodes.add();
@@ -181,8 +255,7 @@ Node* HashTable::get_edge_node(int p1, int p2)
   newnode->elem[0] = newnode->elem[1] = NULL;
 
   // insert into hashtable
-  newnode->next_hash = e_table[i];
-  e_table[i] = newnode;
+  insert_node(e_table, newnode);
 
   return newnode;
 }
@@ -191,33 +264,23 @@ Node* HashTable::get_edge_node(int p1, int p2)
 Node* HashTable::peek_vertex_node(int p1, int p2)
 {
   if (p1 > p2) std::swap(p1, p2);
-  return search_list(v_table[hash(p1, p2)], p1, p2);
+  Slot* slot = find_slot(v_table, p1, p2);
+  return (slot->id >= 0) ? &nodes[slot->id] : NULL;
 }
 
 
 Node* HashTable::peek_edge_node(int p1, int p2)
 {
   if (p1 > p2) std::swap(p1, p2);
-  return search_list(e_table[hash(p1, p2)], p1, p2);
+  Slot* slot = find_slot(e_table, p1, p2);
+  return (slot->id >= 0) ? &nodes[slot->id] : NULL;
 }
 
 
 void HashTable::remove_vertex_node(int id)
 {
   // remove the node from the hash table
-  int i = hash(nodes[id].p1, nodes[id].p2);
-  Node** ptr = v_table + i;
-  Node* node = *ptr;
-  while (node != NULL)
-  {
-    if (node->id == id)
-    {
-      *ptr = node->next_hash;
-      break;
-    }
-    ptr = &node->next_hash;
-    node = *ptr;
-  }
+  remove_node(v_table, id);
 
   // remove node from the array
   nodes.remove(id);
@@ -227,19 +290,7 @@ void HashTable::remove_vertex_node(int id)
 void HashTable::remove_edge_node(int id)
 {
   // remove the node from the hash table
-  int i = hash(nodes[id].p1, nodes[id].p2);
-  Node** ptr = e_table + i;
-  Node* node = *ptr;
-  while (node != NULL)
-  {
-    if (node->id == id)
-    {
-      *ptr = node->next_hash;
-      break;
-    }
-    ptr = &node->next_hash;
-    node = *ptr;
-  }
+  remove_node(e_table, id);
 
   // remove node from the array
   nodes.remove(id);
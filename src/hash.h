@@ -26,6 +26,8 @@ struct Node;
 ///
 /// HashTable is a base class for Mesh. It serves as a container for all nodes
 /// of a mesh. Moreover, it has node searching functions based on hash tables.
+/// The hash tables use open addressing (linear probing) and grow automatically
+/// when they become half full.
 ///
 class HERMES2D_API HashTable
 {
@@ -49,6 +51,11 @@ public:
   /// Returns an edge node with parent id's p1 and p2 if it exists, NULL otherwise.
   Node* peek_edge_node(int p1, int p2);
 
+  /// Returns the number of hash table look-ups and the number of extra probes
+  /// (collisions) they needed, and the number of times the tables were enlarged.
+  void get_hash_stats(size_t& queries, size_t& collisions, size_t& rehashes) const
+    { queries = nqueries;  collisions = ncollisions;  rehashes = nrehashes; }
+
 
 // The following functions are used by the derived class Mesh:
 protected:
@@ -56,15 +63,25 @@ protected:
   HERMES2D_API_USED_TEMPLATE(Array<Node>);
   Array<Node> nodes; ///< Array storing all nodes
 
-  static const int DEFAULT_HASH_SIZE = 0x20000; // 128K entries
+  static const int DEFAULT_HASH_SIZE = 0x400; // initial size, the tables grow as needed
 
   /// Initializes the hash table.
-  /// \param size [in] Hash table size; must be a power of two.
-  void init(int size = DEFAULT_HASH_SIZE);
+  /// \param size [in] Initial hash table size; must be a power of two.
+  /// \param esize [in] Initial size of the edge node table, if different from 'size'.
+  void init(int size = DEFAULT_HASH_SIZE, int esize = 0);
+
+  /// Returns the smallest table size that holds 'n' nodes without growing.
+  static int get_table_size(int n);
 
   /// Copies another hash table contents
   void copy(const HashTable* ht);
 
+  /// Makes this hash table use the nodes and tables of another one, without copying them.
+  void share(const HashTable* ht);
+
+  /// Sets whether the nodes and tables belong to another hash table (and will not be freed).
+  void set_shared(bool shared);
+
   /// Reconstructs the hashtable, after, e.g., the nodes have been loaded from a file.
   void rebuild();
 
@@ -94,20 +111,47 @@ protected:
 // Internal members
 private:
 
-  Node** v_table; ///< Vertex node hash table
-  Node** e_table; ///< Edge node hash table
-
-  int mask;
-  int nqueries, ncollisions;
-
-  int hash(int p1, int p2) { return (984120265*p1 + 125965121*p2) & mask; }
-
-  /// Searches a list of hash synonyms given the first list item.
-  /// Returns the node matching the parent ids p1 and p2.
-  Node* search_list(Node* node, int p1, int p2);
-
-  /// Creates a copy of a hash synonym list.
-  void copy_list(Node** ptr, Node* node);
+  /// One entry of the hash table: the parent ids (the key) and the node id.
+  struct Slot
+  {
+    int p1, p2;
+    int id; ///< -1 = empty slot
+  };
+
+  /// Open addressing hash table mapping (p1, p2) to node ids.
+  struct Table
+  {
+    Slot* slots;
+    int size;  ///< a power of two
+    int shift; ///< 64 - log2(size)
+    int count; ///< number of used slots
+  };
+
+  Table v_table; ///< Vertex node hash table
+  Table e_table; ///< Edge node hash table
+  bool shared;   ///< the tables belong to another instance
+
+  size_t nqueries, ncollisions, nrehashes;
+
+  static int hash(const Table& t, int p1, int p2)
+  {
+    // Fibonacci hashing of the 64-bit key
+    uint64_t key = ((uint64_t) (unsigned) p1 << 32) | (unsigned) p2;
+    return (int) ((key * 0x9e3779b97f4a7c15ULL) >> t.shift);
+  }
+
+  void init_table(Table& t, int size);
+  void free_table(Table& t);
+  void grow_table(Table& t);
+
+  /// Returns the slot holding the key (p1, p2), or the empty slot where it should be inserted.
+  Slot* find_slot(const Table& t, int p1, int p2);
+
+  /// Inserts a node into the table (it must not be there yet).
+  void insert_node(Table& t, Node* node);
+
+  /// Removes the node with the given id from the table.
+  void remove_node(Table& t, int id);
 
   friend struct Node;
   friend class H2DReader;
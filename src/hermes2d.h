@@ -37,6 +37,7 @@
 
 #include "refmap.h"
 #include "traverse.h"
+#include "spatial_index.h"
 
 #include "weakform.h"
 #include "linsystem.h"
@@ -65,6 +66,7 @@
 
 #include "norm.h"
 #include "graph.h"
+#include "profiler.h"
 
 #include "views/view.h"
 #include "views/base_view.h"
@@ -91,6 +91,8 @@ protected:
   bool curved, disp;
   double min_val, max_val;
 
+  ActiveElementTable elem_tab; ///< active elements of the last mesh, rebuilt when its seq changes
+
   int get_vertex(int p1, int p2, double x, double y, double value);
   int get_top_vertex(int id, double value);
   int peek_vertex(int p1, int p2);
@@ -718,15 +718,17 @@ void Linearizer::process_solution(MeshFunction* sln, int item, double eps, doubl
   max = auto_max ? 0.0 : max_abs;
 
   // obtain the solution in vertices, estimate the maximum solution value
-  Element* e;
-  for_all_active_elements(e, mesh)
+  elem_tab.update(mesh);
+  for (int k = 0; k < elem_tab.num; k++)
   {
+    Element* e = mesh->get_element_fast(elem_tab.id[k]);
+    const int* vn = &elem_tab.vn[4*k];
     sln->set_active_element(e);
     sln->set_quad_order(0, item);
     scalar* val = sln->get_values(ia, ib);
     if (val == NULL) error("item not defined in the solution.");
 
-    scalar *dx, *dy;
+    scalar *dx = NULL, *dy = NULL;
     if (disp)
     {
       xdisp->set_active_element(e);
@@ -737,24 +739,26 @@ void Linearizer::process_solution(MeshFunction* sln, int item, double eps, doubl
       dy = ydisp->get_fn_values();
     }
 
-    for (unsigned int i = 0; i < e->nvert; i++)
+    for (int i = 0; i < elem_tab.nvert[k]; i++)
     {
       double f = getval(i);
       if (auto_max && finite(f) && fabs(f) > max) max = fabs(f);
-      int id = id2id[e->vn[i]->id];
+      int id = id2id[vn[i]];
       verts[id][2] = f;
 
       if (disp)
       {
-        verts[id][0] = e->vn[i]->x + dmult*realpart(dx[i]);
-        verts[id][1] = e->vn[i]->y + dmult*realpart(dy[i]);
+        verts[id][0] = elem_tab.x[4*k + i] + dmult*realpart(dx[i]);
+        verts[id][1] = elem_tab.y[4*k + i] + dmult*realpart(dy[i]);
       }
     }
   }
 
   // process all elements of the mesh
-  for_all_active_elements(e, mesh)
+  for (int k = 0; k < elem_tab.num; k++)
   {
+    Element* e = mesh->get_element_fast(elem_tab.id[k]);
+    const int* vn = &elem_tab.vn[4*k];
     sln->set_active_element(e);
     sln->set_quad_order(0, item);
     scalar* val = sln->get_values(ia, ib);
@@ -765,8 +769,8 @@ void Linearizer::process_solution(MeshFunction* sln, int item, double eps, doubl
     }
 
     int iv[4];
-    for (unsigned int i = 0; i < e->nvert; i++)
-      iv[i] = get_top_vertex(id2id[e->vn[i]->id], getval(i));
+    for (int i = 0; i < elem_tab.nvert[k]; i++)
+      iv[i] = get_top_vertex(id2id[vn[i]], getval(i));
 
     // we won't bother calculating physical coordinates from the refmap if this is not a curved element
     curved = e->is_curved();
@@ -778,8 +782,8 @@ void Linearizer::process_solution(MeshFunction* sln, int item, double eps, doubl
     else
       process_quad(iv[0], iv[1], iv[2], iv[3], 0, NULL, NULL, NULL, NULL);
 
-    for (unsigned int i = 0; i < e->nvert; i++)
-      process_edge(iv[i], iv[e->next_vert(i)], e->en[i]->marker);
+    for (int i = 0; i < elem_tab.nvert[k]; i++)
+      process_edge(iv[i], iv[e->next_vert(i)], elem_tab.en_marker[4*k + i]);
   }
 
   delete [] id2id;
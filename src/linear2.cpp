@@ -111,9 +111,10 @@ void Orderizer::process_solution(Space* space)
   refmap.set_quad_2d(&quad_ord);
 
   // make a mesh illustrating the distribution of polynomial orders over the space
-  Element* e;
-  for_all_active_elements(e, mesh)
+  elem_tab.update(mesh);
+  for (int n = 0; n < elem_tab.num; n++)
   {
+    Element* e = mesh->get_element_fast(elem_tab.id[n]);
     oo = o[4] = o[5] = space->get_element_order(e->id);
     for (unsigned int k = 0; k < e->nvert; k++)
       o[k] = space->get_edge_order(e, k);
@@ -158,12 +159,14 @@ void Orderizer::process_solution(Space* space)
     }
 
     double xmin = 1e100, ymin = 1e100, xmax = -1e100, ymax = -1e100;
-    for (unsigned int k = 0; k < e->nvert; k++)
+    const double* vx = &elem_tab.x[4*n];
+    const double* vy = &elem_tab.y[4*n];
+    for (int k = 0; k < elem_tab.nvert[n]; k++)
     {
-      if (e->vn[k]->x < xmin) xmin = e->vn[k]->x;
-      if (e->vn[k]->x > xmax) xmax = e->vn[k]->x;
-      if (e->vn[k]->y < ymin) ymin = e->vn[k]->y;
-      if (e->vn[k]->y > ymax) ymax = e->vn[k]->y;
+      if (vx[k] < xmin) xmin = vx[k];
+      if (vx[k] > xmax) xmax = vx[k];
+      if (vy[k] < ymin) ymin = vy[k];
+      if (vy[k] > ymax) ymax = vy[k];
     }
     lbox[nl][0] = xmax - xmin;
     lbox[nl][1] = ymax - ymin;
@@ -22,6 +22,7 @@
 #include "refmap.h"
 #include "solution.h"
 #include "config.h"
+#include "profiler.h"
 
 
 void qsort_int(int* pbase, size_t total_elems); // defined in qsort.cpp
@@ -199,7 +200,7 @@ static inline void page_add_ij(Page** pages, int i, int j)
 }
 
 
-void LinSystem::precalc_sparse_structure(Page** pages)
+void LinSystem::precalc_sparse_structure(Page** pages, const bool* reuse)
 {
   int i, j, m, n;
   AUTOLA_CL(AsmList, al, wf->neq);
@@ -211,6 +212,7 @@ void LinSystem::precalc_sparse_structure(Page** pages)
   for (i = 0; i < wf->neq; i++)
     meshes[i] = spaces[i]->get_mesh();
   Traverse trav;
+  trav.set_plan_cache(&plans);
   trav.begin(wf->neq, meshes);
 
   // loop through all elements
@@ -221,7 +223,6 @@ void LinSystem::precalc_sparse_structure(Page** pages)
     for (i = 0; i < wf->neq; i++)
       if (e[i] != NULL)
         spaces[i]->get_element_assembly_list(e[i], al + i);
-      // todo: neziskavat znova, pokud se element nezmenil
 
     // go through all equation-blocks of the local stiffness matrix
     for (m = 0; m < wf->neq; m++)
@@ -236,7 +237,7 @@ void LinSystem::precalc_sparse_structure(Page** pages)
           {
             // register nonzero elements (row-oriented matrix)
             for (i = 0; i < am->cnt; i++)
-              if (am->dof[i] >= 0)
+              if (am->dof[i] >= 0 && (reuse == NULL || !reuse[am->dof[i]]))
                 for (j = 0; j < an->cnt; j++)
                   if (an->dof[j] >= 0)
                     page_add_ij(pages, am->dof[i], an->dof[j]);
@@ -245,7 +246,7 @@ void LinSystem::precalc_sparse_structure(Page** pages)
           {
             // register nonzero elements (column-oriented matrix)
             for (j = 0; j < an->cnt; j++)
-              if (an->dof[j] >= 0)
+              if (an->dof[j] >= 0 && (reuse == NULL || !reuse[an->dof[j]]))
                 for (i = 0; i < am->cnt; i++)
                   if (am->dof[i] >= 0)
                     page_add_ij(pages, an->dof[j], am->dof[i]);
@@ -323,40 +324,117 @@ void LinSystem::create_matrix(bool rhsonly)
   else if (rhsonly)
     error("Cannot reassemble RHS only: spaces have changed.");
 
+  // calculate the total number of DOFs
+  int prev_ndofs = ndofs, new_ndofs = 0;
+  for (int i = 0; i < wf->neq; i++)
+    new_ndofs += spaces[i]->get_num_dofs();
+  if (!new_ndofs)
+    error("zero matrix size.");
+
+  // relate the new DOFs to the previous ones; the last solution is kept as an initial guess
+  // and the rows of the previous matrix structure which have not changed are reused
+  int* prev = NULL;
+  bool* reuse = NULL;
+  int *prev_Ap = NULL, *prev_Ai = NULL;
+  scalar* prev_vec = NULL;
+  if (Ap != NULL)
+  {
+    prev = new int[new_ndofs];
+    reuse = new bool[new_ndofs];
+    for (int i = 0; i < new_ndofs; i++)
+      { prev[i] = -1; reuse[i] = false; }
+    if (get_prev_dofs(prev, reuse))
+    {
+      prev_Ap = Ap; prev_Ai = Ai; prev_vec = Vec;
+      Ap = Ai = NULL; Vec = NULL;
+    }
+    else
+    {
+      delete [] prev; prev = NULL;
+      delete [] reuse; reuse = NULL;
+    }
+  }
+
   // spaces have changed: create the matrix from scratch
   free();
   verbose("Creating matrix sparse structure..."); begin_time();
+  ndofs = new_ndofs;
 
-  // calculate the total number of DOFs
-  ndofs = 0;
-  for (int i = 0; i < wf->neq; i++)
-    ndofs += spaces[i]->get_num_dofs();
-  if (!ndofs)
-    error("zero matrix size.");
+  if (prev_vec != NULL)
+  {
+    Vec = (scalar*) malloc(sizeof(scalar) * ndofs);
+    for (int i = 0; i < ndofs; i++)
+      Vec[i] = (prev[i] >= 0) ? prev_vec[prev[i]] : 0.0;
+    if (solver != NULL && solver->uses_initial_guess())
+      guess_new_dofs(prev, prev_vec, Vec);
+    ::free(prev_vec);
+  }
+
+  // a previous row can only be reused if all its columns have new numbers
+  int* next = NULL;
+  int num_reused = 0;
+  if (reuse != NULL)
+  {
+    next = new int[prev_ndofs];
+    for (int i = 0; i < prev_ndofs; i++)
+      next[i] = -1;
+    for (int i = 0; i < ndofs; i++)
+      if (prev[i] >= 0)
+        next[prev[i]] = i;
+    for (int i = 0; i < ndofs; i++)
+      if (reuse[i])
+        for (int k = prev_Ap[prev[i]]; k < prev_Ap[prev[i]+1]; k++)
+          if (next[prev_Ai[k]] < 0)
+            { reuse[i] = false; break; }
+  }
 
   // get row and column indices of nonzero matrix elements
   Page** pages = new Page*[ndofs];
   memset(pages, 0, sizeof(Page*) * ndofs);
-  precalc_sparse_structure(pages);
+  precalc_sparse_structure(pages, reuse);
 
   // initialize the arrays Ap and Ai
   Ap = (int*) malloc(sizeof(int) * (ndofs+1));
   int aisize = get_num_indices(pages, ndofs);
+  if (reuse != NULL)
+    for (int i = 0; i < ndofs; i++)
+      if (reuse[i])
+        aisize += prev_Ap[prev[i]+1] - prev_Ap[prev[i]];
   Ai = (int*) malloc(sizeof(int) * aisize);
   if (Ai == NULL) error("Out of memory. Could not allocate the array Ai.");
 
-  // sort the indices and remove duplicities, insert into Ai
+  // sort the indices and remove duplicities, insert into Ai; reused rows are renumbered
   int i, pos = 0;
   for (i = 0; i < ndofs; i++)
   {
     Ap[i] = pos;
-    pos += sort_and_store_indices(pages[i], Ai + pos, Ai + aisize);
+    if (reuse != NULL && reuse[i])
+    {
+      int len = prev_Ap[prev[i]+1] - prev_Ap[prev[i]];
+      for (int k = 0; k < len; k++)
+        Ai[pos + k] = next[prev_Ai[prev_Ap[prev[i]] + k]];
+      qsort_int(Ai + pos, len);
+      pos += len;
+      num_reused++;
+    }
+    else
+      pos += sort_and_store_indices(pages[i], Ai + pos, Ai + aisize);
   }
   Ap[i] = pos;
-  verbose("  (ndof: %d, nnz: %d, size: %0.1lf MB, time: %g sec)",
-          ndofs, pos, (double) get_matrix_size() / (1024*1024), end_time());
+  verbose("  (ndof: %d, nnz: %d, reused rows: %d, size: %0.1lf MB, time: %g sec)",
+          ndofs, pos, num_reused, (double) get_matrix_size() / (1024*1024), end_time());
+  profiler_count("reused matrix rows", num_reused);
   delete [] pages;
 
+  if (prev != NULL)
+  {
+    delete [] prev;
+    delete [] reuse;
+    delete [] next;
+    ::free(prev_Ap);
+    ::free(prev_Ai);
+  }
+
   // shrink Ai to the actual size
   Ai = (int*) realloc(Ai, sizeof(int) * pos);
 
@@ -380,6 +458,27 @@ void LinSystem::create_matrix(bool rhsonly)
 }
 
 
+bool LinSystem::get_prev_dofs(int* prev, bool* reuse)
+{
+  // spaces with stable DOF numbers know the previous number of each DOF
+  int n = 0;
+  for (int i = 0; i < wf->neq; i++)
+  {
+    if (!spaces[i]->has_prev_dofs() || spaces[i]->get_seq() == sp_seq[i])
+      return false;
+    n += spaces[i]->get_num_dofs();
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    for (int j = 0; j < wf->neq && prev[i] < 0; j++)
+      prev[i] = spaces[j]->get_prev_dof(i);
+    if (prev[i] >= ndofs) prev[i] = -1;
+  }
+  return true;
+}
+
+
 int LinSystem::get_matrix_size() const
 {
   return (sizeof(int) + sizeof(scalar)) * Ap[ndofs] + sizeof(scalar) * 2 * ndofs;
@@ -469,10 +568,16 @@ void LinSystem::assemble(bool rhsonly)
 
   if (rhsonly && Ax == NULL)
     error("Cannot reassemble RHS only: matrix is has not been assembled yet.");
+  ProfilerPhase phase("assemble");
 
   // create the sparse structure
-  create_matrix(rhsonly);
+  {
+    ProfilerPhase phase("sparsity");
+    create_matrix(rhsonly);
+  }
   if (!ndofs) return;
+  profiler_count("assembled dofs", ndofs);
+  profiler_count("matrix nonzeros", Ap[ndofs]);
 
   info("Assembling stiffness matrix...");
   begin_time();
@@ -504,6 +609,7 @@ void LinSystem::assemble(bool rhsonly)
   // traverses through the union mesh. On the other hand, if you don't use multi-mesh
   // at all, there will always be only one stage in which all forms are assembled as usual.
   Traverse trav;
+  trav.set_plan_cache(&plans);
   for (unsigned int ss = 0; ss < stages.size(); ss++)
   {
     WeakForm::Stage* s = &stages[ss];
@@ -533,7 +639,6 @@ void LinSystem::assemble(bool rhsonly)
         j = s->idx[i];
         if (e[i] == NULL) { isempty[j] = true; continue; }
         spaces[j]->get_element_assembly_list(e[i], al+j);
-        // todo: neziskavat znova, pokud se element nezmenil
 
         spss[j]->set_active_element(e[i]);
         spss[j]->set_master_transform();
@@ -936,6 +1041,7 @@ scalar LinSystem::eval_form(WeakForm::LiFormSurf *lf, PrecalcShapeset *fv, RefMa
 bool LinSystem::solve(int n, ...)
 {
   if (!solver) error("Cannot solve -- no solver was provided.");
+  ProfilerPhase phase("solve");
   begin_time();
 
   // perform symbolic analysis of the matrix
@@ -952,9 +1058,12 @@ bool LinSystem::solve(int n, ...)
     values_changed = false;
   }
 
-  // solve the system
-  if (Vec != NULL) ::free(Vec);
-  Vec = (scalar*) malloc(ndofs * sizeof(scalar));
+  // solve the system; the previous solution, if any, serves as the initial guess
+  if (Vec == NULL)
+  {
+    Vec = (scalar*) malloc(ndofs * sizeof(scalar));
+    memset(Vec, 0, ndofs * sizeof(scalar));
+  }
   solver->solve(slv_ctx, ndofs, Ap, Ai, Ax, false, RHS, Vec);
   verbose("  (total solve time: %g sec)", end_time());
 
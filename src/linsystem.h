@@ -19,6 +19,7 @@
 #include "matrix.h"
 #include "forms.h"
 #include "weakform.h"
+#include "traverse.h"
 #include <map>
 
 class Space;
@@ -92,8 +93,19 @@ protected:
   scalar* Dir; ///< contributions to the RHS from Dirichlet DOFs
   scalar* Vec; ///< last solution vector
 
+  TraversePlanCache plans; ///< traversals recorded by create_matrix() and assemble()
+
   void create_matrix(bool rhsonly);
-  void precalc_sparse_structure(Page** pages);
+  void precalc_sparse_structure(Page** pages, const bool* reuse = NULL);
+
+  /// Relates the DOFs of the spaces to the DOFs of the previous matrix. Sets prev[i] to the
+  /// previous number of DOF i (initialized to -1) and reuse[i] to true if the row (column) i
+  /// of the previous matrix structure is valid after renumbering. Returns false if the DOFs
+  /// cannot be related. Called by create_matrix() before the old matrix is freed.
+  virtual bool get_prev_dofs(int* prev, bool* reuse);
+  /// Calculates the initial guess for the DOFs which have no previous number (prev[i] < 0).
+  /// Only called if the solver uses the initial guess (see Solver::uses_initial_guess()).
+  virtual void guess_new_dofs(const int* prev, const scalar* prev_vec, scalar* vec) {}
   void insert_block(scalar** mat, int* iidx, int* jidx, int ilen, int jlen);
 
   ExtData<Ord>* init_ext_fns_ord(std::vector<MeshFunction *> &ext);
@@ -14,6 +14,8 @@
 // along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "common.h"
+#include <algorithm>
+#include <map>
 #include "mesh.h"
 #include "h2d_reader.h"
 
@@ -130,6 +132,9 @@ Mesh::Mesh() : HashTable()
 {
   nbase = nactive = ntopvert = ninitial = 0;
   seq = g_mesh_seq++;
+  cow_owner = NULL;
+  num_threads = 1;
+  defer_refmap_coefs = false;
 }
 
 
@@ -141,6 +146,49 @@ Element* Mesh::get_element(int id) const
 }
 
 
+void ActiveElementTable::update(const Mesh* mesh)
+{
+  if (this->mesh == mesh && seq == mesh->get_seq()) return;
+
+  int n = 0, max = mesh->get_max_element_id();
+  for (int i = 0; i < max; i++)
+  {
+    Element* e = mesh->get_element_fast(i);
+    if (e->used && e->active) n++;
+  }
+
+  num = n;
+  id.resize(n);
+  nvert.resize(n);
+  marker.resize(n);
+  vn.assign(4*n, -1);
+  en_marker.assign(4*n, 0);
+  x.assign(4*n, 0.0);
+  y.assign(4*n, 0.0);
+
+  for (int i = 0, k = 0; i < max; i++)
+  {
+    Element* e = mesh->get_element_fast(i);
+    if (!e->used || !e->active) continue;
+
+    id[k] = e->id;
+    nvert[k] = e->nvert;
+    marker[k] = e->marker;
+    for (unsigned int j = 0; j < e->nvert; j++)
+    {
+      vn[4*k + j] = e->vn[j]->id;
+      x[4*k + j] = e->vn[j]->x;
+      y[4*k + j] = e->vn[j]->y;
+      en_marker[4*k + j] = e->en[j]->marker;
+    }
+    k++;
+  }
+
+  this->mesh = mesh;
+  seq = mesh->get_seq();
+}
+
+
 int Mesh::get_edge_sons(Element* e, int edge, int& son1, int& son2)
 {
   assert(!e->active);
@@ -359,7 +407,7 @@ void Mesh::refine_triangle(Element* e)
   // update coefficients of curved reference mapping
   for (int i = 0; i < 4; i++)
     if (sons[i]->is_curved())
-      sons[i]->cm->update_refmap_coefs(sons[i]);
+      update_refmap_coefs(sons[i]);
 
   // deactivate this element and unregister from its nodes
   e->active = 0;
@@ -514,7 +562,7 @@ void Mesh::refine_quad(Element* e, int refinement)
   // update coefficients of curved reference mapping
   for (i = 0; i < 4; i++)
     if (sons[i] != NULL && sons[i]->cm != NULL)
-      sons[i]->cm->update_refmap_coefs(sons[i]);
+      update_refmap_coefs(sons[i]);
 
   // optimization: iro never gets worse
   if (e->iro_cache == 0)
@@ -576,6 +624,7 @@ void Mesh::unrefine_element_internal(Element* e)
 
 void Mesh::refine_element(int id, int refinement)
 {
+  make_private();
   Element* e = get_element(id);
   if (!e->used) error("invalid element id number.");
   if (!e->active) error("attempt to refine element #%d which has been refined already.", e->id);
@@ -589,24 +638,51 @@ void Mesh::refine_element(int id, int refinement)
 }
 
 
+void Mesh::update_refmap_coefs(Element* e)
+{
+  if (defer_refmap_coefs)
+    refmap_pending.push_back(e);
+  else
+    e->cm->update_refmap_coefs(e);
+}
+
+
+void Mesh::flush_refmap_coefs()
+{
+  defer_refmap_coefs = false;
+  if (refmap_pending.empty()) return;
+  ::update_refmap_coefs(&refmap_pending[0], refmap_pending.size(), num_threads);
+  refmap_pending.clear();
+}
+
+
 void Mesh::refine_all_elements(int refinement)
 {
+  make_private();
   Element* e;
+  defer_refmap_coefs = true;
   elements.set_append_only(true);
   for_all_active_elements(e, this)
     refine_element(e->id, refinement);
   elements.set_append_only(false);
+  flush_refmap_coefs();
 }
 
 
 void Mesh::refine_by_criterion(int (*criterion)(Element*), int depth)
 {
+  make_private();
   Element* e;
   elements.set_append_only(true);
   for (int r, i = 0; i < depth; i++)
+  {
+    // the criterion may need the reference maps of the previous level
+    defer_refmap_coefs = true;
     for_all_active_elements(e, this)
       if ((r = criterion(e)) >= 0)
         refine_element(e->id, r);
+    flush_refmap_coefs();
+  }
   elements.set_append_only(false);
 }
 
@@ -680,6 +756,7 @@ void Mesh::refine_towards_boundary(int marker, int depth, bool aniso)
 
 void Mesh::unrefine_element(int id)
 {
+  make_private();
   Element* e = get_element(id);
   if (!e->used) error("invalid element id number.");
   if (e->active) return;
@@ -695,6 +772,8 @@ void Mesh::unrefine_element(int id)
 
 void Mesh::unrefine_all_elements(bool keep_initial_refinements)
 {
+  make_private();
+
   // find inactive elements with active sons
   std::vector<int> list;
   Element* e;
@@ -841,10 +920,10 @@ void Mesh::create(int nv, double2* verts, int nt, int4* tris,
 {
   free();
 
-  // initialize hash table
+  // initialize hash table; by Euler's formula a planar mesh has about nv + nt + nq edges
   int size = 16;
   while (size < 2*nv) size *= 2;
-  HashTable::init(size);
+  HashTable::init(size, get_table_size(nv + nt + nq));
 
   // create vertex nodes
   for (int i = 0; i < nv; i++)
@@ -855,7 +934,6 @@ void Mesh::create(int nv, double2* verts, int nt, int4* tris,
     node->type = TYPE_VERTEX;
     node->bnd = 0;
     node->p1 = node->p2 = -1;
-    node->next_hash = NULL;
     node->x = verts[i][0];
     node->y = verts[i][1];
   }
@@ -945,6 +1023,71 @@ void Mesh::copy(const Mesh* mesh)
 }
 
 
+void Mesh::copy_cow(const Mesh* mesh)
+{
+  if (mesh == this) return;
+  free();
+
+  // all copies share the data of the original owner
+  const Mesh* owner = (mesh->cow_owner != NULL) ? mesh->cow_owner : mesh;
+  HashTable::share(owner);
+  elements.share(owner->elements);
+  cow_owner = const_cast<Mesh*>(owner);
+  owner->cow_copies.push_back(this);
+
+  nbase = mesh->nbase;
+  nactive = mesh->nactive;
+  ntopvert = mesh->ntopvert;
+  ninitial = mesh->ninitial;
+  seq = mesh->seq;
+}
+
+
+void Mesh::make_private()
+{
+  // this mesh keeps its nodes and elements, so that the pointers held by its users stay
+  // valid; the snapshots share one new copy and get a new seq number, which tells their
+  // users to drop the element pointers they have cached (see Solution::set_active_element)
+  if (!cow_copies.empty())
+  {
+    std::vector<Mesh*> snaps = cow_copies;
+    snaps[0]->copy(this); // copy() frees the target first, which removes it from cow_copies
+    snaps[0]->seq = g_mesh_seq++;
+    for (unsigned i = 1; i < snaps.size(); i++)
+      snaps[i]->copy_cow(snaps[0]);
+  }
+
+  if (cow_owner != NULL)
+    copy(cow_owner);
+}
+
+
+void Mesh::detach_cow()
+{
+  if (cow_owner != NULL)
+  {
+    std::vector<Mesh*>& list = cow_owner->cow_copies;
+    list.erase(std::find(list.begin(), list.end(), this));
+    cow_owner = NULL;
+  }
+  else if (!cow_copies.empty())
+  {
+    // the first copy becomes the new owner of the nodes and elements
+    Mesh* heir = cow_copies[0];
+    heir->cow_owner = NULL;
+    heir->elements.set_shared(false);
+    heir->HashTable::set_shared(false);
+    heir->cow_copies.assign(cow_copies.begin() + 1, cow_copies.end());
+    for (unsigned i = 0; i < heir->cow_copies.size(); i++)
+      heir->cow_copies[i]->cow_owner = heir;
+    cow_copies.clear();
+
+    elements.set_shared(true);
+    HashTable::set_shared(true);
+  }
+}
+
+
 Node* Mesh::get_base_edge_node(Element* base, int edge)
 {
   while (!base->active) // we need to go down to an active element
@@ -1007,13 +1150,19 @@ void Mesh::copy_base(Mesh* mesh)
 
 void Mesh::free()
 {
-  Element* e;
-  for_all_elements(e, this)
-    if (e->cm != NULL)
-    {
-      delete e->cm;
-      e->cm = NULL; // fixme!!!
-    }
+  // the curved maps are freed together with the shared elements
+  if (is_shared())
+    detach_cow();
+  else
+  {
+    Element* e;
+    for_all_elements(e, this)
+      if (e->cm != NULL)
+      {
+        delete e->cm;
+        e->cm = NULL; // fixme!!!
+      }
+  }
 
   elements.free();
   HashTable::free();
@@ -1098,6 +1247,8 @@ void Mesh::convert_to_quads(int refinement)
   Element* e;
   Mesh tmp;
 
+  make_private();
+
   elements.set_append_only(true);
   for_all_active_elements(e, this)
     refine_element_to_quads(e->id, refinement);
@@ -1113,6 +1264,8 @@ void Mesh::convert_to_triangles()
   Element* e;
   Mesh tmp;
 
+  make_private();
+
   elements.set_append_only(true);
   for_all_active_elements(e, this)
     refine_element_to_triangles(e->id);
@@ -1614,97 +1767,208 @@ void Mesh::load_str(char *mesh)
 
 //// save_raw, load_raw ////////////////////////////////////////////////////////////////////////////
 
-void Mesh::save_raw(FILE* f)
-{
-  int i, nn, mm;
-  int null = -1;
+// Version 2 of the raw mesh format. All records have a fixed size and are stored in
+// sections at 8-byte aligned offsets, so that the file can be decoded directly from
+// memory (see H2DReader::load_binary). Node and element records are stored for all
+// array slots, including unused ones, so that ids are preserved. Numbers are stored
+// in the native byte order.
 
-  assert(sizeof(int) == 4);
-  assert(sizeof(double) == 8);
+static const int RAW_MESH_VERSION = 2;
 
-  hermes2d_fwrite("H2DM\001\000\000\000", 1, 8, f);
+// numbers are stored in the native byte order, so a file from a machine with the other
+// byte order is recognized by its byte-swapped version number
+static void check_raw_version(int version)
+{
+  if (version == RAW_MESH_VERSION) return;
+  unsigned v = version;
+  unsigned swapped = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+  if (swapped == (unsigned) RAW_MESH_VERSION || swapped == 1)
+    error("The mesh file was saved on a machine with a different byte order.");
+  error("Unsupported file version.");
+}
 
-  #define output(n, type) \
-    hermes2d_fwrite(&(n), sizeof(type), 1, f)
+struct RawMeshHeader
+{
+  char magic[4];        // "H2DM"
+  int version;
+  int nbase, ntopvert, nactive, ninitial;
+  int nnodes, nelems;   // node and element array sizes
+  int ncurv, nnurbs;    // number of curved maps and NURBS curves
+  int64_t ndoubles;     // size of the pool of doubles
+  int64_t off_nodes, off_elems, off_curv, off_nurbs, off_doubles;
+  int64_t size;         // total size of the data, including this header
+};
+
+struct RawNode
+{
+  unsigned bits;        // ref | type << 29 | bnd << 30 | used << 31
+  int marker;           // edge nodes only
+  int p1, p2;
+  int elem[2];          // edge nodes only; -1 = NULL
+  double x, y;          // vertex nodes only
+};
+
+struct RawElement
+{
+  unsigned bits;        // nvert | active << 30 | used << 31
+  int marker, userdata, iro_cache;
+  int vn[4];
+  int en[4];            // edge node ids of active elements, son ids of inactive ones
+  int cm;               // index of the curved map, -1 = none
+  int pad;
+};
+
+struct RawCurvMap
+{
+  int toplevel, order, nc;
+  int ref[4];           // NURBS indices for top-level maps, parent element id otherwise
+  int pad;
+  uint64_t part;
+  int64_t coefs;        // offset of the coefficients in the pool of doubles
+};
+
+struct RawNurbs
+{
+  int degree, np, nk, flags; // flags: 1 = twin, 2 = arc
+  double angle;
+  int64_t pt, kv;       // offsets in the pool of doubles
+};
 
-  output(nbase, int);
-  output(ntopvert, int);
-  output(nactive, int);
 
-  nn = nodes.get_num_items();
-  mm = nodes.get_size();
-  output(nn, int);
-  output(mm, int);
+void Mesh::save_raw(FILE* f)
+{
+  int i, j;
+  Element* e;
 
-  // dump all nodes
+  RawMeshHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, "H2DM", 4);
+  hdr.version = RAW_MESH_VERSION;
+  hdr.nbase = nbase;
+  hdr.ntopvert = ntopvert;
+  hdr.nactive = nactive;
+  hdr.ninitial = ninitial;
+  hdr.nnodes = get_max_node_id();
+  hdr.nelems = get_max_element_id();
+
+  // collect the curved maps, NURBS curves and the doubles they store
+  std::vector<RawCurvMap> curv;
+  std::vector<RawNurbs> nurbs;
+  std::vector<double> pool;
+  std::map<Nurbs*, int> nurbs_idx;
+  std::vector<int> elem_cm(hdr.nelems, -1);
+  for_all_elements(e, this)
+  {
+    if (e->cm == NULL) continue;
+    CurvMap* cm = e->cm;
+    RawCurvMap rc;
+    memset(&rc, 0, sizeof(rc));
+    rc.toplevel = cm->toplevel;
+    rc.order = cm->order;
+    rc.nc = cm->nc;
+    if (cm->toplevel)
+    {
+      for (i = 0; i < 4; i++)
+      {
+        Nurbs* nu = cm->nurbs[i];
+        rc.ref[i] = -1;
+        if (nu == NULL) continue;
+        std::map<Nurbs*, int>::iterator it = nurbs_idx.find(nu);
+        if (it == nurbs_idx.end())
+        {
+          RawNurbs rn;
+          memset(&rn, 0, sizeof(rn));
+          rn.degree = nu->degree;
+          rn.np = nu->np;
+          rn.nk = nu->nk;
+          rn.flags = (nu->twin ? 1 : 0) | (nu->arc ? 2 : 0);
+          rn.angle = nu->angle;
+          rn.pt = pool.size();
+          pool.insert(pool.end(), (double*) nu->pt, (double*) (nu->pt + nu->np));
+          rn.kv = pool.size();
+          pool.insert(pool.end(), nu->kv, nu->kv + nu->nk);
+          it = nurbs_idx.insert(std::make_pair(nu, (int) nurbs.size())).first;
+          nurbs.push_back(rn);
+        }
+        rc.ref[i] = it->second;
+      }
+    }
+    else
+    {
+      rc.ref[0] = cm->parent->id;
+      rc.part = cm->part;
+    }
+    rc.coefs = pool.size();
+    if (cm->nc > 0)
+      pool.insert(pool.end(), (double*) cm->coefs, (double*) (cm->coefs + cm->nc));
+    elem_cm[e->id] = curv.size();
+    curv.push_back(rc);
+  }
+
+  hdr.ncurv = curv.size();
+  hdr.nnurbs = nurbs.size();
+  hdr.ndoubles = pool.size();
+  hdr.off_nodes = sizeof(RawMeshHeader);
+  hdr.off_elems = hdr.off_nodes + (int64_t) hdr.nnodes * sizeof(RawNode);
+  hdr.off_curv = hdr.off_elems + (int64_t) hdr.nelems * sizeof(RawElement);
+  hdr.off_nurbs = hdr.off_curv + (int64_t) hdr.ncurv * sizeof(RawCurvMap);
+  hdr.off_doubles = hdr.off_nurbs + (int64_t) hdr.nnurbs * sizeof(RawNurbs);
+  hdr.size = hdr.off_doubles + hdr.ndoubles * sizeof(double);
+  hermes2d_fwrite(&hdr, sizeof(hdr), 1, f);
+
+  // nodes
+  std::vector<RawNode> rn(hdr.nnodes);
   Node* n;
   for_all_nodes(n, this)
   {
-    output(n->id, int);
-    unsigned bits = n->ref | (n->type << 29) | (n->bnd << 30) | (n->used << 31);
-    output(bits, unsigned);
-
+    RawNode& r = rn[n->id];
+    r.bits = n->ref | (n->type << 29) | (n->bnd << 30) | (1u << 31);
+    r.p1 = n->p1;
+    r.p2 = n->p2;
     if (n->type == TYPE_VERTEX)
     {
-      output(n->x, double);
-      output(n->y, double);
+      r.x = n->x;
+      r.y = n->y;
     }
     else
     {
-      output(n->marker, int);
-      output(n->elem[0] ? n->elem[0]->id : null, int);
-      output(n->elem[1] ? n->elem[1]->id : null, int);
+      r.marker = n->marker;
+      for (j = 0; j < 2; j++)
+        r.elem[j] = n->elem[j] ? n->elem[j]->id : -1;
     }
-
-    output(n->p1, int);
-    output(n->p2, int);
   }
+  if (hdr.nnodes) hermes2d_fwrite(&rn[0], sizeof(RawNode), hdr.nnodes, f);
+  std::vector<RawNode>().swap(rn);
 
-  nn = elements.get_num_items();
-  mm = elements.get_size();
-  output(nn, int);
-  output(mm, int);
-
-  // dump all elements
-  Element* e;
-  for (int id = 0; id < get_max_element_id(); id++)
+  // elements
+  std::vector<RawElement> re(hdr.nelems);
+  for_all_elements(e, this)
   {
-    if ((e = get_element_fast(id))->used || id < nbase)
+    RawElement& r = re[e->id];
+    r.bits = e->nvert | (e->active << 30) | (1u << 31);
+    r.marker = e->marker;
+    r.userdata = e->userdata;
+    r.iro_cache = e->iro_cache;
+    for (i = 0; i < 4; i++)
     {
-      output(e->id, int);
-      unsigned bits = e->nvert | (e->active << 30) | (e->used << 31);
-      output(bits, unsigned);
-
-      if (e->used)
-      {
-        output(e->marker, int);
-        output(e->userdata, int);
-        output(e->iro_cache, int);
-
-        for (i = 0; i < e->nvert; i++)
-          output(e->vn[i]->id, int);
-
-        if (e->active)
-          for (i = 0; i < e->nvert; i++)
-            output(e->en[i]->id, int);
-        else
-          for (i = 0; i < 4; i++)
-            output(e->sons[i] ? e->sons[i]->id : null, int);
-
-        if (e->is_curved()) error("Not implemented for curved elements yet.");
-      }
+      r.vn[i] = (i < (int) e->nvert) ? e->vn[i]->id : -1;
+      if (e->active)
+        r.en[i] = (i < (int) e->nvert) ? e->en[i]->id : -1;
+      else
+        r.en[i] = e->sons[i] ? e->sons[i]->id : -1;
     }
+    r.cm = elem_cm[e->id];
   }
-  // TODO: curved elements
+  if (hdr.nelems) hermes2d_fwrite(&re[0], sizeof(RawElement), hdr.nelems, f);
 
-  #undef output
+  if (hdr.ncurv) hermes2d_fwrite(&curv[0], sizeof(RawCurvMap), hdr.ncurv, f);
+  if (hdr.nnurbs) hermes2d_fwrite(&nurbs[0], sizeof(RawNurbs), hdr.nnurbs, f);
+  if (hdr.ndoubles) hermes2d_fwrite(&pool[0], sizeof(double), hdr.ndoubles, f);
 }
 
 
 void Mesh::load_raw(FILE* f)
 {
-  int i, j, nv, mv, ne, me, id;
-
   assert(sizeof(int) == 4);
   assert(sizeof(double) == 8);
 
@@ -1713,8 +1977,208 @@ void Mesh::load_raw(FILE* f)
   hermes2d_fread(&hdr, sizeof(hdr), 1, f);
   if (hdr.magic[0] != 'H' || hdr.magic[1] != '2' || hdr.magic[2] != 'D' || hdr.magic[3] != 'M')
     error("Not a Hermes2D raw mesh file.");
-  if (hdr.ver > 1)
-    error("Unsupported file version.");
+  if (hdr.ver == 1)
+  {
+    load_raw_v1(f);
+    return;
+  }
+  check_raw_version(hdr.ver);
+
+  // read the rest of the data and decode it from memory
+  RawMeshHeader full;
+  memcpy(&full, &hdr, sizeof(hdr));
+  hermes2d_fread((char*) &full + sizeof(hdr), sizeof(full) - sizeof(hdr), 1, f);
+  if (full.size < (int64_t) sizeof(full)) error("Corrupt data.");
+
+  char* data = new char[full.size];
+  memcpy(data, &full, sizeof(full));
+  hermes2d_fread(data + sizeof(full), 1, full.size - sizeof(full), f);
+  load_raw_data(data, full.size);
+  delete [] data;
+}
+
+
+void Mesh::load_raw_data(const void* data, size_t size)
+{
+  int i, j;
+
+  const RawMeshHeader* hdr = (const RawMeshHeader*) data;
+  if (size < sizeof(RawMeshHeader) || memcmp(hdr->magic, "H2DM", 4))
+    error("Not a Hermes2D raw mesh file.");
+  check_raw_version(hdr->version);
+
+  // validate the section table
+  int nn = hdr->nnodes, ne = hdr->nelems;
+  if (nn < 0 || ne < 0 || hdr->ncurv < 0 || hdr->nnurbs < 0 || hdr->ndoubles < 0 ||
+      hdr->off_nodes + (int64_t) nn * sizeof(RawNode) > hdr->off_elems ||
+      hdr->off_elems + (int64_t) ne * sizeof(RawElement) > hdr->off_curv ||
+      hdr->off_curv + (int64_t) hdr->ncurv * sizeof(RawCurvMap) > hdr->off_nurbs ||
+      hdr->off_nurbs + (int64_t) hdr->nnurbs * sizeof(RawNurbs) > hdr->off_doubles ||
+      hdr->off_doubles + hdr->ndoubles * (int64_t) sizeof(double) > hdr->size ||
+      hdr->off_nodes < (int64_t) sizeof(RawMeshHeader) || (uint64_t) hdr->size > size)
+    error("Corrupt data.");
+
+  const char* base = (const char*) data;
+  const RawNode* rn = (const RawNode*) (base + hdr->off_nodes);
+  const RawElement* re = (const RawElement*) (base + hdr->off_elems);
+  const RawCurvMap* rc = (const RawCurvMap*) (base + hdr->off_curv);
+  const RawNurbs* rnu = (const RawNurbs*) (base + hdr->off_nurbs);
+  const double* pool = (const double*) (base + hdr->off_doubles);
+  int64_t npool = hdr->ndoubles;
+
+  free();
+  nbase = hdr->nbase;
+  ntopvert = hdr->ntopvert;
+  nactive = hdr->nactive;
+  ninitial = hdr->ninitial;
+  if (nbase > ne || ntopvert > nn) error("Corrupt data.");
+
+  // nodes (the element pointers of edge nodes are set below)
+  nodes.force_size(nn);
+  for (i = 0; i < nn; i++)
+  {
+    const RawNode& r = rn[i];
+    Node* n = &(nodes[i]);
+    n->id = i;
+    n->used = (r.bits >> 31) & 0x1;
+    if (!n->used) continue;
+    n->ref  =  r.bits & 0x1fffffff;
+    n->type = (r.bits >> 29) & 0x1;
+    n->bnd  = (r.bits >> 30) & 0x1;
+    n->p1 = r.p1;
+    n->p2 = r.p2;
+    if (n->type == TYPE_VERTEX)
+    {
+      n->x = r.x;
+      n->y = r.y;
+    }
+    else
+    {
+      n->marker = r.marker;
+      n->elem[0] = n->elem[1] = NULL;
+      n->nurbs = NULL;
+    }
+  }
+  nodes.post_load_scan();
+  HashTable::rebuild();
+
+  // NURBS curves
+  std::vector<Nurbs*> nurbs(hdr->nnurbs);
+  for (i = 0; i < hdr->nnurbs; i++)
+  {
+    const RawNurbs& r = rnu[i];
+    if (r.degree < 1 || r.np <= r.degree || r.nk != r.np + r.degree + 1 ||
+        r.pt < 0 || r.pt + 3*r.np > npool || r.kv < 0 || r.kv + r.nk > npool)
+      error("Corrupt data.");
+    Nurbs* nu = nurbs[i] = new Nurbs;
+    nu->degree = r.degree;
+    nu->np = r.np;
+    nu->pt = new double3[r.np];
+    memcpy(nu->pt, pool + r.pt, sizeof(double3) * r.np);
+    nu->nk = r.nk;
+    nu->kv = new double[r.nk];
+    memcpy(nu->kv, pool + r.kv, sizeof(double) * r.nk);
+    nu->twin = (r.flags & 1) != 0;
+    nu->arc = (r.flags & 2) != 0;
+    nu->angle = r.angle;
+  }
+
+  // elements
+  elements.force_size(ne);
+  for (i = 0; i < ne; i++)
+  {
+    const RawElement& r = re[i];
+    Element* e = &(elements[i]);
+    e->id = i;
+    e->used = (r.bits >> 31) & 0x1;
+    if (!e->used) continue;
+    e->nvert  =  r.bits & 0x3fffffff;
+    e->active = (r.bits >> 30) & 0x1;
+    e->marker = r.marker;
+    e->userdata = r.userdata;
+    e->iro_cache = r.iro_cache;
+    if (e->nvert < 3 || e->nvert > 4) error("Corrupt data.");
+
+    for (j = 0; j < (int) e->nvert; j++)
+    {
+      if (r.vn[j] < 0 || r.vn[j] >= nn) error("Corrupt data.");
+      e->vn[j] = &(nodes[r.vn[j]]);
+    }
+
+    if (e->active)
+    {
+      for (j = 0; j < (int) e->nvert; j++)
+      {
+        if (r.en[j] < 0 || r.en[j] >= nn) error("Corrupt data.");
+        e->en[j] = &(nodes[r.en[j]]);
+      }
+    }
+    else
+    {
+      for (j = 0; j < 4; j++)
+      {
+        if (r.en[j] >= ne) error("Corrupt data.");
+        e->sons[j] = (r.en[j] < 0) ? NULL : &(elements[r.en[j]]);
+      }
+    }
+
+    // curved map
+    e->cm = NULL;
+    if (r.cm < 0) continue;
+    if (r.cm >= hdr->ncurv) error("Corrupt data.");
+    const RawCurvMap& c = rc[r.cm];
+    if (c.nc < 0 || c.coefs < 0 || c.coefs + 2*c.nc > npool) error("Corrupt data.");
+    CurvMap* cm = e->cm = new CurvMap;
+    cm->toplevel = c.toplevel != 0;
+    if (cm->toplevel)
+    {
+      for (j = 0; j < 4; j++)
+      {
+        if (c.ref[j] >= hdr->nnurbs) error("Corrupt data.");
+        cm->nurbs[j] = (c.ref[j] < 0) ? NULL : nurbs[c.ref[j]];
+        if (cm->nurbs[j] != NULL) cm->nurbs[j]->ref++;
+      }
+    }
+    else
+    {
+      if (c.ref[0] < 0 || c.ref[0] >= ne) error("Corrupt data.");
+      cm->parent = &(elements[c.ref[0]]);
+      cm->part = c.part;
+    }
+    cm->order = c.order;
+    cm->nc = c.nc;
+    cm->coefs = new double2[c.nc];
+    memcpy(cm->coefs, pool + c.coefs, sizeof(double2) * c.nc);
+  }
+  elements.post_load_scan(nbase);
+
+  // curves not used by any element
+  for (i = 0; i < hdr->nnurbs; i++)
+    if (!nurbs[i]->ref)
+    {
+      nurbs[i]->ref = 1;
+      nurbs[i]->unref();
+    }
+
+  // update edge node element pointers
+  for (i = 0; i < nn; i++)
+  {
+    Node* n = &(nodes[i]);
+    if (!n->used || n->type != TYPE_EDGE) continue;
+    for (j = 0; j < 2; j++)
+    {
+      if (rn[i].elem[j] >= ne) error("Corrupt data.");
+      n->elem[j] = (rn[i].elem[j] < 0) ? NULL : &(elements[rn[i].elem[j]]);
+    }
+  }
+
+  seq = g_mesh_seq++;
+}
+
+
+void Mesh::load_raw_v1(FILE* f)
+{
+  int i, j, nv, mv, ne, me, id;
 
   #define input(n, type) \
     hermes2d_fread(&(n), sizeof(type), 1, f)
@@ -1837,5 +2301,5 @@ void Mesh::load_raw(FILE* f)
         n->elem[j] = get_element((int) (long) n->elem[j]);
 
   #undef input
-  seq++;
+  seq = g_mesh_seq++;
 }
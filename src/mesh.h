@@ -21,6 +21,7 @@
 
 struct Element;
 class HashTable;
+class Mesh;
 class Space;
 struct MItem;
 
@@ -56,7 +57,6 @@ struct HERMES2D_API Node
   };
 
   int p1, p2; ///< parent id numbers
-  Node* next_hash; ///< next node in hash synonym list
 
   bool is_constrained_vertex() const { assert(type == TYPE_VERTEX); return ref <= 3 && !bnd; }
 
@@ -138,6 +138,40 @@ struct HERMES2D_API Element
 #include "hash.h"
 
 
+/// Flat copy of the active elements of a mesh. The elements are stored in the order of
+/// increasing id. The per-vertex arrays have four entries for each element; the fourth
+/// one is unused for triangles. Loops over the active elements can use the table instead
+/// of following the element and node pointers. The table is a snapshot owned by its user:
+/// it only changes when update() is called, so a loop over it may change the mesh.
+///
+struct HERMES2D_API ActiveElementTable
+{
+  int num;                   ///< number of active elements
+  HERMES2D_API_USED_STL_VECTOR(int);
+  std::vector<int> id;       ///< element id
+  std::vector<int> nvert;    ///< number of vertices
+  std::vector<int> marker;   ///< element marker
+  std::vector<int> vn;       ///< vertex node ids, 4 per element
+  std::vector<int> en_marker; ///< markers of the edges starting at the vertices, 4 per element
+  HERMES2D_API_USED_STL_VECTOR(double);
+  std::vector<double> x, y;  ///< vertex coordinates, 4 per element
+
+  ActiveElementTable() : num(0), mesh(NULL), seq(0) {}
+
+  /// Builds the table for the given mesh, unless it was built for the same mesh with
+  /// the same seq number already (see Mesh::get_seq()).
+  void update(const Mesh* mesh);
+  /// Makes the next update() build the table again, e.g., after vertex nodes were moved.
+  void invalidate() { mesh = NULL; }
+
+protected:
+
+  const Mesh* mesh; ///< the mesh the table was built for
+  unsigned seq;     ///< Mesh::seq the table was built for
+
+};
+
+
 /// \brief Represents a finite element mesh.
 ///
 ///
@@ -150,6 +184,15 @@ public:
   ~Mesh() { free(); dump_hash_stat(); }
   /// Creates a copy of another mesh.
   void copy(const Mesh* mesh);
+  /// Creates a copy-on-write copy of another mesh. Nothing is copied: the two meshes
+  /// share their nodes and elements until one of them is changed by a function of
+  /// this class, which first gives the other copies their own data. Node and element
+  /// pointers obtained from those copies are only valid until then, which they announce
+  /// by a new seq number. The nodes and elements of a shared mesh must not be modified
+  /// directly.
+  void copy_cow(const Mesh* mesh);
+  /// Returns true if the mesh shares its nodes and elements with other meshes.
+  bool is_shared() const { return cow_owner != NULL || !cow_copies.empty(); }
   /// Copies the coarsest elements of another mesh.
   void copy_base(Mesh* mesh);
   /// Copies the refined elements of another mesh.
@@ -200,6 +243,12 @@ public:
   /// \param refinement [in] Same meaning as in refine_element().
   void refine_all_elements(int refinement = 0);
 
+  /// Sets the number of threads used by refine_all_elements(), refine_by_criterion()
+  /// and the functions based on them to calculate the reference maps of new curved
+  /// elements, which is the most expensive part of refining curved meshes. The
+  /// resulting mesh does not depend on the number of threads.
+  void set_num_threads(int num_threads) { this->num_threads = (num_threads > 1) ? num_threads : 1; }
+
   /// Selects elements to refine according to a given criterion and
   /// performs 'depth' levels of refinements. The criterion function
   /// receives a pointer to an element to be considered.
@@ -228,6 +277,14 @@ public:
   /// Space::distribute_orders(). The array must be deallocated with ::free().
   int* regularize(int n);
 
+  /// Like regularize() with n >= 1, but only checks the neighbourhood of the elements 'refined',
+  /// which have been refined since the mesh was last n-irregular. Each new hanging node can
+  /// only affect the neighbours along the refined edges and the sons, so the rest of the mesh
+  /// is not visited. The elements are checked in the same order as by regularize(), so both
+  /// give the same mesh. The IDs of the elements refined by the regularization are appended
+  /// to 'refined' in the order of their refinement, i.e., parents precede their sons.
+  void regularize_refined(int n, std::vector<int>& refined);
+
   /// Recursively removes all son elements of the given element and
   /// makes it active.
   void unrefine_element(int id);
@@ -242,9 +299,11 @@ public:
   void transform(double2x2 m, double2 t);
   void transform(void (*fn)(double* x, double* y));
 
-  /// Loads the entire internal state from a (binary) file. DEPRECATED
+  /// Loads the entire internal state (including refinements and curved
+  /// elements) from a binary file written by save_raw(). Files in the older
+  /// version 1 format are also accepted.
   void load_raw(FILE* f);
-  /// Saves the entire internal state to a (binary) file. DEPRECATED
+  /// Saves the entire internal state to a binary file. See also H2DReader::save_binary().
   void save_raw(FILE* f);
 
   /// For internal use.
@@ -272,6 +331,16 @@ protected:
   int nactive, ninitial;
   unsigned seq;
 
+  Mesh* cow_owner; ///< the mesh whose nodes and elements are shared by this one, or NULL
+  HERMES2D_API_USED_STL_VECTOR(Mesh*);
+  mutable std::vector<Mesh*> cow_copies; ///< meshes sharing the nodes and elements of this one
+
+  /// Ends sharing before the mesh is changed: the shared copies (or this mesh, if it is
+  /// a copy) get their own nodes and elements. The copies of this mesh get a new seq.
+  void make_private();
+  /// Stops sharing before the mesh is freed. The owner hands its data over to a copy.
+  void detach_cow();
+
   Element* create_triangle(int marker, Node* v0, Node* v1, Node* v2, CurvMap* cm);
   Element* create_quad(int marker, Node* v0, Node* v1, Node* v2, Node* v3, CurvMap* cm);
 
@@ -286,6 +355,8 @@ protected:
   int parents_size;
 
   int  get_edge_degree(Node* v1, Node* v2);
+  int  get_regularization_split(Element* e, int n);
+  void push_regularization_neighbours(Element* e, std::vector<Element*>& stack);
   void assign_parent(Element* e, int i);
   void regularize_triangle(Element* e);
   void regularize_quad(Element* e);
@@ -297,7 +368,22 @@ protected:
   void refine_quad_to_triangles(Element* e);
   void refine_element_to_triangles(int id);
 
+  int num_threads;
+  bool defer_refmap_coefs; ///< collect new curved elements in refmap_pending
+  HERMES2D_API_USED_STL_VECTOR(Element*);
+  std::vector<Element*> refmap_pending;
+
+  /// Calculates the reference map of a new curved element, or defers it until
+  /// flush_refmap_coefs() if a whole level of elements is being refined.
+  void update_refmap_coefs(Element* e);
+  void flush_refmap_coefs();
+
+  void load_raw_v1(FILE* f);
+  /// Decodes a mesh saved by save_raw() from memory.
+  void load_raw_data(const void* data, size_t size);
+
   friend class H2DReader;
+  friend class ExodusIIReader;
 };
 
 
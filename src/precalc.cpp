@@ -16,8 +16,12 @@
 #include "common.h"
 #include "quad.h"
 #include "precalc.h"
+#include <algorithm>
 
 
+// cur_key of a shapeset which has no active shape function
+static const unsigned no_key = (unsigned) -1;
+
 
 PrecalcShapeset::PrecalcShapeset(Shapeset* shapeset)
                : RealFunction()
@@ -27,6 +31,8 @@ PrecalcShapeset::PrecalcShapeset(Shapeset* shapeset)
   num_components = shapeset->get_num_components();
   assert(num_components == 1 || num_components == 2);
   tables = NULL;
+  cur_key = no_key;
+  stamp_clock = 0;
   update_max_index();
   set_quad_2d(&g_quad_2d_std);
 }
@@ -38,9 +44,13 @@ PrecalcShapeset::PrecalcShapeset(PrecalcShapeset* pss)
   while (pss->is_slave())
     pss = pss->master_pss;
   master_pss = pss;
+  table_owner = pss;
+  pss->slaves.push_back(this);
   shapeset = pss->shapeset;
   num_components = pss->num_components;
   tables = NULL;
+  cur_key = no_key;
+  stamp_clock = 0;
   update_max_index();
   set_quad_2d(&g_quad_2d_std);
 }
@@ -90,10 +100,14 @@ void PrecalcShapeset::set_active_shape(int index)
   // val/d/dd indices are used directly in the Node structure.
 
   unsigned key = cur_quad | (mode << 3) | ((unsigned) (max_index[mode] - index) << 4);
-  void** tab = (master_pss == NULL) ? &tables : &(master_pss->tables);
-  sub_tables = (void**) JudyLIns(tab, key, NULL);
+  PrecalcShapeset* owner = (master_pss == NULL) ? this : master_pss;
+  sub_tables = (void**) JudyLIns(&(owner->tables), key, NULL);
   update_nodes_ptr();
 
+  cur_key = key;
+  if (owner->mem_budget > 0)
+    owner->key_stamps[key] = ++(owner->stamp_clock);
+
   this->index = index;
   order = shapeset->get_order(index);
   order = std::max(get_h_order(order), get_v_order(order));
@@ -102,6 +116,11 @@ void PrecalcShapeset::set_active_shape(int index)
 
 void PrecalcShapeset::set_active_element(Element* e)
 {
+  // the values on the previous element are no longer needed, so this is
+  // a safe point for freeing tables which exceed the memory budget
+  if (over_budget())
+    ((master_pss == NULL) ? this : master_pss)->trim_tables();
+
   mode = e->get_mode();
   shapeset->set_mode(mode);
   get_quad_2d()->set_mode(mode);
@@ -167,6 +186,51 @@ void PrecalcShapeset::free()
     JudyLDel(&tables, key, NULL);
     sub = JudyLNext(tables, &key, NULL);
   }
+  key_stamps.clear();
+}
+
+
+void PrecalcShapeset::trim_tables()
+{
+  assert(master_pss == NULL);
+
+  // collect the primary tables which are not in use, together with their last use
+  std::vector<std::pair<unsigned long, unsigned> > lru;
+  unsigned long key = 0;
+  void** sub = (void**) JudyLFirst(tables, &key, NULL);
+  while (sub != NULL)
+  {
+    bool in_use = (key == cur_key);
+    for (unsigned int i = 0; i < slaves.size() && !in_use; i++)
+      if (key == slaves[i]->cur_key) in_use = true;
+
+    if (!in_use)
+    {
+      std::map<unsigned, unsigned long>::iterator it = key_stamps.find(key);
+      lru.push_back(std::make_pair(it != key_stamps.end() ? it->second : 0ul, (unsigned) key));
+    }
+    sub = JudyLNext(tables, &key, NULL);
+  }
+  std::sort(lru.begin(), lru.end());
+
+  // free the least recently used tables until we get safely below the budget
+  size_t low_mark = mem_budget - mem_budget / 4;
+  for (unsigned int i = 0; i < lru.size() && total_mem > low_mark; i++)
+  {
+    sub = (void**) JudyLGet(tables, lru[i].second, NULL);
+    free_sub_tables(sub);
+    JudyLDel(&tables, lru[i].second, NULL);
+    key_stamps.erase(lru[i].second);
+    cache_evictions++;
+  }
+
+  // deleting from the primary array may have moved the slots of the remaining tables;
+  // shapesets with no active shape function have no slot
+  if (cur_key != no_key)
+    sub_tables = (void**) JudyLIns(&tables, cur_key, NULL);
+  for (unsigned int i = 0; i < slaves.size(); i++)
+    if (slaves[i]->cur_key != no_key)
+      slaves[i]->sub_tables = (void**) JudyLIns(&tables, slaves[i]->cur_key, NULL);
 }
 
 
@@ -217,12 +281,18 @@ extern PrecalcShapeset ref_map_pss; // see below
 
 PrecalcShapeset::~PrecalcShapeset()
 {
+  if (master_pss != NULL)
+  {
+    std::vector<PrecalcShapeset*>& s = master_pss->slaves;
+    s.erase(std::find(s.begin(), s.end(), this));
+  }
+
   free();
   JudyLFreeArray(&tables, NULL);
 
   /*if (master_pss == NULL)
   {
-    verbose("~PrecalcShapeset(): peak size of precalculated tables: %d B (%0.1lf MB)%s", max_mem,
+    verbose("~PrecalcShapeset(): peak size of precalculated tables: %lu B (%0.1lf MB)%s", (unsigned long) max_mem,
             (double) max_mem / (1024 * 1024), (this == &ref_map_pss) ? " (refmap)" : "");
   }*/
 }
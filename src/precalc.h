@@ -18,6 +18,7 @@
 
 #include "function.h"
 #include "shapeset.h"
+#include <map>
 
 
 /// \brief Caches precalculated shape function values.
@@ -94,8 +95,13 @@ protected:
   int mode;
   int index;
   int max_index[2];
+  unsigned cur_key; ///< key of the current primary table
 
   PrecalcShapeset* master_pss;
+  std::vector<PrecalcShapeset*> slaves; ///< slaves sharing the tables of this master
+
+  std::map<unsigned, unsigned long> key_stamps; ///< last use of primary tables (with a budget only)
+  unsigned long stamp_clock;
 
   bool is_slave() const { return master_pss != NULL; }
 
@@ -103,6 +109,10 @@ protected:
 
   void update_max_index();
 
+  /// Frees the least recently used primary tables until the memory budget is met.
+  /// Tables currently selected by the master or any of its slaves are kept.
+  void trim_tables();
+
   /// Forces a transform without using push_transform() etc.
   /// Used by the Solution class. <b>For internal use only</b>.
   void force_transform(uint64_t sub_idx, Trf* ctm)
@@ -0,0 +1,306 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "profiler.h"
+#include <time.h>
+#ifndef WIN32
+  #include <sys/time.h>
+  #include <unistd.h>
+#endif
+
+
+Profiler* Profiler::current = NULL;
+
+
+static double get_wall_time()
+{
+#ifndef WIN32
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static double get_cpu_time()
+{
+  return (double) clock() / CLOCKS_PER_SEC;
+}
+
+
+long Profiler::get_resident_size()
+{
+#ifdef __linux__
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f == NULL) return -1;
+  unsigned long size, resident;
+  int n = fscanf(f, "%lu %lu", &size, &resident);
+  fclose(f);
+  if (n != 2) return -1;
+  return (long) resident * sysconf(_SC_PAGESIZE);
+#else
+  return -1;
+#endif
+}
+
+
+Profiler::Profiler()
+{
+}
+
+
+Profiler::~Profiler()
+{
+  if (current == this)
+    current = NULL;
+}
+
+
+void Profiler::clear()
+{
+  if (!stack.empty()) error("Phases have to be stopped first.");
+  iterations.clear();
+}
+
+
+Profiler::Iteration& Profiler::get_iteration()
+{
+  if (iterations.empty())
+  {
+    Iteration it;
+    it.number = -1;
+    iterations.push_back(it);
+  }
+  return iterations.back();
+}
+
+
+void Profiler::begin_iteration(int number)
+{
+  if (!stack.empty()) error("Phases have to be stopped before a new iteration is started.");
+  Iteration it;
+  it.number = number;
+  iterations.push_back(it);
+}
+
+
+void Profiler::update_memory(long rss)
+{
+  if (rss < 0) return;
+  Iteration& it = get_iteration();
+  for (unsigned i = 0; i < stack.size(); i++)
+  {
+    Phase& phase = it.phases[stack[i].index];
+    if (rss > phase.rss_max) phase.rss_max = rss;
+  }
+}
+
+
+void Profiler::begin_phase(const char* name)
+{
+  Iteration& it = get_iteration();
+  std::string path = stack.empty() ? std::string(name) : it.phases[stack.back().index].path + "/" + name;
+
+  // repeated phases are summed
+  int index = -1;
+  for (unsigned i = 0; i < it.phases.size(); i++)
+    if (it.phases[i].path == path) { index = i; break; }
+  if (index < 0)
+  {
+    Phase phase;
+    phase.path = path;
+    phase.depth = stack.size();
+    phase.calls = 0;
+    phase.wall = phase.cpu = 0.0;
+    phase.rss_max = -1;
+    index = it.phases.size();
+    it.phases.push_back(phase);
+  }
+  it.phases[index].calls++;
+
+  OpenPhase open = { index, 0.0, 0.0 };
+  stack.push_back(open);
+  update_memory(get_resident_size());
+  stack.back().wall = get_wall_time();
+  stack.back().cpu = get_cpu_time();
+}
+
+
+double Profiler::end_phase()
+{
+  if (stack.empty()) error("No phase was started.");
+  double wall = get_wall_time() - stack.back().wall;
+  double cpu = get_cpu_time() - stack.back().cpu;
+  update_memory(get_resident_size());
+
+  Phase& phase = get_iteration().phases[stack.back().index];
+  phase.wall += wall;
+  phase.cpu += cpu;
+  stack.pop_back();
+  return wall;
+}
+
+
+Profiler::Counter& Profiler::get_counter(const char* name)
+{
+  Iteration& it = get_iteration();
+  for (unsigned i = 0; i < it.counters.size(); i++)
+    if (it.counters[i].name == name)
+      return it.counters[i];
+  Counter counter;
+  counter.name = name;
+  counter.value = 0.0;
+  it.counters.push_back(counter);
+  return it.counters.back();
+}
+
+
+void Profiler::add_count(const char* name, double value)
+{
+  get_counter(name).value += value;
+}
+
+
+void Profiler::set_count(const char* name, double value)
+{
+  get_counter(name).value = value;
+}
+
+
+double Profiler::get_phase_time(const char* path) const
+{
+  if (iterations.empty()) return 0.0;
+  const Iteration& it = iterations.back();
+  for (unsigned i = 0; i < it.phases.size(); i++)
+    if (it.phases[i].path == path)
+      return it.phases[i].wall;
+  return 0.0;
+}
+
+
+double Profiler::get_count(const char* name) const
+{
+  if (iterations.empty()) return 0.0;
+  const Iteration& it = iterations.back();
+  for (unsigned i = 0; i < it.counters.size(); i++)
+    if (it.counters[i].name == name)
+      return it.counters[i].value;
+  return 0.0;
+}
+
+
+// Writes a string as a JSON or CSV string literal.
+static void write_string(FILE* f, const std::string& str, bool json)
+{
+  fputc('"', f);
+  for (unsigned i = 0; i < str.size(); i++)
+  {
+    char c = str[i];
+    if (c == '"') fputs(json ? "\\\"" : "\"\"", f);
+    else if (c == '\\' && json) fputs("\\\\", f);
+    else fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+
+void Profiler::save_json(const char* filename) const
+{
+  FILE* f = fopen(filename, "w");
+  if (f == NULL) error("Error writing to %s.", filename);
+
+  fprintf(f, "{\n  \"iterations\": [");
+  for (unsigned i = 0; i < iterations.size(); i++)
+  {
+    const Iteration& it = iterations[i];
+    fprintf(f, "%s\n    {\n      \"iteration\": %d,\n      \"phases\": [", i ? "," : "", it.number);
+    for (unsigned j = 0; j < it.phases.size(); j++)
+    {
+      const Phase& phase = it.phases[j];
+      fprintf(f, "%s\n        { \"path\": ", j ? "," : "");
+      write_string(f, phase.path, true);
+      fprintf(f, ", \"depth\": %d, \"calls\": %d, \"wall\": %.6g, \"cpu\": %.6g, \"rss_max\": ",
+              phase.depth, phase.calls, phase.wall, phase.cpu);
+      if (phase.rss_max >= 0) fprintf(f, "%ld }", phase.rss_max);
+      else fprintf(f, "null }");
+    }
+    fprintf(f, "\n      ],\n      \"counters\": {");
+    for (unsigned j = 0; j < it.counters.size(); j++)
+    {
+      fprintf(f, "%s\n        ", j ? "," : "");
+      write_string(f, it.counters[j].name, true);
+      fprintf(f, ": %.14g", it.counters[j].value);
+    }
+    fprintf(f, "\n      }\n    }");
+  }
+  fprintf(f, "\n  ]\n}\n");
+
+  info("Profile saved to file '%s'.", filename);
+  fclose(f);
+}
+
+
+void Profiler::save_csv(const char* filename) const
+{
+  FILE* f = fopen(filename, "w");
+  if (f == NULL) error("Error writing to %s.", filename);
+
+  fprintf(f, "iteration,kind,name,calls,wall,cpu,rss_max,value\n");
+  for (unsigned i = 0; i < iterations.size(); i++)
+  {
+    const Iteration& it = iterations[i];
+    for (unsigned j = 0; j < it.phases.size(); j++)
+    {
+      const Phase& phase = it.phases[j];
+      fprintf(f, "%d,phase,", it.number);
+      write_string(f, phase.path, false);
+      fprintf(f, ",%d,%.6g,%.6g,", phase.calls, phase.wall, phase.cpu);
+      if (phase.rss_max >= 0) fprintf(f, "%ld", phase.rss_max);
+      fprintf(f, ",\n");
+    }
+    for (unsigned j = 0; j < it.counters.size(); j++)
+    {
+      fprintf(f, "%d,counter,", it.number);
+      write_string(f, it.counters[j].name, false);
+      fprintf(f, ",,,,,%.14g\n", it.counters[j].value);
+    }
+  }
+
+  info("Profile saved to file '%s'.", filename);
+  fclose(f);
+}
+
+
+void Profiler::print() const
+{
+  if (iterations.empty()) return;
+  const Iteration& it = iterations.back();
+  printf("Profile of iteration %d:\n", it.number);
+  for (unsigned i = 0; i < it.phases.size(); i++)
+  {
+    const Phase& phase = it.phases[i];
+    std::string name = phase.path.substr(phase.path.rfind('/') + 1);
+    int indent = std::min(2 * phase.depth, 20);
+    printf("  %*s%-*s %10.4f s wall %10.4f s cpu %6d calls ", indent, "", 30 - indent,
+           name.c_str(), phase.wall, phase.cpu, phase.calls);
+    if (phase.rss_max >= 0) printf("%8.1f MB\n", phase.rss_max / 1048576.0);
+    else printf("%8s MB\n", "n/a");
+  }
+  for (unsigned i = 0; i < it.counters.size(); i++)
+    printf("  %-30s %14.14g\n", it.counters[i].name.c_str(), it.counters[i].value);
+}
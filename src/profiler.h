@@ -0,0 +1,148 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __HERMES2D_PROFILER_H
+#define __HERMES2D_PROFILER_H
+
+#include <string>
+#include <vector>
+
+
+///  Profiler collects statistics of adaptivity iterations: wall and CPU times of nested
+///  phases, counters and resident set sizes. Phases are started by begin_phase() and
+///  stopped by end_phase(), or by the scoped helper ProfilerPhase. A phase started inside
+///  another one is recorded under the path "outer/inner"; repeated phases with the same path
+///  are summed. Counters are added by add_count() or set to a value by set_count().
+///
+///  The library records its phases (assembling, solving, error calculation, adaptivity,
+///  DOF assignment) and counters into the profiler selected by set_current(). Nothing is
+///  recorded if no profiler is selected. The profiler is not thread-safe; the library records
+///  only from the calling thread.
+///
+///  The resident set size of a phase is the largest one sampled when this phase or a nested
+///  phase was started or stopped, not a true peak: memory allocated and freed in between is
+///  not seen. It is measured on Linux only, elsewhere it is reported as unavailable (-1 by
+///  get_resident_size(), null in JSON, an empty field in CSV and "n/a" by print()).
+///
+///  The statistics are kept per iteration, which is started by begin_iteration(). Phases
+///  recorded before the first iteration belong to an iteration with the number -1. The report
+///  is saved by save_json() or save_csv(), or printed by print().
+///
+class HERMES2D_API Profiler
+{
+public:
+
+  Profiler();
+  ~Profiler();
+
+  /// Starts a new iteration. All phases have to be stopped.
+  void begin_iteration(int number);
+  /// Starts a phase. Phases can be nested.
+  void begin_phase(const char* name);
+  /// Stops the last started phase. Returns its wall time in seconds.
+  double end_phase();
+
+  /// Adds a value to a counter of the current iteration.
+  void add_count(const char* name, double value = 1.0);
+  /// Sets a counter of the current iteration, e.g., a size of a cache.
+  void set_count(const char* name, double value);
+
+  /// Returns the wall time of a phase of the last iteration, zero if it was not recorded.
+  double get_phase_time(const char* path) const;
+  /// Returns a counter of the last iteration, zero if it was not recorded.
+  double get_count(const char* name) const;
+
+  /// Saves the statistics of all iterations as JSON.
+  void save_json(const char* filename) const;
+  /// Saves the statistics of all iterations as CSV, a line per phase or counter.
+  void save_csv(const char* filename) const;
+  /// Prints the statistics of the last iteration to the standard output.
+  void print() const;
+  /// Removes all statistics.
+  void clear();
+
+  /// Selects the profiler used by the library, NULL disables recording.
+  static void set_current(Profiler* profiler) { current = profiler; }
+  /// Returns the profiler used by the library, NULL if none.
+  static Profiler* get_current() { return current; }
+
+  /// Returns the current resident set size of the process in bytes, -1 if not available.
+  static long get_resident_size();
+
+protected:
+
+  struct Phase {
+    std::string path;
+    int depth;
+    int calls;
+    double wall, cpu;
+    long rss_max; ///< largest resident set size sampled at the phase boundaries, -1 if unknown
+  };
+
+  struct Counter {
+    std::string name;
+    double value;
+  };
+
+  struct Iteration {
+    int number;
+    std::vector<Phase> phases;
+    std::vector<Counter> counters;
+  };
+
+  struct OpenPhase {
+    int index;
+    double wall, cpu;
+  };
+
+  std::vector<Iteration> iterations;
+  std::vector<OpenPhase> stack;
+
+  Iteration& get_iteration();
+  Counter& get_counter(const char* name);
+  void update_memory(long rss);
+
+  static Profiler* current;
+
+};
+
+
+///  ProfilerPhase records a phase into the current profiler for its lifetime.
+///
+class HERMES2D_API ProfilerPhase
+{
+public:
+
+  ProfilerPhase(const char* name) : profiler(Profiler::get_current())
+    { if (profiler != NULL) profiler->begin_phase(name); }
+  ~ProfilerPhase()
+    { if (profiler != NULL) profiler->end_phase(); }
+
+protected:
+
+  Profiler* profiler;
+
+};
+
+
+/// Adds a value to a counter of the current profiler, if any.
+inline void profiler_count(const char* name, double value)
+{
+  Profiler* profiler = Profiler::get_current();
+  if (profiler != NULL) profiler->add_count(name, value);
+}
+
+
+#endif
@@ -41,6 +41,8 @@ class HERMES2D_API Quad1D
 {
 public:
 
+  virtual ~Quad1D() {}
+
   double2* get_points(int order) const { return tables[order]; }
   int get_num_points(int order) const { return np[order]; };
 
@@ -66,6 +68,8 @@ class HERMES2D_API Quad2D
 {
 public:
 
+  virtual ~Quad2D() {}
+
   void set_mode(int mode) { this->mode = mode; }
   int  get_mode() const { return mode; }
 
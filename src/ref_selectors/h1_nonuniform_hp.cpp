@@ -4,42 +4,112 @@
 #include "../shapeset_h1_all.h"
 #include "../element_to_refine.h"
 #include "h1_nonuniform_hp.h"
+#include <map>
+#include <algorithm>
+
+#define H2DRS_NUM_SUB_TRFS 9 ///< A number of sub-element transformations: the identity and eight transformations to sons.
 
 namespace RefinementSelectors {
+
+  // Projection matrices and values of shape functions at GIP do not depend on the element
+  // being refined, just on the mode, the orders, the sub-element transformation and the
+  // shapeset. They are kept across calls of adapt() and shared by all selectors which use
+  // a shapeset of the same type, including the clones used by parallel adaptivity. A cache
+  // is freed together with the last selector which uses it.
+  struct H1ProjCache {
+    double** chol_matrices[H2D_NUM_MODES][H2DRS_MAX_ORDER+1][H2DRS_MAX_ORDER+1]; ///< Cholesky factors of projection matrices.
+    double* chol_diags[H2D_NUM_MODES][H2DRS_MAX_ORDER+1][H2DRS_MAX_ORDER+1]; ///< Diagonals of the Cholesky factors.
+    double3** shape_values[H2D_NUM_MODES][H2DRS_NUM_SUB_TRFS]; ///< Values of shape functions at transformed GIP.
+    TableCacheStats stats; ///< Memory usage and hit/miss counters.
+    int shapeset_id; ///< ID of the shapeset, the key of the cache.
+    int num_users; ///< A number of selectors which use the cache.
+
+    H1ProjCache(int shapeset_id) : shapeset_id(shapeset_id), num_users(0) {
+      memset(chol_matrices, 0, sizeof(chol_matrices));
+      memset(chol_diags, 0, sizeof(chol_diags));
+      memset(shape_values, 0, sizeof(shape_values));
+      memset(&stats, 0, sizeof(stats));
+    }
+
+    ~H1ProjCache() {
+      for(int m = 0; m < H2D_NUM_MODES; m++) {
+        for(int i = 0; i <= H2DRS_MAX_ORDER; i++)
+          for(int k = 0; k <= H2DRS_MAX_ORDER; k++) {
+            delete[] (char*) chol_matrices[m][i][k];
+            delete[] chol_diags[m][i][k];
+          }
+        for(int i = 0; i < H2DRS_NUM_SUB_TRFS; i++)
+          delete[] (char*) shape_values[m][i];
+      }
+    }
+  };
+
+  // Caches in use indexed by the shapeset id, allocated while there are any.
+  typedef std::map<int, H1ProjCache*> H1ProjCacheMap;
+  static H1ProjCacheMap* proj_caches = NULL;
+  static pthread_mutex_t proj_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+  static Trf trf_identity = { {1.0, 1.0}, {0.0, 0.0} };
+
+  // Returns a sub-element transformation given by an index accepted by get_shape_values().
+  static Trf* get_sub_trf(const int mode, const int inx_trf) {
+    if (inx_trf == 0)
+      return &trf_identity;
+    return (mode == MODE_TRIANGLE) ? &tri_trf[inx_trf-1] : &quad_trf[inx_trf-1];
+  }
+
   H1Shapeset H1NonUniformHP::default_shapeset;
 
   H1NonUniformHP::H1NonUniformHP(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, H1Shapeset* user_shapeset)
     : ProjBasedSelector(iso_only, cands_allowed, conv_exp, max_order, user_shapeset == NULL ? &default_shapeset : user_shapeset)
-    , rhs_cache(NULL) {
+    , proj_cache(NULL), own_shapeset(NULL) {
       //build shape indices
       build_shape_indices(MODE_TRIANGLE);
       evalute_shape_indices(MODE_TRIANGLE);
       build_shape_indices(MODE_QUAD);
       evalute_shape_indices(MODE_QUAD);
 
-      //clear matrix cache
-      for(int i = 0; i < H2DRS_MAX_ORDER+1; i++)
-        for(int k = 0; k < H2DRS_MAX_ORDER+1; k++)
-          proj_matrices[i][k] = NULL;
-
-      //allocate cache
-      int max_inx = max_shape_inx[0];
-      for(int i = 1; i < H2D_NUM_MODES; i++)
-        max_inx = std::max(max_inx, max_shape_inx[i]);
-      rhs_cache = new ValueCacheItem<scalar>[max_inx + 1];
+      //find the shared cache of projections
+      pthread_mutex_lock(&proj_cache_mutex);
+      if (proj_caches == NULL)
+        proj_caches = new H1ProjCacheMap();
+      H1ProjCache*& cache = (*proj_caches)[shapeset->get_id()];
+      if (cache == NULL)
+        cache = new H1ProjCache(shapeset->get_id());
+      cache->num_users++;
+      proj_cache = cache;
+      pthread_mutex_unlock(&proj_cache_mutex);
   }
 
   H1NonUniformHP::~H1NonUniformHP() {
-    delete[] rhs_cache;
-    for(int i = 0; i < H2DRS_MAX_ORDER+1; i++) {
-      for(int k = 0; k < H2DRS_MAX_ORDER+1; k++) {
-        if (proj_matrices[i][k] != NULL)
-          free(proj_matrices[i][k]);
-
+    //release the shared cache of projections
+    pthread_mutex_lock(&proj_cache_mutex);
+    if (--proj_cache->num_users == 0) {
+      proj_caches->erase(proj_cache->shapeset_id);
+      delete proj_cache;
+      if (proj_caches->empty()) {
+        delete proj_caches;
+        proj_caches = NULL;
       }
     }
+    pthread_mutex_unlock(&proj_cache_mutex);
+
+    delete own_shapeset;
+  }
+
+  Selector* H1NonUniformHP::clone() const {
+    H1Shapeset* shapeset = new H1Shapeset();
+    H1NonUniformHP* copy = new H1NonUniformHP(iso_only, cands_allowed, conv_exp, max_order, shapeset);
+    copy->own_shapeset = shapeset;
+    copy->use_private_quad();
+    return copy;
   }
 
+  void H1NonUniformHP::get_cache_stats(TableCacheStats& stats) const {
+    pthread_mutex_lock(&proj_cache_mutex);
+    stats = proj_cache->stats;
+    pthread_mutex_unlock(&proj_cache_mutex);
+  }
 
   void H1NonUniformHP::evalute_shape_indices(const int mode) {
     std::vector<ShapeInx> &indices = shape_indices[mode];
@@ -107,7 +177,6 @@ namespace RefinementSelectors {
     int mode = e->get_mode();
 
     // select quadrature, obtain integration points and weights
-    Quad2D* quad = &g_quad_2d_std;
     quad->set_mode(mode);
     rsln->set_quad_2d(quad);
     double3* gip_points = quad->get_points(H2DRS_GIP_ORDER);
@@ -131,53 +200,50 @@ namespace RefinementSelectors {
       rval[son][H2D_FN_DY] = rsln->get_dy_values();
     }
 
+    //all projections share the values of the reference solution and the factors of projection matrices
+    scalar** son_rval[4] = { rval[0], rval[1], rval[2], rval[3] };
+    ProjArea areas[9];
+    int num_areas = 0;
+
     //H-candidates
-    {
-      Trf trf_identity = { {1.0, 1.0}, {0.0, 0.0} };
-      Trf* p_trf_identity[1] = { &trf_identity };
-      double coef_mm = 1;
-      for(int son = 0; son < H2D_MAX_ELEMENT_SONS; son++) {
-        scalar **sub_rval[1] = { rval[son] };
-        proj_calc_err_son(mode, gip_points, num_gip_points
-          , 1, &base_element->sons[son], p_trf_identity, sub_rval, &coef_mm, &coef_mm
-          , max_quad_order_h, herr[son]);
-      }
+    const int h_trfs[1] = { 0 };
+    const double h_coefs[1] = { 1.0 };
+    for(int son = 0; son < H2D_MAX_ELEMENT_SONS; son++) {
+      ProjArea area = { 1, h_trfs, &son_rval[son], h_coefs, h_coefs, max_quad_order_h, herr[son] };
+      areas[num_areas++] = area;
     }
 
     //ANISO-candidates
+    const int sons[4][2] = { {0,1}, {3,2}, {0,3}, {1,2} }; //indices of sons for sub-areas
+    const int tr[4][2]   = { {6,7}, {6,7}, {4,5}, {4,5} }; //indices of ref. domain transformations for sub-areas
+    const double mx[4] = { 2.0, 2.0, 1.0, 1.0}; //scale coefficients of dx for X-axis due to trasformations
+    const double my[4] = { 1.0, 1.0, 2.0, 2.0}; //scale coefficients of dy for Y-axis due to trasformations
+    int aniso_trfs[4][2];
+    double aniso_mx[4][2], aniso_my[4][2];
+    scalar** aniso_rval[4][2];
     if (mode == MODE_QUAD && !iso_only) {
-      const double mx[4] = { 2.0, 2.0, 1.0, 1.0}; //scale coefficients of dx for X-axis due to trasformations
-      const double my[4] = { 1.0, 1.0, 2.0, 2.0}; //scale coefficients of dy for Y-axis due to trasformations
-      const int sons[4][2] = { {0,1}, {3,2}, {0,3}, {1,2} }; //indices of sons for sub-areas
-      const int tr[4][2]   = { {6,7}, {6,7}, {4,5}, {4,5} }; //indices of ref. domain transformations for sub-areas
       for(int version = 0; version < 4; version++) { // 2 sons for vertical split, 2 sons for horizontal split
-        Trf* sub_trfs[2] = { &quad_trf[tr[version][0]], &quad_trf[tr[version][1]] };
-        Element* sub_elems[2] = { base_element->sons[sons[version][0]], base_element->sons[sons[version][1]] };
-        scalar **sub_rval[2] = { rval[sons[version][0]], rval[sons[version][1]] };
-        double coefs_mx[2] = { mx[version], mx[version] }, coefs_my[2] = { my[version], my[version] };
-        proj_calc_err_son(mode, gip_points, num_gip_points
-          , 2, sub_elems, sub_trfs, sub_rval, coefs_mx, coefs_my
-          , max_quad_order_aniso, anisoerr[version]);
+        for(int i = 0; i < 2; i++) {
+          aniso_trfs[version][i] = 1 + tr[version][i];
+          aniso_mx[version][i] = mx[version];
+          aniso_my[version][i] = my[version];
+          aniso_rval[version][i] = son_rval[sons[version][i]];
+        }
+        ProjArea area = { 2, aniso_trfs[version], aniso_rval[version], aniso_mx[version], aniso_my[version], max_quad_order_aniso, anisoerr[version] };
+        areas[num_areas++] = area;
       }
     }
 
     //P-candidates
-    {
-      Trf* src_trfs = NULL;
-      if (mode == MODE_TRIANGLE)
-        src_trfs = tri_trf;
-      else
-        src_trfs = quad_trf;
-      Trf* sub_trfs[4] = { &src_trfs[0], &src_trfs[1], &src_trfs[2], &src_trfs[3] };
-      scalar **sub_rval[4] = { rval[0], rval[1], rval[2], rval[3] };
-      double coefs_mm[4] = { 2.0, 2.0, 2.0, (mode == MODE_TRIANGLE) ? -2.0 : 2.0 };
-      proj_calc_err_son(mode, gip_points, num_gip_points
-        , 4, base_element->sons, sub_trfs, sub_rval, coefs_mm, coefs_mm
-        , max_quad_order_p, perr);
-    }
+    const int p_trfs[4] = { 1, 2, 3, 4 };
+    const double p_coefs[4] = { 2.0, 2.0, 2.0, (mode == MODE_TRIANGLE) ? -2.0 : 2.0 };
+    ProjArea area = { 4, p_trfs, son_rval, p_coefs, p_coefs, max_quad_order_p, perr };
+    areas[num_areas++] = area;
+
+    proj_calc_errors(mode, gip_points, num_gip_points, areas, num_areas);
   }
 
-  double** H1NonUniformHP::build_projection_matrix(Shapeset& shapeset,
+  double** H1NonUniformHP::build_projection_matrix(double3** shape_values,
     double3* gip_points, int num_gip_points,
     const int* shape_inx, const int num_shapes) {
     //allocate
@@ -187,21 +253,15 @@ namespace RefinementSelectors {
     int inx_row = 0;
     for(int i = 0; i < num_shapes; i++, inx_row += num_shapes) {
       double* matrix_row = matrix[i];
-      int shape0_inx = shape_inx[i];
+      double3* shape0_values = shape_values[shape_inx[i]];
       for(int k = 0; k < num_shapes; k++) {
-        int shape1_inx = shape_inx[k];
+        double3* shape1_values = shape_values[shape_inx[k]];
 
         double value = 0.0;
         for(int j = 0; j < num_gip_points; j++) {
-          double gip_x = gip_points[j][H2D_GIP2D_X], gip_y = gip_points[j][H2D_GIP2D_Y];
-          double value0 = shapeset.get_value(H2D_FN_VALUE, shape0_inx, gip_x, gip_y, 0);
-          double value1 = shapeset.get_value(H2D_FN_VALUE, shape1_inx, gip_x, gip_y, 0);
-          double dx0 = shapeset.get_value(H2D_FN_DX, shape0_inx, gip_x, gip_y, 0);
-          double dx1 = shapeset.get_value(H2D_FN_DX, shape1_inx, gip_x, gip_y, 0);
-          double dy0 = shapeset.get_value(H2D_FN_DY, shape0_inx, gip_x, gip_y, 0);
-          double dy1 = shapeset.get_value(H2D_FN_DY, shape1_inx, gip_x, gip_y, 0);
-
-          value += gip_points[j][H2D_GIP2D_W] * (value0*value1 + dx0*dx1 + dy0*dy1);
+          double3& val0 = shape0_values[j];
+          double3& val1 = shape1_values[j];
+          value += gip_points[j][H2D_GIP2D_W] * (val0[H2D_FN_VALUE]*val1[H2D_FN_VALUE] + val0[H2D_FN_DX]*val1[H2D_FN_DX] + val0[H2D_FN_DY]*val1[H2D_FN_DY]);
         }
 
         matrix_row[k] = value;
@@ -211,158 +271,200 @@ namespace RefinementSelectors {
     return matrix;
   }
 
-  void H1NonUniformHP::proj_calc_err_son(const int mode
-    , double3* gip_points, int num_gip_points
-    , const int num_sub, Element** sub_elems, Trf** sub_trfs, scalar*** sub_rvals, double* coefs_mx, double* coefs_my
-    , int max_quad_order
-    , SonProjectionError errors
-    ) {
-    //allocate space
-    int max_num_shapes = next_order_shape[mode][current_max_order] - next_order_shape[mode][0];
+  double3** H1NonUniformHP::get_shape_values(const int mode, const int inx_trf, double3* gip_points, int num_gip_points) {
+    assert_msg(inx_trf >= 0 && inx_trf < H2DRS_NUM_SUB_TRFS, "E invalid index of a sub-element transformation (%d)", inx_trf);
+    pthread_mutex_lock(&proj_cache_mutex);
+    double3**& values = proj_cache->shape_values[mode][inx_trf];
+    if (values == NULL) {
+      //evaluate shape functions at transformed GIP
+      int num_shapes = max_shape_inx[mode] + 1;
+      values = new_matrix<double3>(num_shapes, num_gip_points);
+      shapeset->set_mode(mode);
+      Trf* trf = get_sub_trf(mode, inx_trf);
+      std::vector<ShapeInx>& indices = shape_indices[mode];
+      for(unsigned int i = 0; i < indices.size(); i++) {
+        double3* shape_values = values[indices[i].inx];
+        for(int j = 0; j < num_gip_points; j++) {
+          double ref_x = gip_points[j][H2D_GIP2D_X] * trf->m[0] + trf->t[0];
+          double ref_y = gip_points[j][H2D_GIP2D_Y] * trf->m[1] + trf->t[1];
+          shape_values[j][H2D_FN_VALUE] = shapeset->get_fn_value(indices[i].inx, ref_x, ref_y, 0);
+          shape_values[j][H2D_FN_DX] = shapeset->get_dx_value(indices[i].inx, ref_x, ref_y, 0);
+          shape_values[j][H2D_FN_DY] = shapeset->get_dy_value(indices[i].inx, ref_x, ref_y, 0);
+        }
+      }
+
+      TableCacheStats& stats = proj_cache->stats;
+      stats.total_mem += num_shapes * (sizeof(double3*) + num_gip_points * sizeof(double3));
+      stats.max_mem = std::max(stats.max_mem, stats.total_mem);
+      stats.misses++;
+    }
+    else
+      proj_cache->stats.hits++;
+    pthread_mutex_unlock(&proj_cache_mutex);
+    return values;
+  }
+
+  void H1NonUniformHP::get_proj_factor(const int mode, const int order_h, const int order_v, double3* gip_points, int num_gip_points, const int* shape_inx, const int num_shapes, double**& chol_matrix, double*& chol_diag) {
+    double3** shape_values = NULL;
+    pthread_mutex_lock(&proj_cache_mutex);
+    double**& matrix = proj_cache->chol_matrices[mode][order_h][order_v];
+    double*& diag = proj_cache->chol_diags[mode][order_h][order_v];
+    if (matrix == NULL) {
+      //shape values are obtained without the lock, another thread might build the matrix meanwhile
+      pthread_mutex_unlock(&proj_cache_mutex);
+      shape_values = get_shape_values(mode, 0, gip_points, num_gip_points);
+      pthread_mutex_lock(&proj_cache_mutex);
+    }
+    if (matrix == NULL) {
+      //the projection matrix is symmetric and positive definite
+      matrix = build_projection_matrix(shape_values, gip_points, num_gip_points, shape_inx, num_shapes);
+      diag = new double[num_shapes];
+      choldc(matrix, num_shapes, diag);
+
+      TableCacheStats& stats = proj_cache->stats;
+      stats.total_mem += num_shapes * (sizeof(double*) + (num_shapes + 1) * sizeof(double));
+      stats.max_mem = std::max(stats.max_mem, stats.total_mem);
+      stats.misses++;
+    }
+    else
+      proj_cache->stats.hits++;
+    chol_matrix = matrix;
+    chol_diag = diag;
+    pthread_mutex_unlock(&proj_cache_mutex);
+  }
+
+  void H1NonUniformHP::proj_calc_errors(const int mode, double3* gip_points, int num_gip_points, ProjArea* areas, const int num_areas) {
+    bool uniform = (mode == MODE_TRIANGLE);
+    std::vector<ShapeInx>& full_shape_indices = shape_indices[mode];
+
+    //find the range of orders of all areas, orders start at (1, 1) even if the maximum is zero
+    int end_order_h = 1, end_order_v = 1;
+    int* area_order_h = new int[num_areas];
+    int* area_order_v = new int[num_areas];
+    int* area_num_shapes = new int[num_areas];
+    int* area_first_sub = new int[num_areas];
+    for(int i = 0; i < num_areas; i++) {
+      int order_h = std::max(1, get_h_order(areas[i].max_quad_order)), order_v = std::max(1, get_v_order(areas[i].max_quad_order));
+      if (uniform)
+        order_h = order_v = std::max(order_h, order_v);
+      area_order_h[i] = order_h;
+      area_order_v[i] = order_v;
+      area_num_shapes[i] = next_order_shape[mode][std::max(order_h, order_v)];
+      end_order_h = std::max(end_order_h, order_h);
+      end_order_v = std::max(end_order_v, order_v);
+    }
+    int max_num_shapes = next_order_shape[mode][std::max(end_order_h, end_order_v)];
+
+    //allocate space: right-hand sides of all shapes of each area, shape values and reference values of each sub-element
+    int num_sub_total = 0;
+    for(int i = 0; i < num_areas; i++)
+      num_sub_total += areas[i].num_sub;
+    scalar* rhs = new scalar[num_areas * max_num_shapes];
+    scalar* ref_values = new scalar[num_sub_total * 3 * num_gip_points];
+    scalar* proj_values = new scalar[3 * num_gip_points];
     scalar* right_side = new scalar[max_num_shapes];
     int* shape_inxs = new int[max_num_shapes];
-    int* indx = new int[max_num_shapes]; //solver data
-    double* d = new double[max_num_shapes]; //solver data
-    double** proj_matrix = new_matrix<double>(max_num_shapes, max_num_shapes);
-    std::vector<ShapeInx>& full_shape_indices = shape_indices[mode];
+    int* shape_pos = new int[max_num_shapes];
+    double3*** sub_shape_values = new double3**[num_sub_total];
+
+    //evaluate reference values of sub-elements and right-hand sides of all shapes once
+    for(int i = 0, inx_sub_total = 0; i < num_areas; i++) {
+      ProjArea& area = areas[i];
+      scalar* area_rhs = rhs + i * max_num_shapes;
+      std::fill(area_rhs, area_rhs + area_num_shapes[i], scalar(0));
+      area_first_sub[i] = inx_sub_total;
+      for(int inx_sub = 0; inx_sub < area.num_sub; inx_sub++, inx_sub_total++) {
+        double3** shape_values = sub_shape_values[inx_sub_total] = get_shape_values(mode, area.sub_trfs[inx_sub], gip_points, num_gip_points);
+        scalar** rvals = area.sub_rvals[inx_sub];
+        scalar* rv = ref_values + inx_sub_total * 3 * num_gip_points;
+        for(int j = 0; j < num_gip_points; j++) {
+          rv[3*j + H2D_FN_VALUE] = rvals[H2D_FN_VALUE][j];
+          rv[3*j + H2D_FN_DX] = area.coefs_mx[inx_sub] * rvals[H2D_FN_DX][j];
+          rv[3*j + H2D_FN_DY] = area.coefs_my[inx_sub] * rvals[H2D_FN_DY][j];
+        }
 
-    //clenup of the cache
-    memset(rhs_cache, 0, sizeof(ValueCacheItem<scalar>) * max_shape_inx[mode]); //TODO: can be done efficient by remembering the previous order during creating a list of indices for current range of orders
+        for(int k = 0; k < area_num_shapes[i]; k++) {
+          double3* sv = shape_values[full_shape_indices[k].inx];
+          scalar value = 0;
+          for(int j = 0; j < num_gip_points; j++)
+            value += gip_points[j][H2D_GIP2D_W] * ((sv[j][H2D_FN_VALUE] * rv[3*j + H2D_FN_VALUE]) + (sv[j][H2D_FN_DX] * rv[3*j + H2D_FN_DX]) + (sv[j][H2D_FN_DY] * rv[3*j + H2D_FN_DY]));
+          area_rhs[k] += value;
+        }
+      }
+    }
 
-    //calculate for all orders
-    double sub_area_corr_coef = 1.0 / num_sub;
-    OrderPermutator order_perm(make_quad_order(1, 1), max_quad_order, mode == MODE_TRIANGLE);
+    //calculate for all orders, the factor of the projection matrix is shared by all areas
+    OrderPermutator order_perm(make_quad_order(1, 1), make_quad_order(end_order_h, end_order_v), uniform);
     do {
       int quad_order = order_perm.get_quad_order();
       int order_h = get_h_order(quad_order), order_v = get_v_order(quad_order);
 
       //build a list of shape indices from the full list
       int num_shapes = 0;
-      unsigned int inx_shape = 0;
-      while (inx_shape < full_shape_indices.size()) {
-        ShapeInx& shape = full_shape_indices[inx_shape];
+      for(int k = 0; k < next_order_shape[mode][std::max(order_h, order_v)]; k++) {
+        ShapeInx& shape = full_shape_indices[k];
         if (order_h >= shape.order_h && order_v >= shape.order_v) {
-          assert_msg(num_shapes < max_num_shapes, "E more shapes than predicted, possible incosistency");
           shape_inxs[num_shapes] = shape.inx;
+          shape_pos[num_shapes] = k;
           num_shapes++;
         }
-        inx_shape++;
       }
 
-      //calculate projection matrix
-      if (proj_matrices[order_h][order_v] == NULL)
-        proj_matrices[order_h][order_v] = build_projection_matrix(*shapeset, gip_points, num_gip_points, shape_inxs, num_shapes);
-      copy_matrix(proj_matrix, proj_matrices[order_h][order_v], num_shapes, num_shapes); //copy projection matrix because original matrix will be modified
-
-      //build right side (fill cache values that are missing)
-      for(int inx_sub = 0; inx_sub < num_sub; inx_sub++) {
-        Element* sub_elem = sub_elems[inx_sub];
-        ElemSubTrf sub_trf = { sub_trfs[inx_sub], coefs_mx[inx_sub], coefs_my[inx_sub] };
-        ElemGIP sub_gip = { gip_points, num_gip_points, sub_rvals[inx_sub] };
-
-        for(int k = 0; k < num_shapes; k++) {
-          int shape_inx = shape_inxs[k];
-          ValueCacheItem<scalar>& shape_rhs_cache = rhs_cache[shape_inx];
-          if (!shape_rhs_cache.is_valid())
-            shape_rhs_cache.set(shape_rhs_cache.get() + evaluate_rsh_sub_element(sub_elem, sub_gip, sub_trf, shape_inx));
+      //obtain a factorized projection matrix
+      double** chol_matrix = NULL;
+      double* chol_diag = NULL;
+      get_proj_factor(mode, order_h, order_v, gip_points, num_gip_points, shape_inxs, num_shapes, chol_matrix, chol_diag);
+
+      for(int i = 0; i < num_areas; i++) {
+        ProjArea& area = areas[i];
+        if (order_h > area_order_h[i] || order_v > area_order_v[i])
+          continue;
+
+        //solve
+        double sub_area_corr_coef = 1.0 / area.num_sub;
+        scalar* area_rhs = rhs + i * max_num_shapes;
+        for(int k = 0; k < num_shapes; k++)
+          right_side[k] = sub_area_corr_coef * area_rhs[shape_pos[k]];
+        cholsl<scalar>(chol_matrix, num_shapes, chol_diag, right_side, right_side);
+
+        //calculate error
+        double error = 0;
+        for(int inx_sub = 0; inx_sub < area.num_sub; inx_sub++) {
+          double3** shape_values = sub_shape_values[area_first_sub[i] + inx_sub];
+          scalar* rv = ref_values + (area_first_sub[i] + inx_sub) * 3 * num_gip_points;
+
+          //values of the projected solution, the value and the derivatives of a point are stored consecutively
+          std::fill(proj_values, proj_values + 3 * num_gip_points, scalar(0));
+          for(int k = 0; k < num_shapes; k++) {
+            const double* sv = shape_values[shape_inxs[k]][0];
+            const scalar coef = right_side[k];
+            for(int j = 0; j < 3 * num_gip_points; j++)
+              proj_values[j] += coef * sv[j];
+          }
+
+          double sub_error = 0;
+          for(int j = 0; j < num_gip_points; j++)
+            sub_error += gip_points[j][H2D_GIP2D_W] * (sqr(proj_values[3*j + H2D_FN_VALUE] - rv[3*j + H2D_FN_VALUE])
+              + sqr(proj_values[3*j + H2D_FN_DX] - rv[3*j + H2D_FN_DX])
+              + sqr(proj_values[3*j + H2D_FN_DY] - rv[3*j + H2D_FN_DY]));
+          error += sub_error;
         }
+        area.errors[order_h][order_v] = error * sub_area_corr_coef; //apply area correction coefficient
       }
-
-      //copy values from cache and apply area correction coefficient
-      for(int k = 0; k < num_shapes; k++) {
-        ValueCacheItem<scalar>& shape_rhs_cache = rhs_cache[shape_inxs[k]];
-        right_side[k] = sub_area_corr_coef * shape_rhs_cache.get();
-        shape_rhs_cache.mark();
-      }
-
-      //solve
-      ludcmp(proj_matrix, num_shapes, indx, d);
-      lubksb<scalar>(proj_matrix, num_shapes, indx, right_side);
-
-      //calculate error
-      double error = 0;
-      for(int inx_sub = 0; inx_sub < num_sub; inx_sub++) {
-        Element* sub_elem = sub_elems[inx_sub];
-        Trf* ref_coord_transf = sub_trfs[inx_sub];
-        double coef_mx = coefs_mx[inx_sub], coef_my = coefs_my[inx_sub];
-        ElemSubTrf sub_trf = { sub_trfs[inx_sub], coefs_mx[inx_sub], coefs_my[inx_sub] };
-        ElemGIP sub_gip = { gip_points, num_gip_points, sub_rvals[inx_sub] };
-        ElemProj elem_proj = { shape_inxs, num_shapes, right_side, quad_order };
-
-        error += evaluate_error_sub_element(sub_elem, sub_gip, sub_trf, elem_proj);
-      }
-      errors[order_h][order_v] = error * sub_area_corr_coef; //apply area correction coefficient
     } while (order_perm.next());
 
     //clenaup
-    free(proj_matrix);
+    delete[] rhs;
+    delete[] ref_values;
+    delete[] proj_values;
     delete[] right_side;
     delete[] shape_inxs;
-    delete[] indx;
-    delete[] d;
-  }
-
-  scalar H1NonUniformHP::evaluate_rsh_sub_element(Element* sub_elem, const ElemGIP& sub_gip, const ElemSubTrf& sub_trf, int shape_inx) {
-    scalar total_value = 0;
-    for(int gip_inx = 0; gip_inx < sub_gip.num_gip_points; gip_inx++) {
-      //get location and transform it
-      double3 &gip_pt = sub_gip.gip_points[gip_inx];
-      double ref_x = gip_pt[H2D_GIP2D_X] * sub_trf.trf->m[0] + sub_trf.trf->t[0];
-      double ref_y = gip_pt[H2D_GIP2D_Y] * sub_trf.trf->m[1] + sub_trf.trf->t[1];
-
-      //get value of a shape function
-      scalar shape_value[3] = {0, 0, 0};
-      shape_value[H2D_FN_VALUE] = shapeset->get_fn_value(shape_inx, ref_x, ref_y, 0);
-      shape_value[H2D_FN_DX] = shapeset->get_dx_value(shape_inx, ref_x, ref_y, 0);
-      shape_value[H2D_FN_DY] = shapeset->get_dy_value(shape_inx, ref_x, ref_y, 0);
-
-      //get value of ref. solution
-      scalar ref_value[3];
-      ref_value[H2D_FN_VALUE] = sub_gip.rvals[H2D_FN_VALUE][gip_inx];
-      ref_value[H2D_FN_DX] = sub_trf.coef_mx * sub_gip.rvals[H2D_FN_DX][gip_inx];
-      ref_value[H2D_FN_DY] = sub_trf.coef_my * sub_gip.rvals[H2D_FN_DY][gip_inx];
-
-      //evaluate a right-hand value
-      scalar value = (shape_value[H2D_FN_VALUE] * ref_value[H2D_FN_VALUE])
-        + (shape_value[H2D_FN_DX] * ref_value[H2D_FN_DX])
-        + (shape_value[H2D_FN_DY] * ref_value[H2D_FN_DY]);
-
-      total_value += gip_pt[H2D_GIP2D_W] * value;
-    }
-    return total_value;
-  }
-
-  double H1NonUniformHP::evaluate_error_sub_element(Element* sub_elem, const ElemGIP& sub_gip, const ElemSubTrf& sub_trf, const ElemProj& elem_proj) {
-    double total_error = 0;
-    for(int gip_inx = 0; gip_inx < sub_gip.num_gip_points; gip_inx++) {
-      //get location and transform it
-      double3 &gip_pt = sub_gip.gip_points[gip_inx];
-      double ref_x = gip_pt[H2D_GIP2D_X] * sub_trf.trf->m[0] + sub_trf.trf->t[0];
-      double ref_y = gip_pt[H2D_GIP2D_Y] * sub_trf.trf->m[1] + sub_trf.trf->t[1];
-
-      //calculate value of projected solution
-      scalar proj_value[3] = {0, 0, 0};
-      for(int i = 0; i < elem_proj.num_shapes; i++) {
-        int shape_inx = elem_proj.shape_inxs[i];
-        proj_value[H2D_FN_VALUE] += elem_proj.shape_coefs[i] * shapeset->get_fn_value(shape_inx, ref_x, ref_y, 0);
-        proj_value[H2D_FN_DX] += elem_proj.shape_coefs[i] * shapeset->get_dx_value(shape_inx, ref_x, ref_y, 0);
-        proj_value[H2D_FN_DY] += elem_proj.shape_coefs[i] * shapeset->get_dy_value(shape_inx, ref_x, ref_y, 0);
-      }
-
-      //get value of ref. solution
-      scalar ref_value[3];
-      ref_value[H2D_FN_VALUE] = sub_gip.rvals[H2D_FN_VALUE][gip_inx];
-      ref_value[H2D_FN_DX] = sub_trf.coef_mx * sub_gip.rvals[H2D_FN_DX][gip_inx];
-      ref_value[H2D_FN_DY] = sub_trf.coef_my * sub_gip.rvals[H2D_FN_DY][gip_inx];
-
-      //evaluate error
-      double error = sqr(proj_value[H2D_FN_VALUE] - ref_value[H2D_FN_VALUE])
-        + sqr(proj_value[H2D_FN_DX] - ref_value[H2D_FN_DX])
-        + sqr(proj_value[H2D_FN_DY] - ref_value[H2D_FN_DY]);
-
-      total_error += gip_pt[H2D_GIP2D_W] * error;
-    }
-    return total_error;
+    delete[] shape_pos;
+    delete[] sub_shape_values;
+    delete[] area_order_h;
+    delete[] area_order_v;
+    delete[] area_num_shapes;
+    delete[] area_first_sub;
   }
 }
 
@@ -26,44 +26,25 @@
 #define H2D_FN_DY     2
 
 namespace RefinementSelectors {
+  struct H1ProjCache;
 
   class HERMES2D_API H1NonUniformHP : public ProjBasedSelector { ///< Selector that does HP-adaptivity using non-uniform orders on quadrilateral elements.
   protected: //projection and error evaluation
-    template<typename T>
-    struct ValueCacheItem { ///< An item of a value cache.
-      inline bool is_valid() const { return state != 0; }; ///< Returns true, if value is valid.
-      inline void mark_invalid() { state = 0; }; ///< Marks a value as invalid.
-      inline void mark(int new_state = 1) { state = new_state; }; ///< Sets state of a value cache.
-      inline void set(T new_value) { value = new_value; }; ///< Sets a new value.
-      inline T get() { return value; }; ///< Returns value.
-    private:
-      T value; ///< Value.
-      int state; ///< State.
+    struct ProjArea { ///< An area formed by sub-elements on which a reference solution is projected.
+      int num_sub; ///< A number of sub-elements.
+      const int* sub_trfs; ///< Sub-element transformations given as indices accepted by get_shape_values().
+      scalar*** sub_rvals; ///< Values and derivatives of a reference solution at GIP of sub-elements.
+      const double* coefs_mx, * coefs_my; ///< Differentials correction coefficients of sub-elements.
+      int max_quad_order; ///< Maximum quad order of projections.
+      double (*errors)[H2DRS_MAX_ORDER+2]; ///< Errors of projections, rows of a SonProjectionError.
     };
 
-    struct ElemProj { ///< Element projection parameters.
-      int* shape_inxs; ///< Shape indices
-      int num_shapes; ///< Number of shape indices.
-      scalar* shape_coefs; ///< Coefficients of shape indices of a projection.
-      int max_quad_order; ///< Maximum quad order of the projection.
-    };
-    struct ElemGIP { ///< GIP on a element.
-      double3* gip_points; ///< GIP points and weights.
-      int num_gip_points; ///< A number of GIP points.
-      scalar** rvals; ///< Values of a reference solution at GIP.
-    };
-    struct ElemSubTrf { ///< Transformation from a coordinate system of a sub-element to coordinate system of an element.
-      Trf* trf; ///< Transformation.
-      double coef_mx, coef_my; ///< Differentials correction coefficients.
-    };
-
-    double** proj_matrices[H2DRS_MAX_ORDER+1][H2DRS_MAX_ORDER+1]; ///< An array of projection matrices. Used functions are defined through shape_inx. Index to the array is the size. All matrices are square. If record is NULL, the corresponding matrix has to be calculated.
-    ValueCacheItem<scalar>* rhs_cache; ///< An array of RHS values. Valid only during evalution of proj_calc_err_son.
+    H1ProjCache* proj_cache; ///< Cholesky factors of projection matrices and values of shape functions at GIP. Shared by all selectors which use the same shapeset type and freed with the last of them.
 
-    double** build_projection_matrix(Shapeset& shapeset, double3* gip_points, int num_gip_points, const int* shape_inx, const int num_shapes); ///< Builds a projection matrix.
-    void proj_calc_err_son(const int mode, double3* gip_points, int num_gip_points, const int num_sub, Element** sub_elems, Trf** sub_trfs, scalar*** sub_rvals, double* coefs_mx, double* coefs_my, int max_quad_order, SonProjectionError errors); ///< Calculate projection errors.
-    virtual scalar evaluate_rsh_sub_element(Element* sub_elem, const ElemGIP& sub_gip, const ElemSubTrf& sub_trf, int shape_inx); ///> Evaluate a single value of the right side for a sub-element. Provided GIP are defined on a reference domain. Provided transformation will transform form a reference domain of a sub-element to a reference domain of an element.
-    virtual double evaluate_error_sub_element(Element* sub_elem, const ElemGIP& sub_gip, const ElemSubTrf& sub_trf, const ElemProj& elem_proj); ///> Evaluate an error of a projection on a sub-element. Provided GIP are defined on a reference domain. Provided transformation will transform form a reference domain of a sub-element to a reference domain of an element.
+    double** build_projection_matrix(double3** shape_values, double3* gip_points, int num_gip_points, const int* shape_inx, const int num_shapes); ///< Builds a projection matrix from values of shape functions at GIP.
+    double3** get_shape_values(const int mode, const int inx_trf, double3* gip_points, int num_gip_points); ///< Returns values of shape functions at GIP transformed by a sub-element transformation. Index 0 is the identity, index i > 0 is the transformation i-1 of tri_trf or quad_trf.
+    void get_proj_factor(const int mode, const int order_h, const int order_v, double3* gip_points, int num_gip_points, const int* shape_inx, const int num_shapes, double**& chol_matrix, double*& chol_diag); ///< Returns the Cholesky factor of a projection matrix.
+    void proj_calc_errors(const int mode, double3* gip_points, int num_gip_points, ProjArea* areas, const int num_areas); ///< Calculates errors of projections to all areas. Right-hand sides of all shapes are evaluated once per area and a factor of a projection matrix is obtained once per order and used by all areas.
 
     virtual void calc_projection_errors(Element* e, const int max_quad_order_h, const int max_quad_order_p, const int max_quad_order_aniso, Solution* rsln, SonProjectionError herr[4], SonProjectionError anisoerr[4], SonProjectionError perr);     ///> Overloaded. Calculate various projection errors for sons of a candidates of given combination of orders.
 
@@ -76,6 +57,7 @@ namespace RefinementSelectors {
     };
 
     static H1Shapeset default_shapeset; ///< Default shapeset.
+    H1Shapeset* own_shapeset; ///< Private shapeset of a clone, NULL otherwise.
     std::vector<ShapeInx> shape_indices[H2D_NUM_MODES]; ///< Shape indices.
     int max_shape_inx[H2D_NUM_MODES]; ///< Maximum of shape indices.
     int next_order_shape[H2D_NUM_MODES][H2DRS_MAX_ORDER+1]; ///< An index of a shape index of the next order.
@@ -86,6 +68,8 @@ namespace RefinementSelectors {
   public:
     H1NonUniformHP(bool iso_only, AllowedCandidates cands_allowed = H2DRS_CAND_HP, double conv_exp = 1.0, int max_order = H2DRS_DEFAULT_ORDER, H1Shapeset* user_shapeset = NULL);
     virtual ~H1NonUniformHP();
+    virtual Selector* clone() const; ///< Creates a copy of the selector with a private shapeset and quadrature.
+    virtual void get_cache_stats(TableCacheStats& stats) const; ///< Overloaded. Returns statistics of the cache of projection matrices and shape values.
   };
 }
 
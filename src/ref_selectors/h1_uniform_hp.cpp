@@ -6,16 +6,72 @@
 #include "../integrals_h1.h"
 #include "../element_to_refine.h"
 #include "h1_uniform_hp.h"
+#include <map>
 
 namespace RefinementSelectors {
+
+  // The orthonormalized base depends only on the shapeset, so it is calculated once and kept
+  // across calls of adapt(). It is shared by all selectors which use a shapeset of the same
+  // type, including the clones used by parallel adaptivity.
+  struct H1OrthoBase {
+    double3** obase[2][9]; ///< Values at GIP of orthonormalized base, see H1UniformHP::obase.
+    int basecnt[2][11]; ///< Indices of the first shape functions of the given order, see H1UniformHP::basecnt.
+    bool ready; ///< True if the base was calculated.
+    TableCacheStats stats; ///< Memory usage and hit/miss counters.
+
+    H1OrthoBase() : ready(false) {
+      memset(obase, 0, sizeof(obase));
+      memset(&stats, 0, sizeof(stats));
+    }
+
+    ~H1OrthoBase() {
+      for (int i = 0; i < 9; i++)
+        for (int j = 0; j < 2; j++)
+          delete [] (char*) obase[j][i];
+    }
+  };
+
+  // Shared bases indexed by the shapeset id. They are freed when the program exits.
+  struct H1OrthoBaseMap : public std::map<int, H1OrthoBase*> {
+    ~H1OrthoBaseMap() {
+      for (iterator it = begin(); it != end(); ++it)
+        delete it->second;
+    }
+  };
+
+  static H1OrthoBaseMap ortho_bases;
+  static pthread_mutex_t ortho_base_mutex = PTHREAD_MUTEX_INITIALIZER;
+
   H1Shapeset H1UniformHP::default_shapeset;
 
   H1UniformHP::H1UniformHP(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, H1Shapeset* user_shapeset)
     : ProjBasedSelector(iso_only, cands_allowed, conv_exp, max_order, user_shapeset == NULL ? &default_shapeset : user_shapeset)
-    , obase_ready(false) {};
+    , own_shapeset(NULL), obase_ready(false), shared_obase(NULL) {
+      pthread_mutex_lock(&ortho_base_mutex);
+      H1OrthoBase*& base = ortho_bases[shapeset->get_id()];
+      if (base == NULL)
+        base = new H1OrthoBase();
+      shared_obase = base;
+      pthread_mutex_unlock(&ortho_base_mutex);
+  }
 
   H1UniformHP::~H1UniformHP() {
     free_ortho_base();
+    delete own_shapeset;
+  }
+
+  Selector* H1UniformHP::clone() const {
+    H1Shapeset* shapeset = new H1Shapeset();
+    H1UniformHP* copy = new H1UniformHP(iso_only, cands_allowed, conv_exp, max_order, shapeset);
+    copy->own_shapeset = shapeset;
+    copy->use_private_quad();
+    return copy;
+  }
+
+  void H1UniformHP::get_cache_stats(TableCacheStats& stats) const {
+    pthread_mutex_lock(&ortho_base_mutex);
+    stats = shared_obase->stats;
+    pthread_mutex_unlock(&ortho_base_mutex);
   }
 
   int H1UniformHP::build_shape_inxs(const int mode, Shapeset* shapeset, int idx[121]) {
@@ -72,9 +128,9 @@ namespace RefinementSelectors {
       n = build_shape_inxs(m, shapeset, idx);
 
       // obtain their values for integration rule 20
-      g_quad_2d_std.set_mode(m);
-      np = g_quad_2d_std.get_num_points(20);
-      double3* pt = g_quad_2d_std.get_points(20);
+      quad->set_mode(m);
+      np = quad->get_num_points(20);
+      double3* pt = quad->get_points(20);
 
       for (i = 0; i < n; i++)
         for (j = 0; j < np; j++)
@@ -151,13 +207,32 @@ namespace RefinementSelectors {
     obase_ready = true;
   }
 
-  void H1UniformHP::free_ortho_base() {
-    if (!obase_ready) return;
-
-    for (int i = 0; i < 5; i++)
-      for (int j = 0; j < 2; j++)
-        delete [] obase[j][i];
+  void H1UniformHP::use_ortho_base() {
+    pthread_mutex_lock(&ortho_base_mutex);
+    if (obase_ready)
+      shared_obase->stats.hits++;
+    else {
+      if (shared_obase->ready)
+        shared_obase->stats.hits++;
+      else {
+        calc_ortho_base();
+        memcpy(shared_obase->obase, obase, sizeof(obase));
+        memcpy(shared_obase->basecnt, basecnt, sizeof(basecnt));
+        shared_obase->ready = true;
+
+        TableCacheStats& stats = shared_obase->stats;
+        stats.total_mem = 9 * (sizeof(double3*) * 121 + sizeof(double3) * 121 * 121) + 5 * (sizeof(double3*) * 66 + sizeof(double3) * 66 * 79);
+        stats.max_mem = stats.total_mem;
+        stats.misses++;
+      }
+      memcpy(obase, shared_obase->obase, sizeof(obase));
+      memcpy(basecnt, shared_obase->basecnt, sizeof(basecnt));
+      obase_ready = true;
+    }
+    pthread_mutex_unlock(&ortho_base_mutex);
+  }
 
+  void H1UniformHP::free_ortho_base() {
     obase_ready = false;
   }
 
@@ -174,10 +249,9 @@ namespace RefinementSelectors {
     double error;
     scalar prod;
 
-    if (!obase_ready) calc_ortho_base();
+    use_ortho_base();
 
     // select quadrature, obtain integration points and weights
-    Quad2D* quad = &g_quad_2d_std;
     quad->set_mode(m);
     rsln->set_quad_2d(quad);
     double3* pt = quad->get_points(20);
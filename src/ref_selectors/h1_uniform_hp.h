@@ -19,6 +19,8 @@
 #include "proj_based_selector.h"
 
 namespace RefinementSelectors {
+  struct H1OrthoBase;
+
   class HERMES2D_API H1UniformHP : public ProjBasedSelector { ///< Selector that does HP-adaptivity using uniform orders on quadrilateral elements.
   protected: //candidates
     /// \brief Calculate various projection errors for sons of a candidates of given combination of orders. Errors are not normalized. Overloadable.
@@ -32,19 +34,24 @@ namespace RefinementSelectors {
 
   protected: //shapeset
     static H1Shapeset default_shapeset; ///< Default shapeset.
+    H1Shapeset* own_shapeset; ///< Private shapeset of a clone, NULL otherwise.
 
   protected: //orthonormalized base
     double3** obase[2][9]; ///< Values at GIP of orthonormalized base. first index: 0 = triangles, 1 = quads; second index: order; third index: index of a shape function; fouth index: index of GIP; fifth index: 0 = value, 1 = df/dx, 2 = df/dy
     int basecnt[2][11]; ///< Indices of the first shape functions from H1Shapeset of the given order. first index: 0 = triangles, 1 = quads; second index: order
     bool obase_ready; ///< True if orthonormalized base is not ready.
+    H1OrthoBase* shared_obase; ///< Orthonormalized base shared by all selectors which use the same shapeset type. It is kept until the end of the program.
 
     void calc_ortho_base(); ///< Calculates orthonormalized base.
-    void free_ortho_base(); ///< Deallocates allocated structures.
+    void use_ortho_base(); ///< Makes the orthonormalized base ready. The base is calculated only if no selector calculated it before.
+    void free_ortho_base(); ///< Releases the orthonormalized base. The tables are owned by the shared base.
     int build_shape_inxs(const int mode, Shapeset *shapeset, int idx[121]); ///< Build indices of shape functions and initializes ranges. Returns number of indices.
 
   public:
     H1UniformHP(bool iso_only, AllowedCandidates cands_allowed = H2DRS_CAND_HP, double conv_exp = 1.0, int max_order = H2DRS_DEFAULT_ORDER, H1Shapeset* user_shapeset = NULL);
     virtual ~H1UniformHP();
+    virtual Selector* clone() const; ///< Creates a copy of the selector with a private shapeset and quadrature.
+    virtual void get_cache_stats(TableCacheStats& stats) const; ///< Overloaded. Returns statistics of the shared orthonormalized base.
     virtual void update_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders); ///< Updates orders of a refinement in another multimesh component which shares a mesh.
   };
 }
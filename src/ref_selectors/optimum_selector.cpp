@@ -61,7 +61,7 @@ namespace RefinementSelectors {
 
   OptimumSelector::OptimumSelector(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, Shapeset* shapeset)
     : Selector(max_order), iso_only(iso_only), cands_allowed(cands_allowed)
-    , conv_exp(conv_exp), shapeset(shapeset) {
+    , conv_exp(conv_exp), num_evaluated_cands(0), shapeset(shapeset) {
     assert_msg(shapeset != NULL, "E shapeset is NULL");
   }
 
@@ -334,6 +334,7 @@ namespace RefinementSelectors {
       // evaluate candidates (sum partial projection errors, calculate dofs)
       double avg_error, dev_error;
       evaluate_candidates(element, rsln, &avg_error, &dev_error);
+      num_evaluated_cands += candidates.size();
 
       //select candidate
       select_best_candidate(element, avg_error, dev_error, &inx_cand, &inx_h_cand);
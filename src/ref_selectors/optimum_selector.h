@@ -106,6 +106,7 @@ namespace RefinementSelectors {
   protected: //orders and their range
     int current_max_order; ///< Current maximum order.
     int current_min_order; ///< Current minimum order.
+    unsigned long num_evaluated_cands; ///< A number of candidates evaluated by select_refinement().
 
     virtual void set_current_order_range(Element* element); ///< Sets current maximum and minimum order. If the max_order is H2DRS_DEFAULT_ORDER, in the case of linear elements it uses 9 and in the case of curvilinear elements it depends on iro_cache (how curved they are).
 
@@ -116,6 +117,7 @@ namespace RefinementSelectors {
     OptimumSelector(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, Shapeset* shapeset);
     virtual ~OptimumSelector() {};
     virtual bool select_refinement(Element* element, int quad_order, Solution* rsln, ElementToRefine& refinement); ///< Selects refinement.
+    unsigned long get_num_evaluated_cands() const { return num_evaluated_cands; }; ///< Returns a number of candidates evaluated since the selector was created.
     virtual void update_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders); ///< Updates orders of a refinement in another multimesh component which shares a mesh.
   };
 
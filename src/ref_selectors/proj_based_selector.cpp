@@ -6,6 +6,39 @@
 #include "proj_based_selector.h"
 
 namespace RefinementSelectors {
+  ProjBasedSelector::ProjBasedSelector(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, Shapeset* shapeset)
+    : OptimumSelector(iso_only, cands_allowed, conv_exp, max_order, shapeset)
+    , quad(&g_quad_2d_std), own_quad(NULL) {}
+
+  ProjBasedSelector::~ProjBasedSelector() {
+    delete own_quad;
+  }
+
+  void ProjBasedSelector::use_private_quad() {
+    if (own_quad == NULL)
+      quad = own_quad = new Quad2DStd();
+  }
+
+  void ProjBasedSelector::get_cache_stats(TableCacheStats& stats) const {
+    memset(&stats, 0, sizeof(TableCacheStats));
+  }
+
+  int ProjBasedSelector::calc_coarsening_errors(Element* e, const int max_order, Solution* sln, SonProjectionError herr[4], SonProjectionError perr) {
+    // the element is inactive, so the order of its inverse reference map may be unknown;
+    // the range is taken from its sons, which are active and have the same geometry
+    int order = max_order;
+    for (int son = 0; son < 4; son++) {
+      if (e->sons[son]->iro_cache < 0)
+        sln->set_active_element(e->sons[son]);
+      set_current_order_range(e->sons[son]);
+      order = std::min(order, current_max_order);
+    }
+    int max_quad_order = make_quad_order(order, order);
+    SonProjectionError anisoerr[4];
+    calc_projection_errors(e, max_quad_order, max_quad_order, max_quad_order, sln, herr, anisoerr, perr);
+    return order;
+  }
+
   void ProjBasedSelector::evaluate_cands_error(Element* e, Solution* rsln, double* avg_error, double* dev_error) {
     bool tri = e->is_triangle();
 
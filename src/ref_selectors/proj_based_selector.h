@@ -18,6 +18,9 @@
 
 #include "optimum_selector.h"
 
+class Quad2D;
+class Quad2DStd;
+
 namespace RefinementSelectors {
   typedef double SonProjectionError[H2DRS_MAX_ORDER+2][H2DRS_MAX_ORDER+2]; ///< Error of a son of a candidate for various order combinations. The maximum allowed order is H2DRS_MAX_ORDER+1.
 
@@ -32,9 +35,29 @@ namespace RefinementSelectors {
     virtual void calc_projection_errors(Element* e, const int max_quad_order_h, const int max_quad_order_p, const int max_quad_order_aniso, Solution* rsln, SonProjectionError herr[4], SonProjectionError anisoerr[4], SonProjectionError perr) = 0;
     virtual void evaluate_cands_error(Element* e, Solution* rsln, double* avg_error, double* dev_error); ///< Calculates error of candidates.
 
+  protected: //quadrature
+    Quad2D* quad; ///< Quadrature used for projections. It is g_quad_2d_std unless the selector is a clone.
+    Quad2DStd* own_quad; ///< Private quadrature of a clone, NULL otherwise.
+
+    void use_private_quad(); ///< Switches to a private quadrature, so that the selector does not change a mode of g_quad_2d_std which is shared by other threads.
+
   public:
-    ProjBasedSelector(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, Shapeset* shapeset)
-	  : OptimumSelector(iso_only, cands_allowed, conv_exp, max_order, shapeset) {};
+    ProjBasedSelector(bool iso_only, AllowedCandidates cands_allowed, double conv_exp, int max_order, Shapeset* shapeset);
+    virtual ~ProjBasedSelector();
+
+    /// \brief Returns statistics of a cache of projection data which is kept across calls of adapt().
+    /// Selectors without such a cache return zeros.
+    virtual void get_cache_stats(TableCacheStats& stats) const;
+
+    /// \brief Calculates errors of projections of a solution used to decide about coarsening.
+    /// The element has to be split to four active sons in the mesh of the solution. Errors are calculated on the reference domain and are not normalized.
+    /// \param[in] e Element whose sons are merged.
+    /// \param[in] max_order Maximum uniform order of the projections.
+    /// \param[in] sln Solution.
+    /// \param[out] herr Errors of projections to the sons, herr[i][o][o] is the error of the son i with the order o.
+    /// \param[out] perr Errors of projections to the element, perr[o][o] is the error of the element with the order o.
+    /// \return The maximum order for which the errors were calculated. It is lower than max_order if the selector does not allow max_order.
+    int calc_coarsening_errors(Element* e, const int max_order, Solution* sln, SonProjectionError herr[4], SonProjectionError perr);
   };
 
 }
@@ -33,6 +33,10 @@ namespace RefinementSelectors {
     Selector(int max_order = H2DRS_DEFAULT_ORDER) : max_order(max_order) {};
     virtual ~Selector() {};
     virtual void reset() {}; ///< Clears internal structures of a selector.
+
+    /// \brief Creates a selector with the same settings which can be used concurrently with this one in another thread.
+    /// \return A new selector which has to be deleted by the caller. NULL if the selector does not support it.
+    virtual Selector* clone() const { return NULL; };
     /// \brief Selects refinement.
     /// \param quad_order Encoded order.
     /// \param result Defined refinement. ID and comp attribute of the structure ElementToRefine should be initialized beforehand.
@@ -51,6 +55,7 @@ namespace RefinementSelectors {
   class HERMES2D_API H1OnlyH : public Selector { ///< Selector that does only H-adaptivity.
   public:
     H1OnlyH() : Selector() {};
+    virtual Selector* clone() const { return new H1OnlyH(); }; ///< Creates a copy of the selector.
     virtual bool select_refinement(Element* element, int quad_order, Solution* rsln, ElementToRefine& refinement); ///< Suggests refinement.
     virtual void update_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders); ///< Updates orders of a refinement in another multimesh component which shares a mesh.
   };
@@ -58,6 +63,7 @@ namespace RefinementSelectors {
   class HERMES2D_API H1OnlyP : public Selector { ///< Selector that does only P-adaptivity.
   public:
     H1OnlyP(int max_order) : Selector(max_order) {};
+    virtual Selector* clone() const { return new H1OnlyP(max_order); }; ///< Creates a copy of the selector.
     virtual bool select_refinement(Element* element, int quad_order, Solution* rsln, ElementToRefine& refinement); ///< Suggests refinement.
     virtual void update_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders); ///< Updates orders of a refinement in another multimesh component which shares a mesh.
   };
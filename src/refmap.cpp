@@ -22,6 +22,8 @@
 H1ShapesetBeuchler ref_map_shapeset;
 PrecalcShapeset ref_map_pss(&ref_map_shapeset);
 
+size_t RefMap::default_mem_budget = 0;
+
 
 RefMap::RefMap()
 {
@@ -30,15 +32,37 @@ RefMap::RefMap()
   nodes = NULL;
   cur_node = NULL;
   overflow = NULL;
+  total_mem = max_mem = 0;
+  mem_budget = default_mem_budget;
+  cache_hits = cache_misses = cache_evictions = 0;
+  shapeset = &ref_map_shapeset;
+  pss = &ref_map_pss;
+  own_shapeset = NULL;
+  own_pss = NULL;
   set_quad_2d(&g_quad_2d_std); // default quadrature
 }
 
 
+RefMap::~RefMap()
+{
+  free();
+  delete own_pss;
+  delete own_shapeset;
+}
+
+
+void RefMap::use_private_shapeset()
+{
+  if (own_pss != NULL) return;
+  shapeset = own_shapeset = new H1ShapesetBeuchler;
+  pss = own_pss = new PrecalcShapeset(own_shapeset);
+}
+
+
 void RefMap::set_quad_2d(Quad2D* quad_2d)
 {
   free();
   this->quad_2d = quad_2d;
-  ref_map_pss.set_quad_2d(quad_2d);
 }
 
 
@@ -46,7 +70,8 @@ void RefMap::set_active_element(Element* e)
 {
   if (e != element) free();
 
-  ref_map_pss.set_active_element(e);
+  if (shapeset->get_mode() != e->get_mode())
+    shapeset->set_mode(e->get_mode());
   quad_2d->set_mode(e->get_mode());
   num_tables = quad_2d->get_num_tables();
   assert(num_tables <= max_tables);
@@ -57,22 +82,28 @@ void RefMap::set_active_element(Element* e)
   reset_transform();
   update_cur_node();
 
+  // straight-edged elements: read the vertex coordinates once, is_parallelogram()
+  // and calc_const_inv_ref_map() work with this copy
+  if (e->cm == NULL)
+  {
+    for (unsigned int i = 0; i < e->nvert; i++)
+    {
+      lin_coefs[i][0] = e->vn[i]->x;
+      lin_coefs[i][1] = e->vn[i]->y;
+    }
+  }
+
   is_const = !element->is_curved() &&
              (element->is_triangle() || is_parallelogram());
 
   // prepare the shapes and coefficients of the reference map
   int j, k = 0;
   for (unsigned int i = 0; i < e->nvert; i++)
-    indices[k++] = ref_map_shapeset.get_vertex_index(i);
+    indices[k++] = shapeset->get_vertex_index(i);
 
   // straight-edged element
   if (e->cm == NULL)
   {
-    for (unsigned int i = 0; i < e->nvert; i++)
-    {
-      lin_coefs[i][0] = e->vn[i]->x;
-      lin_coefs[i][1] = e->vn[i]->y;
-    }
     coefs = lin_coefs;
     nc = e->nvert;
   }
@@ -81,11 +112,11 @@ void RefMap::set_active_element(Element* e)
     int o = e->cm->order;
     for (unsigned int i = 0; i < e->nvert; i++)
       for (j = 2; j <= o; j++)
-        indices[k++] = ref_map_shapeset.get_edge_index(i, 0, j);
+        indices[k++] = shapeset->get_edge_index(i, 0, j);
 
     if (e->is_quad()) o = make_quad_order(o, o);
-    memcpy(indices + k, ref_map_shapeset.get_bubble_indices(o),
-           ref_map_shapeset.get_num_bubbles(o) * sizeof(int));
+    memcpy(indices + k, shapeset->get_bubble_indices(o),
+           shapeset->get_num_bubbles(o) * sizeof(int));
 
     coefs = e->cm->coefs;
     nc = e->cm->nc;
@@ -119,6 +150,14 @@ void RefMap::pop_transform()
 }
 
 
+void RefMap::prepare_ref_map_pss()
+{
+  pss->set_quad_2d(quad_2d);
+  pss->set_active_element(element);
+  pss->force_transform(sub_idx, ctm);
+}
+
+
 void RefMap::calc_inv_ref_map(int order)
 {
   assert(quad_2d != NULL);
@@ -128,13 +167,13 @@ void RefMap::calc_inv_ref_map(int order)
 
   AUTOLA_OR(double2x2, m, np);
   memset(m, 0, m.size);
-  ref_map_pss.force_transform(sub_idx, ctm);
+  prepare_ref_map_pss();
   for (i = 0; i < nc; i++)
   {
     double *dx, *dy;
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    ref_map_pss.get_dx_dy_values(dx, dy);
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    pss->get_dx_dy_values(dx, dy);
     for (j = 0; j < np; j++)
     {
       m[j][0][0] += coefs[i][0] * dx[j];
@@ -148,6 +187,7 @@ void RefMap::calc_inv_ref_map(int order)
   double trj = get_transform_jacobian();
   double2x2* irm = cur_node->inv_ref_map[order] = new double2x2[np];
   double* jac = cur_node->jacobian[order] = new double[np];
+  add_table_mem(np * (sizeof(double2x2) + sizeof(double)));
   for (i = 0; i < np; i++)
   {
     jac[i] = (m[i][0][0] * m[i][1][1] - m[i][0][1] * m[i][1][0]);
@@ -171,15 +211,15 @@ void RefMap::calc_second_ref_map(int order)
 
   AUTOLA_OR(double3x2, k, np);
   memset(k, 0, k.size);
-  ref_map_pss.force_transform(sub_idx, ctm);
+  prepare_ref_map_pss();
   for (i = 0; i < nc; i++)
   {
     double *dxy, *dxx, *dyy;
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order, FN_ALL);
-    dxx = ref_map_pss.get_dxx_values();
-    dyy = ref_map_pss.get_dyy_values();
-    dxy = ref_map_pss.get_dxy_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order, FN_ALL);
+    dxx = pss->get_dxx_values();
+    dyy = pss->get_dyy_values();
+    dxy = pss->get_dxy_values();
     for (j = 0; j < np; j++)
     {
       k[j][0][0] += coefs[i][0] * dxx[j];
@@ -192,6 +232,7 @@ void RefMap::calc_second_ref_map(int order)
   }
 
   double3x2* mm = cur_node->second_ref_map[order] = new double3x2[np];
+  add_table_mem(np * sizeof(double3x2));
   double2x2* m = get_inv_ref_map(order);
   for (j = 0; j < np; j++)
   {
@@ -220,10 +261,10 @@ void RefMap::calc_second_ref_map(int order)
 bool RefMap::is_parallelogram()
 {
   const double eps = 1e-14;
-  Element* e = element;
-  assert(e->is_quad());
-  return fabs(e->vn[2]->x - (e->vn[1]->x + e->vn[3]->x - e->vn[0]->x)) < eps &&
-         fabs(e->vn[2]->y - (e->vn[1]->y + e->vn[3]->y - e->vn[0]->y)) < eps;
+  double2* v = lin_coefs;
+  assert(element->is_quad() && !element->is_curved());
+  return fabs(v[2][0] - (v[1][0] + v[3][0] - v[0][0])) < eps &&
+         fabs(v[2][1] - (v[1][1] + v[3][1] - v[0][1])) < eps;
 }
 
 
@@ -236,8 +277,9 @@ void RefMap::calc_const_inv_ref_map()
   if (element == NULL)
       error("The element variable must not be NULL.");
   int k = element->is_triangle() ? 2 : 3;
-  double m[2][2] = { { element->vn[1]->x - element->vn[0]->x,  element->vn[k]->x - element->vn[0]->x },
-                     { element->vn[1]->y - element->vn[0]->y,  element->vn[k]->y - element->vn[0]->y } };
+  double2* v = lin_coefs;
+  double m[2][2] = { { v[1][0] - v[0][0],  v[k][0] - v[0][0] },
+                     { v[1][1] - v[0][1],  v[k][1] - v[0][1] } };
 
   const_jacobian = 0.25 * (m[0][0] * m[1][1] - m[0][1] * m[1][0]);
   if (const_jacobian <= 0.0)
@@ -259,13 +301,14 @@ void RefMap::calc_phys_x(int order)
   // transform all x coordinates of the integration points
   int i, j, np = quad_2d->get_num_points(order);
   double* x = cur_node->phys_x[order] = new double[np];
+  add_table_mem(np * sizeof(double));
   memset(x, 0, np * sizeof(double));
-  ref_map_pss.force_transform(sub_idx, ctm);
+  prepare_ref_map_pss();
   for (i = 0; i < nc; i++)
   {
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    double* fn = ref_map_pss.get_fn_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    double* fn = pss->get_fn_values();
     for (j = 0; j < np; j++)
       x[j] += coefs[i][0] * fn[j];
   }
@@ -277,13 +320,14 @@ void RefMap::calc_phys_y(int order)
   // transform all y coordinates of the integration points
   int i, j, np = quad_2d->get_num_points(order);
   double* y = cur_node->phys_y[order] = new double[np];
+  add_table_mem(np * sizeof(double));
   memset(y, 0, np * sizeof(double));
-  ref_map_pss.force_transform(sub_idx, ctm);
+  prepare_ref_map_pss();
   for (i = 0; i < nc; i++)
   {
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    double* fn = ref_map_pss.get_fn_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    double* fn = pss->get_fn_values();
     for (j = 0; j < np; j++)
       y[j] += coefs[i][1] * fn[j];
   }
@@ -296,6 +340,7 @@ void RefMap::calc_tangent(int edge)
   int eo = quad_2d->get_edge_points(edge);
   int np = quad_2d->get_num_points(eo);
   double3* tan = cur_node->tan[edge] = new double3[np];
+  add_table_mem(np * sizeof(double3));
   int a = edge, b = element->next_vert(edge);
 
   if (!element->is_curved())
@@ -318,13 +363,13 @@ void RefMap::calc_tangent(int edge)
     static double2x2 m[15];
     assert(np <= 15);
     memset(m, 0, np*sizeof(double2x2));
-    ref_map_pss.force_transform(sub_idx, ctm);
+    prepare_ref_map_pss();
     for (i = 0; i < nc; i++)
     {
       double *dx, *dy;
-      ref_map_pss.set_active_shape(indices[i]);
-      ref_map_pss.set_quad_order(eo);
-      ref_map_pss.get_dx_dy_values(dx, dy);
+      pss->set_active_shape(indices[i]);
+      pss->set_quad_order(eo);
+      pss->get_dx_dy_values(dx, dy);
       for (j = 0; j < np; j++)
       {
         m[j][0][0] += coefs[i][0] * dx[j];
@@ -335,8 +380,8 @@ void RefMap::calc_tangent(int edge)
     }
 
     // multiply them by the vector of the reference edge
-    double2* v1 = ref_map_shapeset.get_ref_vertex(a);
-    double2* v2 = ref_map_shapeset.get_ref_vertex(b);
+    double2* v1 = shapeset->get_ref_vertex(a);
+    double2* v2 = shapeset->get_ref_vertex(b);
     double ex = (*v2)[0] - (*v1)[0];
     double ey = (*v2)[1] - (*v1)[1];
     for (i = 0; i < np; i++)
@@ -404,12 +449,12 @@ void RefMap::inv_ref_map_at_point(double xi1, double xi2, double& x, double& y,
   x = y = 0;
   for (int i = 0; i < nc; i++)
   {
-    double val = ref_map_shapeset.get_fn_value(indices[i], xi1, xi2, 0);
+    double val = shapeset->get_fn_value(indices[i], xi1, xi2, 0);
     x += coefs[i][0] * val;
     y += coefs[i][1] * val;
 
-    double dx =  ref_map_shapeset.get_dx_value(indices[i], xi1, xi2, 0);
-    double dy =  ref_map_shapeset.get_dy_value(indices[i], xi1, xi2, 0);
+    double dx =  shapeset->get_dx_value(indices[i], xi1, xi2, 0);
+    double dy =  shapeset->get_dy_value(indices[i], xi1, xi2, 0);
     tmp[0][0] += coefs[i][0] * dx;
     tmp[0][1] += coefs[i][0] * dy;
     tmp[1][0] += coefs[i][1] * dx;
@@ -468,6 +513,7 @@ void RefMap::init_node(Node** pp)
   memset(node->phys_x, 0, num_tables * sizeof(double*));
   memset(node->phys_y, 0, num_tables * sizeof(double*));
   memset(node->tan, 0, sizeof(node->tan));
+  node->size = 0;
 }
 
 
@@ -490,10 +536,52 @@ void RefMap::free_node(Node* node)
     if (node->tan[i] != NULL)
       delete [] node->tan[i];
 
+  total_mem -= node->size;
   delete node;
 }
 
 
+void RefMap::trim_nodes()
+{
+  // free the tables of all sub-elements except the one being selected
+  unsigned long idx = 0;
+  std::vector<unsigned long> victims;
+  Node** pp = (Node**) JudyLFirst(nodes, &idx, NULL);
+  while (pp != NULL)
+  {
+    if (idx != sub_idx) victims.push_back(idx);
+    pp = (Node**) JudyLNext(nodes, &idx, NULL);
+  }
+
+  for (unsigned int i = 0; i < victims.size(); i++)
+  {
+    pp = (Node**) JudyLGet(nodes, victims[i], NULL);
+    free_node(*pp);
+    JudyLDel(&nodes, victims[i], NULL);
+    cache_evictions++;
+  }
+  cur_node = NULL;
+}
+
+
+void RefMap::get_cache_stats(TableCacheStats& stats) const
+{
+  stats.total_mem = total_mem;
+  stats.max_mem = max_mem;
+  stats.mem_budget = mem_budget;
+  stats.hits = cache_hits;
+  stats.misses = cache_misses;
+  stats.evictions = cache_evictions;
+}
+
+
+void RefMap::reset_cache_stats()
+{
+  cache_hits = cache_misses = cache_evictions = 0;
+  max_mem = total_mem;
+}
+
+
 void RefMap::free()
 {
   unsigned long idx = 0;
@@ -21,6 +21,7 @@
 #include "quad_all.h"
 
 struct Element;
+class H1ShapesetBeuchler;
 
 
 /// \brief Represents the reference mapping.
@@ -36,7 +37,7 @@ class HERMES2D_API RefMap : public Transformable
 public:
 
   RefMap();
-  ~RefMap() { free(); }
+  ~RefMap();
 
   /// Sets the quadrature points in which the reference map will be evaluated.
   /// \param quad_2d [in] The quadrature points.
@@ -48,6 +49,10 @@ public:
   /// Returns the 1D quadrature for use in surface integrals.
   const Quad1D* get_quad_1d() const { return &quad_1d; }
 
+  /// Makes the reference map use its own shapeset instead of the one shared by all reference
+  /// maps, so that its tables can be calculated concurrently with other reference maps.
+  void use_private_shapeset();
+
   /// Initializes the reference map for the specified element.
   /// Must be called prior to using all other functions in the class.
   virtual void set_active_element(Element* e);
@@ -134,6 +139,27 @@ public:
   /// Frees all data associated with the instance.
   void free();
 
+  /// Limits the memory occupied by the tables precalculated for the sub-elements
+  /// of the current element. When the budget is exceeded, the tables of the other
+  /// sub-elements are freed on the next transform change. Zero means no limit.
+  void set_mem_budget(size_t bytes) { mem_budget = bytes; }
+
+  /// Returns the memory budget for the precalculated tables (0 = unlimited).
+  size_t get_mem_budget() const { return mem_budget; }
+
+  /// Returns the current size of the precalculated tables in bytes.
+  size_t get_total_mem() const { return total_mem; }
+
+  /// Returns the memory usage and the counters of the table cache. Hits and misses
+  /// are counted per sub-element look-up.
+  void get_cache_stats(TableCacheStats& stats) const;
+
+  /// Resets the hit/miss/eviction counters and the peak memory usage.
+  void reset_cache_stats();
+
+  /// Sets the memory budget used by all reference maps created afterwards.
+  static void set_default_mem_budget(size_t bytes) { default_mem_budget = bytes; }
+
   /// For internal use only.
   void force_transform(uint64_t sub_idx, Trf* ctm)
   {
@@ -166,14 +192,24 @@ protected:
     double* phys_x[max_tables];
     double* phys_y[max_tables];
     double3* tan[4];
+    int size; ///< size in bytes of all tables of the node
   };
 
   void* nodes;
   Node* cur_node;
   Node* overflow;
 
+  size_t total_mem;  ///< total memory in bytes used by the tables
+  size_t max_mem;    ///< peak memory usage
+  size_t mem_budget; ///< memory budget for the tables, 0 = unlimited
+  size_t cache_hits, cache_misses, cache_evictions;
+
+  static size_t default_mem_budget;
+
   void update_cur_node()
   {
+    if (mem_budget > 0 && total_mem > mem_budget) trim_nodes();
+
     Node** pp = NULL;
     if (sub_idx > max_idx)
       pp = handle_overflow();
@@ -181,10 +217,30 @@ protected:
       pp = (Node**) JudyLIns(&nodes, (Word_t)sub_idx, NULL);
       //debug_assert((sub_idx >> (sizeof(Word_t) * 8)) == 0, "E index is larger than JudyLins can contain (RefMap::update_cur_node)");
     }
-    if (*pp == NULL) init_node(pp);
+    if (*pp == NULL) { init_node(pp); cache_misses++; }
+    else cache_hits++;
     cur_node = *pp;
   }
 
+  /// Registers a new table of the current node in the memory accounting.
+  void add_table_mem(int bytes)
+  {
+    cur_node->size += bytes;
+    total_mem += bytes;
+    if (max_mem < total_mem) max_mem = total_mem;
+  }
+
+  Shapeset* shapeset;              ///< shapeset of the reference map, ref_map_shapeset unless private
+  PrecalcShapeset* pss;            ///< precalculated shapeset, ref_map_pss unless private
+  H1ShapesetBeuchler* own_shapeset; ///< private shapeset, see use_private_shapeset()
+  PrecalcShapeset* own_pss;        ///< private precalculated shapeset
+
+  /// Sets up the precalculated shapeset of the reference map, which is shared by all reference
+  /// maps unless use_private_shapeset() was called, for this element and transformation. It is
+  /// only touched when a table is calculated, so reference maps which read their cached tables
+  /// only can be used in several threads.
+  void prepare_ref_map_pss();
+
   void calc_inv_ref_map(int order);
   void calc_const_inv_ref_map();
   void calc_second_ref_map(int order);
@@ -201,6 +257,7 @@ protected:
 
   void init_node(Node** pp);
   void free_node(Node* node);
+  void trim_nodes();
   Node** handle_overflow();
 
   Quad1DStd quad_1d;
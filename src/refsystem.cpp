@@ -19,6 +19,10 @@
 #include "weakform.h"
 #include "refsystem.h"
 #include "solution.h"
+#include "profiler.h"
+#include "quad_all.h"
+#include "matrix.h"
+#include <map>
 
 
 
@@ -32,11 +36,15 @@ RefSystem::RefSystem(LinSystem* base, int order_increase, int refinement)
   this->refinement = refinement;
   ref_meshes = NULL;
   ref_spaces = NULL;
+  reuse_prev = false;
+  prev_meshes = NULL;
+  prev_spaces = NULL;
 }
 
 RefSystem::~RefSystem()
 {
   free_ref_data();
+  free_data(prev_meshes, prev_spaces);
   delete [] order_inc;
 }
 
@@ -65,9 +73,14 @@ void RefSystem::set_order_increase(int* order_increase)
 
 void RefSystem::assemble(bool rhsonly)
 {
-  refine_mesh();
+  ProfilerPhase phase("ref_assemble");
+  {
+    ProfilerPhase phase("refine_mesh");
+    refine_mesh();
+  }
 
   LinSystem::assemble(rhsonly);
+  free_data(prev_meshes, prev_spaces);
 }
 
 
@@ -75,8 +88,16 @@ void RefSystem::refine_mesh()
 {
   int i, j;
 
-  // get rid of any previous data
-  free_ref_data();
+  // get rid of any previous data; if the reuse is enabled and the matrix was created for the
+  // current reference spaces, they are kept until the new matrix is created (see get_prev_dofs())
+  free_data(prev_meshes, prev_spaces);
+  if (reuse_prev && Ap != NULL && sp_seq[0] != -1)
+  {
+    prev_meshes = ref_meshes;  ref_meshes = NULL;
+    prev_spaces = ref_spaces;  ref_spaces = NULL;
+  }
+  else
+    free_ref_data();
 
   ref_meshes = new Mesh*[wf->neq];
   ref_spaces = new Space*[wf->neq];
@@ -146,6 +167,9 @@ void RefSystem::refine_mesh()
   memcpy(spaces, ref_spaces, sizeof(Space*) * wf->neq);
   memcpy(pss, base->pss, sizeof(PrecalcShapeset*) * wf->neq);
   have_spaces = true;
+
+  // the new spaces may have the same seq numbers as the previous ones
+  memset(sp_seq, -1, sizeof(int) * wf->neq);
 }
 
 bool RefSystem::solve_exact(scalar (*exactfn)(double x, double y, scalar& dx , scalar& dy), Solution* sln)
@@ -164,32 +188,310 @@ bool RefSystem::solve_exact(scalar (*exactfn)(double x, double y, scalar& dx , s
 
 
 void RefSystem::free_ref_data()
+{
+  free_data(ref_meshes, ref_spaces);
+}
+
+
+void RefSystem::free_data(Mesh**& rmeshes, Space**& rspaces)
 {
   int i, j;
 
   // free reference meshes
-  if (ref_meshes != NULL)
+  if (rmeshes != NULL)
   {
     for (i = 0; i < wf->neq; i++)
     {
       for (j = 0; j < i; j++)
-        if (ref_meshes[j] == ref_meshes[i])
+        if (rmeshes[j] == rmeshes[i])
           break;
 
-      if (i == j) delete ref_meshes[i];
+      if (i == j) delete rmeshes[i];
     }
 
-    delete [] ref_meshes;
-    ref_meshes = NULL;
+    delete [] rmeshes;
+    rmeshes = NULL;
   }
 
   // free reference spaces
-  if (ref_spaces != NULL)
+  if (rspaces != NULL)
   {
     for (i = 0; i < wf->neq; i++)
-      delete ref_spaces[i];
+      delete rspaces[i];
+
+    delete [] rspaces;
+    rspaces = NULL;
+  }
+}
+
+
+//// transfer of the previous reference solution //////////////////////////////////////////////////
+
+// Vertex coordinates of an element. Elements of the previous and the new reference mesh
+// with the same key are identical.
+struct ElementKey
+{
+  int nvert;
+  double x[4], y[4];
+
+  ElementKey(Element* e)
+  {
+    nvert = e->nvert;
+    for (int i = 0; i < 4; i++)
+    {
+      x[i] = (i < nvert) ? e->vn[i]->x : 0.0;
+      y[i] = (i < nvert) ? e->vn[i]->y : 0.0;
+    }
+  }
+
+  bool operator<(const ElementKey& other) const
+  {
+    if (nvert != other.nvert) return nvert < other.nvert;
+    for (int i = 0; i < nvert; i++)
+    {
+      if (x[i] != other.x[i]) return x[i] < other.x[i];
+      if (y[i] != other.y[i]) return y[i] < other.y[i];
+    }
+    return false;
+  }
+};
+
+
+// Returns true if two assembly lists of identical elements contain the same functions
+// with the same coefficients, and the DOFs of the new list are related to the old ones.
+static bool same_assembly_lists(AsmList* al, AsmList* prev_al, const int* prev)
+{
+  if (al->cnt != prev_al->cnt) return false;
+  for (int k = 0; k < al->cnt; k++)
+  {
+    if (al->idx[k] != prev_al->idx[k] || al->coef[k] != prev_al->coef[k]) return false;
+    if ((al->dof[k] < 0) != (prev_al->dof[k] < 0)) return false;
+    if (al->dof[k] >= 0 && prev[al->dof[k]] != prev_al->dof[k]) return false;
+  }
+  return true;
+}
+
+
+bool RefSystem::get_prev_dofs(int* prev, bool* reuse)
+{
+  if (prev_spaces == NULL) return false;
+
+  int i, k, n = 0;
+  for (i = 0; i < wf->neq; i++)
+    n += spaces[i]->get_num_dofs();
+
+  // the number of element assembly lists containing each DOF: all new lists, new lists
+  // identical to the old ones, and all old lists
+  std::vector<int> num_new(n, 0), num_same(n, 0), num_old(ndofs, 0);
+  std::vector<int> next(ndofs, -1);
+  AsmList al, prev_al;
+  Element* e;
+
+  for (int c = 0; c < wf->neq; c++)
+  {
+    // find the elements which did not change
+    std::map<ElementKey, Element*> prev_elems;
+    for_all_active_elements(e, prev_spaces[c]->get_mesh())
+    {
+      if (e->cm == NULL)
+        prev_elems.insert(std::make_pair(ElementKey(e), e));
+      prev_spaces[c]->get_element_assembly_list(e, &prev_al);
+      for (k = 0; k < prev_al.cnt; k++)
+        if (prev_al.dof[k] >= 0) num_old[prev_al.dof[k]]++;
+    }
+
+    // a function which is not constrained on an identical element is the same function
+    std::vector<std::pair<Element*, Element*> > same;
+    for_all_active_elements(e, spaces[c]->get_mesh())
+    {
+      spaces[c]->get_element_assembly_list(e, &al);
+      for (k = 0; k < al.cnt; k++)
+        if (al.dof[k] >= 0) num_new[al.dof[k]]++;
+      if (e->cm != NULL) continue;
+
+      std::map<ElementKey, Element*>::iterator it = prev_elems.find(ElementKey(e));
+      if (it == prev_elems.end()) continue;
+      same.push_back(std::make_pair(e, it->second));
+
+      prev_spaces[c]->get_element_assembly_list(it->second, &prev_al);
+      for (k = 0; k < al.cnt; k++)
+      {
+        if (al.dof[k] < 0 || al.coef[k] != 1.0 || prev[al.dof[k]] >= 0) continue;
+        int m = k;
+        if (m >= prev_al.cnt || prev_al.idx[m] != al.idx[k])
+          for (m = 0; m < prev_al.cnt && prev_al.idx[m] != al.idx[k]; m++) ;
+        if (m >= prev_al.cnt || prev_al.dof[m] < 0 || prev_al.coef[m] != 1.0 || next[prev_al.dof[m]] >= 0)
+          continue;
+        prev[al.dof[k]] = prev_al.dof[m];
+        next[prev_al.dof[m]] = al.dof[k];
+      }
+    }
+
+    for (unsigned j = 0; j < same.size(); j++)
+    {
+      spaces[c]->get_element_assembly_list(same[j].first, &al);
+      prev_spaces[c]->get_element_assembly_list(same[j].second, &prev_al);
+      if (same_assembly_lists(&al, &prev_al, prev))
+        for (k = 0; k < al.cnt; k++)
+          if (al.dof[k] >= 0) num_same[al.dof[k]]++;
+    }
+  }
 
-    delete [] ref_spaces;
-    ref_spaces = NULL;
+  // a row of the matrix structure did not change if all elements containing the DOF are the
+  // same; with more equations, the rows also depend on the other meshes, so they are not reused
+  int num_prev = 0, num_reuse = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (prev[i] < 0) continue;
+    num_prev++;
+    reuse[i] = (wf->neq == 1 && num_same[i] == num_new[i] && num_old[prev[i]] == num_new[i]);
+    if (reuse[i]) num_reuse++;
   }
+  verbose("Related %d of %d DOFs to the previous reference space, %d rows unchanged.", num_prev, n, num_reuse);
+  return true;
+}
+
+
+void RefSystem::guess_new_dofs(const int* prev, const scalar* prev_vec, scalar* vec)
+{
+  // each element with new functions projects the previous solution onto them in the L2 sense,
+  // the other functions keep their values; shared functions take the average of the projections
+  AsmList al;
+  Element* e;
+  RefMap rm;
+  rm.set_quad_2d(&g_quad_2d_std);
+  std::vector<scalar> sum(ndofs, 0.0);
+  std::vector<int> num(ndofs, 0);
+  for (int c = 0; c < wf->neq; c++)
+  {
+    Shapeset* shapeset = spaces[c]->get_shapeset();
+    if (shapeset->get_num_components() != 1) continue;
+
+    // the quadrature points of the elements with new functions
+    std::vector<Element*> elems;
+    std::vector<int> orders, first;
+    std::vector<double> x, y, jwt;
+    for_all_active_elements(e, spaces[c]->get_mesh())
+    {
+      spaces[c]->get_element_assembly_list(e, &al);
+      int k = 0;
+      while (k < al.cnt && (al.dof[k] < 0 || prev[al.dof[k]] >= 0)) k++;
+      if (k >= al.cnt) continue;
+
+      // constrained functions may have higher orders than the element
+      int o = 0;
+      shapeset->set_mode(e->get_mode());
+      for (k = 0; k < al.cnt; k++)
+      {
+        int fo = shapeset->get_order(al.idx[k]);
+        o = std::max(o, std::max(get_h_order(fo), get_v_order(fo)));
+      }
+      o *= 2;
+      update_limit_table(e->get_mode());
+      limit_order_nowarn(o);
+
+      rm.set_active_element(e);
+      double3* pt = g_quad_2d_std.get_points(o);
+      int np = g_quad_2d_std.get_num_points(o);
+      double* px = rm.get_phys_x(o);
+      double* py = rm.get_phys_y(o);
+      double* jac = rm.get_jacobian(o);
+      elems.push_back(e);
+      orders.push_back(o);
+      first.push_back(x.size());
+      for (int i = 0; i < np; i++)
+      {
+        x.push_back(px[i]);
+        y.push_back(py[i]);
+        jwt.push_back(pt[i][2] * jac[i]);
+      }
+    }
+    if (elems.empty()) continue;
+
+    // evaluate the previous solution at all of them at once; a point on a curved
+    // boundary may miss the previous mesh by rounding, its element is then skipped
+    Solution sln;
+    sln.enable_lazy_conversion();
+    sln.set_fe_solution(prev_spaces[c], pss[c], (scalar*) prev_vec);
+    int n = x.size();
+    AUTOLA_OR(scalar, val, n);
+    sln.get_pt_values(n, &x[0], &y[0], val, FN_VAL_0, true);
+
+    for (unsigned j = 0; j < elems.size(); j++)
+    {
+      e = elems[j];
+      int o = orders[j];
+      g_quad_2d_std.set_mode(e->get_mode());
+      double3* pt = g_quad_2d_std.get_points(o);
+      int np = g_quad_2d_std.get_num_points(o);
+      scalar* u = &val[first[j]];
+      double* w = &jwt[first[j]];
+      int i, k, l;
+      for (i = 0; i < np && u[i] == u[i]; i++) ;
+      if (i < np) continue;
+
+      // the new functions are the unknowns, the rest is subtracted from the previous solution
+      spaces[c]->get_element_assembly_list(e, &al);
+      shapeset->set_mode(e->get_mode());
+      std::vector<int> dofs;
+      std::vector<scalar> rest(u, u + np);
+      std::vector<std::vector<double> > fn;
+      for (k = 0; k < al.cnt; k++)
+      {
+        int dof = al.dof[k];
+        if (dof < 0 || prev[dof] >= 0)
+        {
+          scalar coef = (dof < 0) ? al.coef[k] : al.coef[k] * vec[dof];
+          for (i = 0; i < np; i++)
+            rest[i] -= coef * shapeset->get_fn_value(al.idx[k], pt[i][0], pt[i][1], 0);
+          continue;
+        }
+        for (l = 0; l < (int) dofs.size() && dofs[l] != dof; l++) ;
+        if (l == (int) dofs.size())
+        {
+          dofs.push_back(dof);
+          fn.push_back(std::vector<double>(np, 0.0));
+        }
+        // the coefficients of the functions with a DOF come from the constraints, they are real
+        #ifndef COMPLEX
+        double coef = al.coef[k];
+        #else
+        double coef = al.coef[k].real();
+        #endif
+        for (i = 0; i < np; i++)
+          fn[l][i] += coef * shapeset->get_fn_value(al.idx[k], pt[i][0], pt[i][1], 0);
+      }
+
+      // solve the local projection problem
+      int m = dofs.size();
+      double** mat = new_matrix<double>(m);
+      AUTOLA_OR(scalar, rhs, m);
+      AUTOLA_OR(double, diag, m);
+      for (k = 0; k < m; k++)
+      {
+        rhs[k] = 0.0;
+        for (i = 0; i < np; i++)
+          rhs[k] += w[i] * fn[k][i] * rest[i];
+        for (l = 0; l <= k; l++)
+        {
+          double s = 0.0;
+          for (i = 0; i < np; i++)
+            s += w[i] * fn[k][i] * fn[l][i];
+          mat[k][l] = mat[l][k] = s;
+        }
+      }
+      choldc(mat, m, diag);
+      cholsl<scalar>(mat, m, diag, rhs, rhs);
+      delete [] (char*) mat;
+
+      for (k = 0; k < m; k++)
+      {
+        sum[dofs[k]] += rhs[k];
+        num[dofs[k]]++;
+      }
+    }
+  }
+
+  for (int i = 0; i < ndofs; i++)
+    if (num[i]) vec[i] = sum[i] / (double) num[i];
 }
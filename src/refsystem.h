@@ -40,6 +40,16 @@ public:
   /// The length of array "order_increase" must be equal to the number of equations
   void set_order_increase(int* order_increase);
 
+  /// Enables the reuse of the previous reference system (off by default). When the same
+  /// RefSystem is assembled again after the coarse space was adapted, the rows of the
+  /// matrix structure which did not change are reused and the last reference solution
+  /// is transferred to the new reference space. If the solver uses an initial guess,
+  /// each element with new functions projects the last solution onto them (in the L2
+  /// sense, the other functions are fixed), and functions shared by several elements
+  /// take the average. The previous reference meshes and spaces are kept until the new
+  /// matrix is created, which costs memory.
+  void set_reuse_previous(bool reuse) { reuse_prev = reuse; }
+
   /// Creates reference (fine) meshes and spaces and assembles the
   /// reference system.
   void assemble(bool rhsonly = false);
@@ -63,6 +73,15 @@ protected:
   Mesh**  ref_meshes;
   Space** ref_spaces;
 
+  bool reuse_prev;
+  Mesh**  prev_meshes; ///< reference meshes of the previous assembling
+  Space** prev_spaces; ///< reference spaces of the previous assembling
+
+  virtual bool get_prev_dofs(int* prev, bool* reuse);
+  virtual void guess_new_dofs(const int* prev, const scalar* prev_vec, scalar* vec);
+
+  void free_data(Mesh**& rmeshes, Space**& rspaces);
+
 };
 
 
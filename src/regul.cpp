@@ -15,6 +15,7 @@
 
 #include "common.h"
 #include "mesh.h"
+#include <set>
 
 
 int Mesh::get_edge_degree(Node* v1, Node* v2)
@@ -284,12 +285,38 @@ void Mesh::assign_parent(Element* e, int i)
 }
 
 
+int Mesh::get_regularization_split(Element* e, int n)
+{
+  // returns the refinement needed to reduce the degree of hanging nodes on the edges of
+  // the element to at most n, or -1 if none is needed
+  if (e->is_triangle())
+  {
+    for (unsigned int i = 0; i < e->nvert; i++)
+      if (get_edge_degree(e->vn[i], e->vn[e->next_vert(i)]) > n)
+        return 0;
+    return -1;
+  }
+
+  if (   ((get_edge_degree(e->vn[0], e->vn[1]) > n)  || (get_edge_degree(e->vn[2], e->vn[3]) > n))
+      && (get_edge_degree(e->vn[1], e->vn[2]) <= n) && (get_edge_degree(e->vn[3], e->vn[0]) <= n) )
+    return 2;
+  if (    (get_edge_degree(e->vn[0], e->vn[1]) <= n)  && (get_edge_degree(e->vn[2], e->vn[3]) <= n)
+       && ((get_edge_degree(e->vn[1], e->vn[2]) > n) || (get_edge_degree(e->vn[3], e->vn[0]) > n)) )
+    return 1;
+  for (unsigned int i = 0; i < e->nvert; i++)
+    if (get_edge_degree(e->vn[i], e->vn[e->next_vert(i)]) > n)
+      return 0;
+  return -1;
+}
+
+
 int* Mesh::regularize(int n)
 {
-  int j;
   bool ok;
+
+  make_private();
+
   bool reg = false;
-  int iso = 0;
   Element* e;
 
   if (n < 1)
@@ -308,37 +335,10 @@ int* Mesh::regularize(int n)
     ok = true;
     for_all_active_elements(e, this)
     {
-      int iso = -1;
-      if (e->is_triangle())
-      {
-        for(unsigned int i = 0; i < e->nvert; i++)
-        {
-          j = e->next_vert(i);
-          if (get_edge_degree(e->vn[i], e->vn[j]) > n)
-            { iso = 0; ok = false; break; }
-        }
-      }
-      else
-      {
-        if (   ((get_edge_degree(e->vn[0], e->vn[1]) > n)  || (get_edge_degree(e->vn[2], e->vn[3]) > n))
-            && (get_edge_degree(e->vn[1], e->vn[2]) <= n) && (get_edge_degree(e->vn[3], e->vn[0]) <= n) )
-          { iso = 2; ok = false; }
-        else if (    (get_edge_degree(e->vn[0], e->vn[1]) <= n)  && (get_edge_degree(e->vn[2], e->vn[3]) <= n)
-                  && ((get_edge_degree(e->vn[1], e->vn[2]) > n) || (get_edge_degree(e->vn[3], e->vn[0]) > n)) )
-          { iso = 1; ok = false; }
-        else
-        {
-          for(unsigned int i = 0; i < e->nvert; i++)
-          {
-            j = e->next_vert(i);
-            if (get_edge_degree(e->vn[i], e->vn[j]) > n)
-              { iso = 0; ok = false; break; }
-          }
-        }
-      }
-
+      int iso = get_regularization_split(e, n);
       if (iso >= 0)
       {
+        ok = false;
         refine_element(e->id, iso);
         for (int i = 0; i < 4; i++)
           assign_parent(e, i);
@@ -365,3 +365,89 @@ int* Mesh::regularize(int n)
   return parents;
 
 }
+
+
+void Mesh::push_regularization_neighbours(Element* e, std::vector<Element*>& stack)
+{
+  // the sons of a refined element may have too many hanging nodes
+  for (int i = 0; i < 4; i++)
+    if (e->sons[i] != NULL && e->sons[i]->active)
+      stack.push_back(e->sons[i]);
+
+  // a split edge adds a hanging node to the neighbour sharing the edge; if there is no
+  // such neighbour, the edge is a half of a longer edge of a neighbour (or lies on the
+  // boundary). The end points of the longer edge are the parents of its midpoint.
+  for (unsigned int i = 0; i < e->nvert; i++)
+  {
+    int v1 = e->vn[i]->id, v2 = e->vn[e->next_vert(i)]->id;
+    if (peek_vertex_node(v1, v2) == NULL) continue;
+    while (true)
+    {
+      Node* en = peek_edge_node(v1, v2);
+      if (en != NULL)
+      {
+        for (int k = 0; k < 2; k++)
+          if (en->elem[k] != NULL && en->elem[k]->active)
+            stack.push_back(en->elem[k]);
+        break;
+      }
+
+      Node* n1 = get_node(v1);
+      Node* n2 = get_node(v2);
+      if (n1->p1 == v2 || n1->p2 == v2) { v1 = n1->p1; v2 = n1->p2; }
+      else if (n2->p1 == v1 || n2->p2 == v1) { v1 = n2->p1; v2 = n2->p2; }
+      else break;
+    }
+  }
+}
+
+
+void Mesh::regularize_refined(int n, std::vector<int>& refined)
+{
+  if (n < 1) error("Local regularization requires n >= 1.");
+  make_private();
+
+  // The candidates are checked in passes in the order of their IDs, like in regularize(),
+  // so that the same splits are chosen. An element affected by a refinement is checked later
+  // in the same pass if regularize() would still reach it, otherwise in the next pass.
+  std::vector<Element*> stack;
+  std::set<int> pass, next;
+  std::vector<bool> seen(get_max_element_id(), false);
+  for (unsigned int i = 0; i < refined.size(); i++)
+  {
+    Element* e = get_element(refined[i]);
+    if (e->active || seen[e->id]) continue;
+    seen[e->id] = true;
+    push_regularization_neighbours(e, stack);
+  }
+  for (unsigned int i = 0; i < stack.size(); i++)
+    pass.insert(stack[i]->id);
+
+  while (!pass.empty())
+  {
+    int max = get_max_element_id();
+    while (!pass.empty())
+    {
+      int id = *pass.begin();
+      pass.erase(pass.begin());
+      Element* e = get_element(id);
+      if (!e->active) continue;
+
+      int iso = get_regularization_split(e, n);
+      if (iso >= 0)
+      {
+        refine_element(id, iso);
+        refined.push_back(id);
+        stack.clear();
+        push_regularization_neighbours(e, stack);
+        for (unsigned int i = 0; i < stack.size(); i++)
+        {
+          int j = stack[i]->id;
+          if (j > id && j < max) pass.insert(j);
+          else next.insert(j);
+        }
+      }
+    }
+    pass.swap(next);
+  }
+}
@@ -64,7 +64,7 @@ class HERMES2D_API Shapeset
 {
 public:
 
-  ~Shapeset() { free_constrained_edge_combinations(); }
+  virtual ~Shapeset() { free_constrained_edge_combinations(); }
 
   /// Selects MODE_TRIANGLE or MODE_QUAD.
   void set_mode(int mode)
@@ -19,6 +19,11 @@
 #include "precalc.h"
 #include "refmap.h"
 #include "auto_local_array.h"
+#include <algorithm>
+#ifndef WIN32
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 //// MeshFunction //////////////////////////////////////////////////////////////////////////////////
 
@@ -146,14 +151,20 @@ public:
 Solution::Solution()
         : MeshFunction()
 {
-  memset(tables, 0, sizeof(tables));
-  memset(elems,  0, sizeof(elems));
-  memset(oldest, 0, sizeof(oldest));
+  cur_slot = 0;
+  slot_clock = 0;
+  hint_clock = 1;
+  mesh_seq = (unsigned) -1;
+  elem_hits = elem_misses = elem_evictions = 0;
+  set_table_cache_size(4);
   transform = true;
   type = UNDEF;
+  space_type = -1;
   own_mesh = false;
+  lazy = false;
+  data = NULL;
   num_components = 0;
-  e_last = NULL;
+  e_last = -1;
   exact_mult = 1.0;
 
   mono_coefs = NULL;
@@ -174,24 +185,18 @@ void Solution::assign(Solution* sln)
 
   free();
 
-  mesh = sln->mesh;
-  own_mesh = sln->own_mesh;
-  sln->own_mesh = false;
-
-  mono_coefs = sln->mono_coefs;        sln->mono_coefs = NULL;
-  elem_coefs[0] = sln->elem_coefs[0];  sln->elem_coefs[0] = NULL;
-  elem_coefs[1] = sln->elem_coefs[1];  sln->elem_coefs[1] = NULL;
-  elem_orders = sln->elem_orders;      sln->elem_orders = NULL;
-  dxdy_buffer = sln->dxdy_buffer;      sln->dxdy_buffer = NULL;
-  num_coefs = sln->num_coefs;          sln->num_coefs = 0;
-  num_elems = sln->num_elems;          sln->num_elems = 0;
+  // take over the coefficients without touching their reference count
+  data = sln->data;            sln->data = NULL;
+  attach_data(data);           data->refs--;
+  dxdy_buffer = sln->dxdy_buffer;  sln->dxdy_buffer = NULL;
 
   type = sln->type;
   space_type = sln->space_type;
   num_components = sln->num_components;
+  num_dofs = sln->num_dofs;
 
+  sln->free();
   sln->type = UNDEF;
-  memset(sln->tables, 0, sizeof(sln->tables));
 }
 
 
@@ -201,35 +206,22 @@ void Solution::copy(const Solution* sln)
 
   free();
 
-  mesh = new Mesh;
-  mesh->copy(sln->mesh);
-  own_mesh = true;
-
   type = sln->type;
   space_type = sln->space_type;
   num_components = sln->num_components;
   num_dofs = sln->num_dofs;
 
-  if (sln->type == SLN) // standard solution: copy coefficient arrays
+  if (sln->type == SLN) // standard solution: share the coefficients and the mesh
   {
-    num_coefs = sln->num_coefs;
-    num_elems = sln->num_elems;
-
-    mono_coefs = new scalar[num_coefs];
-    memcpy(mono_coefs, sln->mono_coefs, sizeof(scalar) * num_coefs);
-
-    for (int l = 0; l < num_components; l++) {
-      elem_coefs[l] = new int[num_elems];
-      memcpy(elem_coefs[l], sln->elem_coefs[l], sizeof(int) * num_elems);
-    }
-
-    elem_orders = new int[num_elems];
-    memcpy(elem_orders, sln->elem_orders, sizeof(int) * num_elems);
-
+    attach_data(sln->data);
     init_dxdy_buffer();
   }
   else // exact, const
   {
+    mesh = new Mesh;
+    mesh->copy_cow(sln->mesh);
+    own_mesh = true;
+
     exactfn1 = sln->exactfn1;
     exactfn2 = sln->exactfn2;
     cnst[0] = sln->cnst[0];
@@ -238,23 +230,187 @@ void Solution::copy(const Solution* sln)
 }
 
 
+Solution::SlnData::SlnData()
+{
+  refs = 0;
+  mesh = NULL;
+  mono_coefs = NULL;
+  mono_map = NULL;
+  mono_map_size = 0;
+  elem_coefs[0] = elem_coefs[1] = NULL;
+  elem_orders = NULL;
+  num_coefs = num_elems = num_components = 0;
+  shapeset = NULL;
+  pss = NULL;
+  pending = NULL;
+  num_pending = 0;
+}
+
+
+Solution::SlnData::~SlnData()
+{
+  #ifndef WIN32
+  if (mono_map != NULL)
+    munmap(mono_map, mono_map_size);
+  else
+  #endif
+  if (mono_coefs != NULL) delete [] mono_coefs;
+
+  for (int i = 0; i < 2; i++)
+    if (elem_coefs[i] != NULL) delete [] elem_coefs[i];
+  if (elem_orders != NULL) delete [] elem_orders;
+  if (mesh != NULL) delete mesh;
+  free_pending();
+}
+
+
+void Solution::SlnData::free_pending()
+{
+  num_pending = 0;
+  if (pending != NULL) { delete [] pending;  pending = NULL; }
+  std::vector<int>().swap(pend_first);
+  std::vector<int>().swap(pend_idx);
+  std::vector<scalar>().swap(pend_coef);
+  if (pss != NULL) { delete pss;  pss = NULL; }
+  shapeset = NULL;
+}
+
+
+void Solution::attach_data(SlnData* d)
+{
+  data = d;
+  data->refs++;
+  mesh = data->mesh;
+  mono_coefs = data->mono_coefs;
+  elem_coefs[0] = data->elem_coefs[0];
+  elem_coefs[1] = data->elem_coefs[1];
+  elem_orders = data->elem_orders;
+  num_coefs = data->num_coefs;
+  num_elems = data->num_elems;
+}
+
+
+void Solution::unshare_data()
+{
+  if (data->refs <= 1) return;
+  convert_all();
+
+  SlnData* d = new SlnData;
+  d->mesh = new Mesh;
+  d->mesh->copy_cow(data->mesh);
+  d->num_coefs = num_coefs;
+  d->num_elems = num_elems;
+  d->num_components = num_components;
+  d->mono_coefs = new scalar[num_coefs];
+  memcpy(d->mono_coefs, mono_coefs, sizeof(scalar) * num_coefs);
+  for (int l = 0; l < num_components; l++) {
+    d->elem_coefs[l] = new int[num_elems];
+    memcpy(d->elem_coefs[l], elem_coefs[l], sizeof(int) * num_elems);
+  }
+  d->elem_orders = new int[num_elems];
+  memcpy(d->elem_orders, elem_orders, sizeof(int) * num_elems);
+
+  // the cached tables and the element search refer to the old mesh
+  data->refs--;
+  attach_data(d);
+  free_tables();
+  e_last = -1;
+  sindex.invalidate();
+}
+
+
 void Solution::free_tables()
 {
-  for (int i = 0; i < 4; i++)
+  for (unsigned i = 0; i < slots.size(); i++)
+  {
+    for (int j = 0; j < 4; j++)
+      free_sub_tables(&(slots[i].tables[j]));
+    slots[i].e = NULL;
+    slots[i].next = -1;
+  }
+  slot_hash.assign(slot_hash.size(), -1);
+  hinted.clear();
+  hint_clock++;
+}
+
+
+void Solution::trim_tables()
+{
+  // free the tables of the cached elements, least recently used first, the current one last
+  size_t low_mark = mem_budget - mem_budget / 4;
+  while (total_mem > low_mark)
+  {
+    int victim = -1;
+    for (int i = 0; i < (int) slots.size(); i++)
+    {
+      if (i == cur_slot) continue;
+      ElemSlot* sl = &slots[i];
+      if (!sl->tables[0] && !sl->tables[1] && !sl->tables[2] && !sl->tables[3]) continue;
+      if (victim < 0 || sl->stamp < slots[victim].stamp) victim = i;
+    }
+    if (victim < 0) break;
+
     for (int j = 0; j < 4; j++)
-      free_sub_tables(&(tables[i][j]));
+      free_sub_tables(&(slots[victim].tables[j]));
+    cache_evictions++;
+  }
+
+  for (int q = 1; q < 4 && total_mem > low_mark; q++)
+  {
+    void** tab = &(slots[cur_slot].tables[(cur_quad + q) & 3]);
+    if (*tab == NULL) continue;
+    free_sub_tables(tab);
+    cache_evictions++;
+  }
+}
+
+
+void Solution::set_table_cache_size(int n)
+{
+  if (n < 1) error("Invalid table cache size.");
+
+  free_tables();
+  slots.resize(n);
+  for (int i = 0; i < n; i++)
+  {
+    memset(&slots[i], 0, sizeof(ElemSlot));
+    slots[i].next = -1;
+  }
+
+  int nh = 1;
+  while (nh < 2*n) nh <<= 1;
+  slot_hash.assign(nh, -1);
+
+  // the old slots are gone: the active element must be selected again
+  cur_slot = 0;
+  sub_tables = NULL;
+  element = NULL;
+}
+
+
+void Solution::get_elem_cache_stats(TableCacheStats& stats) const
+{
+  get_cache_stats(stats);
+  stats.hits = elem_hits;
+  stats.misses = elem_misses;
+  stats.evictions = elem_evictions;
 }
 
 
 void Solution::free()
 {
-  if (mono_coefs  != NULL) { delete [] mono_coefs;   mono_coefs = NULL;  }
-  if (elem_orders != NULL) { delete [] elem_orders;  elem_orders = NULL; }
-  if (dxdy_buffer != NULL) { delete [] dxdy_buffer;  dxdy_buffer = NULL; }
+  if (data != NULL)
+  {
+    if (--data->refs <= 0) delete data;
+    data = NULL;
+    mesh = NULL;
+  }
 
-  for (int i = 0; i < num_components; i++)
-    if (elem_coefs[i] != NULL)
-      { delete [] elem_coefs[i];  elem_coefs[i] = NULL; }
+  mono_coefs = NULL;
+  elem_coefs[0] = elem_coefs[1] = NULL;
+  elem_orders = NULL;
+  num_coefs = num_elems = 0;
+  if (dxdy_buffer != NULL) { delete [] dxdy_buffer;  dxdy_buffer = NULL; }
 
   if (own_mesh && mesh != NULL)
   {
@@ -262,7 +418,8 @@ void Solution::free()
     own_mesh = false;
   }
 
-  e_last = NULL;
+  e_last = -1;
+  sindex.invalidate();
 
   free_tables();
 }
@@ -302,7 +459,7 @@ public:
 mono_lu;
 
 
-double** Solution::calc_mono_matrix(int o, int*& perm)
+double** Solution::calc_mono_matrix(int mode, int o, int*& perm)
 {
   int i, j, k, l, m, row;
   double x, y, xn, yn;
@@ -347,24 +504,25 @@ void Solution::set_fe_solution(Space* space, PrecalcShapeset* pss, scalar* vec,
   type = SLN;
   num_dofs = space->get_num_dofs();
 
-  // copy the mesh   TODO: share meshes between solutions
-  mesh = new Mesh;
-  mesh->copy(space->get_mesh());
-  own_mesh = true;
+  // take a snapshot of the mesh; it is shared until the space's mesh changes
+  SlnData* d = new SlnData;
+  d->mesh = new Mesh;
+  d->mesh->copy_cow(space->get_mesh());
 
   // allocate the coefficient arrays
-  num_elems = mesh->get_max_element_id();
-  elem_orders = new int[num_elems];
-  memset(elem_orders, 0, sizeof(int) * num_elems);
+  d->num_components = num_components;
+  int ne = d->num_elems = d->mesh->get_max_element_id();
+  d->elem_orders = new int[ne];
+  memset(d->elem_orders, 0, sizeof(int) * ne);
   for (int l = 0; l < num_components; l++) {
-    elem_coefs[l] = new int[num_elems];
-    memset(elem_coefs[l], 0, sizeof(int) * num_elems);
+    d->elem_coefs[l] = new int[ne];
+    memset(d->elem_coefs[l], 0, sizeof(int) * ne);
   }
 
   // obtain element orders, allocate mono_coefs
   Element* e;
-  num_coefs = 0;
-  for_all_active_elements(e, mesh)
+  int nc = 0;
+  for_all_active_elements(e, d->mesh)
   {
     mode = e->get_mode();
     o = space->get_element_order(e->id);
@@ -377,56 +535,218 @@ void Solution::set_fe_solution(Space* space, PrecalcShapeset* pss, scalar* vec,
     // Hcurl: actual order of functions is one higher than element order
     if ((space->get_shapeset())->get_num_components() == 2) o++;
 
-    num_coefs += mode ? sqr(o+1) : (o+1)*(o+2)/2;
-    elem_orders[e->id] = o;
+    int np = mode ? sqr(o+1) : (o+1)*(o+2)/2;
+    for (int l = 0; l < num_components; l++)
+      d->elem_coefs[l][e->id] = nc + l*np;
+    nc += num_components * np;
+    d->elem_orders[e->id] = o;
   }
-  num_coefs *= num_components;
-  mono_coefs = new scalar[num_coefs];
-
-  // express the solution on elements as a linear combination of monomials
-  Quad2D* quad = &g_quad_2d_cheb;
-  pss->set_quad_2d(quad);
-  scalar* mono = mono_coefs;
-  for_all_active_elements(e, mesh)
+  d->num_coefs = nc;
+  d->mono_coefs = new scalar[nc];
+
+  // in the lazy mode, record the shape functions and their coefficients on each element,
+  // so that the conversion does not depend on 'space' and 'vec' any more; otherwise
+  // express the solution on elements as a linear combination of monomials right away
+  d->shapeset = space->get_shapeset();
+  if (lazy)
   {
-    mode = e->get_mode();
-    quad->set_mode(mode);
-    o = elem_orders[e->id];
-    int np = quad->get_num_points(o);
+    d->pending = new bool[ne];
+    memset(d->pending, 0, sizeof(bool) * ne);
+    d->pend_first.resize(ne + 1, 0);
+  }
+  else
+    pss->set_quad_2d(&g_quad_2d_cheb);
 
-    AsmList al;
+  AsmList al;
+  std::vector<scalar> coef;
+  for_all_active_elements(e, d->mesh)
+  {
     space->get_element_assembly_list(e, &al);
-    pss->set_active_element(e);
-
-    for (int l = 0; l < num_components; l++)
+    if (lazy)
     {
-      // obtain solution values for the current element
-      scalar* val = mono;
-      elem_coefs[l][e->id] = (int) (mono - mono_coefs);
-      memset(val, 0, sizeof(scalar)*np);
+      d->pend_first[e->id] = d->pend_idx.size();
       for (int k = 0; k < al.cnt; k++)
       {
-        pss->set_active_shape(al.idx[k]);
-        pss->set_quad_order(o, FN_VAL);
         int dof = al.dof[k];
-        scalar coef = al.coef[k] * (dof >= 0 ? vec[dof] : dir);
-        double* shape = pss->get_fn_values(l);
-        for (int i = 0; i < np; i++)
-          val[i] += shape[i] * coef;
+        d->pend_idx.push_back(al.idx[k]);
+        d->pend_coef.push_back(al.coef[k] * (dof >= 0 ? vec[dof] : dir));
       }
-      mono += np;
-
-      // solve for the monomial coefficients
-      if (mono_lu.mat[mode][o] == NULL)
-        mono_lu.mat[mode][o] = calc_mono_matrix(o, mono_lu.perm[mode][o]);
-      lubksb(mono_lu.mat[mode][o], np, mono_lu.perm[mode][o], val);
+      d->pend_first[e->id + 1] = d->pend_idx.size();
+      d->pending[e->id] = true;
+      d->num_pending++;
+    }
+    else
+    {
+      coef.resize(al.cnt);
+      for (int k = 0; k < al.cnt; k++)
+        coef[k] = al.coef[k] * (al.dof[k] >= 0 ? vec[al.dof[k]] : dir);
+      int m = e->get_mode();
+      o = d->elem_orders[e->id];
+      if (mono_lu.mat[m][o] == NULL)
+        mono_lu.mat[m][o] = calc_mono_matrix(m, o, mono_lu.perm[m][o]);
+      convert_coefs(d, pss, e, al.idx, al.cnt ? &coef[0] : NULL, al.cnt);
     }
   }
 
+  attach_data(d);
   init_dxdy_buffer();
 }
 
 
+//// conversion to monomials ///////////////////////////////////////////////////////////////////////
+
+void Solution::convert_coefs(SlnData* d, PrecalcShapeset* pss, Element* e, const int* idx,
+                             const scalar* coef, int cnt)
+{
+  int mode = e->get_mode();
+  int o = d->elem_orders[e->id];
+  int np = mode ? sqr(o+1) : (o+1)*(o+2)/2;
+  pss->set_active_element(e);
+
+  for (int l = 0; l < d->num_components; l++)
+  {
+    // obtain solution values for the current element
+    scalar* val = d->mono_coefs + d->elem_coefs[l][e->id];
+    memset(val, 0, sizeof(scalar)*np);
+    for (int k = 0; k < cnt; k++)
+    {
+      pss->set_active_shape(idx[k]);
+      pss->set_quad_order(o, FN_VAL);
+      double* shape = pss->get_fn_values(l);
+      for (int i = 0; i < np; i++)
+        val[i] += shape[i] * coef[k];
+    }
+
+    // solve for the monomial coefficients
+    lubksb(mono_lu.mat[mode][o], np, mono_lu.perm[mode][o], val);
+  }
+}
+
+
+void Solution::convert_elements(SlnData* d, PrecalcShapeset* pss, const int* ids, int n, int step)
+{
+  pss->set_quad_2d(&g_quad_2d_cheb);
+  for (int j = 0; j < n; j += step)
+  {
+    Element* e = d->mesh->get_element(ids[j]);
+    int first = d->pend_first[e->id], cnt = d->pend_first[e->id + 1] - first;
+    convert_coefs(d, pss, e, cnt ? &d->pend_idx[first] : NULL, cnt ? &d->pend_coef[first] : NULL, cnt);
+    d->pending[e->id] = false;
+  }
+}
+
+
+struct ConvertThreadData
+{
+  void* d;
+  PrecalcShapeset* pss;
+  const int* ids;
+  int n, step;
+};
+
+void* Solution::convert_thread(void* arg)
+{
+  ConvertThreadData* td = (ConvertThreadData*) arg;
+  convert_elements((SlnData*) td->d, td->pss, td->ids, td->n, td->step);
+  return NULL;
+}
+
+
+void Solution::convert_pending(PrecalcShapeset* pss, int num_threads)
+{
+  SlnData* d = data;
+  if (d == NULL || !d->num_pending) return;
+
+  // the quadrature and the shapeset have a global mode, so the triangles
+  // and the quads are converted separately
+  for (int m = 0; m <= 1; m++)
+  {
+    std::vector<int> ids;
+    Element* e;
+    for_all_active_elements(e, d->mesh)
+      if (d->pending[e->id] && e->get_mode() == m)
+        ids.push_back(e->id);
+    if (ids.empty()) continue;
+
+    // prepare the LU-decomposed matrices beforehand, they are shared
+    for (unsigned i = 0; i < ids.size(); i++)
+    {
+      int o = d->elem_orders[ids[i]];
+      if (mono_lu.mat[m][o] == NULL)
+        mono_lu.mat[m][o] = calc_mono_matrix(m, o, mono_lu.perm[m][o]);
+    }
+
+    int nt = std::min(num_threads, (int) ids.size());
+    if (nt <= 1)
+    {
+      convert_elements(d, pss, &ids[0], ids.size(), 1);
+      continue;
+    }
+
+    // the constructor of PrecalcShapeset switches the shapeset mode, so the
+    // per-thread instances are created here
+    std::vector<PrecalcShapeset*> tpss(nt);
+    for (int t = 0; t < nt; t++)
+      tpss[t] = new PrecalcShapeset(d->shapeset);
+
+    // the constrained edge functions are cached by the shapeset on first use,
+    // which is not thread safe: evaluate each of them once here
+    d->shapeset->set_mode(m);
+    std::set<int> constrained;
+    for (unsigned i = 0; i < ids.size(); i++)
+      for (int k = d->pend_first[ids[i]]; k < d->pend_first[ids[i] + 1]; k++)
+        if (d->pend_idx[k] < 0 && constrained.insert(d->pend_idx[k]).second)
+          d->shapeset->get_fn_value(d->pend_idx[k], 0.0, 0.0, 0);
+
+    // each thread takes every nt-th element
+    g_quad_2d_cheb.set_mode(m);
+    std::vector<pthread_t> threads(nt);
+    std::vector<ConvertThreadData> td(nt);
+    for (int t = 0; t < nt; t++)
+    {
+      td[t].d = d;
+      td[t].pss = tpss[t];
+      td[t].ids = &ids[t];
+      td[t].n = ids.size() - t;
+      td[t].step = nt;
+      if (pthread_create(&threads[t], NULL, convert_thread, &td[t]))
+        error("Could not create a conversion thread.");
+    }
+    for (int t = 0; t < nt; t++)
+    {
+      pthread_join(threads[t], NULL);
+      delete tpss[t];
+    }
+  }
+
+  // the recorded shape functions are not needed any more
+  d->free_pending();
+}
+
+
+void Solution::convert_all(int num_threads)
+{
+  if (type != SLN || !data->num_pending) return;
+  if (data->pss == NULL) data->pss = new PrecalcShapeset(data->shapeset);
+  convert_pending(data->pss, num_threads);
+}
+
+
+void Solution::convert_element(Element* e)
+{
+  // the element may not be the active one, so 'mode' is left alone
+  SlnData* d = data;
+  int id = e->id, o = d->elem_orders[id], m = e->get_mode();
+  if (mono_lu.mat[m][o] == NULL)
+    mono_lu.mat[m][o] = calc_mono_matrix(m, o, mono_lu.perm[m][o]);
+
+  if (d->pss == NULL) d->pss = new PrecalcShapeset(d->shapeset);
+  convert_elements(d, d->pss, &id, 1, 1);
+
+  if (--d->num_pending == 0) d->free_pending();
+}
+
+
 //// set_exact etc. ////////////////////////////////////////////////////////////////////////////////
 
 void Solution::set_exact(Mesh* mesh, scalar (*exactfn)(double x, double y, scalar& dx, scalar& dy))
@@ -511,6 +831,8 @@ void Solution::multiply(scalar coef)
 {
   if (type == SLN)
   {
+    convert_all();
+    unshare_data();
     for (int i = 0; i < num_coefs; i++)
       mono_coefs[i] *= coef;
   }
@@ -575,27 +897,25 @@ void Solution::set_active_element(Element* e)
   // if (e == element) return; // FIXME
   if (!e->active) error("Cannot select inactive element. Wrong mesh?");
   MeshFunction::set_active_element(e);
+  check_mesh_seq();
 
-  // try finding an existing table for e
-  for (cur_elem = 0; cur_elem < 4; cur_elem++)
-    if (elems[cur_quad][cur_elem] == e)
-      break;
-
-  // if not found, free the oldest one and use its slot
-  if (cur_elem >= 4)
+  // try finding existing tables for e, if not found, reuse the least recently used slot
+  cur_slot = find_slot(e);
+  if (cur_slot >= 0)
+    elem_hits++;
+  else
   {
-    if (tables[cur_quad][oldest[cur_quad]] != NULL)
-      free_sub_tables(&(tables[cur_quad][oldest[cur_quad]]));
-
-    cur_elem = oldest[cur_quad];
-    if (++oldest[cur_quad] >= 4)
-      oldest[cur_quad] = 0;
-
-    elems[cur_quad][cur_elem] = e;
+    cur_slot = take_slot(e);
+    elem_misses++;
   }
+  slots[cur_slot].stamp = ++slot_clock;
+
+  if (over_budget()) trim_tables();
 
   if (type == SLN)
   {
+    if (data->num_pending && data->pending[e->id]) convert_element(e);
+
     int o = order = elem_orders[element->id];
     int n = mode ? sqr(o+1) : (o+1)*(o+2)/2;
 
@@ -622,11 +942,96 @@ void Solution::set_active_element(Element* e)
   else
     error("Uninitialized solution.");
 
-  sub_tables = &(tables[cur_quad][cur_elem]);
+  sub_tables = &(slots[cur_slot].tables[cur_quad]);
   update_nodes_ptr();
 }
 
 
+int Solution::find_slot(Element* e)
+{
+  int s = slot_hash[e->id & (slot_hash.size() - 1)];
+  while (s >= 0 && slots[s].e != e)
+    s = slots[s].next;
+  return s;
+}
+
+
+int Solution::take_slot(Element* e)
+{
+  // pick an empty slot or the least recently used one, sparing the hinted elements
+  int victim = -1;
+  bool victim_hinted = true;
+  for (int i = 0; i < (int) slots.size(); i++)
+  {
+    ElemSlot* sl = &slots[i];
+    if (sl->e == NULL) { victim = i; break; }
+
+    bool h = (sl->hint == hint_clock);
+    if (victim < 0 || (victim_hinted && !h) ||
+        (victim_hinted == h && sl->stamp < slots[victim].stamp))
+      { victim = i;  victim_hinted = h; }
+  }
+
+  ElemSlot* sl = &slots[victim];
+  if (sl->e != NULL)
+  {
+    unlink_slot(victim);
+    for (int j = 0; j < 4; j++)
+      free_sub_tables(&(sl->tables[j]));
+    elem_evictions++;
+  }
+
+  int h = e->id & (slot_hash.size() - 1);
+  sl->e = e;
+  sl->next = slot_hash[h];
+  slot_hash[h] = victim;
+
+  // the hinted elements are only looked up when they get a slot
+  sl->hint = 0;
+  for (unsigned i = 0; i < hinted.size(); i++)
+    if (hinted[i] == e) { sl->hint = hint_clock; break; }
+  return victim;
+}
+
+
+void Solution::unlink_slot(int s)
+{
+  int* p = &slot_hash[slots[s].e->id & (slot_hash.size() - 1)];
+  while (*p != s)
+    p = &(slots[*p].next);
+  *p = slots[s].next;
+  slots[s].next = -1;
+}
+
+
+void Solution::check_mesh_seq()
+{
+  // a copy-on-write mesh gets new elements and a new seq when the mesh it shares
+  // them with is changed (see Mesh::make_private), the cached pointers are stale then
+  if (mesh->get_seq() == mesh_seq) return;
+  free_tables();
+  mesh_seq = mesh->get_seq();
+}
+
+
+void Solution::hint_elements(int n, Element** e)
+{
+  check_mesh_seq();
+
+  // at least one slot has to stay available for the elements not hinted
+  if (n > (int) slots.size() - 1) n = slots.size() - 1;
+  hinted.assign(e, e + n);
+
+  // mark the slots of the hinted elements which are cached already
+  hint_clock++;
+  for (int i = 0; i < n; i++)
+  {
+    int s = find_slot(e[i]);
+    if (s >= 0) slots[s].hint = hint_clock;
+  }
+}
+
+
 //// precalculate //////////////////////////////////////////////////////////////////////////////////
 
 // sets all elements of y[] to num
@@ -918,38 +1323,63 @@ void Solution::precalculate(int order, int mask)
 
 //// save & load ///////////////////////////////////////////////////////////////////////////////////
 
-void Solution::save(const char* filename, bool compress)
+// Solution file layout (version 2):
+//   "H2DS", version, sizeof(scalar), num_components, num_elems, num_coefs  (6 x 4 bytes)
+//   space_type, padding                                                  (4 + 4 bytes)
+//   mono_coefs                                 (offset 32, can be memory-mapped)
+//   element orders (1 byte each), elem_coefs for each component, raw mesh
+// Version 1 files lack the padding. Compressed files are gzip streams of the above.
+
+static const int SLN_FILE_VERSION = 2;
+static const int SLN_COEFS_OFFSET = 32;
+
+void Solution::save(const char* filename, SaveCodec codec, int level)
 {
   int i;
 
   if (type == EXACT) error("Exact solution cannot be saved to a file.");
   if (type == CNST)  error("Constant solution cannot be saved to a file.");
   if (type == UNDEF) error("Cannot save -- uninitialized solution.");
+  convert_all();
+
+  #ifndef WITH_ZLIB
+  if (codec == SAVE_GZIP)
+  {
+    warn("Hermes2D was built without zlib, saving %s uncompressed.", filename);
+    codec = SAVE_RAW;
+  }
+  #endif
 
   // open the stream
   std::string fname = filename;
-  if (compress) fname += ".gz";
-  FILE* f = fopen(fname.c_str(), "wb");
-  if (f == NULL) error("Could not open %s for writing.", filename);
-
-  if (compress)
+  FILE* f;
+  if (codec == SAVE_GZIP)
   {
-    fclose(f);
-    char cmdline[270];
-    sprintf(cmdline, "gzip > %s.gz", filename);
-    f = popen(cmdline, "w");
-    if (f == NULL) error("Could not create compressed stream (command line: %s).", cmdline);
+    #ifdef WITH_ZLIB
+    fname += ".gz";
+    f = hermes2d_gzopen(fname.c_str(), "wb", level);
+    if (f == NULL) error("Could not open %s for writing.", fname.c_str());
+    #endif
+  }
+  else
+  {
+    f = fopen(fname.c_str(), "wb");
+    if (f == NULL) error("Could not open %s for writing.", fname.c_str());
   }
 
   // write header
-  hermes2d_fwrite("H2DS\001\000\000\000", 1, 8, f);
+  hermes2d_fwrite("H2DS", 1, 4, f);
+  hermes2d_fwrite(&SLN_FILE_VERSION, sizeof(int), 1, f);
   int ssize = sizeof(scalar);
   hermes2d_fwrite(&ssize, sizeof(int), 1, f);
   hermes2d_fwrite(&num_components, sizeof(int), 1, f);
   hermes2d_fwrite(&num_elems, sizeof(int), 1, f);
   hermes2d_fwrite(&num_coefs, sizeof(int), 1, f);
+  hermes2d_fwrite(&space_type, sizeof(int), 1, f);
+  static const char padding[SLN_COEFS_OFFSET - 28] = { 0 };
+  hermes2d_fwrite(padding, 1, sizeof(padding), f);
 
-  // write monomial coefficients
+  // write monomial coefficients (a compressed stream consumes them chunk by chunk)
   hermes2d_fwrite(mono_coefs, sizeof(scalar), num_coefs, f);
 
   // write element orders
@@ -966,7 +1396,7 @@ void Solution::save(const char* filename, bool compress)
   // write the mesh
   mesh->save_raw(f);
 
-  if (compress) pclose(f); else fclose(f);
+  if (fclose(f) != 0) error("Error writing to %s.", fname.c_str());
 }
 
 
@@ -976,21 +1406,25 @@ void Solution::load(const char* filename)
 
   free();
   type = SLN;
+  SlnData* d = new SlnData;
 
-  int len = strlen(filename);
-  bool compressed = (len > 3 && !strcmp(filename + len - 3, ".gz"));
-
-  // open the stream
+  // open the stream, recognize gzip files by their magic number
   FILE* f = fopen(filename, "rb");
   if (f == NULL) error("Could not open %s", filename);
 
+  unsigned char magic[2];
+  bool compressed = (fread(magic, 1, 2, f) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+  rewind(f);
+
   if (compressed)
   {
     fclose(f);
-    char cmdline[270];
-    sprintf(cmdline, "gunzip < %s", filename);
-    f = popen(cmdline, "r");
-    if (f == NULL) error("Could not read from compressed stream (command line: %s).", cmdline);
+    #ifdef WITH_ZLIB
+    f = hermes2d_gzopen(filename, "rb");
+    if (f == NULL) error("Could not read from compressed file %s.", filename);
+    #else
+    error("Hermes2D was built without zlib, cannot load compressed file %s.", filename);
+    #endif
   }
 
   // load header
@@ -1003,12 +1437,47 @@ void Solution::load(const char* filename)
   // some checks
   if (hdr.magic[0] != 'H' || hdr.magic[1] != '2' || hdr.magic[2] != 'D' || hdr.magic[3] != 'S')
     error("Not a Hermes2D solution file.");
-  if (hdr.ver > 1)
+  if (hdr.ver > SLN_FILE_VERSION)
     error("Unsupported file version.");
+  if (hdr.ver >= 2)
+  {
+    hermes2d_fread(&space_type, sizeof(int), 1, f);
+    char padding[SLN_COEFS_OFFSET - 28];
+    hermes2d_fread(padding, 1, sizeof(padding), f);
+  }
+  else
+    space_type = (hdr.nc == 1) ? 0 : 1; // version 1 does not record it, assume H1 or Hcurl
+  if (space_type < 0 || space_type > 3)
+    error("Corrupt solution file.");
 
   // load monomial coefficients
   num_coefs = hdr.nf;
-  if (hdr.ss == sizeof(double))
+  bool mapped = false;
+  #ifndef WIN32
+  if (!compressed && hdr.ver >= 2 && hdr.ss == sizeof(scalar))
+  {
+    // map the coefficients directly; the mapping is private, so that multiply() still works
+    size_t end = SLN_COEFS_OFFSET + (size_t) num_coefs * sizeof(scalar);
+    struct stat st;
+    if (fstat(fileno(f), &st) || (size_t) st.st_size < end)
+      error("Corrupt solution file.");
+
+    void* map = mmap(NULL, end, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED && !fseek(f, (long) end, SEEK_SET))
+    {
+      d->mono_map = map;
+      d->mono_map_size = end;
+      mono_coefs = (scalar*) ((char*) map + SLN_COEFS_OFFSET);
+      mapped = true;
+    }
+    else if (map != MAP_FAILED)
+      munmap(map, end);
+  }
+  #endif
+
+  if (mapped)
+    ; // coefficients are in the mapped file
+  else if (hdr.ss == sizeof(double))
   {
     double* temp = new double[num_coefs];
     hermes2d_fread(temp, sizeof(double), num_coefs, f);
@@ -1059,24 +1528,28 @@ void Solution::load(const char* filename)
   }
 
   // load the mesh
-  mesh = new Mesh;
-  mesh->load_raw(f);
-  own_mesh = true;
-
-  if (compressed) pclose(f); else fclose(f);
-
+  d->mesh = new Mesh;
+  d->mesh->load_raw(f);
+
+  fclose(f);
+
+  d->mono_coefs = mono_coefs;
+  d->elem_coefs[0] = elem_coefs[0];
+  d->elem_coefs[1] = elem_coefs[1];
+  d->elem_orders = elem_orders;
+  d->num_coefs = num_coefs;
+  d->num_elems = num_elems;
+  d->num_components = num_components;
+  attach_data(d);
   init_dxdy_buffer();
 }
 
 
 //// getting solution values in arbitrary points ///////////////////////////////////////////////////////////////
 
-scalar Solution::get_ref_value(Element* e, double xi1, double xi2, int component, int item)
+// evaluates the monomial expansion of order 'o' at (xi1, xi2) using Horner's scheme
+static inline scalar eval_mono(int mode, int o, const scalar* mono, double xi1, double xi2)
 {
-  set_active_element(e);
-
-  int o = elem_orders[e->id];
-  scalar* mono = dxdy_coefs[component][item];
   scalar result = 0.0;
   int k = 0;
   for (int i = 0; i <= o; i++)
@@ -1090,6 +1563,13 @@ scalar Solution::get_ref_value(Element* e, double xi1, double xi2, int component
 }
 
 
+scalar Solution::get_ref_value(Element* e, double xi1, double xi2, int component, int item)
+{
+  set_active_element(e);
+  return eval_mono(mode, elem_orders[e->id], dxdy_coefs[component][item], xi1, xi2);
+}
+
+
 static inline bool is_in_ref_domain(Element* e, double xi1, double xi2)
 {
   const double TOL = 1e-11;
@@ -1102,18 +1582,25 @@ static inline bool is_in_ref_domain(Element* e, double xi1, double xi2)
 
 scalar Solution::get_ref_value_transformed(Element* e, double xi1, double xi2, int a, int b)
 {
+  set_active_element(e);
+  return get_active_ref_value_transformed(xi1, xi2, a, b);
+}
+
 
+scalar Solution::get_active_ref_value_transformed(double xi1, double xi2, int a, int b)
+{
+  int o = elem_orders[element->id];
   if (num_components == 1)
   {
     if (b == 0)
-      return get_ref_value(e, xi1, xi2, a, b);
+      return eval_mono(mode, o, dxdy_coefs[a][b], xi1, xi2);
     if (b == 1 || b == 2)
     {
       double2x2 m;
       double xx, yy;
       refmap->inv_ref_map_at_point(xi1, xi2, xx, yy, m);
-      scalar dx = get_ref_value(e_last = e, xi1, xi2, a, 1);
-      scalar dy = get_ref_value(e, xi1, xi2, a, 2);
+      scalar dx = eval_mono(mode, o, dxdy_coefs[a][1], xi1, xi2);
+      scalar dy = eval_mono(mode, o, dxdy_coefs[a][2], xi1, xi2);
       if (b == 1) return m[0][0]*dx + m[0][1]*dy; // FN_DX
       if (b == 2) return m[1][0]*dx + m[1][1]*dy; // FN_DY
     }
@@ -1127,26 +1614,80 @@ scalar Solution::get_ref_value_transformed(Element* e, double xi1, double xi2, i
       double2x2 m;
       double xx, yy;
       refmap->inv_ref_map_at_point(xi1, xi2, xx, yy, m);
-      scalar vx = get_ref_value(e, xi1, xi2, 0, 0);
-      scalar vy = get_ref_value(e, xi1, xi2, 1, 0);
+      scalar vx = eval_mono(mode, o, dxdy_coefs[0][0], xi1, xi2);
+      scalar vy = eval_mono(mode, o, dxdy_coefs[1][0], xi1, xi2);
       if (a == 0) return m[0][0]*vx + m[0][1]*vy; // FN_VAL_0
       if (a == 1) return m[1][0]*vx + m[1][1]*vy; // FN_VAL_1
     }
     else
       error("Getting derivatives of the vector solution: Not implemented yet.");
   }
-
+  return 0.0;
 }
 
-scalar Solution::get_pt_value(double x, double y, int item)
+
+Element* Solution::find_element(double x, double y, double& xi1, double& xi2)
 {
-  double xi1, xi2;
+  // try the last visited element and its neighbours; it is kept as an id, since
+  // a copy-on-write mesh may get new element pointers (see Mesh::copy_cow)
+  if (e_last >= 0)
+  {
+    Element* elem[5];
+    elem[0] = mesh->get_element_fast(e_last);
+    for (unsigned int i = 1; i <= elem[0]->nvert; i++)
+      elem[i] = elem[0]->get_neighbor(i-1);
+
+    for (unsigned int i = 0; i <= elem[0]->nvert; i++)
+      if (elem[i] != NULL)
+      {
+        refmap->set_active_element(elem[i]);
+        refmap->untransform(elem[i], x, y, xi1, xi2);
+        if (is_in_ref_domain(elem[i], xi1, xi2))
+        {
+          e_last = elem[i]->id;
+          return elem[i];
+        }
+      }
+  }
+
+  // look up the candidate elements in the search tree
+  std::vector<int> cand;
+  sindex.update(mesh);
+  sindex.get_candidates(x, y, cand);
+  for (unsigned int i = 0; i < cand.size(); i++)
+  {
+    Element* e = mesh->get_element_fast(cand[i]);
+    refmap->set_active_element(e);
+    refmap->untransform(e, x, y, xi1, xi2);
+    if (is_in_ref_domain(e, xi1, xi2))
+    {
+      e_last = e->id;
+      return e;
+    }
+  }
 
-  int a = 0, b = 0, mask = item; // a = component, b = val, dx, dy, dxx, dyy, dxy
+  return NULL;
+}
+
+
+// splits 'item' (FN_VAL_0, FN_DX_1, ...) to the component 'a' and the value type 'b'
+static void decode_item(int item, int num_components, int& a, int& b)
+{
+  int mask = item;
+  a = b = 0;
   if (num_components == 1) mask = mask & FN_COMPONENT_0;
   if ((mask & (mask - 1)) != 0) error("'item' is invalid. ");
   if (mask >= 0x40) { a = 1; mask >>= 6; }
   while (!(mask & 1)) { mask >>= 1; b++; }
+}
+
+
+scalar Solution::get_pt_value(double x, double y, int item)
+{
+  double xi1, xi2;
+
+  int a, b; // a = component, b = val, dx, dy, dxx, dyy, dxy
+  decode_item(item, num_components, a, b);
 
   if (type == EXACT)
   {
@@ -1170,7 +1711,7 @@ scalar Solution::get_pt_value(double x, double y, int item)
   }
   else if (type == CNST)
   {
-    if (b = 0) return cnst[a];
+    if (b == 0) return cnst[a];
     return 0.0;
   }
   else if (type == UNDEF)
@@ -1180,41 +1721,53 @@ scalar Solution::get_pt_value(double x, double y, int item)
           "the solution on its right-hand side.");
   }
 
-  // try the last visited element and its neighbours
-  if (e_last != NULL)
-  {
-    Element* elem[5];
-    elem[0] = e_last;
-    for (unsigned int i = 1; i <= e_last->nvert; i++)
-      elem[i] = e_last->get_neighbor(i-1);
+  Element* e = find_element(x, y, xi1, xi2);
+  if (e != NULL)
+    return get_ref_value_transformed(e, xi1, xi2, a, b);
 
-    for (unsigned int i = 0; i <= e_last->nvert; i++)
-      if (elem[i] != NULL)
-      {
-        refmap->set_active_element(elem[i]);
-        refmap->untransform(elem[i], x, y, xi1, xi2);
-        if (is_in_ref_domain(elem[i], xi1, xi2))
-        {
-          e_last = elem[i];
-          return get_ref_value_transformed(elem[i], xi1, xi2, a, b);
-        }
-      }
+  warn("Point (%g, %g) does not lie in any element.", x, y);
+  return NAN;
+}
+
+
+void Solution::get_pt_values(int n, double* x, double* y, scalar* result, int item, bool quiet)
+{
+  if (type != SLN)
+  {
+    for (int i = 0; i < n; i++)
+      result[i] = get_pt_value(x[i], y[i], item);
+    return;
   }
 
-  // go through all elements
-  Element *e;
-  for_all_active_elements(e, mesh)
+  int a, b;
+  decode_item(item, num_components, a, b);
+
+  // locate all points
+  std::vector<std::pair<int, int> > pts; // (element id, point index)
+  AUTOLA_OR(double, xi1, n); AUTOLA_OR(double, xi2, n);
+  pts.reserve(n);
+  int outside = 0;
+  for (int i = 0; i < n; i++)
   {
-    refmap->set_active_element(e);
-    refmap->untransform(e, x, y, xi1, xi2);
-    if (is_in_ref_domain(e, xi1, xi2))
+    Element* e = find_element(x[i], y[i], xi1[i], xi2[i]);
+    if (e != NULL)
+      pts.push_back(std::make_pair(e->id, i));
+    else
     {
-      e_last = e;
-      return get_ref_value_transformed(e, xi1, xi2, a, b);
+      result[i] = NAN;
+      outside++;
     }
   }
+  if (outside && !quiet)
+    warn("%d of %d points do not lie in any element.", outside, n);
 
-  warn("Point (%g, %g) does not lie in any element.", x, y);
-  return NAN;
+  // evaluate the points element by element
+  std::sort(pts.begin(), pts.end());
+  for (unsigned int k = 0; k < pts.size(); k++)
+  {
+    if (k == 0 || pts[k].first != pts[k-1].first)
+      set_active_element(mesh->get_element_fast(pts[k].first));
+    int i = pts[k].second;
+    result[i] = get_active_ref_value_transformed(xi1[i], xi2[i], a, b);
+  }
 }
-
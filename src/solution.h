@@ -19,6 +19,7 @@
 #include "function.h"
 #include "space.h"
 #include "refmap.h"
+#include "spatial_index.h"
 
 class PrecalcShapeset;
 
@@ -45,6 +46,10 @@ public:
   Mesh*   get_mesh() const { return mesh; }
   RefMap* get_refmap() { update_refmap(); return refmap; }
 
+  /// Gives the reference map of the function its own shapeset, so that the function can be
+  /// evaluated concurrently with other functions. See RefMap::use_private_shapeset().
+  void use_private_refmap() { refmap->use_private_shapeset(); }
+
   virtual scalar get_pt_value(double x, double y, int item = FN_VAL_0) = 0;
 
 protected:
@@ -107,14 +112,26 @@ public:
   /// mapping matrix. The default is enabled (true).
   void enable_transform(bool enable = true);
 
+  /// Compression of solution files written by Solution::save().
+  enum SaveCodec
+  {
+    SAVE_RAW,  ///< uncompressed, the coefficients can be memory-mapped by load()
+    SAVE_GZIP  ///< gzip, compressed in-process (requires WITH_ZLIB)
+  };
+
   /// Saves the complete solution (i.e., including the internal copy of the mesh and
-  /// element orders) to a binary file. On Linux, if `compress` is true, the file is
-  /// compressed with gzip and a ".gz" suffix added to the file name.
-  void save(const char* filename, bool compress = true);
+  /// element orders) to a binary file. If `compress` is true, the file is compressed
+  /// with gzip and a ".gz" suffix added to the file name.
+  void save(const char* filename, bool compress = true)
+    { save(filename, compress ? SAVE_GZIP : SAVE_RAW); }
+
+  /// Saves the solution using the given codec. 'level' is the compression level
+  /// (1 = fastest, 9 = best, -1 = the codec default).
+  void save(const char* filename, SaveCodec codec, int level = -1);
 
   /// Loads the solution from a file previously created by Solution::save(). This completely
-  /// restores the solution in the memory. The file name has to include the ".gz" suffix,
-  /// in which case the file is piped through gzip to decompress the data (Linux only).
+  /// restores the solution in the memory. Compressed files are recognized by their contents.
+  /// The coefficients of an uncompressed file are memory-mapped instead of being copied.
   void load(const char* filename);
 
   /// Returns solution value or derivatives at element e, in its reference domain point (xi1, xi2).
@@ -132,18 +149,55 @@ public:
 
   /// Returns solution value or derivatives at the physical domain point (x, y).
   /// 'item' controls the returned value: FN_VAL_0, FN_VAL_1, FN_DX_0, FN_DX_1, FN_DY_0,....
+  /// The element containing the point is found using a quadtree of element bounding
+  /// boxes, which is built on the first call and rebuilt when the mesh changes.
   /// NOTE: This function should be used for postprocessing only, it is not effective
-  /// enough for calculations. Since it searches for an element sequentinally, it is extremelly
-  /// slow. Prefer Solution::get_ref_value if possible.
+  /// enough for calculations. Prefer Solution::get_ref_value if possible.
   virtual scalar get_pt_value(double x, double y, int item = FN_VAL_0);
 
+  /// Returns solution values or derivatives at 'n' physical domain points (x[i], y[i])
+  /// in result[i]. 'item' has the same meaning as in get_pt_value(). The points are
+  /// grouped by element, so that each element is activated only once. Points outside
+  /// the domain yield NAN; their number is reported in a single warning unless 'quiet'
+  /// is set.
+  void get_pt_values(int n, double* x, double* y, scalar* result, int item = FN_VAL_0, bool quiet = false);
+
+  /// Sets the number of elements for which the precalculated tables are kept (default 4).
+  /// Increase this if the elements are revisited in an irregular order, e.g., by several
+  /// filters sharing this solution or in multi-mesh traversals. All cached tables are
+  /// freed and the active element has to be selected again.
+  void set_table_cache_size(int n);
+
+  /// Returns the number of elements for which the precalculated tables are kept.
+  int get_table_cache_size() const { return (int) slots.size(); }
+
+  /// Returns the hit/miss/eviction counters of the element cache (ie., how often
+  /// set_active_element() found the tables of the element). The memory fields are
+  /// the same as in get_cache_stats().
+  void get_elem_cache_stats(TableCacheStats& stats) const;
+
+  /// Resets the counters returned by get_elem_cache_stats().
+  void reset_elem_cache_stats() { elem_hits = elem_misses = elem_evictions = 0; }
+
   /// Returns the number of degrees of freedom of the solution.
   /// Returns -1 for exact or constant solutions.
   int get_num_dofs() const { return num_dofs; };
 
   /// Multiplies the function represented by this class by the given coefficient.
+  /// If the coefficients are shared with a copy, this solution gets its own copy of
+  /// them (and of the mesh) first.
   void multiply(scalar coef);
 
+  /// Enables or disables lazy conversion for the following calls to set_fe_solution().
+  /// In the lazy mode, the solution on an element is converted to monomials only when
+  /// the element is selected for the first time. The shapeset of the space must then
+  /// exist as long as the solution is not fully converted. The default is disabled.
+  void enable_lazy_conversion(bool enable = true) { lazy = enable; }
+
+  /// Converts all elements not converted yet (see enable_lazy_conversion()). If
+  /// 'num_threads' is greater than one, the elements are converted in parallel.
+  void convert_all(int num_threads = 1);
+
 
 public:
 
@@ -153,6 +207,10 @@ public:
   /// Internal.
   virtual void set_active_element(Element* e);
 
+  /// Internal. Keeps the tables of the given elements cached until the next hint.
+  virtual void hint_elements(int n, Element** e);
+  virtual int get_max_hints() const { return (int) slots.size() - 1; }
+
 
 protected:
 
@@ -160,12 +218,72 @@ protected:
 
   bool own_mesh;
   bool transform;
+  bool lazy;
 
-  void* tables[4][4];   ///< precalculated tables for last four used elements
-  Element* elems[4][4];
-  int cur_elem, oldest[4];
-
-  scalar* mono_coefs;  ///< monomial coefficient array
+  /// Monomial coefficients and the mesh of a solution. They are shared by the copies
+  /// of the solution (see copy()) and freed together with the last of them.
+  struct SlnData
+  {
+    int refs;               ///< number of solutions using the data
+    Mesh* mesh;             ///< private copy of the mesh
+    scalar* mono_coefs;     ///< monomial coefficient array
+    void* mono_map;         ///< memory-mapped solution file holding mono_coefs, or NULL
+    size_t mono_map_size;
+    int* elem_coefs[2];     ///< array of pointers into mono_coefs
+    int* elem_orders;       ///< stored element orders
+    int num_coefs, num_elems, num_components;
+
+    // lazy conversion: shape functions and their coefficients on each element
+    // which has not been converted to monomials yet
+    Shapeset* shapeset;
+    PrecalcShapeset* pss;
+    bool* pending;          ///< true for elements not converted yet
+    int num_pending;
+    std::vector<int> pend_first;  ///< first entry of each element in pend_idx, pend_coef
+    std::vector<int> pend_idx;
+    std::vector<scalar> pend_coef;
+
+    SlnData();
+    ~SlnData();
+    void free_pending();    ///< frees the data used for the lazy conversion
+  };
+
+  SlnData* data;  ///< coefficients of a standard (SLN) solution, NULL otherwise
+
+  void attach_data(SlnData* d);
+  void unshare_data();
+  void convert_element(Element* e);
+  void convert_pending(PrecalcShapeset* pss, int num_threads);
+  static void convert_coefs(SlnData* d, PrecalcShapeset* pss, Element* e, const int* idx,
+                            const scalar* coef, int cnt);
+  static void convert_elements(SlnData* d, PrecalcShapeset* pss, const int* ids, int n, int step);
+  static void* convert_thread(void* arg);
+
+  /// Cached precalculated tables of one element.
+  struct ElemSlot
+  {
+    Element* e;           ///< the element, NULL if the slot is unused
+    void* tables[4];      ///< precalculated tables, one for each quadrature
+    unsigned long stamp;  ///< time of the last use, for LRU replacement
+    unsigned long hint;   ///< equal to hint_clock if the element is hinted
+    int next;             ///< next slot in the same hash chain, -1 = none
+  };
+
+  std::vector<ElemSlot> slots;  ///< element table cache
+  std::vector<int> slot_hash;   ///< heads of the hash chains, indexed by element id
+  std::vector<Element*> hinted; ///< elements which will be visited soon (see hint_elements())
+  int cur_slot;
+  unsigned long slot_clock, hint_clock;
+  size_t elem_hits, elem_misses, elem_evictions;
+
+  unsigned mesh_seq; ///< seq of the mesh the cached element pointers belong to
+
+  int  find_slot(Element* e);
+  int  take_slot(Element* e);
+  void unlink_slot(int s);
+  void check_mesh_seq();
+
+  scalar* mono_coefs;  ///< monomial coefficient array (these five are copies of 'data' fields)
   int* elem_coefs[2];  ///< array of pointers into mono_coefs
   int* elem_orders;    ///< stored element orders
   int num_coefs, num_elems;
@@ -184,11 +302,20 @@ protected:
   scalar* dxdy_coefs[2][6];
   scalar* dxdy_buffer;
 
-  double** calc_mono_matrix(int o, int*& perm);
+  static double** calc_mono_matrix(int mode, int o, int*& perm);
   void init_dxdy_buffer();
   void free_tables();
+  void trim_tables(); ///< frees cached element tables to respect the memory budget
+
+  int e_last; ///< id of the last visited element when getting solution values at specific points
+  SpatialIndex sindex; ///< element search tree for get_pt_value()
+
+  /// Finds the active element containing the physical point (x, y) and the reference
+  /// coordinates of the point. Returns NULL if the point lies outside the mesh.
+  Element* find_element(double x, double y, double& xi1, double& xi2);
 
-  Element* e_last; ///< last visited element when getting solution values at specific points
+  /// Like get_ref_value_transformed(), but for the active element.
+  scalar get_active_ref_value_transformed(double xi1, double xi2, int a, int b);
 
 };
 
@@ -51,6 +51,10 @@ protected:
   /// stored in the CSR or CSC arrays.
   virtual bool handles_symmetry() = 0;
 
+  /// Iterative solvers should return true if they start from the vector passed to solve().
+  /// Otherwise LinSystem does not spend time calculating an initial guess.
+  virtual bool uses_initial_guess() { return false; }
+
 
   /// Creates a new data block containing (optional) factorization data.
   /// This method is called by LinSystem on its creation.
@@ -17,6 +17,9 @@
 #include "space.h"
 #include "matrix.h"
 #include "auto_local_array.h"
+#include "profiler.h"
+#include <map>
+#include <algorithm>
 
 
 Space::Space(Mesh* mesh, Shapeset* shapeset)
@@ -31,6 +34,9 @@ Space::Space(Mesh* mesh, Shapeset* shapeset)
   mesh_seq = -1;
   seq = 0;
   was_assigned = false;
+  stable_dofs = prev_valid = false;
+  blocks_first_dof = blocks_stride = 0;
+  ac_seq = assigned_seq = -1;
 
   set_bc_types(NULL);
   set_bc_values((scalar (*)(int, double, double)) NULL);
@@ -49,6 +55,11 @@ void Space::free()
   free_extra_data();
   if (nsize) { ::free(ndata); nsize = 0; }
   if (esize) { ::free(edata); esize = 0; }
+  dof_blocks.clear();
+  prev_dof.clear();
+  prev_valid = false;
+  blocks_stride = 0;
+  ac_seq = assigned_seq = -1;
 }
 
 
@@ -261,6 +272,7 @@ int Space::assign_dofs(int first_dof, int stride)
 {
   if (first_dof < 0) error("Invalid first_dof.");
   if (stride < 1)    error("Invalid stride.");
+  ProfilerPhase phase("assign_dofs");
 
   resize_tables();
 
@@ -276,9 +288,18 @@ int Space::assign_dofs(int first_dof, int stride)
   this->first_dof = next_dof = first_dof;
   this->stride = stride;
 
+  new_blocks.clear();
   assign_vertex_dofs();
   assign_edge_dofs();
   assign_bubble_dofs();
+  if (stable_dofs)
+    renumber_stable();
+  else
+  {
+    dof_blocks.clear();
+    prev_valid = false;
+    blocks_stride = 0;
+  }
 
   free_extra_data();
   update_bc_dofs();
@@ -288,10 +309,131 @@ int Space::assign_dofs(int first_dof, int stride)
   mesh_seq = mesh->get_seq();
   was_assigned = true;
   seq++;
+  assigned_seq = seq;
   return get_num_dofs();
 }
 
 
+void Space::new_dofs(int& dof, int n, Node* node)
+{
+  dof = next_dof;
+  next_dof += n * stride;
+  if (!stable_dofs || n <= 0) return;
+
+  DofBlock b = { { 0, node->id, node->p1, node->p2, n }, n, (dof - first_dof) / stride, &dof };
+  new_blocks.push_back(b);
+}
+
+
+void Space::new_dofs(int& dof, int n, Element* e)
+{
+  dof = next_dof;
+  next_dof += n * stride;
+  if (!stable_dofs || n <= 0) return;
+
+  DofBlock b = { { 1, e->id, e->vn[0]->id, e->vn[1]->id, edata[e->id].order }, n, (dof - first_dof) / stride, &dof };
+  new_blocks.push_back(b);
+}
+
+
+static bool larger_block_first(const std::pair<int, int>& a, const std::pair<int, int>& b)
+{
+  return (a.first != b.first) ? a.first > b.first : a.second < b.second;
+}
+
+void Space::renumber_stable()
+{
+  std::vector<DofBlock>& blocks = new_blocks;
+  int ndofs = get_num_dofs();
+  int nb = blocks.size();
+  std::sort(blocks.begin(), blocks.end());
+
+  // find the blocks that existed before; they keep their DOFs if these are still in range
+  prev_valid = (blocks_stride > 0);
+  std::vector<int> start(nb, -1), old(nb, -1);
+  std::vector<char> used(ndofs, 0);
+  for (int i = 0, j = 0; i < nb && j < (int) dof_blocks.size(); )
+  {
+    if (blocks[i] < dof_blocks[j]) i++;
+    else if (dof_blocks[j] < blocks[i]) j++;
+    else
+    {
+      old[i] = dof_blocks[j].first;
+      if (old[i] + blocks[i].n <= ndofs)
+      {
+        start[i] = old[i];
+        memset(&used[start[i]], 1, blocks[i].n);
+      }
+      i++; j++;
+    }
+  }
+
+  // without a previous numbering there is nothing to keep, the fresh one is used
+  if (!prev_valid)
+    for (int i = 0; i < nb; i++)
+      start[i] = blocks[i].first;
+
+  // the other blocks fill the gaps, the largest first, each into the smallest gap it fits
+  std::multimap<int, int> gaps;
+  for (int k = 0; k < ndofs; )
+  {
+    if (used[k]) { k++; continue; }
+    int l = k;
+    while (l < ndofs && !used[l]) l++;
+    gaps.insert(std::make_pair(l - k, k));
+    k = l;
+  }
+
+  std::vector<std::pair<int, int> > todo;
+  for (int i = 0; i < nb; i++)
+    if (start[i] < 0)
+      todo.push_back(std::make_pair(blocks[i].n, i));
+  std::sort(todo.begin(), todo.end(), larger_block_first);
+
+  for (unsigned t = 0; t < todo.size(); t++)
+  {
+    int i = todo[t].second, n = blocks[i].n;
+    std::multimap<int, int>::iterator it = gaps.lower_bound(n);
+    if (it == gaps.end())
+    {
+      // the gaps are too fragmented: keep the fresh numbering
+      verbose("Stable DOF numbering not possible, %d of %d blocks would have been kept.",
+              nb - (int) todo.size(), nb);
+      for (int k = 0; k < nb; k++) start[k] = blocks[k].first;
+      break;
+    }
+    start[i] = it->second;
+    if (it->first > n) gaps.insert(std::make_pair(it->first - n, it->second + n));
+    gaps.erase(it);
+  }
+
+  // store the new DOF numbers and the mapping to the previous ones
+  prev_dof.assign(ndofs, -1);
+  for (int i = 0; i < nb; i++)
+  {
+    DofBlock& b = blocks[i];
+    b.first = start[i];
+    *b.dof = first_dof + b.first * stride;
+    if (old[i] >= 0)
+      for (int k = 0; k < b.n; k++)
+        prev_dof[b.first + k] = blocks_first_dof + (old[i] + k) * blocks_stride;
+  }
+
+  dof_blocks.swap(blocks);
+  blocks.clear();
+  blocks_first_dof = first_dof;
+  blocks_stride = stride;
+}
+
+
+int Space::get_prev_dof(int dof) const
+{
+  if (!prev_valid) error("The previous DOF numbering is not known, see set_stable_dofs().");
+  if (dof < first_dof || dof >= next_dof || (dof - first_dof) % stride) return -1;
+  return prev_dof[(dof - first_dof) / stride];
+}
+
+
 //// assembly lists ///////////////////////////////////////////////////////////////////////////////
 
 void AsmList::enlarge()
@@ -303,6 +445,44 @@ void AsmList::enlarge()
 }
 
 
+void Space::build_asm_cache()
+{
+  int n = mesh->get_max_element_id();
+  ac_sec.assign(10 * n, -1);
+  ac_idx.clear();
+  ac_dof.clear();
+  ac_coef.clear();
+
+  AsmList al;
+  Element* e;
+  for_all_active_elements(e, mesh)
+  {
+    int* sec = &ac_sec[10 * e->id];
+    int nv = e->nvert, base = ac_idx.size();
+    al.clear();
+    shapeset->set_mode(e->get_mode());
+    for (int i = 0; i < 4; i++)
+    {
+      sec[i] = base + al.cnt;
+      if (i < nv) get_vertex_assembly_list(e, i, &al);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+      sec[4 + i] = base + al.cnt;
+      if (i < nv) get_edge_assembly_list_internal(e, i, &al);
+    }
+    sec[8] = base + al.cnt;
+    get_bubble_assembly_list(e, &al);
+    sec[9] = base + al.cnt;
+
+    ac_idx.insert(ac_idx.end(), al.idx, al.idx + al.cnt);
+    ac_dof.insert(ac_dof.end(), al.dof, al.dof + al.cnt);
+    ac_coef.insert(ac_coef.end(), al.coef, al.coef + al.cnt);
+  }
+  ac_seq = seq;
+}
+
+
 void Space::get_element_assembly_list(Element* e, AsmList* al)
 {
   // some checks
@@ -312,9 +492,20 @@ void Space::get_element_assembly_list(Element* e, AsmList* al)
     error("The space is out of date. You need to update it with assign_dofs()"
           " any time the mesh changes.");
 
-  // add vertex, edge and bubble functions to the assembly list
   al->clear();
   shapeset->set_mode(e->get_mode());
+
+  // use the cached list if the space did not change since assign_dofs()
+  if (ac_seq != seq && assigned_seq == seq) build_asm_cache();
+  if (ac_seq == seq && 10 * e->id < (int) ac_sec.size() && ac_sec[10 * e->id] >= 0)
+  {
+    const int* sec = &ac_sec[10 * e->id];
+    int n = sec[9] - sec[0];
+    if (n) al->add_triplets(&ac_idx[sec[0]], &ac_dof[sec[0]], &ac_coef[sec[0]], n);
+    return;
+  }
+
+  // add vertex, edge and bubble functions to the assembly list
   for (unsigned int i = 0; i < e->nvert; i++)
     get_vertex_assembly_list(e, i, al);
   for (unsigned int i = 0; i < e->nvert; i++)
@@ -327,6 +518,21 @@ void Space::get_edge_assembly_list(Element* e, int edge, AsmList* al)
 {
   al->clear();
   shapeset->set_mode(e->get_mode());
+
+  if (ac_seq != seq && assigned_seq == seq && is_up_to_date()) build_asm_cache();
+  if (ac_seq == seq && 10 * e->id < (int) ac_sec.size() && ac_sec[10 * e->id] >= 0)
+  {
+    const int* sec = &ac_sec[10 * e->id];
+    int next = e->next_vert(edge);
+    int part[3][2] = { { sec[edge], sec[edge+1] }, { sec[next], sec[next+1] }, { sec[4+edge], sec[5+edge] } };
+    for (int i = 0; i < 3; i++)
+    {
+      int n = part[i][1] - part[i][0];
+      if (n) al->add_triplets(&ac_idx[part[i][0]], &ac_dof[part[i][0]], &ac_coef[part[i][0]], n);
+    }
+    return;
+  }
+
   get_vertex_assembly_list(e, edge, al);
   get_vertex_assembly_list(e, e->next_vert(edge), al);
   get_edge_assembly_list_internal(e, edge, al);
@@ -143,6 +143,21 @@ public:
   /// \brief Returns the DOF number of the last basis function.
   int get_max_dof() const { return next_dof - stride; }
 
+  /// \brief Makes assign_dofs() keep the DOF numbers of unchanged nodes and elements.
+  /// \details Normally the DOFs are numbered from scratch in each call to assign_dofs(). With
+  /// stable numbering, the basis functions of nodes and elements that did not change since the
+  /// previous call keep their numbers, and the new ones take the numbers that were freed or are
+  /// appended at the end. After a local mesh refinement, the numbering thus changes only
+  /// locally and get_prev_dof() relates the old and the new DOFs. LinSystem uses this to keep
+  /// the previous solution as the initial guess. The DOFs, constraints and boundary conditions
+  /// are still assigned by a full pass over the mesh; only the numbering is stable.
+  void set_stable_dofs(bool enable = true) { stable_dofs = enable; }
+  /// \brief Returns true if the last call to assign_dofs() knew the previous numbering.
+  bool has_prev_dofs() const { return prev_valid; }
+  /// \brief Returns the number the basis function 'dof' had before the last call to
+  /// assign_dofs(), or -1 if it is new. Requires has_prev_dofs().
+  int get_prev_dof(int dof) const;
+
   Shapeset* get_shapeset() const { return shapeset; }
   Mesh* get_mesh() const { return mesh; }
   void set_mesh(Mesh* mesh);
@@ -175,6 +190,40 @@ protected:
   int seq, mesh_seq;
   bool was_assigned;
 
+  // A block of consecutive DOFs of one node or element bubble, identified by 'key' (node:
+  // 0, id, p1, p2, n; element: 1, id, first two vertex ids, order) across assign_dofs() calls.
+  struct DofBlock
+  {
+    int key[5];
+    int n;     // number of DOFs
+    int first; // index of the first DOF (not the DOF number)
+    int* dof;  // where the DOF number is stored, valid during assign_dofs() only
+    bool operator<(const DofBlock& b) const { return memcmp(key, b.key, sizeof(key)) < 0; }
+  };
+
+  bool stable_dofs, prev_valid;
+  std::vector<DofBlock> new_blocks; ///< blocks being assigned
+  std::vector<DofBlock> dof_blocks; ///< blocks of the last stable assignment, sorted by key
+  int blocks_first_dof, blocks_stride; ///< numbering of 'dof_blocks', zero stride if none
+  std::vector<int> prev_dof;        ///< previous DOF number of each DOF index, or -1
+
+  /// Assigns 'n' new DOF numbers to the node, storing the first one to 'dof'.
+  void new_dofs(int& dof, int n, Node* node);
+  /// Assigns 'n' new DOF numbers to the bubble of the element, storing the first one to 'dof'.
+  void new_dofs(int& dof, int n, Element* e);
+  /// Renumbers the new blocks so that the unchanged ones keep their previous DOFs.
+  void renumber_stable();
+
+  // Assembly lists of all active elements, built on the first request after assign_dofs() and
+  // valid while 'seq' does not change; if the space is modified after assign_dofs(), the lists
+  // are computed directly until the next assign_dofs(). The lists are stored one after another; for each element id, 'ac_sec' holds
+  // the starts of its four vertex parts, four edge parts and the bubble part, and the end.
+  std::vector<int> ac_idx, ac_dof, ac_sec;
+  std::vector<scalar> ac_coef;
+  int ac_seq, assigned_seq; ///< 'seq' of the cache and after the last assign_dofs()
+
+  void build_asm_cache();
+
   struct BaseComponent
   {
     int dof;
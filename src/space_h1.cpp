@@ -114,8 +114,7 @@ void H1Space::assign_vertex_dofs()
           }
           else
           {
-            nd->dof = next_dof;
-            next_dof += stride;
+            new_dofs(nd->dof, 1, vn);
           }
           nd->n = 1;
         }
@@ -137,8 +136,7 @@ void H1Space::assign_vertex_dofs()
             }
             else
             {
-              nd->dof = next_dof;
-              next_dof += ndofs * stride;
+              new_dofs(nd->dof, ndofs, en);
             }
           }
           else // constrained edge node
@@ -152,9 +150,8 @@ void H1Space::assign_vertex_dofs()
     // bubble dofs
     shapeset->set_mode(e->get_mode());
     ElementData* ed = &edata[e->id];
-    ed->bdof = next_dof;
     ed->n = order ? shapeset->get_num_bubbles(ed->order) : 0;
-    next_dof += ed->n * stride;
+    new_dofs(ed->bdof, ed->n, e);
   }
 }
 
@@ -76,8 +76,7 @@ void HdivSpace::assign_edge_dofs()
       }
       else
       {
-        ndata[en->id].dof = next_dof;
-        next_dof += ndofs * stride;
+        new_dofs(ndata[en->id].dof, ndofs, en);
       }
     }
     else
@@ -95,9 +94,8 @@ void HdivSpace::assign_bubble_dofs()
   {
     shapeset->set_mode(e->get_mode());
     ElementData* ed = &edata[e->id];
-    ed->bdof = next_dof;
     ed->n = shapeset->get_num_bubbles(ed->order);
-    next_dof += ed->n * stride;
+    new_dofs(ed->bdof, ed->n, e);
   }
 }
 
@@ -63,9 +63,8 @@ void L2Space::assign_bubble_dofs()
   {
     shapeset->set_mode(e->get_mode());
     ElementData* ed = &edata[e->id];
-    ed->bdof = next_dof;
     ed->n = shapeset->get_num_bubbles(ed->order);
-    next_dof += ed->n * stride;
+    new_dofs(ed->bdof, ed->n, e);
   }
 }
 
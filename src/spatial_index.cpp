@@ -0,0 +1,160 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "mesh.h"
+#include "refmap.h"
+#include "spatial_index.h"
+
+
+static const int LEAF_SIZE = 8;  // maximum number of elements in a leaf...
+static const int MAX_DEPTH = 24; // ...unless the tree is already this deep
+
+
+SpatialIndex::SpatialIndex()
+{
+  mesh = NULL;
+  seq = 0;
+}
+
+
+void SpatialIndex::calc_bounding_box(Element* e, BBox& box)
+{
+  box.x0 = box.x1 = e->vn[0]->x;
+  box.y0 = box.y1 = e->vn[0]->y;
+  for (unsigned int i = 1; i < e->nvert; i++)
+  {
+    box.x0 = std::min(box.x0, e->vn[i]->x);  box.x1 = std::max(box.x1, e->vn[i]->x);
+    box.y0 = std::min(box.y0, e->vn[i]->y);  box.y1 = std::max(box.y1, e->vn[i]->y);
+  }
+
+  if (e->is_curved())
+  {
+    // sample the curved edges through the reference map
+    static const double2 tri_edge[3][2] = { { {-1,-1}, { 1,-1} }, { { 1,-1}, {-1, 1} }, { {-1, 1}, {-1,-1} } };
+    static const double2 quad_edge[4][2] = { { {-1,-1}, { 1,-1} }, { { 1,-1}, { 1, 1} },
+                                             { { 1, 1}, {-1, 1} }, { {-1, 1}, {-1,-1} } };
+    const int ns = 16;
+    RefMap refmap;
+    refmap.set_active_element(e);
+    for (unsigned int i = 0; i < e->nvert; i++)
+    {
+      const double2* ed = e->is_triangle() ? tri_edge[i] : quad_edge[i];
+      for (int j = 1; j < ns; j++)
+      {
+        double t = (double) j / ns, x, y;
+        double2x2 m;
+        refmap.inv_ref_map_at_point(ed[0][0] + t * (ed[1][0] - ed[0][0]),
+                                    ed[0][1] + t * (ed[1][1] - ed[0][1]), x, y, m);
+        box.x0 = std::min(box.x0, x);  box.x1 = std::max(box.x1, x);
+        box.y0 = std::min(box.y0, y);  box.y1 = std::max(box.y1, y);
+      }
+    }
+
+    // account for the curvature between the samples
+    double mx = 0.01 * (box.x1 - box.x0), my = 0.01 * (box.y1 - box.y0);
+    box.x0 -= mx;  box.x1 += mx;
+    box.y0 -= my;  box.y1 += my;
+  }
+}
+
+
+void SpatialIndex::update(Mesh* mesh)
+{
+  if (this->mesh == mesh && seq == mesh->get_seq()) return;
+  this->mesh = mesh;
+  seq = mesh->get_seq();
+
+  nodes.clear();
+  items.clear();
+  boxes.resize(mesh->get_max_element_id());
+
+  // calculate the bounding boxes of all active elements and of the whole mesh
+  Element* e;
+  std::vector<int> ids;
+  QNode root = { 1e300, 1e300, -1e300, -1e300, -1, 0, 0 };
+  for_all_active_elements(e, mesh)
+  {
+    BBox& box = boxes[e->id];
+    calc_bounding_box(e, box);
+    root.x0 = std::min(root.x0, box.x0);  root.x1 = std::max(root.x1, box.x1);
+    root.y0 = std::min(root.y0, box.y0);  root.y1 = std::max(root.y1, box.y1);
+    ids.push_back(e->id);
+  }
+
+  nodes.push_back(root);
+  build(0, ids, 0);
+}
+
+
+void SpatialIndex::build(int node, std::vector<int>& ids, int depth)
+{
+  if ((int) ids.size() <= LEAF_SIZE || depth >= MAX_DEPTH)
+  {
+    nodes[node].first = items.size();
+    nodes[node].count = ids.size();
+    items.insert(items.end(), ids.begin(), ids.end());
+    return;
+  }
+
+  // split the node into four quadrants
+  QNode n = nodes[node];
+  double xm = 0.5 * (n.x0 + n.x1), ym = 0.5 * (n.y0 + n.y1);
+  int son = nodes[node].son = nodes.size();
+  for (int i = 0; i < 4; i++)
+  {
+    QNode s = { (i & 1) ? xm : n.x0, (i & 2) ? ym : n.y0,
+                (i & 1) ? n.x1 : xm, (i & 2) ? n.y1 : ym, -1, 0, 0 };
+    nodes.push_back(s);
+  }
+
+  // each element goes to all quadrants its bounding box overlaps
+  for (int i = 0; i < 4; i++)
+  {
+    QNode& s = nodes[son + i];
+    std::vector<int> sub;
+    for (unsigned int j = 0; j < ids.size(); j++)
+    {
+      BBox& box = boxes[ids[j]];
+      if (box.x0 <= s.x1 && box.x1 >= s.x0 && box.y0 <= s.y1 && box.y1 >= s.y0)
+        sub.push_back(ids[j]);
+    }
+    build(son + i, sub, depth + 1);
+  }
+}
+
+
+void SpatialIndex::get_candidates(double x, double y, std::vector<int>& cand) const
+{
+  cand.clear();
+  if (nodes.empty()) return;
+
+  const double TOL = 1e-12;
+  const QNode* n = &nodes[0];
+  if (x < n->x0 - TOL || x > n->x1 + TOL || y < n->y0 - TOL || y > n->y1 + TOL) return;
+
+  while (n->son >= 0)
+  {
+    double xm = 0.5 * (n->x0 + n->x1), ym = 0.5 * (n->y0 + n->y1);
+    n = &nodes[n->son + (x >= xm ? 1 : 0) + (y >= ym ? 2 : 0)];
+  }
+
+  for (int i = n->first; i < n->first + n->count; i++)
+  {
+    const BBox& box = boxes[items[i]];
+    if (x >= box.x0 - TOL && x <= box.x1 + TOL && y >= box.y0 - TOL && y <= box.y1 + TOL)
+      cand.push_back(items[i]);
+  }
+}
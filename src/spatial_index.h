@@ -0,0 +1,78 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __HERMES2D_SPATIAL_INDEX_H
+#define __HERMES2D_SPATIAL_INDEX_H
+
+#include "common.h"
+
+class Mesh;
+struct Element;
+
+
+/// \brief Quadtree of the bounding boxes of the active elements of a mesh.
+///
+/// SpatialIndex speeds up the search for the element containing a given physical
+/// point. The tree is built lazily by update() and rebuilt only when the mesh or
+/// its sequence number changes. Each leaf of the tree holds the id numbers of all
+/// elements whose bounding box overlaps the leaf, so a query only descends to one
+/// leaf and returns a handful of candidates. The bounding boxes of curvilinear
+/// elements include their curved edges.
+///
+class HERMES2D_API SpatialIndex
+{
+public:
+
+  SpatialIndex();
+
+  /// Makes sure the index is built for the current state of 'mesh'.
+  void update(Mesh* mesh);
+
+  /// Forgets the index, it will be rebuilt on the next update().
+  void invalidate() { mesh = NULL; }
+
+  /// Returns (in 'cand') the id numbers of the active elements whose bounding
+  /// box contains the point (x, y). The elements still have to be checked
+  /// by RefMap::untransform().
+  void get_candidates(double x, double y, std::vector<int>& cand) const;
+
+protected:
+
+  struct BBox
+  {
+    double x0, y0, x1, y1;
+  };
+
+  struct QNode
+  {
+    double x0, y0, x1, y1; ///< extent of the node
+    int son;               ///< index of the first of the four sons, -1 for leaves
+    int first, count;      ///< range of element ids in 'items' (leaves only)
+  };
+
+  Mesh* mesh;
+  unsigned seq;
+
+  std::vector<BBox> boxes; ///< element bounding boxes, indexed by element id
+  std::vector<QNode> nodes;
+  std::vector<int> items;
+
+  void calc_bounding_box(Element* e, BBox& box);
+  void build(int node, std::vector<int>& ids, int depth);
+
+};
+
+
+#endif
@@ -55,6 +55,17 @@ public:
   /// \param e [in] Element associated with the function being represented by the class.
   virtual void set_active_element(Element* e) { element = e; }
 
+  /// Called by Traverse before it visits the given active elements, so that the class
+  /// can keep their precalculated data. The elements may be visited in any order and
+  /// more than once. The default implementation does nothing.
+  /// \param n [in] Number of elements.
+  /// \param e [in] Array of the elements.
+  virtual void hint_elements(int n, Element** e) {}
+
+  /// \return The largest number of elements worth passing to hint_elements(), zero if
+  /// the class does not use the hints.
+  virtual int get_max_hints() const { return 0; }
+
   /// \return The element associated with the function being represented by the class.
   Element* get_active_element() const { return element; }
 
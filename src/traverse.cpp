@@ -18,6 +18,7 @@
 #include "transform.h"
 #include "traverse.h"
 #include "auto_local_array.h"
+#include <algorithm>
 
 
 const uint64_t ONE = (uint64_t) 1 << 63;
@@ -38,9 +39,123 @@ struct State
   bool bnd[3];
   uint64_t lo[3], hi[3];
   int* trans;
+  uint64_t* sub;
 };
 
 
+/// A recorded traversal: for each leaf state the element ids and sub-element
+/// transformations on all meshes, plus what set_boundary_info() needs. Elements are
+/// stored as ids, so that the plan remains valid for a mesh which reallocates its
+/// elements without changing them (see Mesh::copy_cow()).
+struct TraversePlan
+{
+  struct Leaf
+  {
+    int base;        ///< base element id
+    bool first;      ///< first leaf of the base element
+    bool bnd[3];     ///< triangles: State::bnd
+    uint64_t g[6];   ///< triangles: State::lo and State::hi, quads: State::cr
+  };
+
+  int num;
+  std::vector<Mesh*> meshes;
+  std::vector<unsigned> seqs;
+  std::vector<Leaf> leaves;
+  std::vector<int> ids;       ///< num per leaf, -1 for no element
+  std::vector<uint64_t> subs; ///< num per leaf
+  int refs;                   ///< number of Traverse objects replaying the plan
+  bool cached;
+
+  bool matches(int n, Mesh** m) const
+  {
+    if (n != num) return false;
+    for (int i = 0; i < n; i++)
+      if (m[i] != meshes[i] || m[i]->get_seq() != seqs[i])
+        return false;
+    return true;
+  }
+};
+
+
+static void release_plan(TraversePlan* plan)
+{
+  if (--plan->refs <= 0 && !plan->cached)
+    delete plan;
+}
+
+
+TraversePlanCache::TraversePlanCache(int max_plans)
+{
+  this->max_plans = std::max(max_plans, 0);
+}
+
+
+TraversePlanCache::~TraversePlanCache()
+{
+  free();
+}
+
+
+void TraversePlanCache::set_max_plans(int n)
+{
+  max_plans = std::max(n, 0);
+  trim();
+}
+
+
+void TraversePlanCache::free()
+{
+  int n = max_plans;
+  max_plans = 0;
+  trim();
+  max_plans = n;
+}
+
+
+TraversePlan* TraversePlanCache::find(int n, Mesh** meshes)
+{
+  for (unsigned i = 0; i < plans.size(); i++)
+    if (plans[i]->matches(n, meshes))
+    {
+      TraversePlan* plan = plans[i];
+      plans.erase(plans.begin() + i);
+      plans.insert(plans.begin(), plan);
+      return plan;
+    }
+  return NULL;
+}
+
+
+void TraversePlanCache::insert(TraversePlan* plan)
+{
+  // a plan for the same meshes with older seq numbers will never be replayed again
+  for (unsigned i = 0; i < plans.size(); i++)
+    if (plans[i]->num == plan->num && plans[i]->meshes == plan->meshes)
+    {
+      plans[i]->cached = false;
+      if (plans[i]->refs <= 0) delete plans[i];
+      plans.erase(plans.begin() + i);
+      break;
+    }
+
+  plans.insert(plans.begin(), plan);
+  plan->cached = true;
+  trim();
+}
+
+
+void TraversePlanCache::trim()
+{
+  while ((int) plans.size() > max_plans)
+  {
+    TraversePlan* plan = plans.back();
+    plans.pop_back();
+    plan->cached = false;
+    if (plan->refs <= 0) delete plan;
+  }
+}
+
+
 static int get_split_and_sons(Element* e, Rect* cr, Rect* er, int4& sons)
 {
   uint64_t hmid = (er->l + er->r) >> 1;
@@ -144,6 +259,7 @@ State* Traverse::push_state()
     stack[top].e = new Element*[num];
     stack[top].er = new Rect[num];
     stack[top].trans = new int[num];
+    stack[top].sub = new uint64_t[num];
   }
 
   stack[top].visited = false;
@@ -196,8 +312,32 @@ void Traverse::set_boundary_info(State* s, bool* bnd, EdgePos* ep)
 }
 
 
+static void collect_active(Element* e, std::vector<Element*>& list, int max)
+{
+  if (e->active) { list.push_back(e); return; }
+  for (int i = 0; i < 4 && (int) list.size() < max; i++)
+    if (e->sons[i] != NULL)
+      collect_active(e->sons[i], list, max);
+}
+
+
+void Traverse::hint_elements(int i, Element* e)
+{
+  // tell fn[i] which of its elements will be visited while traversing this base element;
+  // the walk stops when fn[i] cannot keep more of them
+  int max = fn[i]->get_max_hints();
+  if (max <= 0) return;
+  hint_buf.clear();
+  collect_active(e, hint_buf, max);
+  fn[i]->hint_elements(hint_buf.size(), &hint_buf[0]);
+}
+
+
 Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
 {
+  if (plan != NULL)
+    return replay_state(bnd, ep);
+
   while (1)
   {
     int i, j, son;
@@ -236,7 +376,15 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
       {
         // no more base elements? we're finished
         if (id >= meshes[0]->get_num_base_elements())
+        {
+          if (rec != NULL)
+          {
+            // the traversal is complete, keep it for the next time
+            plans->insert(rec);
+            rec = NULL;
+          }
           return NULL;
+        }
 
         int nused = 0;
         for (i = 0; i < num; i++)
@@ -244,7 +392,9 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
           s->e[i] = meshes[i]->get_element(id);
           if (!s->e[i]->used) { s->e[i] = NULL; continue; }
           if (s->e[i]->active && fn != NULL) fn[i]->set_active_element(s->e[i]);
+          if (!s->e[i]->active && fn != NULL) hint_elements(i, s->e[i]);
           s->er[i] = unity;
+          s->sub[i] = 0;
           subs[i] = 0;
           nused++;
           base = s->e[i];
@@ -255,7 +405,8 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
       }
 
       tri = base->is_triangle();
-      id++;
+      rec_base = id++;
+      rec_first = true;
 
       if (tri)
       {
@@ -299,6 +450,8 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
     // if yes, set boundary flags and return the state
     if (leaf)
     {
+      if (rec != NULL)
+        record_state(s);
       if (bnd != NULL)
         set_boundary_info(s, bnd, ep);
       return s->e;
@@ -320,11 +473,13 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
           {
             ns->e[i] = s->e[i];
             ns->trans[i] = son+1;
+            ns->sub[i] = (s->sub[i] << 3) + son + 1;
           }
           else
           {
             ns->e[i] = s->e[i]->sons[son];
             if (ns->e[i]->active) ns->trans[i] = -1;
+            ns->sub[i] = 0;
           }
         }
 
@@ -376,12 +531,14 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
             {
               ns->e[i] = s->e[i];
               ns->trans[i] = son+1;
+              ns->sub[i] = (s->sub[i] << 3) + son + 1;
             }
             else
             {
               ns->e[i] = s->e[i]->sons[sons[i][son] & 3];
               move_to_son(ns->er + i, s->er + i, sons[i][son]);
               if (ns->e[i]->active) ns->trans[i] = -1;
+              ns->sub[i] = ns->e[i]->active ? init_idx(&ns->cr, ns->er + i) : 0;
             }
           }
         }
@@ -408,12 +565,14 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
             {
               ns->e[i] = s->e[i];
               ns->trans[i] = son+1;
+              ns->sub[i] = (s->sub[i] << 3) + son + 1;
             }
             else
             {
               ns->e[i] = s->e[i]->sons[sons[i][j] & 3];
               move_to_son(ns->er + i, s->er + i, sons[i][j]);
               if (ns->e[i]->active) ns->trans[i] = -1;
+              ns->sub[i] = ns->e[i]->active ? init_idx(&ns->cr, ns->er + i) : 0;
             }
           }
         }
@@ -433,12 +592,14 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
           else if (s->e[i]->active)
           {
             ns->e[i] = s->e[i];
+            ns->sub[i] = s->sub[i];
           }
           else
           {
             ns->e[i] = s->e[i]->sons[sons[i][0] & 3];
             move_to_son(ns->er + i, s->er + i, sons[i][0]);
             if (ns->e[i]->active) ns->trans[i] = -1;
+            ns->sub[i] = ns->e[i]->active ? init_idx(&ns->cr, ns->er + i) : 0;
           }
         }
       }
@@ -447,6 +608,126 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
 }
 
 
+void Traverse::record_state(State* s)
+{
+  TraversePlan::Leaf lf;
+  lf.base = rec_base;
+  lf.first = rec_first;
+  rec_first = false;
+  if (tri)
+  {
+    memcpy(lf.bnd, s->bnd, sizeof(lf.bnd));
+    memcpy(lf.g, s->lo, sizeof(s->lo));
+    memcpy(lf.g + 3, s->hi, sizeof(s->hi));
+  }
+  else
+  {
+    lf.g[0] = s->cr.l;  lf.g[1] = s->cr.b;
+    lf.g[2] = s->cr.r;  lf.g[3] = s->cr.t;
+  }
+  rec->leaves.push_back(lf);
+
+  for (int i = 0; i < num; i++)
+  {
+    rec->ids.push_back(s->e[i] != NULL ? s->e[i]->id : -1);
+    rec->subs.push_back(s->e[i] != NULL ? s->sub[i] : 0);
+  }
+}
+
+
+static int get_sons(uint64_t idx, int* son)
+{
+  int n = 0;
+  for ( ; idx > 0; idx = (idx - 1) >> 3)
+    son[n++] = (idx - 1) & 7;
+  std::reverse(son, son + n);
+  return n;
+}
+
+
+static void move_transform(Transformable* fn, uint64_t idx)
+{
+  // pop the transformations down to the common ancestor and push the rest,
+  // just like the stack-based traversal does
+  uint64_t cur = fn->get_transform();
+  if (cur == idx) return;
+
+  int cs[25], ns[25];
+  int nc = get_sons(cur, cs);
+  int nn = get_sons(idx, ns);
+  int k = 0;
+  while (k < nc && k < nn && cs[k] == ns[k]) k++;
+
+  for (int i = nc; i > k; i--)
+    fn->pop_transform();
+  for (int i = k; i < nn; i++)
+    fn->push_transform(ns[i]);
+}
+
+
+Element** Traverse::replay_state(bool* bnd, EdgePos* ep)
+{
+  int i;
+  if (pos >= plan->leaves.size())
+  {
+    // leave the functions untransformed, as the stack-based traversal does
+    if (fn != NULL)
+      for (i = 0; i < num; i++)
+        if (cur[i] != NULL) move_transform(fn[i], 0);
+    return NULL;
+  }
+
+  const TraversePlan::Leaf& lf = plan->leaves[pos];
+  const int* ids = &plan->ids[pos * num];
+  const uint64_t* sub = &plan->subs[pos * num];
+  pos++;
+
+  if (lf.first)
+  {
+    for (i = 0; i < num; i++)
+    {
+      Element* e = meshes[i]->get_element(lf.base);
+      if (!e->used) continue;
+      if (!e->active && fn != NULL) hint_elements(i, e);
+      base = e;
+    }
+    tri = base->is_triangle();
+  }
+
+  Element** e = rs->e;
+  for (i = 0; i < num; i++)
+  {
+    e[i] = (ids[i] >= 0) ? meshes[i]->get_element_fast(ids[i]) : NULL;
+    if (e[i] == NULL || fn == NULL) continue;
+
+    if (e[i] != cur[i])
+    {
+      move_transform(fn[i], 0);
+      fn[i]->set_active_element(e[i]);
+      cur[i] = e[i];
+    }
+    move_transform(fn[i], sub[i]);
+  }
+
+  if (bnd != NULL)
+  {
+    if (tri)
+    {
+      memcpy(rs->bnd, lf.bnd, sizeof(rs->bnd));
+      memcpy(rs->lo, lf.g, sizeof(rs->lo));
+      memcpy(rs->hi, lf.g + 3, sizeof(rs->hi));
+    }
+    else
+    {
+      rs->cr.l = lf.g[0];  rs->cr.b = lf.g[1];
+      rs->cr.r = lf.g[2];  rs->cr.t = lf.g[3];
+    }
+    set_boundary_info(rs, bnd, ep);
+  }
+  return e;
+}
+
+
 void Traverse::begin(int n, Mesh** meshes, Transformable** fn)
 {
   //if (stack != NULL) finish();
@@ -457,6 +738,35 @@ void Traverse::begin(int n, Mesh** meshes, Transformable** fn)
   this->meshes = meshes;
   this->fn = fn;
 
+  // replay a recorded traversal if none of the meshes has changed since
+  plan = rec = NULL;
+  if (plans != NULL)
+    plan = plans->find(num, meshes);
+
+  if (plan != NULL)
+  {
+    plan->refs++;
+    pos = 0;
+    rs = new State;
+    memset(rs, 0, sizeof(State));
+    rs->e = new Element*[num];
+    cur = new Element*[num];
+    memset(cur, 0, num * sizeof(Element*));
+    stack = NULL;
+    return;
+  }
+
+  if (plans != NULL && plans->max_plans > 0)
+  {
+    rec = new TraversePlan;
+    rec->num = num;
+    rec->meshes.assign(meshes, meshes + num);
+    for (int i = 0; i < num; i++)
+      rec->seqs.push_back(meshes[i]->get_seq());
+    rec->refs = 0;
+    rec->cached = false;
+  }
+
   top = 0;
   size = 256;
   stack = new State[size];
@@ -475,12 +785,26 @@ void free_state(State* state)
   delete [] state->e;
   delete [] state->er;
   delete [] state->trans;
+  delete [] state->sub;
   memset(state, 0, sizeof(State));
 }
 
 
 void Traverse::finish()
 {
+  if (plan != NULL)
+  {
+    release_plan(plan);
+    plan = NULL;
+    delete [] rs->e;
+    delete rs;
+    delete [] cur;
+  }
+
+  // an unfinished recording is incomplete
+  delete rec;
+  rec = NULL;
+
   if (stack == NULL) return;
 
   for (int i = 0; i < size; i++)
@@ -20,6 +20,7 @@ class Mesh;
 class Transformable;
 struct State;
 struct Rect;
+struct TraversePlan;
 
 
 struct UniData
@@ -29,14 +30,57 @@ struct UniData
 };
 
 
+/// Recorded traversals, see Traverse::set_plan_cache(). The plans are keyed by the
+/// meshes and their sequence numbers (Mesh::get_seq()). A cache belongs to its user and
+/// must not be used by traversals running in different threads at the same time.
+///
+class HERMES2D_API TraversePlanCache
+{
+public:
+
+  TraversePlanCache(int max_plans = 8);
+  ~TraversePlanCache();
+
+  /// Sets the maximum number of plans kept in memory. Zero disables the recording.
+  void set_max_plans(int n);
+  /// Frees all plans.
+  void free();
+
+protected:
+
+  std::vector<TraversePlan*> plans; ///< most recently used first
+  int max_plans;
+
+  TraversePlan* find(int n, Mesh** meshes);
+  void insert(TraversePlan* plan);
+  void trim();
+
+  TraversePlanCache(const TraversePlanCache&);            // not copyable
+  TraversePlanCache& operator=(const TraversePlanCache&);
+
+  friend class Traverse;
+};
+
+
 /// Traverse is a multi-mesh traversal utility class. Given N meshes sharing the
 /// same base mesh it walks through all (pseudo-)elements of the union of all
 /// the N meshes.
 ///
+/// If a plan cache is set (set_plan_cache()), the sequence of states visited for the
+/// given meshes is recorded into a flat plan. As long as none of the meshes changes,
+/// subsequent traversals using the same cache replay the plan instead of computing
+/// the union again.
+///
 class HERMES2D_API Traverse
 {
 public:
 
+  Traverse() { plans = NULL; }
+
+  /// Makes begin() replay the plans of the cache and record new ones into it. Must be
+  /// called before begin(); NULL (the default) disables the recording.
+  void set_plan_cache(TraversePlanCache* cache) { plans = cache; }
+
   void begin(int n, Mesh** meshes, Transformable** fn = NULL);
   void finish();
 
@@ -63,7 +107,21 @@ private:
   UniData** unidata;
   int udsize;
 
+  std::vector<Element*> hint_buf; ///< active elements under the current base element
+
+  TraversePlanCache* plans; ///< cache of recorded plans, or NULL
+  TraversePlan* plan; ///< plan being replayed, or NULL
+  TraversePlan* rec;  ///< plan being recorded, or NULL
+  unsigned pos;       ///< next leaf of the replayed plan
+  int rec_base;       ///< base element id of the recorded states
+  bool rec_first;     ///< the next recorded state is the first one of its base element
+  State* rs;          ///< replayed state
+  Element** cur;      ///< elements last activated on fn[i] during a replay
+
   State* push_state();
+  void record_state(State* s);
+  Element** replay_state(bool* bnd, EdgePos* ep);
+  void hint_elements(int i, Element* e);
   void set_boundary_info(State* s, bool* bnd, EdgePos* ep);
   void union_recurrent(Rect* cr, Element** e, Rect* er, uint64_t* idx, Element* uni);
   uint64_t init_idx(Rect* cr, Rect* er);
@@ -0,0 +1,113 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that the candidates selected by H1NonUniformHP and the projection
+// errors of all candidates stay the same. The L-shape benchmark is solved on a mesh
+// refined towards the re-entrant corner with various (also anisotropic) orders, and a
+// refinement is selected for each element. The selected refinements are compared exactly,
+// the sums of the candidate errors up to the rounding errors.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+// results of the selection by the unbatched projections
+const int REF_NUM_CANDS = 14892;
+const long REF_SIGNATURE = 837751493;
+const double REF_ERR_SUM = 29.678775155129035;
+const double REF_SEL_ERR_SUM = 0.04633743792155675;
+
+static double fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+int main(int argc, char* argv[])
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &mesh);
+  mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 3);
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+    space.set_element_order(e->id, make_quad_order(1 + e->id % 3, 1 + (e->id / 3) % 4));
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+  Solution sln, rsln;
+  ls.solve(1, &sln);
+  RefSystem rs(&ls);
+  rs.assemble();
+  rs.solve(1, &rsln);
+
+  RefinementSelectors::H1NonUniformHP selector(false, RefinementSelectors::H2DRS_CAND_HP, 1.0, H2DRS_DEFAULT_ORDER, &shapeset);
+  int num_cands = 0;
+  long signature = 0;
+  double err_sum = 0.0, sel_err_sum = 0.0;
+  for_all_active_elements(e, &mesh)
+  {
+    ElementToRefine refinement(e->id, 0);
+    bool refined = selector.select_refinement(e, space.get_element_order(e->id), &rsln, refinement);
+
+    const std::vector<RefinementSelectors::OptimumSelector::Cand>& cands = selector.get_candidates();
+    num_cands += cands.size();
+    for (unsigned int i = 0; i < cands.size(); i++)
+    {
+      err_sum += cands[i].error;
+      if (refined && cands[i].split == refinement.split && cands[i].p[0] == refinement.p[0] &&
+          cands[i].p[1] == refinement.p[1] && cands[i].p[2] == refinement.p[2] && cands[i].p[3] == refinement.p[3])
+        { sel_err_sum += cands[i].error;  refined = false; }
+    }
+
+    signature = (signature * 31 + refinement.split + 7) % 1000000007;
+    for (int i = 0; i < refinement.get_num_sons(); i++)
+      signature = (signature * 31 + refinement.p[i]) % 1000000007;
+  }
+
+  printf("candidates: %d, signature: %ld\n", num_cands, signature);
+  printf("sum of candidate errors: %.17g\n", err_sum);
+  printf("sum of selected candidate errors: %.17g\n", sel_err_sum);
+
+  bool ok = (num_cands == REF_NUM_CANDS && signature == REF_SIGNATURE &&
+             fabs(err_sum - REF_ERR_SUM) <= 1e-12 * REF_ERR_SUM &&
+             fabs(sel_err_sum - REF_SEL_ERR_SUM) <= 1e-12 * REF_SEL_ERR_SUM);
+  if (!ok)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
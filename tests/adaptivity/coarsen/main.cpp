@@ -0,0 +1,230 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test checks H1AdaptHP::coarsen():
+//  - a quadratic solution on a uniformly refined square, computed with quadratic elements,
+//    is represented exactly after all sons are merged, so coarsen() merges every parent of
+//    four sons and keeps the order 2,
+//  - with a zero threshold, nothing is coarsened,
+//  - on the L-shape domain, refined towards the re-entrant corner, the elements away from
+//    the corner are coarsened, the ones at the corner are kept and the error of the solution
+//    on the coarsened mesh stays close to the previous one.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int P_INIT = 2;
+const double THRESHOLD = 1e-3;
+
+// quadratic solution on the square
+static double quad_fn(double x, double y)
+{
+  return x*x + y*y;
+}
+
+static double quad_fndd(double x, double y, double& dx, double& dy)
+{
+  dx = 2*x;
+  dy = 2*y;
+  return quad_fn(x, y);
+}
+
+scalar quad_bc_values(int marker, double x, double y)
+{
+  return quad_fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar quad_linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return -4.0 * int_v<Real, Scalar>(n, wt, v);
+}
+
+// singular solution on the L-shape domain
+static double lshape_fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+static double lshape_fndd(double x, double y, double& dx, double& dy)
+{
+  double t1 = 2.0/3.0*atan2(x, y) + M_PI/3;
+  double t2 = pow(x*x + y*y, 1.0/3.0);
+  double t3 = x*x * ((y*y)/(x*x) + 1);
+  dx = 2.0/3.0*x*sin(t1)/(t2*t2) + 2.0/3.0*y*t2*cos(t1)/t3;
+  dy = 2.0/3.0*y*sin(t1)/(t2*t2) - 2.0/3.0*x*t2*cos(t1)/t3;
+  return lshape_fn(x, y);
+}
+
+scalar lshape_bc_values(int marker, double x, double y)
+{
+  return lshape_fn(x, y);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+// solves the problem on the space and calculates the errors of the coarse solution 'sln'
+static void solve(WeakForm* wf, H1Space* space, PrecalcShapeset* pss, H1AdaptHP* hp, Solution* sln, Solution* rsln)
+{
+  space->assign_dofs();
+  UmfpackSolver solver;
+  LinSystem ls(wf, &solver);
+  ls.set_spaces(1, space);
+  ls.set_pss(1, pss);
+  ls.assemble();
+  ls.solve(1, sln);
+
+  RefSystem rs(&ls);
+  rs.assemble();
+  rs.solve(1, rsln);
+  hp->calc_error(sln, rsln);
+}
+
+// checks that the changed elements of the last coarsen() are active and sorted
+static void check_changed(H1AdaptHP* hp, Mesh* mesh)
+{
+  const std::vector<int>& changed = hp->get_changed_elements(0);
+  for (unsigned int i = 0; i < changed.size(); i++)
+  {
+    CHECK(mesh->get_element(changed[i])->active);
+    if (i > 0) CHECK(changed[i-1] < changed[i]);
+  }
+}
+
+// returns the length of the shortest edge of an active element at the origin
+static double corner_size(Mesh* mesh)
+{
+  double size = 1e100;
+  Element* e;
+  for_all_active_elements(e, mesh)
+    for (unsigned int i = 0; i < e->nvert; i++)
+      if (e->vn[i]->x == 0.0 && e->vn[i]->y == 0.0)
+      {
+        Node* v = e->vn[e->next_vert(i)];
+        size = std::min(size, sqrt(sqr(v->x) + sqr(v->y)));
+      }
+  return size;
+}
+
+static void test_quadratic(H1Shapeset* shapeset, PrecalcShapeset* pss)
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("square.mesh", &mesh);
+  for (int i = 0; i < 3; i++)
+    mesh.refine_all_elements();
+
+  H1Space space(&mesh, shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(quad_bc_values);
+  space.set_uniform_order(P_INIT);
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(quad_linear_form));
+
+  Solution sln, rsln;
+  H1AdaptHP hp(1, &space);
+  solve(&wf, &space, pss, &hp, &sln, &rsln);
+
+  int nact = mesh.get_num_active_elements();
+  int nmerged = hp.coarsen(THRESHOLD);
+  printf("square: %d elements, %d changed, %d elements after coarsening\n",
+         nact, nmerged, mesh.get_num_active_elements());
+  CHECK(nmerged == nact / 4);
+  CHECK(mesh.get_num_active_elements() == nact / 4);
+  CHECK((int) hp.get_changed_elements(0).size() == nact / 4);
+  check_changed(&hp, &mesh);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+    CHECK(space.get_element_order(e->id) == make_quad_order(P_INIT, P_INIT));
+
+  // the solution is still exact
+  solve(&wf, &space, pss, &hp, &sln, &rsln);
+  ExactSolution exact(&mesh, quad_fndd);
+  double error = h1_error(&sln, &exact);
+  printf("square: error after coarsening %g\n", error);
+  CHECK(error < 1e-8);
+}
+
+static void test_lshape(H1Shapeset* shapeset, PrecalcShapeset* pss)
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &mesh);
+  for (int i = 0; i < 3; i++)
+    mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 3);
+
+  H1Space space(&mesh, shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(lshape_bc_values);
+  space.set_uniform_order(P_INIT);
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+
+  Solution sln, rsln;
+  H1AdaptHP hp(1, &space);
+  solve(&wf, &space, pss, &hp, &sln, &rsln);
+  ExactSolution exact(&mesh, lshape_fndd);
+  double error = h1_error(&sln, &exact);
+
+  // nothing is coarsened with a zero threshold
+  int nact = mesh.get_num_active_elements();
+  int ndofs = space.get_num_dofs();
+  CHECK(hp.coarsen(0.0) == 0);
+  CHECK(mesh.get_num_active_elements() == nact);
+  CHECK(hp.get_changed_elements(0).empty());
+  CHECK(space.assign_dofs() == ndofs);
+
+  solve(&wf, &space, pss, &hp, &sln, &rsln);
+  double size = corner_size(&mesh);
+  int nchanged = hp.coarsen(THRESHOLD);
+  check_changed(&hp, &mesh);
+  solve(&wf, &space, pss, &hp, &sln, &rsln);
+  ExactSolution exact2(&mesh, lshape_fndd);
+  double error2 = h1_error(&sln, &exact2);
+  printf("lshape: %d elements, %d dofs, error %g\n", nact, ndofs, error);
+  printf("lshape: %d changed, %d elements, %d dofs, error %g\n",
+         nchanged, mesh.get_num_active_elements(), space.get_num_dofs(), error2);
+  CHECK(nchanged > 0);
+  CHECK(space.get_num_dofs() < ndofs);
+  CHECK(corner_size(&mesh) == size);
+  CHECK(error2 < 1.1 * error);
+}
+
+int main(int argc, char* argv[])
+{
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+
+  test_quadratic(&shapeset, &pss);
+  test_lshape(&shapeset, &pss);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
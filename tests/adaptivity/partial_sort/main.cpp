@@ -0,0 +1,168 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+#include <algorithm>
+
+// This test makes sure that the lazy sorting of elements by error in H1AdaptHP gives the
+// same order as a full sort. The element errors of the L-shape benchmark are calculated,
+// the elements are sorted step by step as adapt() does (partially, using nth_element), and
+// after each step the sorted part has to equal the beginning of a fully sorted list, while
+// the rest contains the remaining elements with smaller or equal errors. The test is done
+// with the calculated errors and with errors rounded so that many elements have equal ones.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int P_INIT = 2;
+
+static double fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+// exposes the lazy sorting
+class TestAdapt : public H1AdaptHP
+{
+public:
+  TestAdapt(Space* space) : H1AdaptHP(1, space) {}
+
+  // rounds the errors to a few levels, so that many elements have equal errors
+  void round_errors()
+  {
+    double max_err = 0.0;
+    Element* e;
+    for_all_active_elements(e, spaces[0]->get_mesh())
+      max_err = std::max(max_err, errors[0][e->id]);
+    for_all_active_elements(e, spaces[0]->get_mesh())
+      errors[0][e->id] = floor(errors[0][e->id] / max_err * 8.0) * max_err / 8.0;
+  }
+
+  // sorts the first 'count' elements and compares them with the fully sorted list 'ids'
+  void check_sorted(int count, const std::vector<int>& ids)
+  {
+    sort_elements(count);
+    CHECK(nsorted >= count && nsorted <= nact);
+    for (int i = 0; i < nsorted; i++)
+      CHECK(esort[i].comp == 0 && esort[i].id == ids[i]);
+
+    // the rest are the remaining elements, none with a larger error
+    std::vector<int> rest;
+    for (int i = nsorted; i < nact; i++)
+    {
+      CHECK(errors[0][esort[i].id] <= errors[0][ids[nsorted - 1]]);
+      rest.push_back(esort[i].id);
+    }
+    std::vector<int> ref_rest(ids.begin() + nsorted, ids.end());
+    std::sort(rest.begin(), rest.end());
+    std::sort(ref_rest.begin(), ref_rest.end());
+    CHECK(rest == ref_rest);
+  }
+};
+
+struct ErrorGreater
+{
+  H1AdaptHP* hp;
+  ErrorGreater(H1AdaptHP* hp) : hp(hp) {}
+  bool operator()(int a, int b) const
+  {
+    double ea = hp->get_element_error(0, a), eb = hp->get_element_error(0, b);
+    return (ea != eb) ? ea > eb : a < b;
+  }
+};
+
+static void test_sorting(Space* space, Solution* sln, Solution* rsln, bool round)
+{
+  TestAdapt hp(space);
+  hp.calc_error(sln, rsln);
+  if (round) hp.round_errors();
+
+  // fully sorted list of element IDs, equal errors ordered by the ID
+  std::vector<int> ids;
+  Element* e;
+  for_all_active_elements(e, space->get_mesh())
+    ids.push_back(e->id);
+  std::sort(ids.begin(), ids.end(), ErrorGreater(&hp));
+  CHECK(hp.get_total_active_elements() == (int) ids.size());
+
+  int counts[] = { 1, 3, 64, 65, 100, 150 };
+  for (unsigned i = 0; i < sizeof(counts) / sizeof(int); i++)
+    if (counts[i] <= (int) ids.size())
+      hp.check_sorted(counts[i], ids);
+  hp.check_sorted(ids.size(), ids);
+
+  // sorting everything at once gives the same list
+  TestAdapt hp_full(space);
+  hp_full.calc_error(sln, rsln);
+  if (round) hp_full.round_errors();
+  H1AdaptHP::ElementReference* esort = hp_full.get_sorted_elements();
+  for (unsigned i = 0; i < ids.size(); i++)
+    CHECK(esort[i].id == ids[i]);
+}
+
+int main(int argc, char* argv[])
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &mesh);
+  for (int i = 0; i < 3; i++)
+    mesh.refine_all_elements();
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  space.set_uniform_order(P_INIT);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  UmfpackSolver solver;
+
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+  Solution sln, rsln;
+  ls.solve(1, &sln);
+
+  RefSystem rs(&ls);
+  rs.assemble();
+  rs.solve(1, &rsln);
+
+  printf("%d elements\n", mesh.get_num_active_elements());
+  test_sorting(&space, &sln, &rsln, false);
+  test_sorting(&space, &sln, &rsln, true);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
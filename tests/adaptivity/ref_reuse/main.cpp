@@ -0,0 +1,159 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that a RefSystem assembled again after the coarse space was adapted
+// builds the same reference system as a new RefSystem, although it reuses the unchanged
+// rows of its previous matrix structure. The L-shape benchmark is adapted in several steps.
+// In each step, the matrix structure of the reused system has to be identical to that of
+// a fresh one, the matrices and solutions have to agree up to the rounding errors, and the
+// initial guess projected from the previous reference solution has to be close to the new
+// one. Without set_reuse_previous(), nothing is reused.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+const int NUM_STEPS = 6;
+
+static double fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+// a direct solver which pretends to start from the initial guess, so that it is calculated
+class GuessSolver : public UmfpackSolver
+{
+protected:
+  virtual bool uses_initial_guess() { return true; }
+};
+
+static double rel_diff(const scalar* a, const scalar* b, int n)
+{
+  double d = 0.0, s = 0.0;
+  for (int i = 0; i < n; i++)
+  {
+    d += std::abs(a[i] - b[i]) * std::abs(a[i] - b[i]);
+    s += std::abs(b[i]) * std::abs(b[i]);
+  }
+  return (s > 0.0) ? sqrt(d / s) : sqrt(d);
+}
+
+int main(int argc, char* argv[])
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &mesh);
+  mesh.refine_all_elements();
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  space.set_uniform_order(1);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  GuessSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  RefSystem rs(&ls), rs3(&ls);
+  rs.set_reuse_previous(true);
+
+  RefinementSelectors::H1NonUniformHP selector(false, RefinementSelectors::H2DRS_CAND_HP, 1.0, H2DRS_DEFAULT_ORDER, &shapeset);
+  Profiler prof;
+  Profiler::set_current(&prof);
+
+  bool ok = true;
+  int total_reused = 0;
+  Solution sln, rsln, rsln2, guess_sln;
+  for (int step = 1; ok && step <= NUM_STEPS; step++)
+  {
+    ls.assemble();
+    ls.solve(1, &sln);
+
+    // the persistent system reuses its previous structure from the second step on
+    prof.begin_iteration(step);
+    rs.assemble();
+    int reused = (int) prof.get_count("reused matrix rows");
+    total_reused += reused;
+
+    int n = rs.get_num_dofs();
+    std::vector<scalar> guess(n, 0.0);
+    if (rs.get_solution_vec() != NULL)
+      for (int i = 0; i < n; i++)
+        guess[i] = rs.get_solution_vec()[i];
+    for (int i = 0; i < n; i++)
+      if (guess[i] != guess[i]) ok = false;
+
+    // without the reuse, the previous system is forgotten
+    prof.begin_iteration(step);
+    rs3.assemble();
+    if (prof.get_count("reused matrix rows") != 0 || rs3.get_solution_vec() != NULL) ok = false;
+
+    RefSystem rs2(&ls);
+    rs2.assemble();
+
+    int *Ap, *Ai, *Ap2, *Ai2, size, size2;
+    scalar *Ax, *Ax2;
+    rs.get_matrix(Ap, Ai, Ax, size);
+    rs2.get_matrix(Ap2, Ai2, Ax2, size2);
+    bool same = (size == size2 && !memcmp(Ap, Ap2, sizeof(int) * (size + 1)) &&
+                 !memcmp(Ai, Ai2, sizeof(int) * Ap[size]));
+    double mat_diff = same ? rel_diff(Ax, Ax2, Ap[size]) : 1.0;
+
+    rs.solve(1, &rsln);
+    rs2.solve(1, &rsln2);
+    double sln_diff = rel_diff(rs.get_solution_vec(), rs2.get_solution_vec(), n);
+
+    // the projected guess is close to the new solution
+    double guess_err = 0.0;
+    if (step > 1)
+    {
+      guess_sln.set_fe_solution(rs.get_space(0), &pss, &guess[0]);
+      guess_err = h1_error(&guess_sln, &rsln) / h1_norm(&rsln);
+    }
+
+    printf("step %d: ndof %d, reused rows %d, structure %s, matrix diff %g, solution diff %g, guess error %g\n",
+           step, n, reused, same ? "same" : "different", mat_diff, sln_diff, guess_err);
+    if (!same || mat_diff > 1e-12 || sln_diff > 1e-10 || guess_err > 0.05) ok = false;
+
+    H1AdaptHP hp(1, &space);
+    hp.calc_error(&sln, &rsln);
+    hp.adapt(0.3, 0, &selector);
+    space.assign_dofs();
+  }
+  Profiler::set_current(NULL);
+
+  // make sure the reuse was exercised at all
+  if (total_reused == 0) ok = false;
+
+  if (!ok)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,169 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that H1AdaptHP gives the same results when the errors are
+// calculated and the refinements are selected by several threads (set_num_threads())
+// as with a single thread. The Poisson problem is solved on the curved bracket mesh,
+// a serial and a threaded adaptivity run in lock-step and their error estimates,
+// meshes and element orders are compared after each step. In each step, the errors
+// calculated by calc_error() with one and with several threads from the same solutions
+// are also compared directly, the total one and the ones of all elements.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+const int P_INIT = 1;
+const int NUM_THREADS = 4;
+const int NUM_STEPS = 5;
+const double THRESHOLD = 0.3;
+
+int bc_types(int marker)
+{
+  return (marker == 1) ? BC_ESSENTIAL : BC_NATURAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return 0;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+struct Run
+{
+  Mesh mesh;
+  H1Space* space;
+  double err_est;
+  bool same_errors;
+};
+
+// calculates the errors of the same solutions with one and with several threads
+static bool same_calc_error(H1Space* space, Solution* sln, Solution* rsln)
+{
+  H1AdaptHP hp_serial(1, space), hp_threaded(1, space);
+  hp_threaded.set_num_threads(NUM_THREADS);
+  double err_serial = hp_serial.calc_error(sln, rsln);
+  double err_threaded = hp_threaded.calc_error(sln, rsln);
+  if (err_serial != err_threaded)
+  {
+    printf("calc_error() differs: %.15g, %.15g.\n", err_serial, err_threaded);
+    return false;
+  }
+
+  Element* e;
+  for_all_active_elements(e, space->get_mesh())
+    if (hp_serial.get_element_error(0, e->id) != hp_threaded.get_element_error(0, e->id))
+    {
+      printf("The errors of element #%d differ.\n", e->id);
+      return false;
+    }
+  return true;
+}
+
+static void adapt_step(Run* run, WeakForm* wf, PrecalcShapeset* pss, Solver* solver,
+                       RefinementSelectors::Selector* selector, int num_threads)
+{
+  run->space->assign_dofs();
+
+  LinSystem ls(wf, solver);
+  ls.set_spaces(1, run->space);
+  ls.set_pss(1, pss);
+  ls.assemble();
+  Solution sln_coarse, sln_fine;
+  ls.solve(1, &sln_coarse);
+
+  RefSystem rs(&ls);
+  rs.assemble();
+  rs.solve(1, &sln_fine);
+
+  run->same_errors = same_calc_error(run->space, &sln_coarse, &sln_fine);
+
+  H1AdaptHP hp(1, run->space);
+  hp.set_num_threads(num_threads);
+  run->err_est = hp.calc_error(&sln_coarse, &sln_fine) * 100;
+  hp.adapt(THRESHOLD, 0, selector);
+  run->space->assign_dofs();
+}
+
+static bool same_runs(Run* r1, Run* r2)
+{
+  if (r1->err_est != r2->err_est)
+  {
+    printf("The error estimates differ: %.15g, %.15g.\n", r1->err_est, r2->err_est);
+    return false;
+  }
+  if (r1->mesh.get_max_element_id() != r2->mesh.get_max_element_id() ||
+      r1->mesh.get_num_active_elements() != r2->mesh.get_num_active_elements())
+  {
+    printf("The meshes differ.\n");
+    return false;
+  }
+
+  Element* e;
+  for_all_elements(e, &r1->mesh)
+  {
+    Element* f = r2->mesh.get_element(e->id);
+    if (e->active != f->active)
+      { printf("Element #%d is refined differently.\n", e->id);  return false; }
+    if (e->active && r1->space->get_element_order(e->id) != r2->space->get_element_order(e->id))
+      { printf("Element #%d has different orders.\n", e->id);  return false; }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H2DReader mloader;
+
+  Run serial, threaded;
+  Run* runs[2] = { &serial, &threaded };
+  for (int i = 0; i < 2; i++)
+  {
+    mloader.load("bracket.mesh", &runs[i]->mesh);
+    runs[i]->mesh.refine_all_elements();
+    runs[i]->space = new H1Space(&runs[i]->mesh, &shapeset);
+    runs[i]->space->set_bc_types(bc_types);
+    runs[i]->space->set_bc_values(bc_values);
+    runs[i]->space->set_uniform_order(P_INIT);
+  }
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  RefinementSelectors::H1NonUniformHP selector(false, RefinementSelectors::H2DRS_CAND_HP, 1.0, H2DRS_DEFAULT_ORDER, &shapeset);
+
+  bool ok = true;
+  for (int step = 1; step <= NUM_STEPS && ok; step++)
+  {
+    adapt_step(&serial, &wf, &pss, &solver, &selector, 1);
+    adapt_step(&threaded, &wf, &pss, &solver, &selector, NUM_THREADS);
+    printf("step %d: error estimate %g%%, %d dofs\n", step, serial.err_est, serial.space->get_num_dofs());
+    ok = serial.same_errors && threaded.same_errors && same_runs(&serial, &threaded);
+  }
+
+  delete serial.space;
+  delete threaded.space;
+
+  if (!ok)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
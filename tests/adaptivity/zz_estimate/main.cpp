@@ -0,0 +1,136 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test checks the error estimate of H1AdaptHP without a reference solution
+// (estimate_error(), gradient recovery). The L-shape benchmark is adapted in several steps:
+//  - the effectivity index, the estimated error over the exact error, has to stay close
+//    to one once the initial mesh has been refined,
+//  - adapt() after estimate_error() may refine the elements in h only, both without
+//    a selector and with a projection-based one: each element is either unchanged or
+//    split to sons of its order.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int P_INIT = 2;
+const int NUM_STEPS = 6;
+const double THRESHOLD = 0.3;
+const double MIN_EFFECTIVITY = 0.5, MAX_EFFECTIVITY = 2.0;
+
+static double fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+static double fndd(double x, double y, double& dx, double& dy)
+{
+  double t1 = 2.0/3.0*atan2(x, y) + M_PI/3;
+  double t2 = pow(x*x + y*y, 1.0/3.0);
+  double t3 = x*x * ((y*y)/(x*x) + 1);
+  dx = 2.0/3.0*x*sin(t1)/(t2*t2) + 2.0/3.0*y*t2*cos(t1)/t3;
+  dy = 2.0/3.0*y*sin(t1)/(t2*t2) - 2.0/3.0*x*t2*cos(t1)/t3;
+  return fn(x, y);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+int main(int argc, char* argv[])
+{
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &mesh);
+  mesh.refine_all_elements();
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  space.set_uniform_order(P_INIT);
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  UmfpackSolver solver;
+  RefinementSelectors::H1NonUniformHP selector(false, RefinementSelectors::H2DRS_CAND_HP, 1.0, H2DRS_DEFAULT_ORDER, &shapeset);
+
+  for (int step = 1; step <= NUM_STEPS; step++)
+  {
+    space.assign_dofs();
+    LinSystem ls(&wf, &solver);
+    ls.set_spaces(1, &space);
+    ls.set_pss(1, &pss);
+    ls.assemble();
+    Solution sln;
+    ls.solve(1, &sln);
+
+    ExactSolution exact(&mesh, fndd);
+    double error = h1_error(&sln, &exact);
+    H1AdaptHP hp(1, &space);
+    double err_est = hp.estimate_error(&sln);
+    double effectivity = err_est / error;
+    printf("step %d: %d dofs, error %g%%, estimate %g%%, effectivity %g\n",
+           step, space.get_num_dofs(), error * 100, err_est * 100, effectivity);
+    if (step > 1) // the initial mesh is too coarse for the recovered gradient
+      CHECK(effectivity > MIN_EFFECTIVITY && effectivity < MAX_EFFECTIVITY);
+
+    // orders of the elements before the refinement
+    int max_id = mesh.get_max_element_id();
+    std::vector<int> orders(max_id, -1);
+    Element* e;
+    for_all_active_elements(e, &mesh)
+      orders[e->id] = space.get_element_order(e->id);
+
+    // the projection-based selector needs a reference solution, it is replaced
+    hp.adapt(THRESHOLD, 0, (step % 2) ? NULL : &selector);
+
+    int nrefined = 0;
+    for (int id = 0; id < max_id; id++)
+    {
+      if (orders[id] < 0) continue;
+      e = mesh.get_element(id);
+      if (e->active)
+      {
+        CHECK(space.get_element_order(id) == orders[id]);
+      }
+      else
+      {
+        nrefined++;
+        for (int i = 0; i < 4; i++)
+          if (e->sons[i] != NULL)
+            CHECK(e->sons[i]->active && space.get_element_order(e->sons[i]->id) == orders[id]);
+      }
+    }
+    CHECK(nrefined > 0);
+  }
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "hermes2d.h"
+
+// This test makes sure that a mesh saved by H2DReader::save_binary() is restored exactly,
+// both by load_binary() (which maps the file) and by Mesh::load_raw() (which reads it).
+// The mesh has curved edges and is refined irregularly, so that the file contains
+// inactive elements and the curved maps of refined elements. The element geometry
+// (the physical coordinates of the integration points) has to be identical.
+//
+// With a second argument ("version" or "endian"), the test changes the version number
+// of a saved file and loads it, which has to fail with an error message (checked by ctest).
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+// compares the elements, the nodes and the geometry of two meshes
+static void compare_meshes(Mesh* a, Mesh* b)
+{
+  CHECK(a->get_max_element_id() == b->get_max_element_id());
+  CHECK(a->get_num_elements() == b->get_num_elements());
+  CHECK(a->get_num_active_elements() == b->get_num_active_elements());
+  CHECK(a->get_num_base_elements() == b->get_num_base_elements());
+  CHECK(a->get_max_node_id() == b->get_max_node_id());
+  CHECK(a->get_num_nodes() == b->get_num_nodes());
+
+  Node* n;
+  int wrong = 0;
+  for_all_nodes(n, a)
+  {
+    Node* m = b->get_node(n->id);
+    if (!m->used || m->type != n->type || m->ref != n->ref || m->bnd != n->bnd ||
+        m->p1 != n->p1 || m->p2 != n->p2) wrong++;
+    else if (n->type == TYPE_VERTEX && (m->x != n->x || m->y != n->y)) wrong++;
+    else if (n->type == TYPE_EDGE && m->marker != n->marker) wrong++;
+  }
+  CHECK(wrong == 0);
+
+  Element* e;
+  RefMap ra, rb;
+  wrong = 0;
+  int curved = 0;
+  for_all_elements(e, a)
+  {
+    Element* f = b->get_element(e->id);
+    if (!f->used || f->active != e->active || f->nvert != e->nvert || f->marker != e->marker ||
+        (f->cm == NULL) != (e->cm == NULL)) { wrong++; continue; }
+    for (unsigned i = 0; i < e->nvert; i++)
+      if (f->vn[i]->id != e->vn[i]->id) wrong++;
+    if (e->cm != NULL)
+    {
+      curved++;
+      if (f->cm->toplevel != e->cm->toplevel || f->cm->order != e->cm->order ||
+          f->cm->nc != e->cm->nc || memcmp(f->cm->coefs, e->cm->coefs, e->cm->nc * sizeof(double2)))
+        wrong++;
+    }
+    if (!e->active) continue;
+
+    ra.set_active_element(e);
+    rb.set_active_element(f);
+    int o = 8, np = g_quad_2d_std.get_num_points(o);
+    double *xa = ra.get_phys_x(o), *ya = ra.get_phys_y(o);
+    double *xb = rb.get_phys_x(o), *yb = rb.get_phys_y(o);
+    for (int i = 0; i < np; i++)
+      if (xa[i] != xb[i] || ya[i] != yb[i]) { wrong++; break; }
+  }
+  CHECK(wrong == 0);
+  CHECK(curved > 0);
+}
+
+static void set_version(const char* filename, bool swap)
+{
+  FILE* f = fopen(filename, "r+b");
+  if (f == NULL) error("Could not open %s.", filename);
+  int ver;
+  fseek(f, 4, SEEK_SET);
+  if (fread(&ver, sizeof(int), 1, f) != 1) error("Could not read %s.", filename);
+  if (swap)
+  {
+    unsigned v = ver;
+    ver = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+  }
+  else
+    ver = 99;
+  fseek(f, 4, SEEK_SET);
+  fwrite(&ver, sizeof(int), 1, f);
+  fclose(f);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: binary meshfile.mesh [version|endian]\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+  mesh.refine_towards_boundary(1, 2);
+  Element* e;
+  int k = 0;
+  for_all_active_elements(e, &mesh)
+    if (k++ % 5 == 0) mesh.refine_element(e->id, e->is_triangle() ? 0 : k % 3);
+
+  mloader.save_binary("mesh.bin", &mesh);
+
+  if (argc > 2)
+  {
+    set_version("mesh.bin", !strcmp(argv[2], "endian"));
+    Mesh bad;
+    mloader.load_binary("mesh.bin", &bad);
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+
+  // the mapped file
+  Mesh mapped;
+  mloader.load_binary("mesh.bin", &mapped);
+  compare_meshes(&mesh, &mapped);
+
+  // the binary format is recognized by load()
+  Mesh loaded;
+  mloader.load("mesh.bin", &loaded);
+  compare_meshes(&mesh, &loaded);
+
+  // the file stream
+  Mesh raw;
+  FILE* f = fopen("mesh.bin", "rb");
+  raw.load_raw(f);
+  fclose(f);
+  compare_meshes(&mesh, &raw);
+
+  // a loaded mesh can be refined further and saved again
+  mapped.refine_all_elements();
+  mesh.refine_all_elements();
+  mloader.save_binary("mesh2.bin", &mapped);
+  Mesh again;
+  mloader.load_binary("mesh2.bin", &again);
+  compare_meshes(&mesh, &again);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include "hermes2d.h"
+
+// This test makes sure that a mesh keeps its nodes and elements when it is changed
+// while its copy-on-write copies (Mesh::copy_cow) share them, and that the copies
+// get their own nodes and elements with a new seq number, which the solutions and
+// filters defined on the copies notice.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+// a signature of the active elements of a mesh
+static int signature(Mesh* mesh)
+{
+  int sig = 1000 * mesh->get_num_active_elements();
+  Element* e;
+  for_all_active_elements(e, mesh)
+    sig += 7 * e->id + e->vn[0]->id;
+  return sig;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: copy_cow meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+  int sig0 = signature(&mesh);
+
+  // copies of the mesh and of a copy share the nodes and elements
+  Mesh* snap1 = new Mesh;
+  snap1->copy_cow(&mesh);
+  Mesh snap2;
+  snap2.copy_cow(snap1);
+  CHECK(mesh.is_shared() && snap1->is_shared() && snap2.is_shared());
+  CHECK(signature(snap1) == sig0 && signature(&snap2) == sig0);
+  CHECK(snap1->get_element(0) == mesh.get_element(0));
+
+  // the changed mesh keeps its pointers, the copies get new ones and a new seq
+  Element* e0 = mesh.get_element(0);
+  Node* n0 = mesh.get_node(0);
+  int seq0 = snap1->get_seq();
+  mesh.refine_all_elements();
+  CHECK(!mesh.is_shared() && snap1->is_shared() && snap2.is_shared());
+  CHECK(mesh.get_element(0) == e0 && mesh.get_node(0) == n0);
+  CHECK(snap1->get_element(0) != e0 && snap1->get_element(0) == snap2.get_element(0));
+  CHECK(snap1->get_seq() != seq0 && snap2.get_seq() == snap1->get_seq());
+  CHECK(mesh.get_seq() != seq0 && mesh.get_seq() != snap1->get_seq());
+  CHECK(signature(snap1) == sig0 && signature(&snap2) == sig0 && signature(&mesh) != sig0);
+
+  // a changed copy does not affect the others
+  int sig1 = signature(&mesh);
+  snap1->copy_cow(&mesh);
+  snap2.copy_cow(&mesh);
+  e0 = mesh.get_element(0);
+  snap1->refine_element(snap1->get_max_element_id() - 1);
+  CHECK(signature(&mesh) == sig1 && signature(&snap2) == sig1 && signature(snap1) != sig1);
+  CHECK(mesh.get_element(0) == e0 && snap2.get_element(0) == e0 && snap1->get_element(0) != e0);
+
+  // freeing the mesh which owns the storage leaves it to the copies
+  Mesh* owner = new Mesh;
+  owner->copy(&mesh);
+  snap1->copy_cow(owner);
+  snap2.copy_cow(owner);
+  delete owner;
+  CHECK(signature(snap1) == sig1 && signature(&snap2) == sig1);
+  snap2.refine_all_elements();
+  CHECK(signature(snap1) == sig1);
+  delete snap1;
+
+  // a solution keeps its snapshot of the mesh, also inside a filter with a union mesh
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_uniform_order(2);
+  space.assign_dofs();
+  int ndofs = space.get_num_dofs();
+  scalar* vec = new scalar[ndofs];
+  for (int i = 0; i < ndofs; i++)
+    vec[i] = sin((double) i);
+  Solution sln;
+  sln.set_fe_solution(&space, &pss, vec);
+
+  Mesh base;
+  mloader.load(argv[1], &base);
+  Solution cnst;
+  cnst.set_const(&base, 1.0);
+  SumFilter sum(&sln, &cnst);
+
+  Element* e;
+  for_all_active_elements(e, &mesh) break;
+  double x = 0.0, y = 0.0;
+  for (unsigned int i = 0; i < e->nvert; i++)
+    { x += e->vn[i]->x / e->nvert;  y += e->vn[i]->y / e->nvert; }
+  scalar val = sln.get_pt_value(x, y);
+  double norm = h1_norm(&sln), sum_norm = l2_norm(&sum);
+
+  mesh.refine_all_elements();
+  space.set_uniform_order(2);
+  space.assign_dofs();
+  CHECK(sln.get_pt_value(x, y) == val);
+  CHECK(h1_norm(&sln) == norm && l2_norm(&sum) == sum_norm);
+  delete [] vec;
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
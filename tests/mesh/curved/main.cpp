@@ -0,0 +1,214 @@
+#include "hermes2d.h"
+#include <set>
+#include <algorithm>
+
+// This test checks the evaluation of curved edges and the reference map projections:
+//  - nurbs_edge() (de Boor's algorithm) against the recursive definition of the NURBS
+//    basis functions, on random curves of degrees 1 to 10 with repeated knots,
+//  - the projected reference maps of a refined curved mesh do not depend on the size
+//    of the projection cache (see set_refmap_cache_size()),
+//  - curves created concurrently get distinct ids.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+static unsigned seed = 4321;
+static double random_double()
+{
+  seed = seed * 1103515245 + 12345;
+  return ((seed >> 8) & 0xffff) / 65536.0;
+}
+
+// recursive calculation of the basis function N_i,k
+static double nurbs_basis_fn(int i, int k, double t, double* knot)
+{
+  if (k == 0)
+    return (t >= knot[i] && t <= knot[i+1] && knot[i] < knot[i+1]) ? 1.0 : 0.0;
+
+  double result = 0.0;
+  if (knot[i+k] != knot[i])
+    result += ((t - knot[i]) / (knot[i+k] - knot[i])) * nurbs_basis_fn(i, k-1, t, knot);
+  if (knot[i+k+1] != knot[i+1])
+    result += ((knot[i+k+1] - t) / (knot[i+k+1] - knot[i+1])) * nurbs_basis_fn(i+1, k-1, t, knot);
+  return result;
+}
+
+// the curve point from the basis functions, t goes from 0 to 1
+static void nurbs_point_recursive(Nurbs* nurbs, double t, double& x, double& y)
+{
+  double3* cp = nurbs->pt;
+  double sum = 0.0;
+  x = y = 0.0;
+  for (int i = 0; i < nurbs->np; i++)
+  {
+    double basis = nurbs_basis_fn(i, nurbs->degree, t, nurbs->kv);
+    sum += cp[i][2] * basis;
+    x   += cp[i][2] * basis * cp[i][0];
+    y   += cp[i][2] * basis * cp[i][1];
+  }
+  x /= sum;
+  y /= sum;
+}
+
+// a clamped curve with random control points, weights and inner knots
+static void make_curve(Nurbs* nurbs, int degree, int inner)
+{
+  nurbs->degree = degree;
+  nurbs->np = degree + 1 + inner;
+  nurbs->pt = new double3[nurbs->np];
+  for (int i = 0; i < nurbs->np; i++)
+  {
+    nurbs->pt[i][0] = 10.0 * random_double();
+    nurbs->pt[i][1] = 10.0 * random_double();
+    nurbs->pt[i][2] = 0.5 + 1.5 * random_double();
+  }
+  nurbs->nk = nurbs->np + degree + 1;
+  nurbs->kv = new double[nurbs->nk];
+  int k = 0;
+  for (int i = 0; i <= degree; i++) nurbs->kv[k++] = 0.0;
+  std::vector<double> knots;
+  while ((int) knots.size() < inner)
+  {
+    // repeated knots are limited by the degree, so that the curve stays continuous
+    double t = (int) (8.0 * random_double() + 1.0) / 10.0;
+    int mult = 0;
+    for (unsigned i = 0; i < knots.size(); i++)
+      if (knots[i] == t) mult++;
+    if (mult < degree) knots.push_back(t);
+  }
+  std::sort(knots.begin(), knots.end());
+  for (int i = 0; i < inner; i++) nurbs->kv[k++] = knots[i];
+  for (int i = 0; i <= degree; i++) nurbs->kv[k++] = 1.0;
+}
+
+static void test_de_boor()
+{
+  int wrong = 0;
+  double max_diff = 0.0;
+  for (int degree = 1; degree <= 10; degree++)
+    for (int inner = 0; inner <= 6; inner++)
+    {
+      Nurbs nurbs;
+      make_curve(&nurbs, degree, inner);
+      for (int i = 0; i <= 200; i++)
+      {
+        double t = i / 100.0 - 1.0; // nurbs_edge() takes t from -1 to 1
+        double x, y, rx, ry;
+        nurbs_edge(NULL, &nurbs, 0, t, x, y);
+        nurbs_point_recursive(&nurbs, (t + 1) / 2.0, rx, ry);
+        double diff = std::max(fabs(x - rx), fabs(y - ry));
+        max_diff = std::max(max_diff, diff);
+        if (!(diff < 1e-11)) wrong++;
+      }
+      delete [] nurbs.pt;
+      delete [] nurbs.kv;
+    }
+  printf("de Boor: max difference %g\n", max_diff);
+  CHECK(wrong == 0);
+}
+
+// refines the mesh so that the curved elements are projected again
+static void load_refined(const char* filename, Mesh* mesh)
+{
+  H2DReader mloader;
+  mloader.load(filename, mesh);
+  mesh->refine_all_elements();
+  mesh->refine_towards_boundary(1, 3);
+}
+
+static bool same_refmaps(Mesh* a, Mesh* b)
+{
+  if (a->get_max_element_id() != b->get_max_element_id()) return false;
+  Element* e;
+  for_all_active_elements(e, a)
+  {
+    Element* f = b->get_element(e->id);
+    if ((e->cm == NULL) != (f->cm == NULL)) return false;
+    if (e->cm == NULL) continue;
+    if (e->cm->nc != f->cm->nc || memcmp(e->cm->coefs, f->cm->coefs, e->cm->nc * sizeof(double2)))
+      return false;
+  }
+  return true;
+}
+
+static void test_cache(const char* filename)
+{
+  // without the cache, with a tiny one (evicting all the time), filling it and using it
+  set_refmap_cache_size(0);
+  Mesh none;
+  load_refined(filename, &none);
+
+  set_refmap_cache_size(3);
+  Mesh tiny;
+  load_refined(filename, &tiny);
+  CHECK(same_refmaps(&none, &tiny));
+
+  set_refmap_cache_size(0x8000);
+  Mesh fill, hit;
+  load_refined(filename, &fill);
+  load_refined(filename, &hit);
+  CHECK(same_refmaps(&none, &fill));
+  CHECK(same_refmaps(&none, &hit));
+
+  // shrinking drops the least recently used projections only
+  set_refmap_cache_size(5);
+  Mesh shrunk;
+  load_refined(filename, &shrunk);
+  CHECK(same_refmaps(&none, &shrunk));
+  set_refmap_cache_size(0x8000);
+}
+
+const int NUM_THREADS = 4;
+const int CURVES_PER_THREAD = 20000;
+
+static void* create_curves(void* arg)
+{
+  unsigned* ids = (unsigned*) arg;
+  for (int i = 0; i < CURVES_PER_THREAD; i++)
+  {
+    Nurbs nurbs;
+    ids[i] = nurbs.id;
+  }
+  return NULL;
+}
+
+static void test_ids()
+{
+  std::vector<unsigned> ids(NUM_THREADS * CURVES_PER_THREAD);
+  pthread_t threads[NUM_THREADS];
+  for (int t = 0; t < NUM_THREADS; t++)
+    pthread_create(&threads[t], NULL, create_curves, &ids[t * CURVES_PER_THREAD]);
+  for (int t = 0; t < NUM_THREADS; t++)
+    pthread_join(threads[t], NULL);
+  std::set<unsigned> unique(ids.begin(), ids.end());
+  CHECK(unique.size() == ids.size());
+  CHECK(unique.count(0) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: curved meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  test_de_boor();
+  test_cache(argv[1]);
+  test_ids();
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#include "hermes2d.h"
+#include <map>
+
+// This test checks the node hash tables of HashTable (open addressing with linear
+// probing). Starting from a tiny table, vertex and edge nodes are created and removed
+// in random order and every key is then looked up again and compared with a std::map.
+// The table has to grow several times, the probe sequences collide, and the removals
+// (backward-shift deletion) must not make any of the remaining keys unreachable.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int NUM_VERTICES = 64;   // top-level vertices, the parents of the hashed nodes
+const int NUM_STEPS = 20000;
+
+typedef std::pair<int, int> Key;
+
+// gives access to the protected node functions of the mesh
+class TestMesh : public Mesh
+{
+public:
+
+  void init_nodes(int size)
+  {
+    init(size);
+    for (int i = 0; i < NUM_VERTICES; i++)
+    {
+      Node* node = nodes.add();
+      node->type = TYPE_VERTEX;
+      node->ref = 1;
+      node->bnd = 0;
+      node->p1 = node->p2 = -1;
+      node->x = i;
+      node->y = i * i;
+    }
+  }
+
+  Node* get_node_hashed(bool vertex, int p1, int p2)
+    { return vertex ? get_vertex_node(p1, p2) : get_edge_node(p1, p2); }
+  Node* peek_node(bool vertex, int p1, int p2)
+    { return vertex ? peek_vertex_node(p1, p2) : peek_edge_node(p1, p2); }
+  void remove_node_hashed(bool vertex, int id)
+    { if (vertex) remove_vertex_node(id); else remove_edge_node(id); }
+  void copy_nodes(TestMesh* m)
+    { HashTable::copy(m); }
+};
+
+static unsigned seed = 12345;
+static int random_int(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+// looks up all possible keys and compares the result with the reference map
+static void check_keys(TestMesh* mesh, std::map<Key, int>* ref, const char* what)
+{
+  int wrong = 0;
+  for (int v = 0; v < 2; v++)
+    for (int p1 = 0; p1 < NUM_VERTICES; p1++)
+      for (int p2 = p1; p2 < NUM_VERTICES; p2++)
+      {
+        std::map<Key, int>::iterator it = ref[v].find(Key(p1, p2));
+        Node* node = mesh->peek_node(v == 0, p1, p2);
+        if (it == ref[v].end() ? node != NULL : (node == NULL || node->id != it->second))
+          wrong++;
+        // the keys are symmetric
+        if (mesh->peek_node(v == 0, p2, p1) != node) wrong++;
+      }
+  if (wrong) printf("%s: %d wrong lookups\n", what, wrong);
+  CHECK(wrong == 0);
+}
+
+int main(int argc, char* argv[])
+{
+  TestMesh mesh;
+  mesh.init_nodes(16);
+  std::map<Key, int> ref[2]; // 0 = vertex nodes, 1 = edge nodes
+
+  int removed = 0;
+  for (int step = 0; step < NUM_STEPS; step++)
+  {
+    int v = random_int(2);
+    int p1 = random_int(NUM_VERTICES), p2 = random_int(NUM_VERTICES);
+    if (p1 == p2) continue;
+    Key key(std::min(p1, p2), std::max(p1, p2));
+
+    std::map<Key, int>::iterator it = ref[v].find(key);
+    if (it == ref[v].end())
+    {
+      // a new node, its id may be one of the removed nodes
+      Node* node = mesh.get_node_hashed(v == 0, p1, p2);
+      CHECK(node->p1 == key.first && node->p2 == key.second);
+      ref[v][key] = node->id;
+    }
+    else if (random_int(3))
+    {
+      // existing nodes are found, not created again
+      int n = mesh.get_num_nodes();
+      CHECK(mesh.get_node_hashed(v == 0, p2, p1)->id == it->second);
+      CHECK(mesh.get_num_nodes() == n);
+    }
+    else
+    {
+      mesh.remove_node_hashed(v == 0, it->second);
+      ref[v].erase(it);
+      removed++;
+    }
+
+    if (step % 1000 == 0) check_keys(&mesh, ref, "step");
+  }
+  check_keys(&mesh, ref, "final");
+  CHECK(mesh.get_num_nodes() == NUM_VERTICES + (int) (ref[0].size() + ref[1].size()));
+
+  size_t queries, collisions, rehashes;
+  mesh.get_hash_stats(queries, collisions, rehashes);
+  printf("vertex nodes %d, edge nodes %d, removed %d, queries %lu, collisions %lu, rehashes %lu\n",
+         (int) ref[0].size(), (int) ref[1].size(), removed,
+         (unsigned long) queries, (unsigned long) collisions, (unsigned long) rehashes);
+  CHECK(removed > 1000);
+  CHECK(collisions > 0);
+  CHECK(rehashes >= 4);
+
+  // removing everything leaves the top-level vertices only
+  for (int v = 0; v < 2; v++)
+  {
+    std::vector<int> ids;
+    for (std::map<Key, int>::iterator it = ref[v].begin(); it != ref[v].end(); ++it)
+      ids.push_back(it->second);
+    // a fresh copy of the tables must give the same answers
+    if (v == 0)
+    {
+      TestMesh copy;
+      copy.copy_nodes(&mesh);
+      check_keys(&copy, ref, "copy");
+    }
+    for (unsigned i = 0; i < ids.size(); i++)
+      mesh.remove_node_hashed(v == 0, ids[i]);
+    ref[v].clear();
+    check_keys(&mesh, ref, "empty");
+  }
+  CHECK(mesh.get_num_nodes() == NUM_VERTICES);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include "hermes2d.h"
+
+// This test makes sure that the refinement of a mesh does not depend on the
+// number of threads used to calculate the reference maps of curved elements
+// (Mesh::set_num_threads): the topology and the curved map coefficients must
+// be identical.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static void refine(Mesh* mesh)
+{
+  mesh->refine_all_elements();
+  mesh->refine_towards_vertex(0, 2);
+  mesh->refine_all_elements();
+}
+
+static bool same_meshes(Mesh* m1, Mesh* m2)
+{
+  if (m1->get_max_element_id() != m2->get_max_element_id() ||
+      m1->get_num_active_elements() != m2->get_num_active_elements() ||
+      m1->get_max_node_id() != m2->get_max_node_id())
+  {
+    printf("The numbers of elements or nodes differ.\n");
+    return false;
+  }
+
+  Element* e;
+  for_all_elements(e, m1)
+  {
+    Element* f = m2->get_element(e->id);
+    if (f->active != e->active || f->nvert != e->nvert || f->is_curved() != e->is_curved())
+      { printf("Element #%d differs.\n", e->id);  return false; }
+
+    for (unsigned int i = 0; i < e->nvert; i++)
+      if (f->vn[i]->id != e->vn[i]->id || f->vn[i]->x != e->vn[i]->x || f->vn[i]->y != e->vn[i]->y)
+        { printf("The vertices of element #%d differ.\n", e->id);  return false; }
+
+    if (!e->active)
+      for (int i = 0; i < 4; i++)
+        if ((e->sons[i] == NULL) != (f->sons[i] == NULL) ||
+            (e->sons[i] != NULL && e->sons[i]->id != f->sons[i]->id))
+          { printf("The sons of element #%d differ.\n", e->id);  return false; }
+
+    if (e->is_curved() && e->cm->coefs != NULL)
+    {
+      if (f->cm->coefs == NULL || f->cm->nc != e->cm->nc)
+        { printf("The curved map of element #%d differs.\n", e->id);  return false; }
+      for (int i = 0; i < e->cm->nc; i++)
+        if (f->cm->coefs[i][0] != e->cm->coefs[i][0] || f->cm->coefs[i][1] != e->cm->coefs[i][1])
+          { printf("The curved map coefficients of element #%d differ.\n", e->id);  return false; }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: refine_threads meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  H2DReader mloader;
+  Mesh serial;
+  mloader.load(argv[1], &serial);
+  refine(&serial);
+
+  bool ok = true;
+  int threads[] = { 2, 3, 8 };
+  for (int i = 0; i < 3; i++)
+  {
+    Mesh mesh;
+    mloader.load(argv[1], &mesh);
+    mesh.set_num_threads(threads[i]);
+    refine(&mesh);
+    printf("%d threads: %d elements\n", threads[i], mesh.get_num_active_elements());
+    if (!same_meshes(&serial, &mesh)) ok = false;
+  }
+
+  if (!ok)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
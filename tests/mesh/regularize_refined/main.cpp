@@ -0,0 +1,121 @@
+#include "hermes2d.h"
+#include <algorithm>
+
+// This test makes sure that Mesh::regularize_refined() gives the same mesh as regularize().
+// Random elements of the mesh are refined in several rounds, in the same way in two copies
+// of the mesh. After each round, one copy is regularized by regularize_refined(), knowing
+// the refined elements, the other one by regularize(). The active elements of both copies
+// have to cover the domain in the same way, the first copy has to stay n-irregular, and
+// the list of refined elements has to name each parent before its sons.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int NUM_ROUNDS = 6;
+const int NUM_REFINED = 5; // elements refined in each round
+
+// the vertices of each active element, sorted, as a description of the mesh
+typedef std::vector<std::vector<double> > MeshShape;
+
+static void get_shape(Mesh* mesh, MeshShape& shape)
+{
+  shape.clear();
+  Element* e;
+  for_all_active_elements(e, mesh)
+  {
+    std::vector<std::pair<double, double> > v;
+    for (unsigned int i = 0; i < e->nvert; i++)
+      v.push_back(std::make_pair(e->vn[i]->x, e->vn[i]->y));
+    std::sort(v.begin(), v.end());
+    std::vector<double> key;
+    for (unsigned int i = 0; i < v.size(); i++)
+    {
+      key.push_back(v[i].first);
+      key.push_back(v[i].second);
+    }
+    shape.push_back(key);
+  }
+  std::sort(shape.begin(), shape.end());
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    printf("please input as this format: regularize_refined meshfile.mesh n\n");
+    return ERROR_FAILURE;
+  }
+  int n = atoi(argv[2]);
+
+  Mesh local, global;
+  H2DReader mloader;
+  mloader.load(argv[1], &local);
+  global.copy(&local);
+
+  srand(1);
+  for (int round = 1; round <= NUM_ROUNDS; round++)
+  {
+    // refine random active elements, quads also anisotropically
+    std::vector<int> refined;
+    for (int k = 0; k < NUM_REFINED; k++)
+    {
+      std::vector<int> active;
+      Element* e;
+      for_all_active_elements(e, &local)
+        active.push_back(e->id);
+      e = local.get_element(active[rand() % active.size()]);
+      int type = e->is_quad() ? rand() % 3 : 0;
+      local.refine_element(e->id, type);
+      global.refine_element(e->id, type);
+      refined.push_back(e->id);
+    }
+
+    unsigned int nrefined = refined.size();
+    local.regularize_refined(n, refined);
+    ::free(global.regularize(n));
+    printf("round %d: %d active elements, %d refined by the regularization\n",
+           round, local.get_num_active_elements(), (int) (refined.size() - nrefined));
+
+    // the same refinements
+    MeshShape local_shape, global_shape;
+    get_shape(&local, local_shape);
+    get_shape(&global, global_shape);
+    CHECK(local_shape == global_shape);
+
+    // no more refinements are needed
+    Mesh test;
+    test.copy(&local);
+    ::free(test.regularize(n));
+    CHECK(test.get_num_active_elements() == local.get_num_active_elements());
+
+    // the refined elements are inactive and listed after their parents
+    std::vector<int> pos(local.get_max_element_id(), -1);
+    for (unsigned int i = 0; i < refined.size(); i++)
+    {
+      CHECK(!local.get_element(refined[i])->active);
+      pos[refined[i]] = i;
+    }
+    for (unsigned int i = 0; i < refined.size(); i++)
+    {
+      Element* e = local.get_element(refined[i]);
+      for (int j = 0; j < 4; j++)
+        if (e->sons[j] != NULL && pos[e->sons[j]->id] >= 0)
+          CHECK(pos[e->sons[j]->id] > (int) i);
+    }
+  }
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
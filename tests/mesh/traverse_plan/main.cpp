@@ -0,0 +1,111 @@
+#include "hermes2d.h"
+
+// This test makes sure that a multi-mesh traversal replayed from a recorded plan
+// (Traverse::set_plan_cache) visits the same states as a traversal computing the
+// union of the meshes: the same elements, the same transformations of the functions
+// and the same boundary information. A plan must not be replayed after one of the
+// meshes has changed.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+const int N = 3;
+
+// refines randomly chosen active elements, quads in random directions
+static void refine_randomly(Mesh* mesh, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    Element* e;
+    int k = rand() % mesh->get_num_active_elements();
+    for_all_active_elements(e, mesh)
+      if (k-- == 0) break;
+    mesh->refine_element(e->id, e->is_quad() ? rand() % 3 : 0);
+  }
+}
+
+// lists everything a traversal tells its user about its states
+static void traverse(Mesh** meshes, TraversePlanCache* cache, std::vector<double>& out)
+{
+  Transformable fns[N];
+  Transformable* fn[N] = { &fns[0], &fns[1], &fns[2] };
+  bool bnd[4];
+  EdgePos ep[4];
+
+  out.clear();
+  Traverse trav;
+  trav.set_plan_cache(cache);
+  trav.begin(N, meshes, fn);
+  Element** e;
+  while ((e = trav.get_next_state(bnd, ep)) != NULL)
+  {
+    out.push_back(trav.get_base()->id);
+    for (int i = 0; i < N; i++)
+    {
+      out.push_back(e[i] != NULL ? e[i]->id : -1);
+      if (e[i] == NULL) continue;
+      out.push_back(fns[i].get_active_element()->id);
+      out.push_back((double) fns[i].get_transform());
+    }
+    for (unsigned int j = 0; j < e[0]->nvert; j++)
+    {
+      out.push_back(bnd[j]);
+      if (bnd[j])
+      {
+        out.push_back(ep[j].marker);
+        out.push_back(ep[j].lo);
+        out.push_back(ep[j].hi);
+      }
+    }
+  }
+  trav.finish();
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: traverse_plan meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  H2DReader mloader;
+  Mesh m1, m2;
+  mloader.load(argv[1], &m1);
+  m2.copy(&m1);
+  srand(12345);
+  refine_randomly(&m1, 20);
+  refine_randomly(&m2, 20);
+
+  // the same mesh may appear more than once
+  Mesh* meshes[N] = { &m1, &m2, &m1 };
+  TraversePlanCache cache;
+  std::vector<double> fresh, recorded, replayed;
+  bool ok = true;
+
+  for (int step = 0; step < 3; step++)
+  {
+    traverse(meshes, NULL, fresh);
+    traverse(meshes, &cache, recorded);
+    traverse(meshes, &cache, replayed);
+    printf("step %d: %d values\n", step, (int) fresh.size());
+    if (recorded != fresh || replayed != fresh)
+    {
+      printf("The traversals differ in step %d.\n", step);
+      ok = false;
+    }
+
+    // the next step must not replay the current plan
+    refine_randomly(step ? &m1 : &m2, 10);
+  }
+
+  if (!ok)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
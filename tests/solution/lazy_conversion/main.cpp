@@ -0,0 +1,145 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that a solution converted to monomials lazily (element by element
+// when first selected, or all at once by convert_all()) is identical to a solution
+// converted right away. The mesh has both triangles and quads, which are converted in
+// separate passes; converting the pending elements must not change the mode of the
+// element that is active at that time.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return x*x - y;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+// compares the values and the derivatives of two solutions on the element 'e'
+static bool same_values(Solution* a, Solution* b, Element* e, int order)
+{
+  a->set_active_element(e);
+  b->set_active_element(e);
+  a->set_quad_order(order, FN_DEFAULT);
+  b->set_quad_order(order, FN_DEFAULT);
+  int np = a->get_quad_2d()->get_num_points(order);
+  scalar *va = a->get_fn_values(), *vb = b->get_fn_values();
+  scalar *dxa = a->get_dx_values(), *dxb = b->get_dx_values();
+  for (int i = 0; i < np; i++)
+    if (va[i] != vb[i] || dxa[i] != dxb[i]) return false;
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: lazy_conversion meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+    space.set_element_order(e->id, 2 + e->id % 4);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+  Solution sln;
+  ls.solve(1, &sln);
+  scalar* vec = ls.get_solution_vec();
+
+  // the last triangle and the last quad of the mesh
+  Element *tri = NULL, *quad = NULL;
+  for_all_active_elements(e, &mesh)
+    if (e->is_triangle()) tri = e; else quad = e;
+  CHECK(tri != NULL && quad != NULL);
+
+  // element by element, in the order of the traversal
+  Solution lazy;
+  lazy.enable_lazy_conversion();
+  lazy.set_fe_solution(&space, &pss, vec);
+  for_all_active_elements(e, &mesh)
+    CHECK(same_values(&sln, &lazy, e, 6));
+  CHECK(h1_norm(&lazy) == h1_norm(&sln));
+
+  // all at once while a triangle is active: the quads are converted last
+  for (int nt = 1; nt <= 4; nt *= 4)
+  {
+    Solution all;
+    all.enable_lazy_conversion();
+    all.set_fe_solution(&space, &pss, vec);
+    CHECK(same_values(&sln, &all, tri, 6));
+    all.convert_all(nt);
+    all.set_quad_order(5, FN_DEFAULT);
+    sln.set_active_element(tri);
+    sln.set_quad_order(5, FN_DEFAULT);
+    int np = all.get_quad_2d()->get_num_points(5);
+    scalar *va = all.get_fn_values(), *vb = sln.get_fn_values();
+    bool same = true;
+    for (int i = 0; i < np; i++)
+      if (va[i] != vb[i]) same = false;
+    CHECK(same);
+    for_all_active_elements(e, &mesh)
+      CHECK(same_values(&sln, &all, e, 6));
+  }
+
+  // a quad converted by a point query while a triangle is active
+  Solution pt;
+  pt.enable_lazy_conversion();
+  pt.set_fe_solution(&space, &pss, vec);
+  CHECK(same_values(&sln, &pt, tri, 4));
+  double x = 0.0, y = 0.0;
+  for (unsigned i = 0; i < quad->nvert; i++)
+    { x += quad->vn[i]->x / quad->nvert;  y += quad->vn[i]->y / quad->nvert; }
+  CHECK(pt.get_pt_value(x, y) == sln.get_pt_value(x, y));
+  CHECK(same_values(&sln, &pt, tri, 4));
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
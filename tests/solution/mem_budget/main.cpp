@@ -0,0 +1,158 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that the memory budget of the precalculated tables does not change
+// the results. The L-shape problem is assembled and solved, and the H1 norm of the solution
+// and its error against the exact solution on the unrefined mesh are calculated, first with
+// no budget and then with a small budget for all shapesets, solutions and reference maps.
+// The matrices and the results have to be identical, and the caches with the budget have to
+// evict tables and stay smaller.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const size_t BUDGET = 16 * 1024;
+
+static double fn(double x, double y)
+{
+  double r = sqrt(x*x + y*y);
+  double a = atan2(x, y);
+  return pow(r, 2.0/3.0) * sin(2.0*a/3.0 + M_PI/3);
+}
+
+static scalar fndd(double x, double y, scalar& dx, scalar& dy)
+{
+  double t1 = 2.0/3.0*atan2(x, y) + M_PI/3;
+  double t2 = pow(x*x + y*y, 1.0/3.0);
+  double t3 = x*x * ((y*y)/(x*x) + 1);
+  dx = 2.0/3.0*x*sin(t1)/(t2*t2) + 2.0/3.0*y*t2*cos(t1)/t3;
+  dy = 2.0/3.0*y*sin(t1)/(t2*t2) - 2.0/3.0*x*t2*cos(t1)/t3;
+  return fn(x, y);
+}
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return fn(x, y);
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+struct Result
+{
+  std::vector<scalar> matrix;
+  double norm, err;
+  TableCacheStats pss, sln, exact, refmap;
+};
+
+static void run(size_t budget, Result& res)
+{
+  RealFunction::set_default_mem_budget(budget);
+  ScalarFunction::set_default_mem_budget(budget);
+  RefMap::set_default_mem_budget(budget);
+
+  Mesh base, mesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &base);
+  mesh.copy(&base);
+  mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 4);
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  space.set_uniform_order(4);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+
+  int *Ap, *Ai, size;
+  scalar* Ax;
+  ls.get_matrix(Ap, Ai, Ax, size);
+  res.matrix.assign(Ax, Ax + Ap[size]);
+
+  // keep more elements than a small budget allows
+  Solution sln, exact;
+  ls.solve(1, &sln);
+  sln.set_table_cache_size(64);
+  exact.set_exact(&base, fndd);
+  res.norm = h1_norm(&sln);
+  res.err = h1_error(&sln, &exact);
+
+  pss.get_cache_stats(res.pss);
+  sln.get_cache_stats(res.sln);
+  exact.get_cache_stats(res.exact);
+  exact.get_refmap()->get_cache_stats(res.refmap);
+
+  RealFunction::set_default_mem_budget(0);
+  ScalarFunction::set_default_mem_budget(0);
+  RefMap::set_default_mem_budget(0);
+}
+
+static void print(const char* name, const TableCacheStats& st)
+{
+  printf("  %-8s peak %8lu B, %7lu hits, %6lu misses, %6lu evictions\n", name, (unsigned long) st.max_mem,
+         (unsigned long) st.hits, (unsigned long) st.misses, (unsigned long) st.evictions);
+}
+
+int main(int argc, char* argv[])
+{
+  Result full, lim;
+  run(0, full);
+  run(BUDGET, lim);
+
+  printf("no budget: norm %.17g, error %.17g\n", full.norm, full.err);
+  print("pss", full.pss); print("sln", full.sln); print("exact", full.exact); print("refmap", full.refmap);
+  printf("budget %lu B: norm %.17g, error %.17g\n", (unsigned long) BUDGET, lim.norm, lim.err);
+  print("pss", lim.pss); print("sln", lim.sln); print("exact", lim.exact); print("refmap", lim.refmap);
+
+  // the results do not depend on the budget
+  CHECK(full.matrix.size() == lim.matrix.size());
+  CHECK(full.matrix.size() == lim.matrix.size() &&
+        !memcmp(&full.matrix[0], &lim.matrix[0], full.matrix.size() * sizeof(scalar)));
+  CHECK(full.norm == lim.norm);
+  CHECK(full.err == lim.err);
+
+  // nothing is evicted without a budget
+  CHECK(full.pss.evictions == 0 && full.sln.evictions == 0);
+  CHECK(full.exact.evictions == 0 && full.refmap.evictions == 0);
+
+  // with the budget, the caches evict tables and stay smaller
+  CHECK(lim.pss.mem_budget == BUDGET && lim.sln.mem_budget == BUDGET && lim.refmap.mem_budget == BUDGET);
+  CHECK(lim.pss.evictions > 0 && lim.pss.max_mem < full.pss.max_mem);
+  CHECK(lim.sln.evictions > 0 && lim.sln.max_mem < full.sln.max_mem);
+  CHECK(lim.exact.evictions > 0 && lim.exact.max_mem < full.exact.max_mem);
+  CHECK(lim.refmap.evictions > 0 && lim.refmap.max_mem < full.refmap.max_mem);
+  CHECK(lim.pss.misses > full.pss.misses);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
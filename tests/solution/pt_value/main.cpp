@@ -0,0 +1,183 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+#include <algorithm>
+
+// This test makes sure that the element search of Solution::get_pt_value() and
+// Solution::get_pt_values() finds the same elements as a search through all elements.
+// A Poisson problem is solved on a refined mesh, and the solution is evaluated at random
+// points. For each point, the elements containing it are found by a linear scan; they have
+// to be among the candidates of the SpatialIndex, the values have to agree with the values
+// at these elements, and points outside the domain have to give NAN. The batched values
+// have to agree with the single ones. The test is repeated after the mesh is refined.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int NUM_POINTS = 400;
+const double TOL = 1e-11;
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return x*x - y;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+static bool in_ref_domain(Element* e, double xi1, double xi2)
+{
+  if (e->is_triangle())
+    return (xi1 + xi2 <= TOL) && (xi1 + 1.0 >= -TOL) && (xi2 + 1.0 >= -TOL);
+  else
+    return (xi1 - 1.0 <= TOL) && (xi1 + 1.0 >= -TOL) && (xi2 - 1.0 <= TOL) && (xi2 + 1.0 >= -TOL);
+}
+
+static unsigned int seed = 12345;
+static double random(double a, double b)
+{
+  seed = seed * 1103515245 + 12345;
+  return a + (b - a) * ((seed >> 8) & 0xffff) / 65535.0;
+}
+
+static void check_points(Mesh* mesh, Solution* sln)
+{
+  // random points in (and around) the bounding box of the vertices
+  double x0 = 1e100, y0 = 1e100, x1 = -1e100, y1 = -1e100;
+  Element* e;
+  for_all_active_elements(e, mesh)
+    for (unsigned int i = 0; i < e->nvert; i++)
+    {
+      x0 = std::min(x0, e->vn[i]->x);  x1 = std::max(x1, e->vn[i]->x);
+      y0 = std::min(y0, e->vn[i]->y);  y1 = std::max(y1, e->vn[i]->y);
+    }
+  double dx = 0.1 * (x1 - x0), dy = 0.1 * (y1 - y0);
+
+  std::vector<double> x(NUM_POINTS), y(NUM_POINTS);
+  for (int i = 0; i < NUM_POINTS; i++)
+  {
+    x[i] = random(x0 - dx, x1 + dx);
+    y[i] = random(y0 - dy, y1 + dy);
+  }
+
+  SpatialIndex index;
+  index.update(mesh);
+  RefMap refmap;
+  std::vector<scalar> val(NUM_POINTS), dxval(NUM_POINTS);
+  int num_inside = 0;
+  for (int i = 0; i < NUM_POINTS; i++)
+  {
+    std::vector<int> cand;
+    index.get_candidates(x[i], y[i], cand);
+
+    val[i] = sln->get_pt_value(x[i], y[i]);
+    dxval[i] = sln->get_pt_value(x[i], y[i], FN_DX_0);
+
+    bool inside = false;
+    for_all_active_elements(e, mesh)
+    {
+      double xi1, xi2;
+      refmap.set_active_element(e);
+      refmap.untransform(e, x[i], y[i], xi1, xi2);
+      if (!in_ref_domain(e, xi1, xi2)) continue;
+
+      inside = true;
+      CHECK(std::find(cand.begin(), cand.end(), e->id) != cand.end());
+      scalar ref = sln->get_ref_value_transformed(e, xi1, xi2, 0, 0);
+      CHECK(std::abs(val[i] - ref) < 1e-10 * (1.0 + std::abs(ref)));
+    }
+    if (inside)
+      num_inside++;
+    else
+      CHECK(val[i] != val[i]);
+  }
+  printf("%d of %d points inside, %d elements\n", num_inside, NUM_POINTS, mesh->get_num_active_elements());
+  CHECK(num_inside > NUM_POINTS / 10 && num_inside < NUM_POINTS);
+
+  // the batched values are the same as the single ones
+  std::vector<scalar> bval(NUM_POINTS), bdxval(NUM_POINTS);
+  sln->get_pt_values(NUM_POINTS, &x[0], &y[0], &bval[0]);
+  sln->get_pt_values(NUM_POINTS, &x[0], &y[0], &bdxval[0], FN_DX_0, true);
+  for (int i = 0; i < NUM_POINTS; i++)
+  {
+    if (val[i] != val[i])
+    {
+      CHECK(bval[i] != bval[i] && bdxval[i] != bdxval[i]);
+      continue;
+    }
+    CHECK(std::abs(bval[i] - val[i]) < 1e-12 * (1.0 + std::abs(val[i])));
+    CHECK(std::abs(bdxval[i] - dxval[i]) < 1e-10 * (1.0 + std::abs(dxval[i])));
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: pt_value meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 3);
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  space.set_uniform_order(3);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+
+  Solution sln;
+  ls.assemble();
+  ls.solve(1, &sln);
+  check_points(&mesh, &sln);
+
+  // the search has to follow the changes of the mesh
+  mesh.refine_all_elements();
+  space.set_uniform_order(3);
+  space.assign_dofs();
+  ls.assemble();
+  ls.solve(1, &sln);
+  check_points(&mesh, &sln);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
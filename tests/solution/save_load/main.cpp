@@ -0,0 +1,166 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that a solution saved by Solution::save() is restored exactly by
+// Solution::load(), both from an uncompressed file (whose coefficients are memory-mapped)
+// and from a compressed one. A Poisson problem is solved on a curved mesh, saved in
+// both formats and loaded again; the norms have to be identical and the error zero.
+// A loaded uncompressed solution can be multiplied without changing the file.
+//
+// With a second argument ("raw" or "gzip"), the test truncates a saved file and loads
+// it, which has to fail with an error message (checked by ctest).
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return x*x - y;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+static long file_size(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) return -1;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+// writes the first half of a file to another one
+static void truncate_file(const char* from, const char* to)
+{
+  long size = file_size(from);
+  std::vector<char> buf(size);
+  FILE* f = fopen(from, "rb");
+  if (fread(&buf[0], 1, size, f) != (size_t) size) error("Could not read %s.", from);
+  fclose(f);
+  f = fopen(to, "wb");
+  fwrite(&buf[0], 1, size / 2, f);
+  fclose(f);
+}
+
+static void check_loaded(Solution* sln, const char* filename)
+{
+  Solution loaded;
+  loaded.load(filename);
+  double norm = h1_norm(sln), lnorm = h1_norm(&loaded);
+  double err = h1_error(sln, &loaded);
+  printf("%s: %ld bytes, norm %.17g, error %g\n", filename, file_size(filename), lnorm, err);
+  CHECK(lnorm == norm);
+  CHECK(err == 0.0);
+  CHECK(loaded.get_mesh()->get_num_active_elements() == sln->get_mesh()->get_num_active_elements());
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: save_load meshfile.mesh [raw|gzip]\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_bc_values(bc_values);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+    space.set_element_order(e->id, 2 + e->id % 4);
+  space.assign_dofs();
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+  Solution sln;
+  ls.solve(1, &sln);
+
+  // compressed files get the suffix ".gz"
+#ifdef WITH_ZLIB
+  const char* gz = ".gz";
+#else
+  const char* gz = "";
+#endif
+  std::string raw_name = "sln_raw.h2d", gz_name = std::string("sln_gzip.h2d") + gz;
+
+  if (argc > 2)
+  {
+    // a truncated file must not be loaded
+    bool raw = !strcmp(argv[2], "raw");
+    if (raw)
+      sln.save(raw_name.c_str(), Solution::SAVE_RAW);
+    else
+      sln.save("sln_gzip.h2d", Solution::SAVE_GZIP);
+    truncate_file(raw ? raw_name.c_str() : gz_name.c_str(), "sln_truncated.h2d");
+    Solution loaded;
+    loaded.load("sln_truncated.h2d");
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+
+  sln.save(raw_name.c_str(), Solution::SAVE_RAW);
+  sln.save("sln_gzip.h2d", Solution::SAVE_GZIP);
+  check_loaded(&sln, raw_name.c_str());
+  check_loaded(&sln, gz_name.c_str());
+#ifdef WITH_ZLIB
+  CHECK(file_size(gz_name.c_str()) < file_size(raw_name.c_str()));
+#endif
+
+  // other compression levels give the same solution
+  sln.save("sln_fast.h2d", Solution::SAVE_GZIP, 1);
+  sln.save("sln_best.h2d", Solution::SAVE_GZIP, 9);
+  check_loaded(&sln, (std::string("sln_fast.h2d") + gz).c_str());
+  check_loaded(&sln, (std::string("sln_best.h2d") + gz).c_str());
+
+  // the mapped coefficients can be changed, the file stays the same
+  Solution mapped;
+  mapped.load(raw_name.c_str());
+  mapped.multiply(2.0);
+  double norm = h1_norm(&sln);
+  CHECK(fabs(h1_norm(&mapped) - 2.0 * norm) < 1e-12 * norm);
+  check_loaded(&sln, raw_name.c_str());
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,149 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+
+// This test makes sure that the size of the element table cache of Solution does not
+// change the results, and that the cache keeps the hinted elements. A Poisson problem
+// is solved on a coarse and a fine mesh, and the error between the two solutions and
+// the norm of their sum are calculated with various cache sizes. The results have to be
+// identical, a larger cache must not miss more often, and a cache larger than the mesh
+// has to calculate the tables of each element once. Then a few elements are hinted and
+// have to stay cached while many other elements are visited.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar bc_values(int marker, double x, double y)
+{
+  return x*y;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+static void solve(H1Space* space, PrecalcShapeset* pss, Solution* sln)
+{
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, space);
+  ls.set_pss(1, pss);
+  ls.assemble();
+  ls.solve(1, sln);
+}
+
+int main(int argc, char* argv[])
+{
+  Mesh cmesh, fmesh;
+  H2DReader mloader;
+  mloader.load("lshape.mesh", &cmesh);
+  cmesh.refine_all_elements();
+  fmesh.copy(&cmesh);
+  fmesh.refine_all_elements();
+  fmesh.refine_towards_vertex(0, 3);
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space cspace(&cmesh, &shapeset), fspace(&fmesh, &shapeset);
+  cspace.set_bc_types(bc_types);
+  cspace.set_bc_values(bc_values);
+  cspace.set_uniform_order(2);
+  cspace.assign_dofs();
+  fspace.set_bc_types(bc_types);
+  fspace.set_bc_values(bc_values);
+  fspace.set_uniform_order(3);
+  fspace.assign_dofs();
+
+  Solution csln, fsln;
+  solve(&cspace, &pss, &csln);
+  solve(&fspace, &pss, &fsln);
+  int nc = cmesh.get_num_active_elements(), nf = fmesh.get_num_active_elements();
+
+  // the results do not depend on the size of the cache
+  const int sizes[] = { 1, 2, 4, 16, 1024 };
+  double err0 = 0.0, norm0 = 0.0;
+  size_t cmiss = 0, fmiss = 0;
+  for (int k = 0; k < 5; k++)
+  {
+    csln.set_table_cache_size(sizes[k]);
+    fsln.set_table_cache_size(sizes[k]);
+    csln.reset_elem_cache_stats();
+    fsln.reset_elem_cache_stats();
+
+    double err = h1_error(&csln, &fsln);
+    SumFilter sum(&csln, &fsln);
+    double norm = l2_norm(&sum);
+
+    TableCacheStats cst, fst;
+    csln.get_elem_cache_stats(cst);
+    fsln.get_elem_cache_stats(fst);
+    printf("cache size %4d: error %.17g, norm %.17g, coarse %lu/%lu, fine %lu/%lu misses/hits\n",
+           sizes[k], err, norm, (unsigned long) cst.misses, (unsigned long) cst.hits,
+           (unsigned long) fst.misses, (unsigned long) fst.hits);
+
+    if (k == 0) { err0 = err; norm0 = norm; }
+    CHECK(err == err0 && norm == norm0);
+    if (k > 0) CHECK(cst.misses <= cmiss && fst.misses <= fmiss);
+    cmiss = cst.misses;
+    fmiss = fst.misses;
+  }
+
+  // the cache larger than the mesh calculates the tables of each element once
+  CHECK(cmiss == (size_t) nc && fmiss == (size_t) nf);
+
+  // the hinted elements stay cached while other elements are visited
+  std::vector<Element*> elems;
+  Element* e;
+  for_all_active_elements(e, &fmesh)
+    elems.push_back(e);
+  for (int hint = 1; hint >= 0; hint--)
+  {
+    fsln.set_table_cache_size(4);
+    CHECK(fsln.get_max_hints() == 3);
+    fsln.reset_elem_cache_stats();
+    fsln.hint_elements(hint ? 3 : 0, &elems[0]);
+    for (int i = 0; i < 3; i++)
+      fsln.set_active_element(elems[i]);
+    for (int i = 3; i < 23; i++)
+      fsln.set_active_element(elems[i]);
+    for (int i = 0; i < 3; i++)
+      fsln.set_active_element(elems[i]);
+
+    TableCacheStats st;
+    fsln.get_elem_cache_stats(st);
+    printf("%s: %lu hits, %lu misses\n", hint ? "hinted" : "not hinted",
+           (unsigned long) st.hits, (unsigned long) st.misses);
+    size_t hits = hint ? 3 : 0;
+    CHECK(st.hits == hits && st.misses == 26 - hits);
+  }
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#include "hermes2d.h"
+
+// This test checks the cached assembly lists of Space:
+//  - the cache is not built by assign_dofs(), but on the first request for a list,
+//  - the cached element and edge lists equal the ones computed directly, also for
+//    elements with hanging nodes and for mixed orders,
+//  - after the mesh is refined and the DOFs are reassigned, the cache is rebuilt,
+//  - if the space changes after assign_dofs(), the lists are computed directly.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+// exposes the state of the cache and the direct computation of the lists
+class TestSpace : public H1Space
+{
+public:
+  TestSpace(Mesh* mesh, Shapeset* shapeset) : H1Space(mesh, shapeset) {}
+
+  bool cache_valid() const { return ac_seq == seq; }
+
+  void get_direct_element_list(Element* e, AsmList* al)
+  {
+    al->clear();
+    shapeset->set_mode(e->get_mode());
+    for (unsigned int i = 0; i < e->nvert; i++)
+      get_vertex_assembly_list(e, i, al);
+    for (unsigned int i = 0; i < e->nvert; i++)
+      get_edge_assembly_list_internal(e, i, al);
+    get_bubble_assembly_list(e, al);
+  }
+
+  void get_direct_edge_list(Element* e, int edge, AsmList* al)
+  {
+    al->clear();
+    shapeset->set_mode(e->get_mode());
+    get_vertex_assembly_list(e, edge, al);
+    get_vertex_assembly_list(e, e->next_vert(edge), al);
+    get_edge_assembly_list_internal(e, edge, al);
+  }
+};
+
+static bool equal_lists(AsmList* a, AsmList* b)
+{
+  if (a->cnt != b->cnt) return false;
+  for (int k = 0; k < a->cnt; k++)
+    if (a->idx[k] != b->idx[k] || a->dof[k] != b->dof[k] || a->coef[k] != b->coef[k])
+      return false;
+  return true;
+}
+
+// compares the lists of all active elements and edges; returns the number of the
+// list entries of constrained (hanging) shape functions
+static int compare_lists(TestSpace* space)
+{
+  AsmList cached, direct;
+  int nconstr = 0;
+  Element* e;
+  for_all_active_elements(e, space->get_mesh())
+  {
+    space->get_element_assembly_list(e, &cached);
+    space->get_direct_element_list(e, &direct);
+    CHECK(equal_lists(&cached, &direct));
+    for (int k = 0; k < cached.cnt; k++)
+      if (cached.dof[k] >= 0 && cached.coef[k] != 1.0) nconstr++;
+
+    for (unsigned int i = 0; i < e->nvert; i++)
+    {
+      space->get_edge_assembly_list(e, i, &cached);
+      space->get_direct_edge_list(e, i, &direct);
+      CHECK(equal_lists(&cached, &direct));
+    }
+  }
+  return nconstr;
+}
+
+// mixed orders 2, 3, 4
+static void set_orders(Space* space)
+{
+  Element* e;
+  int i = 0;
+  for_all_active_elements(e, space->get_mesh())
+    space->set_element_order(e->id, 2 + (i++ % 3));
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: asm_cache meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+
+  // hanging nodes: refine some elements only, one of them anisotropically
+  mesh.refine_element(3);
+  mesh.refine_element(5, 1);
+  mesh.refine_element(mesh.get_max_element_id() - 1);
+
+  H1Shapeset shapeset;
+  TestSpace space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  set_orders(&space);
+  space.assign_dofs();
+
+  // the cache is built on the first request only
+  CHECK(!space.cache_valid());
+  CHECK(compare_lists(&space) > 0);
+  CHECK(space.cache_valid());
+
+  // refine more and reassign: the cache is invalidated and rebuilt
+  mesh.refine_element(7);
+  mesh.refine_element(mesh.get_max_element_id() - 2, 2);
+  set_orders(&space);
+  space.assign_dofs();
+  CHECK(!space.cache_valid());
+  CHECK(compare_lists(&space) > 0);
+  CHECK(space.cache_valid());
+
+  // a change after assign_dofs() bypasses the cache until the next assignment
+  Element* e;
+  for_all_active_elements(e, &mesh)
+  {
+    space.set_element_order(e->id, 3);
+    break;
+  }
+  compare_lists(&space);
+  CHECK(!space.cache_valid());
+  space.assign_dofs();
+  compare_lists(&space);
+  CHECK(space.cache_valid());
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
@@ -0,0 +1,182 @@
+#include "hermes2d.h"
+#include "solver_umfpack.h"
+#include <map>
+
+// This test checks the stable DOF numbering (Space::set_stable_dofs()):
+//  - the first assignment gives the same numbering as without stable DOFs,
+//  - after refining a few elements, get_prev_dof() relates each DOF of an unchanged
+//    node or bubble to its previous number, and most of them keep their numbers,
+//  - LinSystem maps the previous solution to the new DOFs as the initial guess, and
+//    solve() uses that vector; the solution equals the one of a fresh system.
+
+#undef ERROR_SUCCESS
+#undef ERROR_FAILURE
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  if (!(cond)) { printf("Check failed (line %d): %s\n", __LINE__, #cond); failures++; }
+
+const int P_INIT = 3;
+
+int bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+// the DOF of each unconstrained shape function of each active element
+typedef std::map<std::pair<int, int>, int> DofMap;
+
+static void get_dofs(Space* space, DofMap& dofs)
+{
+  dofs.clear();
+  AsmList al;
+  Element* e;
+  for_all_active_elements(e, space->get_mesh())
+  {
+    space->get_element_assembly_list(e, &al);
+    for (int k = 0; k < al.cnt; k++)
+      if (al.dof[k] >= 0 && al.coef[k] == 1.0)
+        dofs[std::make_pair(e->id, al.idx[k])] = al.dof[k];
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("please input as this format: stable_dofs meshfile.mesh\n");
+    return ERROR_FAILURE;
+  }
+
+  Mesh mesh, plain_mesh;
+  H2DReader mloader;
+  mloader.load(argv[1], &mesh);
+  mesh.refine_all_elements();
+  mesh.refine_all_elements();
+  plain_mesh.copy(&mesh);
+
+  H1Shapeset shapeset;
+  PrecalcShapeset pss(&shapeset);
+  H1Space space(&mesh, &shapeset);
+  space.set_bc_types(bc_types);
+  space.set_uniform_order(P_INIT);
+  space.set_stable_dofs();
+  int ndofs = space.assign_dofs();
+  CHECK(!space.has_prev_dofs());
+
+  // without a previous numbering, the stable one is the usual one
+  H1Space plain(&plain_mesh, &shapeset);
+  plain.set_bc_types(bc_types);
+  plain.set_uniform_order(P_INIT);
+  CHECK(plain.assign_dofs() == ndofs);
+  DofMap dofs, plain_dofs;
+  get_dofs(&space, dofs);
+  get_dofs(&plain, plain_dofs);
+  CHECK(dofs == plain_dofs);
+
+  WeakForm wf(1);
+  wf.add_biform(0, 0, callback(bilinear_form), SYM);
+  wf.add_liform(0, callback(linear_form));
+  UmfpackSolver solver;
+  LinSystem ls(&wf, &solver);
+  ls.set_spaces(1, &space);
+  ls.set_pss(1, &pss);
+  ls.assemble();
+  Solution sln;
+  ls.solve(1, &sln);
+  std::vector<scalar> prev_vec(ls.get_solution_vec(), ls.get_solution_vec() + ndofs);
+
+  // refine every seventh element and some more near the re-entrant corner
+  Element* e;
+  int k = 0;
+  for_all_active_elements(e, &mesh)
+    if (k++ % 7 == 0) mesh.refine_element(e->id);
+  space.set_uniform_order(P_INIT);
+  int new_ndofs = space.assign_dofs();
+  CHECK(space.has_prev_dofs());
+  CHECK(new_ndofs > ndofs);
+
+  // unchanged functions map to their previous numbers, the mapping is injective
+  DofMap new_dofs;
+  get_dofs(&space, new_dofs);
+  int same = 0, kept = 0, mapped = 0, wrong = 0;
+  for (DofMap::iterator it = new_dofs.begin(); it != new_dofs.end(); ++it)
+  {
+    DofMap::iterator old = dofs.find(it->first);
+    int prev = space.get_prev_dof(it->second);
+    if (old == dofs.end()) continue;
+    same++;
+    if (prev >= 0 && prev != old->second) wrong++;
+    if (prev == old->second) mapped++;
+    if (it->second == old->second) kept++;
+  }
+  std::vector<int> hits(ndofs, 0);
+  int num_prev = 0;
+  for (int i = 0; i < new_ndofs; i++)
+  {
+    int prev = space.get_prev_dof(i);
+    if (prev < 0) continue;
+    CHECK(prev < ndofs);
+    if (prev < ndofs && hits[prev]++) wrong++;
+    num_prev++;
+  }
+  printf("ndofs %d -> %d, related %d, functions on unchanged elements %d: mapped %d, kept %d\n",
+         ndofs, new_ndofs, num_prev, same, mapped, kept);
+  CHECK(wrong == 0);
+  CHECK(mapped > same * 9 / 10);
+  CHECK(kept > same * 8 / 10);
+  CHECK(space.get_prev_dof(-1) == -1 && space.get_prev_dof(new_ndofs) == -1);
+
+  // the previous solution becomes the initial guess of the solver
+  ls.assemble();
+  scalar* vec = ls.get_solution_vec();
+  CHECK(vec != NULL);
+  wrong = 0;
+  for (int i = 0; i < new_ndofs; i++)
+  {
+    int prev = space.get_prev_dof(i);
+    if (prev >= 0 && vec[i] != prev_vec[prev]) wrong++;
+    if (prev < 0 && vec[i] != 0.0) wrong++;
+  }
+  CHECK(wrong == 0);
+  ls.solve(1, &sln);
+  CHECK(ls.get_solution_vec() == vec);
+
+  // the same solution as without the previous numbering
+  H1Space fresh(&mesh, &shapeset);
+  fresh.set_bc_types(bc_types);
+  fresh.set_uniform_order(P_INIT);
+  fresh.assign_dofs();
+  LinSystem fresh_ls(&wf, &solver);
+  fresh_ls.set_spaces(1, &fresh);
+  fresh_ls.set_pss(1, &pss);
+  fresh_ls.assemble();
+  Solution fresh_sln;
+  fresh_ls.solve(1, &fresh_sln);
+  double err = h1_error(&sln, &fresh_sln), norm = h1_norm(&fresh_sln);
+  printf("difference from a fresh system %g (norm %g)\n", err, norm);
+  CHECK(err < 1e-12 * norm);
+
+  if (failures)
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+  printf("Success!\n");
+  return ERROR_SUCCESS;
+}
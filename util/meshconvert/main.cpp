@@ -1,14 +1,46 @@
 #include "hermes2d.h"
+#include <string.h>
+#include <string>
 
+// Usage: meshconvert file...
+//          converts meshes in the old format to the current text format (in place)
+//        meshconvert -b file...
+//          converts meshes (.mesh or ExodusII .e) to the binary format (file.h2dm)
 
 int main(int argc, char* argv[])
 {
-  for (int i = 1; i < argc; i++)
+  bool binary = (argc > 1 && !strcmp(argv[1], "-b"));
+
+  for (int i = binary ? 2 : 1; i < argc; i++)
   {
     Mesh mesh;
-    mesh.load_old(argv[i]);
-    printf("Converting %s ...\n", argv[i]);
-    mesh.save(argv[i]);
+    if (binary)
+    {
+      std::string name = argv[i];
+      size_t dot = name.rfind('.');
+      std::string ext = (dot == std::string::npos) ? "" : name.substr(dot);
+      if (ext == ".e")
+      {
+        ExodusIIReader reader;
+        reader.load(argv[i], &mesh);
+      }
+      else
+      {
+        H2DReader reader;
+        reader.load(argv[i], &mesh);
+      }
+
+      std::string out = name.substr(0, dot) + ".h2dm";
+      printf("Converting %s to %s ...\n", argv[i], out.c_str());
+      H2DReader writer;
+      writer.save_binary(out.c_str(), &mesh);
+    }
+    else
+    {
+      mesh.load_old(argv[i]);
+      printf("Converting %s ...\n", argv[i]);
+      mesh.save(argv[i]);
+    }
   }
 
   return 0;